@@ -1,9 +1,23 @@
 #include "agent.h"
 #include "uitest.h"
+#include "bufpool.h"
+#include "dirty.h"
+#include "diff.h"
+#include "stats.h"
+#include "workers.h"
+#include "input.h"
+#include "keymap.h"
+#include "jpeg_stripes.h"
+#include "scroll.h"
+#include "pipeline.h"
+#include "pixfmt.h"
+#include "enccache.h"
 #include <deviceinfo.h>
 #include <rfb/keysym.h>
 #include <jpeglib.h>
+#include <jerror.h>
 #include <png.h>
+#include <setjmp.h>
 
 struct UiTestPort g_UiTestPort;
 struct LowLevelFunctions g_LowLevelFunctions;
@@ -54,46 +68,534 @@ static void setServerRfbLog() {
 }
 
 /**
- * 申请修改双缓冲区
- * 注意: 该函数会锁定双缓冲区, 所以请务必调用release_vnc_buf进行切换
+ * 把缓冲区补齐到最近发布的帧: 只复制它错过的各帧变化区域的并集
  *
  * @param manager
- * @return 双缓冲区内存地址
+ * @param index 缓冲区下标
  */
-static char *request_back_vnc_buf(BufferManager *manager) {
-    pthread_mutex_lock(&manager->backBufferLock);
-    pthread_mutex_lock(&manager->backBufferFuncLock);
-    char *buffer = manager->backBuffer;
-    pthread_mutex_unlock(&manager->backBufferFuncLock);
+// 补齐时错过的各帧变化区域的并集, 只由解码线程访问
+static DirtyRects g_syncMissed;
+
+static void sync_vnc_buf(BufferManager *manager, int index) {
+    uint64_t have = manager->bufferSeq[index];
+    if (have == manager->seq) {
+        return;
+    }
+    char *dst = manager->buffers[index];
+    const char *src = manager->buffers[manager->published];
+    if (have == 0 || manager->seq - have > VNC_DAMAGE_HISTORY) {
+        memcpy(dst, src, manager->bufferSize);
+        atomic_fetch_add_explicit(&g_AgentStats.syncFullCopies, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.syncBytes, manager->bufferSize, memory_order_relaxed);
+    } else {
+        DirtyRects *missed = &g_syncMissed;
+        dirty_rects_clear(missed);
+        for (uint64_t s = have + 1; s <= manager->seq; ++s) {
+            dirty_rects_add_list(missed, &manager->history[s % VNC_DAMAGE_HISTORY]);
+        }
+        const int stride = manager->server->paddedWidthInBytes;
+        const int bpp = manager->server->bitsPerPixel / 8;
+        unsigned long long bytes = 0;
+        for (int i = 0; i < missed->count; ++i) {
+            const DirtyRect *rect = &missed->rects[i];
+            size_t offset = (size_t) rect->x1 * bpp;
+            size_t width = (size_t) (rect->x2 - rect->x1) * bpp;
+            for (int y = rect->y1; y < rect->y2; ++y) {
+                memcpy(&dst[y * stride + offset], &src[y * stride + offset], width);
+            }
+            bytes += width * (rect->y2 - rect->y1);
+        }
+        atomic_fetch_add_explicit(&g_AgentStats.syncBytes, bytes, memory_order_relaxed);
+    }
+    manager->bufferSeq[index] = manager->seq;
+}
+
+// 当前帧差分与写入帧缓冲的累计耗时, 只由解码线程访问, 每帧结束时计入阶段直方图
+static uint64_t g_frameDiffNs;
+static uint64_t g_frameWriteNs;
+
+static void frame_stages_flush() {
+    if (g_frameDiffNs != 0) {
+        stats_stage(STATS_STAGE_DIFF, g_frameDiffNs);
+        g_frameDiffNs = 0;
+    }
+    if (g_frameWriteNs != 0) {
+        stats_stage(STATS_STAGE_WRITE, g_frameWriteNs);
+        g_frameWriteNs = 0;
+    }
+}
+
+// 哈希差分的行哈希, 与脏区域网格一同按帧缓冲尺寸重建; 只由解码线程访问
+static DiffHashes g_diffHashes;
+// 当前帧是否经过哈希差分, 发布时没有经过的帧使保存的行哈希失效
+static bool g_frameHashDiffed;
+
+/**
+ * 按配置的差分方式比较一段行: 默认与 last 逐字节比较, -hash_diff 时与保存的行哈希比较
+ *
+ * @param parallel 是否切分条带多线程比较
+ */
+static void diff_rows_select(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last,
+                             int lastStride, int width, int y1, int y2, int bpp, bool exact, bool parallel) {
+    if (!g_AgentConfig.hash_diff) {
+        if (parallel) {
+            diff_rows_parallel(map, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+        } else {
+            diff_rows(map, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+        }
+        return;
+    }
+    if (parallel) {
+        diff_rows_hashed_parallel(map, &g_diffHashes, curr, currStride, last, lastStride, width, y1, y2, bpp,
+                                  g_AgentConfig.hash_verify);
+    } else {
+        diff_rows_hashed(map, &g_diffHashes, curr, currStride, last, lastStride, width, y1, y2, bpp,
+                         g_AgentConfig.hash_verify);
+    }
+    g_frameHashDiffed = true;
+    if (g_AgentConfig.hash_verify) {
+        atomic_fetch_add_explicit(&g_AgentStats.hashVerifiedSegs,
+                                  atomic_exchange_explicit(&g_diffHashes.verified, 0, memory_order_relaxed),
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.hashCollisions,
+                                  atomic_exchange_explicit(&g_diffHashes.collisions, 0, memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+}
+
+/**
+ * 与 diff_rows_parallel 相同, 耗时计入当前帧的差分阶段
+ */
+static void diff_rows_timed(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last,
+                            int lastStride, int width, int y1, int y2, int bpp, bool exact) {
+    uint64_t t0 = stats_now_ns();
+    diff_rows_select(map, curr, currStride, last, lastStride, width, y1, y2, bpp, exact, true);
+    g_frameDiffNs += stats_now_ns() - t0;
+}
+
+// 变化的tile至少占该百分比时才检测平移, 小范围变化直接编码发送更省
+#define SCROLL_MIN_DIRTY_PCT 25
+
+// 滚动检测, 只由解码线程访问: 当前帧检测到的平移在 release_vnc_buf 时随缓冲区发布,
+// 检测器中保存的行哈希属于第 g_scrollHashSeq 帧
+static ScrollDetector g_scrollDetector;
+static ScrollMove g_frameMove;
+static bool g_frameMoved;
+static bool g_frameHashed;
+static uint64_t g_scrollHashSeq;
+
+/**
+ * 当前帧大面积变化时检测相对最近发布的帧的整块平移, 平移区域改用 CopyRect 发送
+ * 注意: 仅限解码线程在差分之后, 发布之前调用, curr 须与即将发布的帧内容一致
+ *
+ * @param manager
+ * @param map 当前帧的变化区域
+ * @param curr 当前帧
+ * @param stride 当前帧每行字节数
+ */
+static void detect_frame_scroll(BufferManager *manager, const DirtyMap *map, const uint8_t *curr, int stride) {
+    if (g_AgentConfig.no_scroll || map->dirtyCount * 100 < map->cols * map->rows * SCROLL_MIN_DIRTY_PCT) {
+        return;
+    }
+    uint64_t t0 = stats_now_ns();
+    rfbScreenInfoPtr server = manager->server;
+    g_frameMoved = scroll_detect(&g_scrollDetector, curr, stride, (const uint8_t *) manager->buffers[manager->published],
+                                 server->paddedWidthInBytes, server->width, server->height, server->bitsPerPixel / 8,
+                                 g_scrollHashSeq == manager->seq, &g_frameMove);
+    g_frameHashed = true;
+    // 与最近发布的帧比较, 计入差分阶段
+    uint64_t elapsed = stats_now_ns() - t0;
+    g_frameDiffNs += elapsed;
+    atomic_fetch_add_explicit(&g_AgentStats.scrollDetectNs, elapsed, memory_order_relaxed);
+}
+
+/**
+ * 申请修改缓冲区
+ * 解码线程始终持有一个空闲缓冲区, 不会等待vnc服务器; 内容是若干帧之前的旧帧
+ * 注意: 同一时刻只允许一个解码线程调用, 修改完成后调用release_vnc_buf发布或cancel_vnc_buf放弃
+ *
+ * @param manager
+ * @param partial 调用者只写入变化区域, 需先把缓冲区补齐到最近发布的帧; 整帧写入时传false
+ * @return 缓冲区内存地址
+ */
+static char *request_back_vnc_buf(BufferManager *manager, bool partial) {
+    uint64_t t0 = stats_now_ns();
+    dirty_rects_clear(&manager->damage[manager->back]);
+    manager->copy[manager->back] = (DirtyRect) {0, 0, 0, 0};
+    manager->jpeg[manager->back].size = 0;
+    if (partial) {
+        sync_vnc_buf(manager, manager->back);
+    }
+    char *buffer = manager->buffers[manager->back];
+    uint64_t elapsed = stats_now_ns() - t0;
+    g_frameWriteNs += elapsed;
+    stats_wait(&g_AgentStats.producerWaits, &g_AgentStats.producerWaitNs, &g_AgentStats.producerWaitMaxNs, elapsed);
     return buffer;
 }
 
 /**
- * 释放双缓冲区
- * 注意: 该函数会解锁双缓冲区, 所以请务必先调用request_back_vnc_buf来获取双缓冲区
+ * 把尚未被vnc服务器取用就被替换的帧并入本帧
+ * 变化区域取并集; 本帧平移的源落在被替换帧的平移目标内的部分, 相对更早的帧是一次偏移之和的平移, 其余平移改为普通变化
  *
  * @param manager
- * @param w1 需要发送到客户端修改的起始宽度
- * @param y1 需要发送到客户端修改的起始高度
- * @param w2 需要发送到客户端修改的终止宽度
- * @param y2 需要发送到客户端修改的终止宽度
+ * @param back 本帧
+ * @param skipped 被替换的帧
+ */
+static void merge_skipped_vnc_buf(BufferManager *manager, int back, int skipped) {
+    DirtyRects *changed = &manager->damage[back];
+    dirty_rects_add_list(changed, &manager->damage[skipped]);
+    dirty_rects_add(changed, &manager->copy[skipped]);
+    dirty_rects_add(changed, &manager->copy[back]);
+    DirtyRect chained = manager->copy[skipped];
+    if (!dirty_rect_empty(&chained)) {
+        chained.x1 += manager->copyDx[back];
+        chained.x2 += manager->copyDx[back];
+        chained.y1 += manager->copyDy[back];
+        chained.y2 += manager->copyDy[back];
+    }
+    dirty_rect_intersect(&manager->copy[back], &chained);
+    manager->copyDx[back] += manager->copyDx[skipped];
+    manager->copyDy[back] += manager->copyDy[skipped];
+    dirty_rects_subtract(changed, &manager->copy[back]);
+}
+
+/**
+ * 发布缓冲区, vnc服务器下一次循环时取用
+ * 上一次发布的帧若还未被取用则被本帧替换, 其变化区域并入本帧
+ * 注意: 请务必先调用request_back_vnc_buf来获取缓冲区
+ *
+ * @param manager
+ * @param map 需要发送到客户端修改的区域, 请先调用dirty_map_build_rects生成矩形列表
+ * @return
+ */
+static int release_vnc_buf(BufferManager *manager, const DirtyMap *map) {
+    uint64_t t0 = stats_now_ns();
+    int back = manager->back;
+    DirtyRect moved = {0, 0, 0, 0};
+    if (g_frameMoved) {
+        const ScrollMove *move = &g_frameMove;
+        moved = (DirtyRect) {move->x1, move->y1, move->x2, move->y2};
+        atomic_fetch_add_explicit(&g_AgentStats.scrollFrames, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.scrollPixels,
+                                  (unsigned long long) (move->x2 - move->x1) * (move->y2 - move->y1),
+                                  memory_order_relaxed);
+    }
+    if (!g_frameHashDiffed) {
+        // 整帧刷新等未经比较就发布的帧
+        diff_hashes_invalidate(&g_diffHashes);
+    }
+    g_frameHashDiffed = false;
+    manager->seq++;
+    g_scrollHashSeq = g_frameHashed ? manager->seq : 0;
+    g_frameHashed = false;
+    g_frameMoved = false;
+    DirtyRects *history = &manager->history[manager->seq % VNC_DAMAGE_HISTORY];
+    dirty_rects_from_map(history, map);
+    manager->bufferSeq[back] = manager->seq;
+    int pending = atomic_load(&manager->pending);
+    do {
+        dirty_rects_copy(&manager->damage[back], history);
+        manager->copy[back] = moved;
+        if (!dirty_rect_empty(&moved)) {
+            dirty_rects_subtract(&manager->damage[back], &moved);
+            manager->copyDx[back] = g_frameMove.dx;
+            manager->copyDy[back] = g_frameMove.dy;
+        } else {
+            manager->copyDx[back] = 0;
+            manager->copyDy[back] = 0;
+        }
+        if (pending & VNC_BUFFER_FRESH) {
+            merge_skipped_vnc_buf(manager, back, pending & VNC_BUFFER_INDEX);
+        }
+        // 合并后vnc服务器若已取走被替换的帧, 平移的基准不同, 按未合并重新生成
+    } while (!atomic_compare_exchange_weak(&manager->pending, &pending, back | VNC_BUFFER_FRESH));
+    if (pending & VNC_BUFFER_FRESH) {
+        atomic_fetch_add_explicit(&g_AgentStats.framesSkipped, 1, memory_order_relaxed);
+    }
+    manager->published = back;
+    manager->back = pending & VNC_BUFFER_INDEX;
+    manager->fullUpdate = false;
+    UiTest_ReportScreenChange(true);
+    uint64_t elapsed = stats_now_ns() - t0;
+    stats_wait(&g_AgentStats.producerWaits, &g_AgentStats.producerWaitNs, &g_AgentStats.producerWaitMaxNs, elapsed);
+    stats_stage(STATS_STAGE_PUBLISH, elapsed);
+    unsigned long long pixels = 0;
+    for (int i = 0; i < map->rectCount; ++i) {
+        const DirtyRect *r = &map->rects[i];
+        pixels += (unsigned long long) (r->x2 - r->x1) * (r->y2 - r->y1);
+    }
+    atomic_fetch_add_explicit(&g_AgentStats.framesPublished, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_AgentStats.dirtyPixels, pixels, memory_order_relaxed);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: publish %d rect(s), %d tile(s), bbox (%d,%d)-(%d,%d)", __func__,
+                   map->rectCount, map->dirtyCount, map->minX, map->minY, map->maxX + 1, map->maxY + 1);
+    return 0;
+}
+
+/**
+ * 把设备原始JPEG附加到正在修改的缓冲区, 随缓冲区一起发布, 供vnc服务器直接转发
+ * 注意: 仅限解码线程在 request_back_vnc_buf 与 release_vnc_buf 之间调用, 且缓冲区内容须与该JPEG一致
+ *
+ * @param manager
+ * @param data JPEG数据
+ * @param size JPEG字节数
+ * @param width JPEG宽度
+ * @param height JPEG高度
+ */
+static void attach_jpeg_vnc_buf(BufferManager *manager, const char *data, int size, int width, int height) {
+    JpegFrame *jpeg = &manager->jpeg[manager->back];
+    size_t capacity = jpeg->capacity;
+    if (!bufpool_reserve(&jpeg->data, &capacity, size)) {
+        jpeg->size = 0;
+        return;
+    }
+    jpeg->capacity = (int) capacity;
+    memcpy(jpeg->data, data, size);
+    jpeg->size = size;
+    jpeg->width = width;
+    jpeg->height = height;
+}
+
+/**
+ * 放弃本次修改, 不发布也不通知客户端, 缓冲区仍由解码线程持有
+ *
+ * @param manager
+ * @param unchanged 缓冲区内容与最近发布的帧相同; 为false时下次补齐需整帧复制
  * @return
  */
-static int release_vnc_buf(BufferManager *manager, int w1, int y1, int w2, int y2) {
-    pthread_rwlock_wrlock(&manager->frontBufferLock);
-    pthread_mutex_lock(&manager->backBufferFuncLock);
-    char *temp = manager->frontBuffer;
-    manager->frontBuffer = manager->backBuffer;
-    manager->backBuffer = temp;
-    manager->server->frameBuffer = manager->frontBuffer;
-    pthread_mutex_unlock(&manager->backBufferLock);
-    pthread_rwlock_unlock(&manager->frontBufferLock);
-    rfbMarkRectAsModified(manager->server, w1, y1, w2, y2);
-    pthread_mutex_unlock(&manager->backBufferFuncLock);
-    AGENT_OHOS_LOG(LOG_DEBUG, "%s: MarkRectAsModified (%d,%d)-(%d,%d)", __func__, w1, y1, w2, y2);
+static int cancel_vnc_buf(BufferManager *manager, bool unchanged) {
+    g_frameHashed = false;
+    g_frameMoved = false;
+    if (!unchanged) {
+        // 行哈希可能已更新为放弃的帧
+        diff_hashes_invalidate(&g_diffHashes);
+    }
+    g_frameHashDiffed = false;
+    manager->bufferSeq[manager->back] = unchanged ? manager->seq : 0;
+    if (unchanged) {
+        UiTest_ReportScreenChange(false);
+    }
     return 0;
 }
 
+/**
+ * 获取最近一次发布的帧
+ * 注意: 仅限解码线程调用, 返回的内存只读
+ *
+ * @param manager
+ * @return 最近一次发布的帧内存地址
+ */
+static const char *last_vnc_buf(BufferManager *manager) {
+    return manager->buffers[manager->published];
+}
+
+/**
+ * libvncserver 按每分量位数生成服务器像素格式, 16位时传5, 其余传8
+ */
+static int fb_bits_per_sample(int bpp) {
+    return bpp == 2 ? 5 : 8;
+}
+
+/**
+ * 16/8位帧缓冲的服务器像素格式与解码转换的格式一致: RGB565 / BGR233, 并为已连接的客户端重建颜色转换
+ * libvncserver 在16位时只能生成 RGB555, 这里显式设置
+ * 注意: 在 rfbGetScreen 或 rfbNewFramebuffer 之后调用
+ *
+ * @param server
+ */
+static void set_server_format(rfbScreenInfoPtr server) {
+    rfbPixelFormat *format = &server->serverFormat;
+    if (server->bitsPerPixel == 16) {
+        format->depth = 16;
+        format->redMax = 31;
+        format->greenMax = 63;
+        format->blueMax = 31;
+        format->redShift = 11;
+        format->greenShift = 5;
+        format->blueShift = 0;
+    } else if (server->bitsPerPixel == 8) {
+        format->depth = 8;
+        format->redMax = 7;
+        format->greenMax = 7;
+        format->blueMax = 3;
+        format->redShift = 0;
+        format->greenShift = 3;
+        format->blueShift = 6;
+    } else {
+        return;
+    }
+    rfbClientIteratorPtr iter = rfbGetClientIterator(server);
+    rfbClientPtr cl;
+    while ((cl = rfbClientIteratorNext(iter)) != NULL) {
+        server->setTranslateFunction(cl);
+    }
+    rfbReleaseClientIterator(iter);
+}
+
+// 同一帧缓冲的客户端共享的编码缓存, 只由vnc服务器线程访问
+static EncodeCache g_encodeCache;
+
+/**
+ * 按解码线程请求的尺寸重建帧缓冲, 并通知客户端新的尺寸
+ * 尚未取用的帧一并丢弃, 三个缓冲区从全黑的第1帧重新开始, 解码线程随后整帧刷新
+ * 注意: 仅限vnc服务器线程在 rfbProcessEvents 之外调用, 此时解码线程不访问缓冲区
+ *
+ * @param manager
+ */
+static void resize_vnc_buf(BufferManager *manager) {
+    const int width = manager->resizeWidth;
+    const int height = manager->resizeHeight;
+    const int bpp = manager->server->bitsPerPixel / 8;
+    const int size = width * height * bpp;
+    char *buffers[VNC_BUFFER_COUNT] = {};
+    for (int i = 0; i < VNC_BUFFER_COUNT; ++i) {
+        buffers[i] = (char *) bufpool_alloc(size);
+        if (buffers[i] == NULL) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: alloc %dx%d failed", __func__, width, height);
+            for (int j = 0; j < i; ++j) {
+                bufpool_free(buffers[j]);
+            }
+            // 保持原尺寸, 解码线程下一帧重新请求
+            atomic_store_explicit(&manager->resizeState, VNC_RESIZE_DONE, memory_order_release);
+            return;
+        }
+    }
+    for (int i = 0; i < VNC_BUFFER_COUNT; ++i) {
+        memset(buffers[i], 0, size);
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: %dx%d -> %dx%d", __func__, manager->server->width, manager->server->height,
+                   width, height);
+    rfbNewFramebuffer(manager->server, buffers[0], width, height, fb_bits_per_sample(bpp), 4, bpp);
+    set_server_format(manager->server);
+    enccache_reset(&g_encodeCache);
+    manager->seq = 1;
+    for (int i = 0; i < VNC_BUFFER_COUNT; ++i) {
+        bufpool_free(manager->buffers[i]);
+        manager->buffers[i] = buffers[i];
+        dirty_rects_clear(&manager->damage[i]);
+        manager->copy[i] = (DirtyRect) {0, 0, 0, 0};
+        manager->jpeg[i].size = 0;
+        manager->bufferSeq[i] = manager->seq;
+    }
+    for (int i = 0; i < VNC_DAMAGE_HISTORY; ++i) {
+        dirty_rects_clear(&manager->history[i]);
+    }
+    // 旧尺寸的缓冲区不再使用, 归还其内存
+    bufpool_trim();
+    manager->bufferSize = size;
+    manager->front = 0;
+    manager->published = 0;
+    manager->back = 1;
+    atomic_store_explicit(&manager->pending, 2, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_AgentStats.screenResizes, 1, memory_order_relaxed);
+    atomic_store_explicit(&manager->resizeState, VNC_RESIZE_DONE, memory_order_release);
+}
+
+/**
+ * 遍历客户端, 与 rfbClientIteratorNext 相同跳过已关闭的客户端
+ * rfbGetClientIterator 每次都分配迭代器, vnc服务器循环里改为直接遍历客户端链表;
+ * 客户端只在vnc服务器线程中加入和移除, 仅限该线程调用
+ *
+ * @param server
+ * @param cl 上一个客户端, 为NULL时从头开始
+ * @return 下一个客户端, 没有时返回NULL
+ */
+static rfbClientPtr next_client(rfbScreenInfoPtr server, rfbClientPtr cl) {
+    cl = cl == NULL ? server->clientHead : cl->next;
+    while (cl != NULL && cl->sock == RFB_INVALID_SOCKET) {
+        cl = cl->next;
+    }
+    return cl;
+}
+
+/**
+ * 通知各客户端复制区域, 与 rfbScheduleCopyRegion 相同, 帧缓冲已是复制后的内容
+ * 不同的是客户端还有未发送的复制时, 本次复制的源落在其中的部分合并为一次偏移之和的复制,
+ * 连续滚动而客户端来不及请求时仍以 CopyRect 发送, 而不是都改为重新编码
+ *
+ * @param server
+ * @param rect 复制的目标区域
+ * @param dx
+ * @param dy
+ */
+static void schedule_copy_region(rfbScreenInfoPtr server, const DirtyRect *rect, int dx, int dy) {
+    sraRegionPtr region = sraRgnCreateRect(rect->x1, rect->y1, rect->x2, rect->y2);
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        if (!cl->useCopyRect) {
+            sraRgnOr(cl->modifiedRegion, region);
+            continue;
+        }
+        // 源须是客户端执行完未发送的复制后不会再被重新编码的内容: 有未发送的复制时只能取其目标区域
+        sraRegionPtr source = sraRgnCreateRect(0, 0, server->width, server->height);
+        int copyDx = dx;
+        int copyDy = dy;
+        if (!sraRgnEmpty(cl->copyRegion)) {
+            sraRgnAnd(source, cl->copyRegion);
+            copyDx += cl->copyDX;
+            copyDy += cl->copyDY;
+        }
+        sraRgnSubtract(source, cl->modifiedRegion);
+        sraRgnOffset(source, dx, dy);
+        sraRegionPtr copy = sraRgnCreateRgn(region);
+        sraRgnAnd(copy, source);
+        sraRgnDestroy(source);
+        if (!cl->enableCursorShapeUpdates && server->cursor != NULL) {
+            // 光标画在发送的画面里, 光标所在及其移动后的位置不能复制
+            int x = cl->cursorX - server->cursor->xhot;
+            int y = cl->cursorY - server->cursor->yhot;
+            sraRegionPtr cursor = sraRgnCreateRect(x, y, x + server->cursor->width, y + server->cursor->height);
+            sraRgnSubtract(copy, cursor);
+            sraRgnOffset(cursor, dx, dy);
+            sraRgnSubtract(copy, cursor);
+            sraRgnDestroy(cursor);
+        }
+        // 未发送的复制与本次不能复制的部分都改为重新编码
+        sraRgnOr(cl->modifiedRegion, cl->copyRegion);
+        sraRgnOr(cl->modifiedRegion, region);
+        sraRgnSubtract(cl->modifiedRegion, copy);
+        sraRgnMakeEmpty(cl->copyRegion);
+        sraRgnOr(cl->copyRegion, copy);
+        sraRgnDestroy(copy);
+        cl->copyDX = copyDx;
+        cl->copyDY = copyDy;
+    }
+    sraRgnDestroy(region);
+}
+
+/**
+ * vnc服务器取用最新发布的帧, 并把其变化区域通知给客户端; 解码线程请求重建帧缓冲时先完成重建
+ * 注意: 仅限vnc服务器线程在 rfbProcessEvents 之外调用, 主机构建的基准工具也用它模拟服务器
+ *
+ * @param manager
+ */
+void acquire_front_vnc_buf(BufferManager *manager) {
+    uint64_t t0 = stats_now_ns();
+    if (atomic_load_explicit(&manager->resizeState, memory_order_acquire) == VNC_RESIZE_PENDING) {
+        resize_vnc_buf(manager);
+        return;
+    }
+    if (!(atomic_load(&manager->pending) & VNC_BUFFER_FRESH)) {
+        return;
+    }
+    // 只有解码线程会设置 FRESH, 因此交换得到的必然是新帧
+    int pending = atomic_exchange(&manager->pending, manager->front);
+    manager->front = pending & VNC_BUFFER_INDEX;
+    manager->server->frameBuffer = manager->buffers[manager->front];
+    // 帧缓冲已是平移后的内容, 只需通知客户端复制, 先复制再标记变化区域
+    const DirtyRects *damage = &manager->damage[manager->front];
+    const DirtyRect *copy = &manager->copy[manager->front];
+    if (!dirty_rect_empty(copy)) {
+        schedule_copy_region(manager->server, copy, manager->copyDx[manager->front], manager->copyDy[manager->front]);
+    }
+    for (int i = 0; i < damage->count; ++i) {
+        const DirtyRect *r = &damage->rects[i];
+        rfbMarkRectAsModified(manager->server, r->x1, r->y1, r->x2, r->y2);
+    }
+    enccache_advance(&g_encodeCache, damage, copy);
+    uint64_t elapsed = stats_now_ns() - t0;
+    stats_wait(&g_AgentStats.serverWaits, &g_AgentStats.serverWaitNs, &g_AgentStats.serverWaitMaxNs, elapsed);
+    stats_stage(STATS_STAGE_ACQUIRE, elapsed);
+}
+
 /**
  * 停止vnc服务器
  * 建议停止后等待几秒再进行清理
@@ -106,381 +608,1496 @@ static int stop_vnc_server(BufferManager *manager) {
     return 0;
 }
 
-static rfbBool ctrl_down = FALSE;
+// 每个客户端各自的修饰键状态, 保存在 cl->clientData
+typedef struct {
+    bool ctrl;
+    bool shift;
+    bool alt;
+    bool meta;
+} ClientKeys;
+
 void key_event(rfbBool down, rfbKeySym key, rfbClientPtr cl) {
     AGENT_OHOS_LOG(LOG_DEBUG, "%s: down=%d, key=0x%08x", __func__, down, key);
+    UiTest_BoostScreenCopy();
+    ClientKeys *keys = (ClientKeys *)cl->clientData;
+    if (keys == NULL) {
+        return;
+    }
 
-    if (key == XK_Control_L || key == XK_Control_R) {
-        ctrl_down = down;
+    switch (key) {
+        case XK_Control_L:
+        case XK_Control_R:
+            keys->ctrl = down;
+            return;
+        case XK_Shift_L:
+        case XK_Shift_R:
+            keys->shift = down;
+            return;
+        case XK_Alt_L:
+        case XK_Alt_R:
+            keys->alt = down;
+            return;
+        case XK_Meta_L:
+        case XK_Meta_R:
+        case XK_Super_L:
+        case XK_Super_R:
+            keys->meta = down;
+            return;
+        default:
+            break;
+    }
+    // 注入的按键自带按下与抬起, 只在按下时注入
+    if (!down) {
         return;
     }
-    if (down && ctrl_down && (key == XK_q || key == XK_Q)) {
+    if (keys->ctrl && (key == XK_q || key == XK_Q)) {
         AGENT_OHOS_LOG(LOG_INFO, "%s: Ctrl+Q detected! Stop Agent...", __func__);
         stop_vnc_server(g_BufferManager);
+        return;
+    }
+
+    // 开启 -input_text 且没有按住功能键时可打印字符作为文本输入(Shift 已体现在 keysym 中), 否则逐键注入
+    uint32_t codepoint;
+    if (g_AgentConfig.input_text && !keys->ctrl && !keys->alt && !keys->meta && keymap_text(key, &codepoint)) {
+        input_push_text(codepoint);
+        return;
+    }
+    bool shift = keys->shift;
+    int code = keymap_keycode(key, &shift);
+    if (code < 0) {
+        AGENT_OHOS_LOG(LOG_DEBUG, "%s: unmapped key 0x%08x", __func__, key);
+        return;
+    }
+    // triggerCombineKeys 最多3个键, 修饰键更多时无法注入, 丢弃而不是改为注入另一个快捷键
+    int modifiers = keys->ctrl + keys->alt + keys->meta + shift;
+    if (modifiers > 2) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: drop key 0x%08x with %d modifiers (ctrl=%d alt=%d meta=%d shift=%d)", __func__,
+                       key, modifiers, keys->ctrl, keys->alt, keys->meta, shift);
+        return;
+    }
+    int combo[3];
+    int n = 0;
+    if (keys->ctrl) {
+        combo[n++] = KEYCODE_CTRL_LEFT;
+    }
+    if (keys->alt) {
+        combo[n++] = KEYCODE_ALT_LEFT;
+    }
+    if (keys->meta) {
+        combo[n++] = KEYCODE_META_LEFT;
     }
+    if (shift) {
+        combo[n++] = KEYCODE_SHIFT_LEFT;
+    }
+    combo[n++] = code;
+    input_push_key(combo, n);
 }
 
 void ptr_event(int buttonMask, int x, int y, rfbClientPtr cl) {
     AGENT_OHOS_LOG(LOG_DEBUG, "%s: buttonMask=0x%02x, x=%d, y=%d", __func__, buttonMask, x, y);
     static int prevMask = 0;
     static int prevX = -1, prevY = -1;
+    UiTest_BoostScreenCopy();
 
     if ((buttonMask & 1) && !(prevMask & 1)) {
-        UiTest_InjectionPtr(ActionStage_DOWN, x, y);
+        input_push_ptr(ActionStage_DOWN, x, y);
     }
     if (!(buttonMask & 1) && (prevMask & 1)) {
-        UiTest_InjectionPtr(ActionStage_UP, x, y);
+        input_push_ptr(ActionStage_UP, x, y);
     }
 
     if ((buttonMask & 8) && !(prevMask & 8)) {
-        UiTest_InjectionPtr(ActionStage_AXIS_UP, x, y);
+        input_push_ptr(ActionStage_AXIS_UP, x, y);
     }
     if ((buttonMask & 16) && !(prevMask & 16)) {
-        UiTest_InjectionPtr(ActionStage_AXIS_DOWN, x, y);
+        input_push_ptr(ActionStage_AXIS_DOWN, x, y);
     }
     if (!(buttonMask & (8|16)) && (prevMask & (8|16))) {
-        UiTest_InjectionPtr(ActionStage_AXIS_STOP, x, y);
+        input_push_ptr(ActionStage_AXIS_STOP, x, y);
     }
 
     if (x != prevX || y != prevY) {
-        UiTest_InjectionPtr(ActionStage_MOVE, x, y);
+        input_push_ptr(ActionStage_MOVE, x, y);
+    }
+
+    prevMask = buttonMask;
+    prevX = x;
+    prevY = y;
+}
+
+// 没有客户端等待画面持续该时长后暂停采集, 避免两次更新请求之间的短暂空档来回切换
+#define CAPTURE_IDLE_PAUSE_MS 500
+// 暂停期间vnc服务器循环的等待时间, 新连接与客户端消息仍会立即唤醒
+#define CAPTURE_PAUSED_POLL_US 100000
+
+static void set_capture_paused(BufferManager *manager, bool paused) {
+    if (manager->capturePaused == paused) {
+        return;
+    }
+    if (UiTest_PauseScreenCopy(paused) == RETCODE_SUCCESS) {
+        manager->capturePaused = paused;
+        stats_capture_paused(paused);
+    }
+}
+
+/**
+ * 是否有客户端在等待画面: 已完成握手且有尚未答复的 FramebufferUpdateRequest
+ */
+static bool capture_demanded(rfbScreenInfoPtr server) {
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        if (cl->state == RFB_NORMAL && !cl->onHold && !sraRgnEmpty(cl->requestedRegion)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 根据客户端需求暂停/恢复采集, 由vnc服务器循环调用
+ */
+static void update_capture_demand(BufferManager *manager) {
+    if (!manager->demandCapture) {
+        return;
+    }
+    uint64_t now = stats_now_ns();
+    if (capture_demanded(manager->server)) {
+        manager->lastDemandNs = now;
+        set_capture_paused(manager, false);
+    } else if (!manager->capturePaused && now - manager->lastDemandNs > CAPTURE_IDLE_PAUSE_MS * 1000000ull) {
+        set_capture_paused(manager, true);
+    }
+}
+
+static void client_gone(rfbClientPtr cl) {
+    AGENT_OHOS_LOG(LOG_INFO, "%s: %s", __func__, cl->host);
+    free(cl->clientData);
+    cl->clientData = NULL;
+}
+
+static enum rfbNewClientAction new_client(rfbClientPtr cl) {
+    AGENT_OHOS_LOG(LOG_INFO, "%s: %s", __func__, cl->host);
+    cl->clientGoneHook = client_gone;
+    cl->clientData = calloc(1, sizeof(ClientKeys));
+    // 新客户端马上会请求画面, 提前恢复采集
+    if (g_BufferManager != NULL && g_BufferManager->demandCapture) {
+        g_BufferManager->lastDemandNs = stats_now_ns();
+        set_capture_paused(g_BufferManager, false);
+    }
+    return RFB_CLIENT_ACCEPT;
+}
+
+/**
+ * 初始化vnc服务器, 该函数会同步创建双缓冲区
+ * 注意: 请务必在不需要时调用cleanup_vnc_server释放内存, 否则会造成内存泄露!
+ *
+ * @param width 屏幕宽度
+ * @param height 屏幕高度
+ * @param bits_per_pixel BPP: 32(RGBX), 16(RGB565), 8(BGR233)
+ * @param port vnc端口
+ * @param desktopName 桌面名称
+ * @param password vnc密码, 为空为无鉴权
+ * @param argc
+ * @param argv
+ * @return
+ */
+static BufferManager *
+init_vnc_server(const int width, const int height, const int bits_per_pixel, const char *desktopName, int* argc, char** argv) {
+    BufferManager *manager = calloc(1, sizeof(BufferManager));
+    manager->bufferSize = width * height * (bits_per_pixel / 8);
+    // 三个缓冲区初始都是全黑的第1帧
+    manager->seq = 1;
+    for (int i = 0; i < VNC_BUFFER_COUNT; ++i) {
+        manager->buffers[i] = (char *) bufpool_alloc(manager->bufferSize);
+        memset(manager->buffers[i], 0, manager->bufferSize);
+        manager->bufferSeq[i] = manager->seq;
+    }
+    manager->front = 0;
+    manager->published = 0;
+    manager->back = 1;
+    atomic_init(&manager->pending, 2);
+    atomic_init(&manager->resizeState, VNC_RESIZE_NONE);
+    manager->fullUpdate = true;
+    manager->server = rfbGetScreen(argc, argv, width, height, fb_bits_per_sample(bits_per_pixel / 8), 4,
+                                   (bits_per_pixel / 8));
+    set_server_format(manager->server);
+    manager->server->frameBuffer = manager->buffers[manager->front];
+    manager->server->desktopName = strdup(desktopName);
+    manager->server->alwaysShared = TRUE;
+    manager->server->httpDir = NULL;
+    manager->server->kbdAddEvent = key_event;
+    manager->server->ptrAddEvent = ptr_event;
+    manager->server->newClientHook = new_client;
+
+    rfbInitServer(manager->server);
+    /* Mark as dirty since we haven't sent any updates at all yet. */
+    rfbMarkRectAsModified(manager->server, 0, 0, width, height);
+
+    return manager;
+}
+
+// 所有客户端累计发送的字节数
+static long long clients_sent_bytes(rfbScreenInfoPtr server) {
+    long long sent = 0;
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        sent += rfbStatGetSentBytes(cl);
+    }
+    return sent;
+}
+
+// 变化区域至少占JPEG面积的该百分比时才整帧转发, 更小的变化由 libvncserver 只编码变化区域, 节省带宽
+#define JPEG_PASSTHROUGH_MIN_DIRTY_PCT 25
+
+// 客户端协商了带质量等级的 Tight, 可以接收 JPEG 矩形
+static bool client_tight_jpeg(rfbClientPtr cl) {
+    if (cl->state != RFB_NORMAL || cl->onHold || cl->scaledScreen != cl->screen) {
+        return false;
+    }
+    return cl->preferredEncoding == rfbEncodingTight && cl->tightQualityLevel >= 0 && cl->format.bitsPerPixel != 8;
+}
+
+/**
+ * 客户端本次更新能否绕过 libvncserver 直接发送 Tight JPEG: 没有光标/尺寸等其他待发送内容,
+ * 有请求且有变化的区域, 没有待发送的 CopyRect
+ */
+static bool client_plain_tight_update(rfbClientPtr cl) {
+    if (!client_tight_jpeg(cl)) {
+        return false;
+    }
+    // libvncserver 会把光标画进帧缓冲, 或在更新中附带光标/尺寸/能力信息, 这些情况交给它处理
+    if (!cl->enableCursorShapeUpdates || cl->cursorWasChanged || (cl->enableCursorPosUpdates && cl->cursorWasMoved) ||
+        cl->newFBSizePending || cl->requestedDesktopSizeChange || cl->enableSupportedMessages ||
+        cl->enableSupportedEncodings || cl->enableServerIdentity) {
+        return false;
+    }
+    return !sraRgnEmpty(cl->requestedRegion) && !sraRgnEmpty(cl->modifiedRegion) && sraRgnEmpty(cl->copyRegion);
+}
+
+/**
+ * 客户端本次更新能否直接使用设备JPEG: 可以直接发送 Tight JPEG, 且待更新区域都在JPEG范围内并达到最低面积
+ */
+static bool jpeg_passthrough_eligible(rfbClientPtr cl, const JpegFrame *jpeg) {
+    if (!client_plain_tight_update(cl)) {
+        return false;
+    }
+    unsigned long long area = 0;
+    bool inside = true;
+    sraRectangleIterator *iter = sraRgnGetIterator(cl->modifiedRegion);
+    sraRect rect;
+    while (sraRgnIteratorNext(iter, &rect)) {
+        if (rect.x2 > jpeg->width || rect.y2 > jpeg->height) {
+            inside = false;
+            break;
+        }
+        area += (unsigned long long) (rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+    }
+    sraRgnReleaseIterator(iter);
+    return inside && area * 100 >= (unsigned long long) jpeg->width * jpeg->height * JPEG_PASSTHROUGH_MIN_DIRTY_PCT;
+}
+
+/**
+ * 把设备JPEG作为单个 Tight JPEG 矩形发送, 相当于 libvncserver 发送了整个JPEG区域的更新
+ *
+ * @param cl
+ * @param jpeg
+ * @return 发送失败时已关闭客户端, 返回false
+ */
+static bool send_jpeg_rect(rfbClientPtr cl, const JpegFrame *jpeg) {
+    char header[sz_rfbFramebufferUpdateMsg + sz_rfbFramebufferUpdateRectHeader + 4];
+    rfbFramebufferUpdateMsg msg = {};
+    msg.type = rfbFramebufferUpdate;
+    msg.nRects = Swap16IfLE(1);
+    rfbFramebufferUpdateRectHeader rect;
+    rect.r.x = 0;
+    rect.r.y = 0;
+    rect.r.w = Swap16IfLE(jpeg->width);
+    rect.r.h = Swap16IfLE(jpeg->height);
+    rect.encoding = Swap32IfLE(rfbEncodingTight);
+    memcpy(header, &msg, sz_rfbFramebufferUpdateMsg);
+    memcpy(&header[sz_rfbFramebufferUpdateMsg], &rect, sz_rfbFramebufferUpdateRectHeader);
+    int len = sz_rfbFramebufferUpdateMsg + sz_rfbFramebufferUpdateRectHeader;
+    header[len++] = (char) (rfbTightJpeg << 4);
+    len += tight_compact_len(&header[len], jpeg->size);
+    if (rfbWriteExact(cl, header, len) < 0 || rfbWriteExact(cl, jpeg->data, jpeg->size) < 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: write to %s failed", __func__, cl->host);
+        rfbCloseClient(cl);
+        return false;
+    }
+    int rectBytes = len - sz_rfbFramebufferUpdateMsg + jpeg->size;
+    rfbStatRecordEncodingSent(cl, rfbEncodingTight, rectBytes,
+                              jpeg->width * jpeg->height * (cl->format.bitsPerPixel / 8));
+    rfbStatRecordMessageSent(cl, rfbFramebufferUpdate, sz_rfbFramebufferUpdateMsg, sz_rfbFramebufferUpdateMsg);
+    return true;
+}
+
+/**
+ * 把最新帧的设备JPEG直接发送给可以使用它的客户端, 省去这些客户端的 Tight 重新编码
+ * 已发送的客户端清空待更新区域, 随后的 rfbProcessEvents 不再为它们编码
+ * 注意: 仅限vnc服务器线程在 acquire_front_vnc_buf 之后, rfbProcessEvents 之前调用
+ *
+ * @param manager
+ */
+static void send_jpeg_passthrough(BufferManager *manager) {
+    const JpegFrame *jpeg = &manager->jpeg[manager->front];
+    rfbScreenInfoPtr server = manager->server;
+    if (jpeg->size == 0 || jpeg->size > TIGHT_MAX_COMPACT_LEN || jpeg->width > server->width ||
+        jpeg->height > server->height) {
+        return;
+    }
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        if (!jpeg_passthrough_eligible(cl, jpeg) || !send_jpeg_rect(cl, jpeg)) {
+            continue;
+        }
+        sraRgnMakeEmpty(cl->modifiedRegion);
+        sraRgnMakeEmpty(cl->requestedRegion);
+        cl->startDeferring.tv_usec = 0;
+        atomic_fetch_add_explicit(&g_AgentStats.jpegPassthroughRects, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.jpegPassthroughBytes, jpeg->size, memory_order_relaxed);
+    }
+}
+
+// 至少这么多客户端可以共享编码结果时才使用编码缓存, 单个客户端仍由 libvncserver 编码
+#define ENCODE_CACHE_MIN_CLIENTS 2
+
+/**
+ * 用共享的编码缓存向可以直接发送 Tight JPEG 的客户端发送更新, 参数相同的客户端对同一矩形只编码一次
+ * 已发送的客户端清空待更新区域, 随后的 rfbProcessEvents 不再为它们编码
+ * 注意: 仅限vnc服务器线程在 acquire_front_vnc_buf 之后, rfbProcessEvents 之前调用
+ *
+ * @param manager
+ */
+static void send_cached_updates(BufferManager *manager) {
+    rfbScreenInfoPtr server = manager->server;
+    int sharing = 0;
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        sharing += client_tight_jpeg(cl);
+    }
+    if (sharing < ENCODE_CACHE_MIN_CLIENTS) {
+        return;
+    }
+    sraRegionPtr region = sraRgnCreate();
+    for (rfbClientPtr cl = next_client(server, NULL); cl != NULL; cl = next_client(server, cl)) {
+        if (!client_plain_tight_update(cl)) {
+            continue;
+        }
+        // 与 libvncserver 相同, 只发送客户端请求范围内的变化
+        sraRgnMakeEmpty(region);
+        sraRgnOr(region, cl->modifiedRegion);
+        sraRgnAnd(region, cl->requestedRegion);
+        if (sraRgnEmpty(region) || enccache_send_update(&g_encodeCache, cl, region) <= 0) {
+            continue;
+        }
+        sraRgnSubtract(cl->modifiedRegion, region);
+        sraRgnMakeEmpty(cl->requestedRegion);
+        cl->startDeferring.tv_usec = 0;
+    }
+    sraRgnDestroy(region);
+}
+
+/**
+ * 运行vnc服务器
+ * 注意: 该函数为阻塞函数
+ *
+ * @param manager
+ * @return
+ */
+static int run_vnc_server(BufferManager *manager) {
+    manager->stop_vnc_server_flag = 0;
+    manager->stopped_vnc_server_flag = 0;
+    while (!manager->stop_vnc_server_flag) {
+        if (manager->server->clientHead != NULL) {
+            if(manager->have_client_flag != 1) {
+                manager->have_client_flag = 1;
+            }
+        } else {
+            if(manager->have_client_flag != 0) {
+                manager->have_client_flag = 0;
+            }
+        }
+        // 每次循环开始时取用最新的帧, 发送期间解码线程继续写入其他缓冲区
+        acquire_front_vnc_buf(manager);
+        rfbScreenInfoPtr server = manager->server;
+        rfbCheckFds(server, manager->capturePaused ? CAPTURE_PAUSED_POLL_US : server->deferUpdateTime * 1000);
+        // 客户端消息已在上面处理, 剩下的只有编码发送, 有数据发出时计入发送阶段
+        long long sent = clients_sent_bytes(server);
+        uint64_t t0 = stats_now_ns();
+        if (!g_AgentConfig.no_jpeg_passthrough) {
+            send_jpeg_passthrough(manager);
+        }
+        if (!g_AgentConfig.no_encode_cache) {
+            send_cached_updates(manager);
+        }
+        rfbProcessEvents(server, 0);
+        if (clients_sent_bytes(server) != sent) {
+            stats_stage(STATS_STAGE_SEND, stats_now_ns() - t0);
+        }
+        update_capture_demand(manager);
+        UiTest_CheckScreenGeometry();
+        stats_tick();
+        stats_report(server);
+    }
+    manager->stopped_vnc_server_flag = 1;
+    return 0;
+}
+
+/**
+ * 清理vnc服务器
+ * 注意: 请务必在vnc服务器停止后调用
+ *
+ * @param manager
+ * @return
+ */
+static int cleanup_vnc_server(BufferManager *manager) {
+    if (manager->stop_vnc_server_flag != 1 || manager->stopped_vnc_server_flag != 1) {
+        return -1;
+    }
+    // 采集停止后才释放, 之前采集线程仍会读取 server 的尺寸
+    rfbScreenCleanup(manager->server);
+    for (int i = 0; i < VNC_BUFFER_COUNT; ++i) {
+        bufpool_free(manager->buffers[i]);
+        bufpool_free(manager->jpeg[i].data);
+    }
+    enccache_free(&g_encodeCache);
+    free(manager);
+    return 0;
+}
+
+static DirtyMap g_dirtyMap;
+
+/**
+ * 获取与帧缓冲尺寸一致的脏区域网格, 并清空上一帧的标记
+ *
+ * @param width 帧缓冲宽度
+ * @param height 帧缓冲高度
+ * @return 失败返回NULL
+ */
+static DirtyMap *acquire_dirty_map(int width, int height) {
+    if (g_dirtyMap.tiles == NULL || g_dirtyMap.width != width || g_dirtyMap.height != height) {
+        dirty_map_free(&g_dirtyMap);
+        diff_hashes_free(&g_diffHashes);
+        if (dirty_map_init(&g_dirtyMap, width, height, g_AgentConfig.dirty_tile) != 0) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: dirty_map_init failed", __func__);
+            return NULL;
+        }
+        if (g_AgentConfig.hash_diff && diff_hashes_init(&g_diffHashes, width, height, g_dirtyMap.tileSize) != 0) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: diff_hashes_init failed", __func__);
+            dirty_map_free(&g_dirtyMap);
+            return NULL;
+        }
+    } else {
+        dirty_map_reset(&g_dirtyMap);
+    }
+    return &g_dirtyMap;
+}
+
+// 最近填充过边框的缓冲区及当时的尺寸
+typedef struct {
+    unsigned char *fb;
+    int screenW, screenH, imageW, imageH;
+} BorderPainted;
+
+static BorderPainted g_borderPainted[4];
+static int g_borderNext;
+
+/**
+ * 将帧缓冲中未被图像覆盖的区域填充为白色, 防止黑块
+ * 每个缓冲区只在图像或帧缓冲尺寸变化后填充一次, 填充的区域同时标记到 map
+ *
+ * @param fb 帧缓冲
+ * @param fb_stride 帧缓冲行字节数
+ * @param bpp 帧缓冲每像素字节数, 各格式的全1字节都是白色
+ * @param screenW 帧缓冲宽度
+ * @param screenH 帧缓冲高度
+ * @param imageW 图像宽度
+ * @param imageH 图像高度
+ * @param map
+ */
+static void paint_border_once(unsigned char *fb, int fb_stride, int bpp, int screenW, int screenH,
+                              int imageW, int imageH, DirtyMap *map) {
+    int slot = -1;
+    for (int i = 0; i < 4; ++i) {
+        if (g_borderPainted[i].fb == fb) {
+            slot = i;
+            break;
+        }
+    }
+    BorderPainted *painted = slot >= 0 ? &g_borderPainted[slot] : NULL;
+    if (painted && painted->screenW == screenW && painted->screenH == screenH &&
+        painted->imageW == imageW && painted->imageH == imageH) {
+        return;
+    }
+    if (painted == NULL) {
+        painted = &g_borderPainted[g_borderNext];
+        g_borderNext = (g_borderNext + 1) % 4;
+    }
+    painted->fb = fb;
+    painted->screenW = screenW;
+    painted->screenH = screenH;
+    painted->imageW = imageW;
+    painted->imageH = imageH;
+
+    int coverH = imageH < screenH ? imageH : screenH;
+    if (imageW < screenW) {
+        for (int y = 0; y < coverH; ++y) {
+            memset(&fb[y * fb_stride + imageW * bpp], 0xFF, (screenW - imageW) * bpp);
+        }
+        dirty_map_mark_rect(map, imageW, 0, screenW, coverH);
+    }
+    if (imageH < screenH) {
+        for (int y = imageH; y < screenH; ++y) {
+            memset(&fb[y * fb_stride], 0xFF, screenW * bpp);
+        }
+        dirty_map_mark_rect(map, 0, imageH, screenW, screenH);
+    }
+}
+
+/**
+ * 解码线程在处理每帧之前调用: 屏幕尺寸与帧缓冲不一致时请求vnc服务器重建帧缓冲
+ * 重建完成后新的缓冲区全黑, 此前的差分与边框填充状态作废, 下一次发布整帧刷新
+ *
+ * @param manager
+ * @return 为true时丢弃本帧, 重建完成之前不访问缓冲区
+ */
+static bool resize_vnc_pending(BufferManager *manager) {
+    int state = atomic_load_explicit(&manager->resizeState, memory_order_acquire);
+    if (state == VNC_RESIZE_PENDING) {
+        return true;
+    }
+    if (state == VNC_RESIZE_DONE) {
+        manager->fullUpdate = true;
+        memset(g_borderPainted, 0, sizeof(g_borderPainted));
+        atomic_store_explicit(&manager->resizeState, VNC_RESIZE_NONE, memory_order_relaxed);
+    }
+    ScreenGeometry geometry;
+    if (UiTest_GetScreenGeometry(&geometry) != RETCODE_SUCCESS ||
+        (geometry.width == manager->server->width && geometry.height == manager->server->height)) {
+        return false;
+    }
+    manager->resizeWidth = geometry.width;
+    manager->resizeHeight = geometry.height;
+    atomic_store_explicit(&manager->resizeState, VNC_RESIZE_PENDING, memory_order_release);
+    return true;
+}
+
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+} JpegErrorMgr;
+
+/**
+ * 整幅DCT系数数组, 代替 libjpeg 内存管理器的虚拟数组
+ * 控制结构随图像一起释放, 系数本身放在解码器跨帧复用的缓冲区中
+ */
+typedef struct JpegCoefArray {
+    JBLOCKARRAY rows;
+    JDIMENSION blocksPerRow;
+    JDIMENSION numRows;
+    boolean preZero;
+    struct JpegCoefArray *next;
+} JpegCoefArray;
+
+/**
+ * JPEG 解码上下文, 跨帧复用
+ * 解码对象只创建一次, 行指针数组与行缓冲只在尺寸变大时重新分配
+ * 注意: cinfo 必须是第一个成员, 内存管理回调据此取得解码器
+ */
+typedef struct {
+    struct jpeg_decompress_struct cinfo;
+    JpegErrorMgr err;
+    bool inited;
+    JSAMPROW *rows;
+    int rowsCap;
+    unsigned char *scratch;
+    int scratchCap;
+    int lastW;
+    int lastH;
+    // 系数域变化检测: 每个 iMCU 行(一个解码带)的DCT系数哈希
+    uint64_t *bandHash;
+    uint8_t *bandChanged;
+    uint8_t *bandDecode;
+    int bandCap;
+    int bands;
+    uint64_t headerHash;
+    bool hashValid;
+    // 条带解码时重新拼装的码流
+    uint8_t *stream;
+    size_t streamCap;
+    // 读取系数时的整幅系数数组, 已申请但尚未分配内存的数组挂在链表上
+    JpegCoefArray *coefPending;
+    char *coefArena;
+    size_t coefCap;
+    // 图像内存池(JPOOL_IMAGE)的分配从该区域依次划分, 随图像一起整体释放;
+    // 区域不足时交给 libjpeg 分配, 并在下一幅图像开始前按本幅的用量扩大
+    char *arena;
+    size_t arenaCap;
+    size_t arenaUsed;
+    size_t arenaNeed;
+} JpegDecoder;
+
+static JpegDecoder g_jpegDecoder;
+// 条带并行解码, 每个条带一个解码器
+static JpegDecoder g_jpegStripeDecoders[WORKERS_MAX];
+static JpegStripePlan g_jpegStripePlan;
+
+static void jpeg_decoder_error_exit(j_common_ptr cinfo) {
+    JpegErrorMgr *err = (JpegErrorMgr *) cinfo->err;
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    AGENT_OHOS_LOG(LOG_ERROR, "%s: %s", __func__, msg);
+    longjmp(err->jmp, 1);
+}
+
+static void jpeg_decoder_output_message(j_common_ptr cinfo) {
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: %s", __func__, msg);
+}
+
+// libjpeg 自带的内存管理方法, 用于永久内存池, 区域不足时的图像内存池, 以及系数数组之外的采样数组
+static struct jpeg_memory_mgr g_jpegMemDefault;
+
+// 区域内的分配按 SIMD 行对齐, 与 libjpeg-turbo 的 2 * ALIGN_SIZE 一致
+#define JPEG_ARENA_ALIGN 64
+
+static void *jpeg_decoder_arena_alloc(JpegDecoder *dec, size_t size) {
+    size_t need = (size + JPEG_ARENA_ALIGN - 1) & ~(size_t) (JPEG_ARENA_ALIGN - 1);
+    dec->arenaNeed += need;
+    if (dec->arenaUsed + need > dec->arenaCap) {
+        return NULL;
+    }
+    void *p = dec->arena + dec->arenaUsed;
+    dec->arenaUsed += need;
+    return p;
+}
+
+static void *jpeg_decoder_alloc_small(j_common_ptr cinfo, int pool_id, size_t sizeofobject) {
+    void *p = pool_id == JPOOL_IMAGE ? jpeg_decoder_arena_alloc((JpegDecoder *) cinfo, sizeofobject) : NULL;
+    return p != NULL ? p : g_jpegMemDefault.alloc_small(cinfo, pool_id, sizeofobject);
+}
+
+static void *jpeg_decoder_alloc_large(j_common_ptr cinfo, int pool_id, size_t sizeofobject) {
+    void *p = pool_id == JPOOL_IMAGE ? jpeg_decoder_arena_alloc((JpegDecoder *) cinfo, sizeofobject) : NULL;
+    return p != NULL ? p : g_jpegMemDefault.alloc_large(cinfo, pool_id, sizeofobject);
+}
+
+/**
+ * 采样行数组, 与 libjpeg-turbo 相同每行长度按 JPEG_ARENA_ALIGN 向上取整, SIMD 实现可以读写到行尾对齐处
+ * 只处理8位精度的图像内存池, 其余交给 libjpeg
+ */
+static JSAMPARRAY jpeg_decoder_alloc_sarray(j_common_ptr cinfo, int pool_id, JDIMENSION samplesperrow,
+                                            JDIMENSION numrows) {
+    JpegDecoder *dec = (JpegDecoder *) cinfo;
+    if (pool_id == JPOOL_IMAGE && dec->cinfo.data_precision == 8) {
+        size_t rowBytes = ((size_t) samplesperrow + JPEG_ARENA_ALIGN - 1) & ~(size_t) (JPEG_ARENA_ALIGN - 1);
+        JSAMPARRAY rows = (JSAMPARRAY) jpeg_decoder_arena_alloc(dec, sizeof(JSAMPROW) * numrows);
+        JSAMPROW data = (JSAMPROW) jpeg_decoder_arena_alloc(dec, rowBytes * numrows);
+        if (rows != NULL && data != NULL) {
+            for (JDIMENSION r = 0; r < numrows; ++r) {
+                rows[r] = data + rowBytes * r;
+            }
+            return rows;
+        }
+    }
+    return g_jpegMemDefault.alloc_sarray(cinfo, pool_id, samplesperrow, numrows);
+}
+
+/**
+ * 释放内存池; 图像内存池释放后区域中没有存活的分配, 从头复用, 上一幅图像区域不足时在此扩大
+ */
+static void jpeg_decoder_free_pool(j_common_ptr cinfo, int pool_id) {
+    g_jpegMemDefault.free_pool(cinfo, pool_id);
+    if (pool_id != JPOOL_IMAGE) {
+        return;
+    }
+    JpegDecoder *dec = (JpegDecoder *) cinfo;
+    if (dec->arenaNeed > dec->arenaCap) {
+        size_t cap = (dec->arenaNeed + dec->arenaNeed / 4 + JPEG_ARENA_ALIGN - 1) & ~(size_t) (JPEG_ARENA_ALIGN - 1);
+        char *p = (char *) aligned_alloc(JPEG_ARENA_ALIGN, cap);
+        if (p != NULL) {
+            free(dec->arena);
+            dec->arena = p;
+            dec->arenaCap = cap;
+        }
+    }
+    dec->arenaUsed = 0;
+    dec->arenaNeed = 0;
+}
+
+static jvirt_barray_ptr jpeg_decoder_request_barray(j_common_ptr cinfo, int pool_id, boolean pre_zero,
+                                                    JDIMENSION blocksperrow, JDIMENSION numrows,
+                                                    JDIMENSION maxaccess) {
+    JpegDecoder *dec = (JpegDecoder *) cinfo;
+    JpegCoefArray *array = (JpegCoefArray *) (*cinfo->mem->alloc_small)(cinfo, JPOOL_IMAGE, sizeof(JpegCoefArray));
+    memset(array, 0, sizeof(*array));
+    array->blocksPerRow = blocksperrow;
+    array->numRows = numrows;
+    array->preZero = pre_zero;
+    array->next = dec->coefPending;
+    dec->coefPending = array;
+    return (jvirt_barray_ptr) array;
+}
+
+/**
+ * 为已申请的系数数组分配内存
+ * libjpeg 每帧按 JPOOL_IMAGE 分配并在 jpeg_abort 时释放整幅系数(一帧数MB),
+ * 这里改为从解码器的缓冲区中划分, 只在图像变大时更换缓冲区
+ */
+static void jpeg_decoder_realize_arrays(j_common_ptr cinfo) {
+    JpegDecoder *dec = (JpegDecoder *) cinfo;
+    g_jpegMemDefault.realize_virt_arrays(cinfo);
+    size_t rowBytes = 0;
+    size_t blockBytes = 0;
+    for (JpegCoefArray *a = dec->coefPending; a != NULL; a = a->next) {
+        rowBytes += sizeof(JBLOCKROW) * a->numRows;
+        blockBytes += sizeof(JBLOCK) * a->blocksPerRow * a->numRows;
+    }
+    if (rowBytes == 0) {
+        return;
+    }
+    rowBytes = (rowBytes + 63) & ~(size_t) 63;
+    if (!bufpool_reserve(&dec->coefArena, &dec->coefCap, rowBytes + blockBytes)) {
+        dec->coefPending = NULL;
+        cinfo->err->msg_code = JERR_OUT_OF_MEMORY;
+        (*cinfo->err->error_exit)(cinfo);
+    }
+    JBLOCKROW *rows = (JBLOCKROW *) dec->coefArena;
+    JBLOCKROW blocks = (JBLOCKROW) (dec->coefArena + rowBytes);
+    for (JpegCoefArray *a = dec->coefPending; a != NULL; a = a->next) {
+        a->rows = rows;
+        if (a->preZero) {
+            memset(blocks, 0, sizeof(JBLOCK) * a->blocksPerRow * a->numRows);
+        }
+        for (JDIMENSION r = 0; r < a->numRows; ++r) {
+            rows[r] = blocks;
+            blocks += a->blocksPerRow;
+        }
+        rows += a->numRows;
+    }
+    dec->coefPending = NULL;
+}
+
+static JBLOCKARRAY jpeg_decoder_access_barray(j_common_ptr cinfo, jvirt_barray_ptr ptr, JDIMENSION start_row,
+                                              JDIMENSION num_rows, boolean writable) {
+    JpegCoefArray *array = (JpegCoefArray *) ptr;
+    if (array->rows == NULL || start_row + num_rows > array->numRows) {
+        cinfo->err->msg_code = JERR_BAD_VIRTUAL_ACCESS;
+        (*cinfo->err->error_exit)(cinfo);
+    }
+    return array->rows + start_row;
+}
+
+static JpegDecoder *jpeg_decoder_get(JpegDecoder *dec) {
+    if (!dec->inited) {
+        dec->cinfo.err = jpeg_std_error(&dec->err.pub);
+        dec->err.pub.error_exit = jpeg_decoder_error_exit;
+        dec->err.pub.output_message = jpeg_decoder_output_message;
+        jpeg_create_decompress(&dec->cinfo);
+        struct jpeg_memory_mgr *mem = dec->cinfo.mem;
+        g_jpegMemDefault = *mem;
+        mem->alloc_small = jpeg_decoder_alloc_small;
+        mem->alloc_large = jpeg_decoder_alloc_large;
+        mem->alloc_sarray = jpeg_decoder_alloc_sarray;
+        mem->free_pool = jpeg_decoder_free_pool;
+        mem->request_virt_barray = jpeg_decoder_request_barray;
+        mem->realize_virt_arrays = jpeg_decoder_realize_arrays;
+        mem->access_virt_barray = jpeg_decoder_access_barray;
+        dec->inited = true;
+    }
+    // 上一帧解码出错时, 已申请的数组随图像释放
+    dec->coefPending = NULL;
+    return dec;
+}
+
+/**
+ * 确保行指针数组与行缓冲足够大, 仅在尺寸变大时分配
+ */
+static bool jpeg_decoder_reserve(JpegDecoder *dec, int rows, int scratchBytes) {
+    if (rows > dec->rowsCap) {
+        JSAMPROW *p = (JSAMPROW *) realloc(dec->rows, sizeof(JSAMPROW) * rows);
+        if (!p) return false;
+        dec->rows = p;
+        dec->rowsCap = rows;
+    }
+    if (scratchBytes > dec->scratchCap) {
+        unsigned char *p = (unsigned char *) realloc(dec->scratch, scratchBytes);
+        if (!p) return false;
+        dec->scratch = p;
+        dec->scratchCap = scratchBytes;
+    }
+    return true;
+}
+
+static bool jpeg_decoder_reserve_bands(JpegDecoder *dec, int bands) {
+    if (bands <= dec->bandCap) {
+        return true;
+    }
+    uint64_t *hash = (uint64_t *) realloc(dec->bandHash, sizeof(uint64_t) * bands);
+    if (hash) dec->bandHash = hash;
+    uint8_t *changed = (uint8_t *) realloc(dec->bandChanged, bands);
+    if (changed) dec->bandChanged = changed;
+    uint8_t *decode = (uint8_t *) realloc(dec->bandDecode, bands);
+    if (decode) dec->bandDecode = decode;
+    if (!hash || !changed || !decode) {
+        return false;
+    }
+    dec->bandCap = bands;
+    dec->hashValid = false;
+    return true;
+}
+
+/**
+ * 计算影响解码结果的头部信息哈希: 尺寸, 采样因子, 色彩空间, 量化表
+ * 头部不同时系数相同也不代表像素相同
+ */
+static uint64_t jpeg_decoder_header_hash(struct jpeg_decompress_struct *cinfo) {
+    int head[4] = {(int) cinfo->image_width, (int) cinfo->image_height, cinfo->num_components,
+                   (int) cinfo->jpeg_color_space};
+    uint64_t h = diff_hash(head, sizeof(head), 0);
+    for (int ci = 0; ci < cinfo->num_components; ++ci) {
+        jpeg_component_info *comp = &cinfo->comp_info[ci];
+        int samp[2] = {comp->h_samp_factor, comp->v_samp_factor};
+        h = diff_hash(samp, sizeof(samp), h);
+        JQUANT_TBL *qtbl = cinfo->quant_tbl_ptrs[comp->quant_tbl_no];
+        if (qtbl) {
+            h = diff_hash(qtbl->quantval, sizeof(qtbl->quantval), h);
+        }
     }
-
-    prevMask = buttonMask;
-    prevX = x;
-    prevY = y;
+    return h;
 }
 
 /**
- * 初始化vnc服务器, 该函数会同步创建双缓冲区
- * 注意: 请务必在不需要时调用cleanup_vnc_server释放内存, 否则会造成内存泄露!
+ * 第一遍: 只做熵解码读取DCT系数, 按 iMCU 行计算哈希并与上一帧比较
+ * 结果写入 dec->bandChanged, 同时更新 dec->bandHash
+ * 注意: 解码错误时通过 longjmp 返回调用者的 setjmp 处
  *
- * @param width 屏幕宽度
- * @param height 屏幕高度
- * @param bits_per_pixel BPP
- * @param port vnc端口
- * @param desktopName 桌面名称
- * @param password vnc密码, 为空为无鉴权
- * @param argc
- * @param argv
- * @return
+ * @return 变化的带数量, -1为内存不足
  */
-static BufferManager *
-init_vnc_server(const int width, const int height, const int bits_per_pixel, const char *desktopName, int* argc, char** argv) {
-    BufferManager *manager = calloc(1, sizeof(BufferManager));
-    manager->bufferSize = width * height * (bits_per_pixel / 8);
-    manager->frontBuffer = (char *) calloc(1, manager->bufferSize);
-    manager->backBuffer = (char *) calloc(1, manager->bufferSize);
-    manager->server = rfbGetScreen(argc, argv, width, height, 8, 4, (bits_per_pixel / 8));
-    manager->server->frameBuffer = manager->frontBuffer;
-    manager->server->desktopName = strdup(desktopName);
-    manager->server->alwaysShared = TRUE;
-    manager->server->httpDir = NULL;
-    manager->server->kbdAddEvent = key_event;
-    manager->server->ptrAddEvent = ptr_event;
-
-    rfbInitServer(manager->server);
-    /* Mark as dirty since we haven't sent any updates at all yet. */
-    rfbMarkRectAsModified(manager->server, 0, 0, width, height);
-    pthread_rwlock_init(&manager->frontBufferLock, NULL);
-    pthread_mutex_init(&manager->backBufferLock, NULL);
-    pthread_mutex_init(&manager->backBufferFuncLock, NULL);
+static int jpeg_decoder_scan_coefficients(JpegDecoder *dec, char *data, int size) {
+    struct jpeg_decompress_struct *cinfo = &dec->cinfo;
+    jpeg_mem_src(cinfo, (unsigned char *) data, size);
+    jpeg_read_header(cinfo, TRUE);
+    uint64_t header = jpeg_decoder_header_hash(cinfo);
+    jvirt_barray_ptr *coef = jpeg_read_coefficients(cinfo);
+    int bands = (int) cinfo->total_iMCU_rows;
+    if (!jpeg_decoder_reserve_bands(dec, bands)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    bool valid = dec->hashValid && header == dec->headerHash && bands == dec->bands;
+    int changed = 0;
+    for (int r = 0; r < bands; ++r) {
+        uint64_t h = 0;
+        for (int ci = 0; ci < cinfo->num_components; ++ci) {
+            jpeg_component_info *comp = &cinfo->comp_info[ci];
+            int v = comp->v_samp_factor;
+            JBLOCKARRAY blocks = (*cinfo->mem->access_virt_barray)((j_common_ptr) cinfo, coef[ci],
+                                                                   (JDIMENSION) (r * v), (JDIMENSION) v, FALSE);
+            for (int k = 0; k < v && r * v + k < (int) comp->height_in_blocks; ++k) {
+                h = diff_hash(blocks[k], sizeof(JBLOCK) * comp->width_in_blocks, h);
+            }
+        }
+        dec->bandChanged[r] = !valid || h != dec->bandHash[r];
+        changed += dec->bandChanged[r];
+        dec->bandHash[r] = h;
+    }
+    jpeg_abort_decompress(cinfo);
+    dec->headerHash = header;
+    dec->bands = bands;
+    dec->hashValid = true;
+    return changed;
+}
 
-    return manager;
+/**
+ * 解码 [y1, y2) 行到帧缓冲, 要求 output_scanline == y1
+ */
+static void jpeg_decoder_read_rows(JpegDecoder *dec, unsigned char *fb, int fb_stride, int bpp, int drawW, int y2) {
+    struct jpeg_decompress_struct *cinfo = &dec->cinfo;
+    if ((int) cinfo->output_width <= drawW && bpp == 4) {
+        while ((int) cinfo->output_scanline < y2) {
+            jpeg_read_scanlines(cinfo, &dec->rows[cinfo->output_scanline], y2 - cinfo->output_scanline);
+        }
+    } else {
+        // JPEG 比帧缓冲宽或帧缓冲不是 RGBX, 逐行解码到行缓冲再裁剪/转换
+        JSAMPROW row = dec->scratch;
+        while ((int) cinfo->output_scanline < y2) {
+            int y = (int) cinfo->output_scanline;
+            jpeg_read_scanlines(cinfo, &row, 1);
+            pixfmt_convert_row(&fb[y * fb_stride], row, drawW, bpp);
+        }
+    }
 }
 
+typedef struct {
+    const JpegStripePlan *plan;
+    const JpegDecoder *main;
+    unsigned char *fb;
+    int fb_stride;
+    int bpp;
+    int drawW;
+    int drawH;
+    int bandH;
+    bool useCoef;
+    int perStripe;
+    atomic_bool failed;
+    uint8_t decoded[WORKERS_MAX];
+} JpegStripeJob;
+
 /**
- * 运行vnc服务器
- * 注意: 该函数为阻塞函数
- *
- * @param manager
- * @return
+ * 解码一个条带: 上下各多解码一段作为上采样的上下文, 只把本条带的行写入帧缓冲
+ * 本条带内没有需要解码的带时保留缓冲区中已补齐的内容
  */
-static int run_vnc_server(BufferManager *manager) {
-    int hasRLock;
-    manager->stop_vnc_server_flag = 0;
-    manager->stopped_vnc_server_flag = 0;
-    while (!manager->stop_vnc_server_flag) {
-        if (manager->server->clientHead != NULL) {
-            if(manager->have_client_flag != 1) {
-                manager->have_client_flag = 1;
-            }
-            hasRLock = 1;
-        } else {
-            if(manager->have_client_flag != 0) {
-                manager->have_client_flag = 0;
-            }
-            hasRLock = 0;
+static void jpeg_stripe_task(void *arg, int index) {
+    JpegStripeJob *job = (JpegStripeJob *) arg;
+    const JpegStripePlan *plan = job->plan;
+    int seg0 = index * job->perStripe;
+    int seg1 = seg0 + job->perStripe < plan->segments ? seg0 + job->perStripe : plan->segments;
+    int y0 = seg0 * plan->segmentRows;
+    int y1 = seg1 * plan->segmentRows < job->drawH ? seg1 * plan->segmentRows : job->drawH;
+    job->decoded[index] = 0;
+    if (y0 >= y1) {
+        return;
+    }
+    if (job->useCoef) {
+        bool need = false;
+        for (int r = y0 / job->bandH; r <= (y1 - 1) / job->bandH && !need; ++r) {
+            need = job->main->bandDecode[r];
         }
-        if (hasRLock) {
-            pthread_rwlock_rdlock(&manager->frontBufferLock);
+        if (!need) {
+            return;
         }
-        rfbProcessEvents(manager->server, -1);
-        if (hasRLock) {
-            pthread_rwlock_unlock(&manager->frontBufferLock);
+    }
+
+    JpegDecoder *dec = jpeg_decoder_get(&g_jpegStripeDecoders[index]);
+    struct jpeg_decompress_struct *cinfo = &dec->cinfo;
+    int first = seg0 > 0 ? seg0 - 1 : 0;
+    int end = seg1 < plan->segments ? seg1 + 1 : plan->segments;
+    size_t size = jpeg_stripes_build(plan, first, end, &dec->stream, &dec->streamCap);
+    bool direct = plan->width <= job->drawW && job->bpp == 4;
+    if (size == 0 || !jpeg_decoder_reserve(dec, 0, direct ? 0 : plan->width * 4)) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+    if (setjmp(dec->err.jmp)) {
+        jpeg_abort_decompress(cinfo);
+        atomic_store(&job->failed, true);
+        return;
+    }
+    jpeg_mem_src(cinfo, dec->stream, size);
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->out_color_space = JCS_EXT_RGBX;
+    jpeg_start_decompress(cinfo);
+    int skip = (seg0 - first) * plan->segmentRows;
+    if (skip > 0) {
+        jpeg_skip_scanlines(cinfo, skip);
+    }
+    for (int y = y0; y < y1;) {
+        if (direct) {
+            y += (int) jpeg_read_scanlines(cinfo, &job->main->rows[y], y1 - y);
+        } else {
+            JSAMPROW row = dec->scratch;
+            jpeg_read_scanlines(cinfo, &row, 1);
+            pixfmt_convert_row(&job->fb[y * job->fb_stride], row, job->drawW, job->bpp);
+            y++;
         }
     }
-    rfbScreenCleanup(manager->server);
-    manager->stopped_vnc_server_flag = 1;
-    return 0;
+    jpeg_abort_decompress(cinfo);
+    job->decoded[index] = 1;
 }
 
 /**
- * 清理vnc服务器
- * 注意: 请务必在vnc服务器停止后调用
+ * 按重启间隔把一帧切成条带并行解码, 解码完成后对解码过的条带做差分
  *
- * @param manager
- * @return
+ * @return false表示某个条带解码失败, 调用者需要顺序解码整帧
  */
-static int cleanup_vnc_server(BufferManager *manager) {
-    if (manager->stop_vnc_server_flag != 1 || manager->stopped_vnc_server_flag != 1) {
-        return -1;
+static bool jpeg_decode_stripes(JpegDecoder *dec, const JpegStripePlan *plan, unsigned char *fb, int fb_stride,
+                                int bpp, const uint8_t *last, int drawW, int drawH, int bandH, bool useCoef,
+                                DirtyMap *map, bool diff, int *decoded) {
+    static JpegStripeJob job;
+    int stripes = workers_count() < plan->segments ? workers_count() : plan->segments;
+    job.plan = plan;
+    job.main = dec;
+    job.fb = fb;
+    job.fb_stride = fb_stride;
+    job.bpp = bpp;
+    job.drawW = drawW;
+    job.drawH = drawH;
+    job.bandH = bandH;
+    job.useCoef = useCoef;
+    job.perStripe = (plan->segments + stripes - 1) / stripes;
+    atomic_store(&job.failed, false);
+    workers_run(jpeg_stripe_task, &job, stripes);
+    if (atomic_load(&job.failed)) {
+        return false;
     }
-    pthread_rwlock_destroy(&manager->frontBufferLock);
-    pthread_mutex_destroy(&manager->backBufferLock);
-    pthread_mutex_destroy(&manager->backBufferFuncLock);
-    free(manager->frontBuffer);
-    free(manager->backBuffer);
-    free(manager->server->screenData);
-    free(manager);
-    return 0;
+    *decoded = 0;
+    for (int i = 0; i < stripes;) {
+        if (!job.decoded[i]) {
+            i++;
+            continue;
+        }
+        // 合并相邻的已解码条带
+        int j = i;
+        while (j < stripes && job.decoded[j]) {
+            j++;
+        }
+        int y0 = i * job.perStripe * plan->segmentRows;
+        int y1 = j * job.perStripe * plan->segmentRows < drawH ? j * job.perStripe * plan->segmentRows : drawH;
+        if (diff) {
+            diff_rows_timed(map, fb, fb_stride, last, fb_stride, drawW, y0, y1, bpp, g_AgentConfig.dirty_bbox);
+        }
+        *decoded += y1 - y0;
+        i = j;
+    }
+    return true;
 }
 
 // HUMAN NOTE: OHOS相关接口只提供了 JPEG 格式的屏幕数据, 性能较差, 没办法优化...
-// AI CODE
+// 解码器跨帧复用, 直接以 RGBX 解码到双缓冲区, 再与最近发布的帧比较; 16/8位帧缓冲时逐行解码后转换格式
+// 系数域变化检测: 先只做熵解码比较每个 iMCU 行的系数哈希, 完全没变的帧不做IDCT;
+// 有变化时只解码变化的带及其上下相邻带(上采样会引用相邻行), 其余带跳过并从最近发布的帧复制
 void screenJpegCallback(char* data, int size) {
     if (!g_BufferManager) {
         return;
     }
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
-    jpeg_mem_src(&cinfo, (unsigned char*)data, size);
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
+    JpegDecoder *dec = jpeg_decoder_get(&g_jpegDecoder);
+    struct jpeg_decompress_struct *cinfo = &dec->cinfo;
     int screenW_local = g_BufferManager->server->width;
     int screenH_local = g_BufferManager->server->height;
-    int jpegW = (int)cinfo.output_width;
-    int jpegH = (int)cinfo.output_height;
-    int row_stride = jpegW * cinfo.output_components; // 通常为3
-    int fb_stride = screenW_local * 4;
-    unsigned char* buffer = (unsigned char*)malloc(row_stride);
-    int y;
-    static unsigned char* last_frame = NULL;
-    static int last_w = 0, last_h = 0, last_components = 0;
-    int need_full_update = 0;
-    if (g_AgentConfig.no_diff) {
-        // 禁用差分更新, 每次全帧刷新
-        need_full_update = 1;
-    }
-    if (last_frame == NULL || last_w != jpegW || last_h != jpegH || last_components != cinfo.output_components) {
-        if (last_frame) free(last_frame);
-        last_frame = (unsigned char*)malloc(jpegW * jpegH * cinfo.output_components);
-        memset(last_frame, 0, jpegW * jpegH * cinfo.output_components);
-        last_w = jpegW;
-        last_h = jpegH;
-        last_components = cinfo.output_components;
-        need_full_update = 1;
-    }
-    int min_x = jpegW, min_y = jpegH, max_x = -1, max_y = -1;
-    unsigned char* curr_frame = (unsigned char*)malloc(jpegW * jpegH * cinfo.output_components);
-    for (y = 0; y < jpegH; ++y) {
-        unsigned char* rowptr = buffer;
-        jpeg_read_scanlines(&cinfo, &rowptr, 1);
-        memcpy(curr_frame + y * jpegW * cinfo.output_components, buffer, row_stride);
+    int bpp = g_BufferManager->server->bitsPerPixel / 8;
+    int fb_stride = screenW_local * bpp;
+    // setjmp 之后会修改的局部变量需声明为 volatile
+    unsigned char *volatile fb = NULL;
+    volatile bool useCoef = !g_AgentConfig.no_jpeg_coef && !g_AgentConfig.no_diff;
+
+    if (setjmp(dec->err.jmp)) {
+        jpeg_abort_decompress(cinfo);
+        if (fb) {
+            cancel_vnc_buf(g_BufferManager, false);
+        }
+        // 解码失败, 下一帧全帧刷新
+        dec->lastW = 0;
+        dec->lastH = 0;
+        dec->hashValid = false;
+        return;
     }
-    if (!need_full_update) {
-        for (y = 0; y < jpegH; ++y) {
-            for (int x = 0; x < jpegW; ++x) {
-                int idx = (y * jpegW + x) * cinfo.output_components;
-                int diff = 0;
-                for (int c = 0; c < cinfo.output_components; ++c) {
-                    if (curr_frame[idx + c] != last_frame[idx + c]) {
-                        diff = 1;
-                        break;
-                    }
+    if (useCoef) {
+        int changed = jpeg_decoder_scan_coefficients(dec, data, size);
+        if (changed == 0 && !g_BufferManager->fullUpdate && dec->lastW == (int) cinfo->image_width &&
+            dec->lastH == (int) cinfo->image_height) {
+            // 系数完全相同, 像素必然相同
+            UiTest_ReportScreenChange(false);
+            return;
+        }
+        if (changed < 0) {
+            useCoef = false;
+            dec->hashValid = false;
+        }
+    } else {
+        dec->hashValid = false;
+    }
+    // 多线程且码流按 MCU 行设置了重启间隔时按条带并行解码
+    const JpegStripePlan *plan = &g_jpegStripePlan;
+    volatile bool stripes = workers_count() > 1 &&
+                            jpeg_stripes_parse(&g_jpegStripePlan, (const uint8_t *)data, (size_t)size);
+    int jpegW, jpegH, bandH;
+    if (stripes) {
+        jpegW = plan->width;
+        jpegH = plan->height;
+        bandH = plan->mcuHeight;
+    } else {
+        jpeg_mem_src(cinfo, (unsigned char*)data, size);
+        jpeg_read_header(cinfo, TRUE);
+        cinfo->out_color_space = JCS_EXT_RGBX;
+        jpeg_start_decompress(cinfo);
+        jpegW = (int)cinfo->output_width;
+        jpegH = (int)cinfo->output_height;
+        bandH = cinfo->max_v_samp_factor * DCTSIZE;
+    }
+    int drawW = jpegW < screenW_local ? jpegW : screenW_local;
+    int drawH = jpegH < screenH_local ? jpegH : screenH_local;
+    int need_full_update = g_AgentConfig.no_diff || g_BufferManager->fullUpdate || jpegW != dec->lastW ||
+                           jpegH != dec->lastH;
+    if (jpegW != dec->lastW || jpegH != dec->lastH) {
+        // 截图尺寸变化(如旋转), 尽快重新查询屏幕参数
+        UiTest_InvalidateScreenGeometry();
+    }
+    int bands = (jpegH + bandH - 1) / bandH;
+    if (!useCoef || need_full_update || bands != dec->bands) {
+        useCoef = false;
+    }
+
+    DirtyMap *map = acquire_dirty_map(screenW_local, screenH_local);
+    if (map == NULL || !jpeg_decoder_reserve(dec, drawH, jpegW > screenW_local || bpp != 4 ? jpegW * 4 : 0)) {
+        jpeg_abort_decompress(cinfo);
+        dec->hashValid = false;
+        return;
+    }
+    if (useCoef) {
+        for (int r = 0; r < bands; ++r) {
+            dec->bandDecode[r] = dec->bandChanged[r] || (r > 0 && dec->bandChanged[r - 1]) ||
+                                 (r + 1 < bands && dec->bandChanged[r + 1]);
+        }
+    }
+
+    fb = (unsigned char*)request_back_vnc_buf(g_BufferManager, useCoef);
+    const uint8_t *last = (const uint8_t *)last_vnc_buf(g_BufferManager);
+    for (int y = 0; y < drawH; ++y) {
+        dec->rows[y] = &fb[y * fb_stride];
+    }
+    int decoded = 0;
+    if (stripes && !jpeg_decode_stripes(dec, plan, fb, fb_stride, bpp, last, drawW, drawH, bandH, useCoef, map,
+                                        !need_full_update, &decoded)) {
+        // 条带解码失败时脏区域尚未标记, 回退到顺序解码整帧
+        AGENT_OHOS_LOG(LOG_WARN, "%s: stripe decode failed, fallback to sequential", __func__);
+        stripes = false;
+        jpeg_mem_src(cinfo, (unsigned char*)data, size);
+        jpeg_read_header(cinfo, TRUE);
+        cinfo->out_color_space = JCS_EXT_RGBX;
+        jpeg_start_decompress(cinfo);
+    }
+    if (!stripes) {
+        for (int y = 0; y < drawH;) {
+            // 合并连续的解码带/跳过带
+            int r = y / bandH;
+            bool decode = !useCoef || dec->bandDecode[r];
+            int y2 = y;
+            while (y2 < drawH && (!useCoef || dec->bandDecode[y2 / bandH] == decode)) {
+                y2 = (y2 / bandH + 1) * bandH;
+            }
+            if (y2 > drawH) {
+                y2 = drawH;
+            }
+            if (decode) {
+                jpeg_decoder_read_rows(dec, fb, fb_stride, bpp, drawW, y2);
+                if (!need_full_update) {
+                    diff_rows_timed(map, fb, fb_stride, last, fb_stride, drawW, y, y2, bpp,
+                                       g_AgentConfig.dirty_bbox);
                 }
-                if (diff) {
-                    if (x < min_x) min_x = x;
-                    if (x > max_x) max_x = x;
-                    if (y < min_y) min_y = y;
-                    if (y > max_y) max_y = y;
+                decoded += y2 - y;
+            } else {
+                // 系数未变化的带与最近发布的帧相同, 申请缓冲区时已补齐
+                if (y2 < drawH) {
+                    jpeg_skip_scanlines(cinfo, y2 - y);
                 }
             }
+            y = y2;
         }
-        if (max_x < min_x || max_y < min_y) {
-            free(curr_frame);
-            free(buffer);
-            jpeg_finish_decompress(&cinfo);
-            jpeg_destroy_decompress(&cinfo);
-            return;
-        }
+    }
+    if (stripes || cinfo->output_scanline < cinfo->output_height) {
+        // 超出帧缓冲的行无需解码
+        jpeg_abort_decompress(cinfo);
     } else {
+        jpeg_finish_decompress(cinfo);
+    }
+    dec->lastW = jpegW;
+    dec->lastH = jpegH;
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: decoded %d/%d rows", __func__, decoded, drawH);
+
+    if (need_full_update) {
         // 全帧刷新，且以屏幕尺寸为准，防止只刷新JPEG区域
-        min_x = 0; min_y = 0; max_x = screenW_local - 1; max_y = screenH_local - 1;
-    }
-    // 仅在有变化区域时才持有锁并写入帧缓冲
-    unsigned char* fb = (unsigned char*)request_back_vnc_buf(g_BufferManager);
-    // 先填充未被JPEG覆盖的区域为白色，防止黑块
-    for (y = 0; y < screenH_local; ++y) {
-        for (int x = 0; x < screenW_local; ++x) {
-            if (y >= jpegH || x >= jpegW) {
-                unsigned char* fb_row = &fb[y * fb_stride + x * 4];
-                fb_row[0] = 255; fb_row[1] = 255; fb_row[2] = 255; fb_row[3] = 0xFF;
-            }
-        }
+        dirty_map_mark_rect(map, 0, 0, screenW_local, screenH_local);
+    }
+    // 未被JPEG覆盖的区域填充为白色，每个缓冲区只在尺寸变化后填充一次
+    paint_border_once(fb, fb_stride, bpp, screenW_local, screenH_local, jpegW, jpegH, map);
+    if (dirty_map_empty(map)) {
+        cancel_vnc_buf(g_BufferManager, true);
+        return;
+    }
+    if (!need_full_update) {
+        detect_frame_scroll(g_BufferManager, map, fb, fb_stride);
+    }
+    dirty_map_build_rects(map, g_AgentConfig.dirty_bbox);
+    if (!g_AgentConfig.no_jpeg_passthrough) {
+        attach_jpeg_vnc_buf(g_BufferManager, data, size, jpegW, jpegH);
     }
-    // 写入变化区域到帧缓冲（只写JPEG区域）
-    for (y = min_y; y <= max_y && y < jpegH && y < screenH_local; ++y) {
-        for (int x = min_x; x <= max_x && x < jpegW && x < screenW_local; ++x) {
-            int idx = (y * jpegW + x) * cinfo.output_components;
-            unsigned char r = curr_frame[idx + 0];
-            unsigned char g = curr_frame[idx + 1];
-            unsigned char b = curr_frame[idx + 2];
-            unsigned char* fb_row = &fb[y * fb_stride + x * 4];
-            fb_row[0] = r;
-            fb_row[1] = g;
-            fb_row[2] = b;
-            fb_row[3] = 0xFF;
-        }
-    }
-    // release_vnc_buf参数校正，防止越界
-    int rel_min_x = min_x < 0 ? 0 : min_x;
-    int rel_min_y = min_y < 0 ? 0 : min_y;
-    int rel_max_x = max_x + 1 > screenW_local ? screenW_local : max_x + 1;
-    int rel_max_y = max_y + 1 > screenH_local ? screenH_local : max_y + 1;
-    release_vnc_buf(g_BufferManager, rel_min_x, rel_min_y, rel_max_x, rel_max_y);
-    memcpy(last_frame, curr_frame, jpegW * jpegH * cinfo.output_components);
-    free(curr_frame);
-    free(buffer);
-    jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
+    release_vnc_buf(g_BufferManager, map);
 }
 
-// HUMAN NOTE: OHOS相关兼容接口只提供了 PNG 格式的屏幕数据, 性能较差, 没办法优化...
-// AI CODE
-void screenPngCallback(char* data, int size) {
-    if (!g_BufferManager) return;
+/**
+ * PNG 解码上下文, 跨帧复用行缓冲
+ * libpng 的读结构体无法跨图像复用, 每帧重新创建, 其内存取自跨帧复用的区域
+ */
+typedef struct {
+    unsigned char *scratch;
+    size_t scratchCap;
+    png_bytep *rows;
+    int rowsCap;
+    int lastW;
+    int lastH;
+    // libpng 内部分配从该区域顺序切分, 每帧开始时整体回收; 不足的部分本帧走堆分配, 下一帧起扩大区域
+    char *arena;
+    size_t arenaCap;
+    size_t arenaUsed;
+    size_t arenaNeed;
+} PngDecoder;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t offset;
+} PngSource;
+
+static PngDecoder g_pngDecoder;
+
+static void png_decoder_error(png_structp png, png_const_charp msg) {
+    AGENT_OHOS_LOG(LOG_ERROR, "%s: %s", __func__, msg);
+    png_longjmp(png, 1);
+}
 
-    int screenW_local = g_BufferManager->server->width;
-    int screenH_local = g_BufferManager->server->height;
+static void png_decoder_warning(png_structp png, png_const_charp msg) {
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: %s", __func__, msg);
+}
 
-    // 使用 libpng 解码 PNG 内存数据
-    png_image image;
-    memset(&image, 0, sizeof(image));
-    image.version = PNG_IMAGE_VERSION;
+static png_voidp png_decoder_malloc(png_structp png, png_alloc_size_t size) {
+    PngDecoder *dec = (PngDecoder *) png_get_mem_ptr(png);
+    size_t need = (size + 15) & ~(size_t) 15;
+    dec->arenaNeed += need;
+    if (dec->arenaUsed + need <= dec->arenaCap) {
+        png_voidp p = dec->arena + dec->arenaUsed;
+        dec->arenaUsed += need;
+        return p;
+    }
+    return malloc(size);
+}
 
-    if (!png_image_begin_read_from_memory(&image, data, size)) {
-        AGENT_OHOS_LOG(LOG_ERROR, "%s: PNG decode failed(%s)", __func__, image.message);
+static void png_decoder_free(png_structp png, png_voidp ptr) {
+    PngDecoder *dec = (PngDecoder *) png_get_mem_ptr(png);
+    if ((char *) ptr >= dec->arena && (char *) ptr < dec->arena + dec->arenaCap) {
         return;
     }
+    free(ptr);
+}
 
-    image.format = PNG_FORMAT_RGB; // 解码成 RGB
-    int pngW = image.width;
-    int pngH = image.height;
-    int components = 3;
-    png_bytep curr_frame = (png_bytep)malloc(PNG_IMAGE_SIZE(image));
-    if (!curr_frame) {
-        png_image_free(&image);
-        return;
+static void png_decoder_read(png_structp png, png_bytep out, size_t length) {
+    PngSource *src = (PngSource *) png_get_io_ptr(png);
+    if (length > src->size - src->offset) {
+        png_error(png, "PNG data truncated");
     }
+    memcpy(out, src->data + src->offset, length);
+    src->offset += length;
+}
 
-    if (!png_image_finish_read(&image, NULL, curr_frame, 0, NULL)) {
-        AGENT_OHOS_LOG(LOG_ERROR, "%s: PNG finish read failed(%s)", __func__, image.message);
-        free(curr_frame);
-        png_image_free(&image);
-        return;
+/**
+ * 确保行缓冲与行指针数组足够大, 仅在尺寸变大时分配
+ */
+static bool png_decoder_reserve(PngDecoder *dec, size_t scratchBytes, int rows) {
+    if (scratchBytes > dec->scratchCap) {
+        unsigned char *p = (unsigned char *) realloc(dec->scratch, scratchBytes);
+        if (!p) return false;
+        dec->scratch = p;
+        dec->scratchCap = scratchBytes;
     }
+    if (rows > dec->rowsCap) {
+        png_bytep *p = (png_bytep *) realloc(dec->rows, sizeof(png_bytep) * rows);
+        if (!p) return false;
+        dec->rows = p;
+        dec->rowsCap = rows;
+    }
+    return true;
+}
 
-    // 差分更新逻辑
-    static png_bytep last_frame = NULL;
-    static int last_w = 0, last_h = 0, last_components = 0;
-    int need_full_update = 0;
+// HUMAN NOTE: OHOS相关兼容接口只提供了 PNG 格式的屏幕数据, 性能较差, 没办法优化...
+// 逐行解码为 RGBX 直接写入双缓冲区, 每行趁热与最近发布的帧比较, 不再保留整帧的 RGB 副本
+// 16/8位帧缓冲时逐行解码到行缓冲再转换格式
+void screenPngCallback(char* data, int size) {
+    if (!g_BufferManager) return;
 
-    if (g_AgentConfig.no_diff) need_full_update = 1;
+    PngDecoder *dec = &g_pngDecoder;
+    int screenW_local = g_BufferManager->server->width;
+    int screenH_local = g_BufferManager->server->height;
+    int bpp = g_BufferManager->server->bitsPerPixel / 8;
+    int fb_stride = screenW_local * bpp;
+    PngSource src = { (const unsigned char *) data, (size_t) size, 0 };
+    // setjmp 之后会修改的局部变量需声明为 volatile
+    unsigned char *volatile fb = NULL;
+
+    // 上一帧区域不足时扩大, 此时区域中没有存活的分配
+    if (dec->arenaNeed > dec->arenaCap && !bufpool_reserve(&dec->arena, &dec->arenaCap, dec->arenaNeed)) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: reserve png arena %zu failed", __func__, dec->arenaNeed);
+    }
+    dec->arenaUsed = 0;
+    dec->arenaNeed = 0;
+    png_structp png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, png_decoder_error, png_decoder_warning,
+                                               dec, png_decoder_malloc, png_decoder_free);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (!info) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: png_create_read_struct failed", __func__);
+        png_destroy_read_struct(&png, NULL, NULL);
+        return;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        if (fb) {
+            cancel_vnc_buf(g_BufferManager, false);
+        }
+        png_destroy_read_struct(&png, &info, NULL);
+        // 解码失败, 下一帧全帧刷新
+        dec->lastW = 0;
+        dec->lastH = 0;
+        return;
+    }
+    png_set_read_fn(png, &src, png_decoder_read);
+    png_read_info(png, info);
+
+    png_uint_32 width, height;
+    int bitDepth, colorType, interlace;
+    png_get_IHDR(png, info, &width, &height, &bitDepth, &colorType, &interlace, NULL, NULL);
+    // 统一转换为 8 位 RGBX, 与旧实现(PNG_FORMAT_RGB 且 X=0xFF)一致
+    png_set_expand(png);
+    png_set_strip_16(png);
+    if (!(colorType & PNG_COLOR_MASK_COLOR)) {
+        png_set_gray_to_rgb(png);
+    }
+    if ((colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS)) {
+        png_set_strip_alpha(png);
+    }
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    if (png_get_rowbytes(png, info) != (size_t) width * 4) {
+        png_error(png, "unexpected row size");
+    }
 
-    if (!last_frame || last_w != pngW || last_h != pngH || last_components != components) {
-        if (last_frame) free(last_frame);
-        last_frame = (png_bytep)malloc(pngW * pngH * components);
-        memset(last_frame, 0, pngW * pngH * components);
-        last_w = pngW;
-        last_h = pngH;
-        last_components = components;
-        need_full_update = 1;
+    int pngW = (int) width;
+    int pngH = (int) height;
+    int drawW = pngW < screenW_local ? pngW : screenW_local;
+    int drawH = pngH < screenH_local ? pngH : screenH_local;
+    int need_full_update = g_AgentConfig.no_diff || g_BufferManager->fullUpdate || pngW != dec->lastW ||
+                           pngH != dec->lastH;
+    if (pngW != dec->lastW || pngH != dec->lastH) {
+        // 截图尺寸变化(如旋转), 尽快重新查询屏幕参数
+        UiTest_InvalidateScreenGeometry();
     }
+    // 隔行扫描的图像需要整幅解码, 超出帧缓冲或帧缓冲不是 RGBX 时先解码到临时图像再裁剪/转换
+    bool direct = pngW <= screenW_local && (passes == 1 || pngH <= screenH_local) && bpp == 4;
+    size_t scratchBytes = direct ? 0 : (size_t) pngW * 4 * (passes == 1 ? 1 : pngH);
 
-    int min_x = pngW, min_y = pngH, max_x = -1, max_y = -1;
+    DirtyMap *map = acquire_dirty_map(screenW_local, screenH_local);
+    if (map == NULL || !png_decoder_reserve(dec, scratchBytes, passes == 1 ? 0 : pngH)) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return;
+    }
 
-    if (!need_full_update) {
-        for (int y = 0; y < pngH; ++y) {
-            for (int x = 0; x < pngW; ++x) {
-                int idx = (y * pngW + x) * components;
-                int diff = 0;
-                for (int c = 0; c < components; ++c) {
-                    if (curr_frame[idx + c] != last_frame[idx + c]) {
-                        diff = 1;
-                        break;
-                    }
-                }
-                if (diff) {
-                    if (x < min_x) min_x = x;
-                    if (x > max_x) max_x = x;
-                    if (y < min_y) min_y = y;
-                    if (y > max_y) max_y = y;
-                }
+    fb = (unsigned char*)request_back_vnc_buf(g_BufferManager, false);
+    const uint8_t *last = (const uint8_t *)last_vnc_buf(g_BufferManager);
+    if (passes == 1) {
+        for (int y = 0; y < drawH; ++y) {
+            unsigned char *fbRow = &fb[y * fb_stride];
+            if (direct) {
+                png_read_row(png, fbRow, NULL);
+            } else {
+                png_read_row(png, dec->scratch, NULL);
+                pixfmt_convert_row(fbRow, dec->scratch, drawW, bpp);
+            }
+            // 单线程时逐行比较, 行数据还在缓存中; 多线程时解码完成后再分条带比较
+            if (!need_full_update && workers_count() <= 1) {
+                diff_rows_select(map, fb, fb_stride, last, fb_stride, drawW, y, y + 1, bpp, g_AgentConfig.dirty_bbox,
+                                 false);
             }
         }
-
-        if (max_x < min_x || max_y < min_y) {
-            free(curr_frame);
-            png_image_free(&image);
-            return; // 没有变化
+        if (!need_full_update && workers_count() > 1) {
+            diff_rows_timed(map, fb, fb_stride, last, fb_stride, drawW, 0, drawH, bpp, g_AgentConfig.dirty_bbox);
         }
     } else {
-        min_x = 0; min_y = 0;
-        max_x = screenW_local - 1;
-        max_y = screenH_local - 1;
-    }
-
-    // 写入帧缓冲
-    unsigned char* fb = (unsigned char*)request_back_vnc_buf(g_BufferManager);
-    int fb_stride = screenW_local * 4;
-
-    // 填充未被PNG覆盖的区域为白色
-    for (int y = 0; y < screenH_local; ++y) {
-        for (int x = 0; x < screenW_local; ++x) {
-            if (y >= pngH || x >= pngW) {
-                unsigned char* fb_row = &fb[y * fb_stride + x * 4];
-                fb_row[0] = 255; fb_row[1] = 255; fb_row[2] = 255; fb_row[3] = 0xFF;
+        for (int y = 0; y < pngH; ++y) {
+            dec->rows[y] = direct ? &fb[y * fb_stride] : &dec->scratch[(size_t) y * pngW * 4];
+        }
+        png_read_image(png, dec->rows);
+        if (!direct) {
+            for (int y = 0; y < drawH; ++y) {
+                pixfmt_convert_row(&fb[y * fb_stride], dec->rows[y], drawW, bpp);
             }
         }
+        if (!need_full_update) {
+            diff_rows_timed(map, fb, fb_stride, last, fb_stride, drawW, 0, drawH, bpp, g_AgentConfig.dirty_bbox);
+        }
+    }
+    // 超出帧缓冲的行无需解码
+    png_destroy_read_struct(&png, &info, NULL);
+    dec->lastW = pngW;
+    dec->lastH = pngH;
+
+    if (need_full_update) {
+        dirty_map_mark_rect(map, 0, 0, screenW_local, screenH_local);
+    }
+    // 未被PNG覆盖的区域填充为白色，每个缓冲区只在尺寸变化后填充一次
+    paint_border_once(fb, fb_stride, bpp, screenW_local, screenH_local, pngW, pngH, map);
+    if (dirty_map_empty(map)) {
+        cancel_vnc_buf(g_BufferManager, true);
+        return;
+    }
+    if (!need_full_update) {
+        detect_frame_scroll(g_BufferManager, map, fb, fb_stride);
     }
+    dirty_map_build_rects(map, g_AgentConfig.dirty_bbox);
+    release_vnc_buf(g_BufferManager, map);
+}
 
-    // 写入变化区域
-    for (int y = min_y; y <= max_y && y < pngH && y < screenH_local; ++y) {
-        for (int x = min_x; x <= max_x && x < pngW && x < screenW_local; ++x) {
-            int idx = (y * pngW + x) * components;
-            unsigned char* fb_row = &fb[y * fb_stride + x * 4];
-            fb_row[0] = curr_frame[idx + 0];
-            fb_row[1] = curr_frame[idx + 1];
-            fb_row[2] = curr_frame[idx + 2];
-            fb_row[3] = 0xFF;
+typedef struct {
+    uint8_t *dst;
+    const uint8_t *src;
+    int stride;
+    int bpp;
+    const DirtyRect *rects;
+    int count;
+    int stripeRows;
+} RectCopyJob;
+
+static void copy_rects_task(void *arg, int index) {
+    const RectCopyJob *job = (const RectCopyJob *) arg;
+    int y0 = index * job->stripeRows;
+    int y1 = y0 + job->stripeRows;
+    for (int i = 0; i < job->count; ++i) {
+        const DirtyRect *rect = &job->rects[i];
+        int ry1 = rect->y1 > y0 ? rect->y1 : y0;
+        int ry2 = rect->y2 < y1 ? rect->y2 : y1;
+        for (int y = ry1; y < ry2; ++y) {
+            memcpy(&job->dst[y * job->stride + rect->x1 * job->bpp], &job->src[y * job->stride + rect->x1 * job->bpp],
+                   (rect->x2 - rect->x1) * job->bpp);
         }
     }
+}
 
-    // release_vnc_buf 参数校正
-    int rel_min_x = min_x < 0 ? 0 : min_x;
-    int rel_min_y = min_y < 0 ? 0 : min_y;
-    int rel_max_x = max_x + 1 > screenW_local ? screenW_local : max_x + 1;
-    int rel_max_y = max_y + 1 > screenH_local ? screenH_local : max_y + 1;
-    release_vnc_buf(g_BufferManager, rel_min_x, rel_min_y, rel_max_x, rel_max_y);
+/**
+ * 按水平条带并行复制矩形区域, 源与目标步长相同
+ *
+ * @param dst
+ * @param src
+ * @param stride 行字节数
+ * @param bpp 每像素字节数
+ * @param rects 矩形列表
+ * @param count 矩形数量
+ * @param height 帧高度
+ */
+static void copy_rects_parallel(uint8_t *dst, const uint8_t *src, int stride, int bpp, const DirtyRect *rects,
+                                int count, int height) {
+    int stripes = workers_count();
+    RectCopyJob job = {dst, src, stride, bpp, rects, count, (height + stripes - 1) / stripes};
+    workers_run(copy_rects_task, &job, stripes);
+}
 
-    // 更新 last_frame
-    memcpy(last_frame, curr_frame, pngW * pngH * components);
+// 16/8位帧缓冲时 DMPUB 帧先整帧转换为帧缓冲格式, 再比较与复制; 只由解码线程访问
+static char *g_dmpubFrame;
+static size_t g_dmpubFrameSize;
 
-    free(curr_frame);
-    png_image_free(&image);
+/**
+ * 把 DMPUB 帧转换为帧缓冲格式, 转换耗时计入写入阶段
+ *
+ * @return 转换后的帧, 分配失败返回NULL
+ */
+static uint8_t *dmpub_convert_frame(const uint8_t *data, int screenW, int screenH, int bpp) {
+    size_t need = (size_t) screenW * screenH * bpp;
+    if (need != g_dmpubFrameSize) {
+        // 只在尺寸变化时更换, 按实际大小分配, 不预留余量
+        bufpool_free(g_dmpubFrame);
+        g_dmpubFrame = (char *) bufpool_alloc(need);
+        g_dmpubFrameSize = g_dmpubFrame != NULL ? need : 0;
+        if (g_dmpubFrame == NULL) {
+            return NULL;
+        }
+    }
+    uint64_t t0 = stats_now_ns();
+    pixfmt_convert_rows_parallel((uint8_t *) g_dmpubFrame, screenW * bpp, data, screenW * 4, screenW, 0, screenH, bpp);
+    g_frameWriteNs += stats_now_ns() - t0;
+    return (uint8_t *) g_dmpubFrame;
 }
 
 // AI CODE
@@ -489,6 +2106,7 @@ void screenDMPUBCallback(char* data, int size) {
 
     int screenW = g_BufferManager->server->width;
     int screenH = g_BufferManager->server->height;
+    int bpp = g_BufferManager->server->bitsPerPixel / 8;
 
     // 必须是 BGRA8888
     if (size < screenW * screenH * 4) {
@@ -497,85 +2115,110 @@ void screenDMPUBCallback(char* data, int size) {
     }
 
     uint8_t* curr_frame = (uint8_t*)data; // 注意：不 malloc，直接使用调用者传入的数据
-
-    // 差分缓存
-    static uint8_t* last_frame = NULL;
-    static int last_w = 0, last_h = 0;
-
-    int need_full_update = g_AgentConfig.no_diff;
-
-    size_t frameSize = screenW * screenH * 4;
-
-    // 首次初始化或分辨率变化
-    if (!last_frame || last_w != screenW || last_h != screenH) {
-        if (last_frame) free(last_frame);
-        last_frame = (uint8_t*)calloc(1, frameSize);
-        last_w = screenW;
-        last_h = screenH;
-        need_full_update = 1;
+    if (bpp != 4 && (curr_frame = dmpub_convert_frame(curr_frame, screenW, screenH, bpp)) == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: convert buffer alloc failed", __func__);
+        return;
     }
 
-    int min_x = screenW, min_y = screenH, max_x = -1, max_y = -1;
+    // 与最近发布的帧比较, 缓冲区在申请时补齐, 无需单独保留上一帧
+    int need_full_update = g_AgentConfig.no_diff || g_BufferManager->fullUpdate;
+
+    DirtyMap *map = acquire_dirty_map(screenW, screenH);
+    if (map == NULL) return;
 
     if (!need_full_update) {
-        // 差分扫描（每像素 4 字节，BGRA 完全一致）
-        for (int y = 0; y < screenH; ++y) {
-            const uint8_t* row_curr = &curr_frame[y * screenW * 4];
-            const uint8_t* row_last = &last_frame[y * screenW * 4];
-
-            for (int x = 0; x < screenW; ++x) {
-                int idx = x * 4;
-
-                if (memcmp(row_curr + idx, row_last + idx, 4) != 0) {
-                    if (x < min_x) min_x = x;
-                    if (x > max_x) max_x = x;
-                    if (y < min_y) min_y = y;
-                    if (y > max_y) max_y = y;
-                }
-            }
-        }
+        // 差分扫描（按帧缓冲格式逐字节比较）
+        const uint8_t *last = (const uint8_t *)last_vnc_buf(g_BufferManager);
+        diff_rows_timed(map, curr_frame, screenW * bpp, last, screenW * bpp, screenW, 0, screenH, bpp,
+                           g_AgentConfig.dirty_bbox);
 
         // 没变化
-        if (max_x < 0) return;
+        if (dirty_map_empty(map)) {
+            UiTest_ReportScreenChange(false);
+            return;
+        }
+        detect_frame_scroll(g_BufferManager, map, curr_frame, screenW * bpp);
 
     } else {
         // 强制全屏刷新
-        min_x = 0;
-        min_y = 0;
-        max_x = screenW - 1;
-        max_y = screenH - 1;
+        dirty_map_mark_rect(map, 0, 0, screenW, screenH);
     }
+    dirty_map_build_rects(map, g_AgentConfig.dirty_bbox);
 
-    // 写入 VNC framebuffer（BGRA 无需转换）
-    unsigned char* fb = (unsigned char*)request_back_vnc_buf(g_BufferManager);
-    int fb_stride = screenW * 4;
+    // 写入 VNC framebuffer（已是帧缓冲格式）, 只复制变化区域
+    unsigned char* fb = (unsigned char*)request_back_vnc_buf(g_BufferManager, true);
+    int fb_stride = screenW * bpp;
 
-    for (int y = min_y; y <= max_y; ++y) {
-        memcpy(
-            &fb[y * fb_stride + min_x * 4],
-            &curr_frame[y * screenW * 4 + min_x * 4],
-            (max_x - min_x + 1) * 4
-        );
-    }
+    uint64_t t0 = stats_now_ns();
+    copy_rects_parallel(fb, curr_frame, fb_stride, bpp, map->rects, map->rectCount, screenH);
+    g_frameWriteNs += stats_now_ns() - t0;
+
+    release_vnc_buf(g_BufferManager, map);
+}
+
+/**
+ * 零拷贝 DMPUB: 采集线程直接把像素读入空闲缓冲区
+ * 读入后与最近发布的帧比较
+ */
+static char *screenDMPUBAcquire(size_t *size) {
+    if (!g_BufferManager || resize_vnc_pending(g_BufferManager)) return NULL;
+    *size = g_BufferManager->bufferSize;
+    return request_back_vnc_buf(g_BufferManager, false);
+}
 
-    release_vnc_buf(
-        g_BufferManager,
-        min_x, min_y,
-        max_x + 1, max_y + 1
-    );
+static void screenDMPUBReleaseFrame(char *data, int size, bool valid) {
+    int screenW = g_BufferManager->server->width;
+    int screenH = g_BufferManager->server->height;
+    if (!valid || size < screenW * screenH * 4) {
+        if (valid) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: Invalid BGRA frame size=%d", __func__, size);
+        }
+        cancel_vnc_buf(g_BufferManager, false);
+        return;
+    }
+    DirtyMap *map = acquire_dirty_map(screenW, screenH);
+    if (map == NULL) {
+        cancel_vnc_buf(g_BufferManager, false);
+        return;
+    }
+    if (!g_BufferManager->fullUpdate && !g_AgentConfig.no_diff) {
+        const uint8_t *last = (const uint8_t *)last_vnc_buf(g_BufferManager);
+        diff_rows_timed(map, (const uint8_t *)data, screenW * 4, last, screenW * 4, screenW, 0, screenH, 4,
+                           g_AgentConfig.dirty_bbox);
+        if (dirty_map_empty(map)) {
+            cancel_vnc_buf(g_BufferManager, true);
+            return;
+        }
+        detect_frame_scroll(g_BufferManager, map, (const uint8_t *)data, screenW * 4);
+    } else {
+        dirty_map_mark_rect(map, 0, 0, screenW, screenH);
+    }
+    dirty_map_build_rects(map, g_AgentConfig.dirty_bbox);
+    release_vnc_buf(g_BufferManager, map);
+}
 
-    // 更新 last_frame
-    memcpy(last_frame, curr_frame, frameSize);
+static void screenDMPUBRelease(char *data, int size, bool valid) {
+    screenDMPUBReleaseFrame(data, size, valid);
+    frame_stages_flush();
 }
 
 void screenCallback(char* data, int size) {
-    if (strcmp(g_AgentConfig.cap_mode, CAP_MODE_PNG) == 0) {
-        screenPngCallback(data, size);
-    }else if (strcmp(g_AgentConfig.cap_mode, CAP_MODE_DMPUB) == 0) {
+    if (!g_BufferManager || resize_vnc_pending(g_BufferManager)) {
+        return;
+    }
+    if (strcmp(g_AgentConfig.cap_mode, CAP_MODE_DMPUB) == 0) {
         screenDMPUBCallback(data, size);
     } else {
-        screenJpegCallback(data, size);
+        // 解码阶段包含与解码交错进行的差分与写入
+        uint64_t t0 = stats_now_ns();
+        if (strcmp(g_AgentConfig.cap_mode, CAP_MODE_PNG) == 0) {
+            screenPngCallback(data, size);
+        } else {
+            screenJpegCallback(data, size);
+        }
+        stats_stage(STATS_STAGE_DECODE, stats_now_ns() - t0);
     }
+    frame_stages_flush();
 }
 
 static int processArguments(const int *argc, char *argv[]) {
@@ -592,12 +2235,94 @@ static int processArguments(const int *argc, char *argv[]) {
                 return false;
             }
             g_AgentConfig.cap_fps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-cap_min_fps") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -cap_min_fps", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            g_AgentConfig.cap_min_fps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-stats_interval") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -stats_interval", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            g_AgentConfig.stats_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-stats_file") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -stats_file", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            snprintf(g_AgentConfig.stats_file, sizeof(g_AgentConfig.stats_file), "%s", argv[++i]);
         } else if (strcmp(argv[i], "-cap_mode") == 0) {
             AGENT_OHOS_LOG(LOG_INFO, "%s: -cap_mode", __func__);
             if (i + 1 >= *argc) {
                 return false;
             }
             snprintf(g_AgentConfig.cap_mode, sizeof(g_AgentConfig.cap_mode), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "-zero_copy") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -zero_copy", __func__);
+            g_AgentConfig.zero_copy = true;
+        } else if (strcmp(argv[i], "-dirty_bbox") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -dirty_bbox", __func__);
+            g_AgentConfig.dirty_bbox = true;
+        } else if (strcmp(argv[i], "-dirty_tile") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -dirty_tile", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            g_AgentConfig.dirty_tile = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-no_pipeline") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -no_pipeline", __func__);
+            g_AgentConfig.no_pipeline = true;
+        } else if (strcmp(argv[i], "-cap_always") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -cap_always", __func__);
+            g_AgentConfig.cap_always = true;
+        } else if (strcmp(argv[i], "-workers") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -workers", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            g_AgentConfig.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-input_sync") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -input_sync", __func__);
+            g_AgentConfig.input_sync = true;
+        } else if (strcmp(argv[i], "-input_keep_moves") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -input_keep_moves", __func__);
+            g_AgentConfig.input_keep_moves = true;
+        } else if (strcmp(argv[i], "-input_text") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -input_text", __func__);
+            g_AgentConfig.input_text = true;
+        } else if (strcmp(argv[i], "-no_jpeg_coef") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -no_jpeg_coef", __func__);
+            g_AgentConfig.no_jpeg_coef = true;
+        } else if (strcmp(argv[i], "-no_scroll") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -no_scroll", __func__);
+            g_AgentConfig.no_scroll = true;
+        } else if (strcmp(argv[i], "-no_jpeg_passthrough") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -no_jpeg_passthrough", __func__);
+            g_AgentConfig.no_jpeg_passthrough = true;
+        } else if (strcmp(argv[i], "-no_encode_cache") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -no_encode_cache", __func__);
+            g_AgentConfig.no_encode_cache = true;
+        } else if (strcmp(argv[i], "-hash_diff") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -hash_diff", __func__);
+            g_AgentConfig.hash_diff = true;
+        } else if (strcmp(argv[i], "-hash_verify") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -hash_verify", __func__);
+            g_AgentConfig.hash_diff = true;
+            g_AgentConfig.hash_verify = true;
+        } else if (strcmp(argv[i], "-fb_bpp") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -fb_bpp", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            g_AgentConfig.fb_bpp = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-diff_kernel") == 0) {
+            AGENT_OHOS_LOG(LOG_INFO, "%s: -diff_kernel", __func__);
+            if (i + 1 >= *argc) {
+                return false;
+            }
+            snprintf(g_AgentConfig.diff_kernel, sizeof(g_AgentConfig.diff_kernel), "%s", argv[++i]);
         } else {
             // 未知参数, 不处理, 可能是给libvncserver的参数
         }
@@ -612,12 +2337,13 @@ RetCode UiTestExtension_OnInit(struct UiTestPort port, size_t argc, char **argv)
     AGENT_OHOS_LOG(LOG_INFO, "%s: Hi~", __func__);
     g_UiTestPort = port;
     port.initLowLevelFunctions(&g_LowLevelFunctions);
-    int screenW = UiTest_getScreenWidth();
-    int screenH = UiTest_getScreenHeight();
-    if (screenH <= 0 || screenW <= 0) {
+    ScreenGeometry geometry;
+    if (UiTest_GetScreenGeometry(&geometry) != RETCODE_SUCCESS) {
         AGENT_OHOS_LOG(LOG_FATAL, "%s: Get Screen Size Failed", __func__);
         return RETCODE_FAIL;
     }
+    int screenW = geometry.width;
+    int screenH = geometry.height;
     AGENT_OHOS_LOG(LOG_INFO, "%s: Screen Size: %dx%d", __func__, screenW, screenH);
     setServerRfbLog();
     int _argc = (int)argc;
@@ -629,7 +2355,47 @@ RetCode UiTestExtension_OnInit(struct UiTestPort port, size_t argc, char **argv)
         // 默认30fps
         g_AgentConfig.cap_fps = 30;
     }
-    g_BufferManager = init_vnc_server(screenW, screenH, 32, OH_GetMarketName(), &_argc, argv);
+    if (g_AgentConfig.cap_min_fps <= 0) {
+        // 默认画面不变时最低降到5fps
+        g_AgentConfig.cap_min_fps = 5;
+    }
+    if (g_AgentConfig.dirty_tile < DIRTY_TILE_SIZE_MIN || g_AgentConfig.dirty_tile > DIRTY_TILE_SIZE_MAX) {
+        g_AgentConfig.dirty_tile = DIRTY_TILE_SIZE_DEFAULT;
+    }
+    if (diff_init(g_AgentConfig.diff_kernel) != 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: Diff kernel %s unavailable", __func__, g_AgentConfig.diff_kernel);
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Diff kernel: %s", __func__, diff_kernel_name());
+    if (g_AgentConfig.fb_bpp != 16 && g_AgentConfig.fb_bpp != 8) {
+        g_AgentConfig.fb_bpp = PIXFMT_BPP_DEFAULT;
+    }
+    if (g_AgentConfig.fb_bpp != PIXFMT_BPP_DEFAULT) {
+        // 采集的像素与设备JPEG都是24位色, 不能直接放入低色深帧缓冲或转发给客户端
+        if (g_AgentConfig.zero_copy) {
+            AGENT_OHOS_LOG(LOG_WARN, "%s: -zero_copy ignored with -fb_bpp %d", __func__, g_AgentConfig.fb_bpp);
+            g_AgentConfig.zero_copy = false;
+        }
+        g_AgentConfig.no_jpeg_passthrough = true;
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Framebuffer: %d bpp, convert kernel: %s", __func__, g_AgentConfig.fb_bpp,
+                   pixfmt_kernel_name());
+    g_AgentConfig.workers = workers_init(g_AgentConfig.workers);
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Workers: %d", __func__, g_AgentConfig.workers);
+    // 预先映射整帧缓冲区: 三个帧缓冲, DMPUB 非零拷贝时另有采集帧槽或私有采集缓冲区(32位),
+    // 帧缓冲不是32位时 DMPUB 另有一个转换后的帧
+    BufPoolFrames poolFrames[2] = {
+        {(size_t) screenW * screenH * (g_AgentConfig.fb_bpp / 8), VNC_BUFFER_COUNT},
+        {(size_t) screenW * screenH * 4, 0},
+    };
+    if (strcmp(g_AgentConfig.cap_mode, CAP_MODE_DMPUB) == 0 && !g_AgentConfig.zero_copy) {
+        poolFrames[0].count += g_AgentConfig.fb_bpp != PIXFMT_BPP_DEFAULT;
+        poolFrames[1].count = g_AgentConfig.no_pipeline ? 1 : PIPELINE_SLOTS;
+    }
+    if (bufpool_init(poolFrames, 2) != 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: Buffer pool prefault failed", __func__);
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Buffer pool: %d frame(s)", __func__, poolFrames[0].count + poolFrames[1].count);
+    g_BufferManager = init_vnc_server(screenW, screenH, g_AgentConfig.fb_bpp, OH_GetMarketName(), &_argc, argv);
     AGENT_OHOS_LOG(LOG_INFO, "%s: Bye~", __func__);
     return RETCODE_SUCCESS;
 }
@@ -641,18 +2407,40 @@ RetCode UiTestExtension_OnRun() {
         AGENT_OHOS_LOG(LOG_FATAL, "%s: g_BufferManager NULL??", __func__);
         return RETCODE_FAIL;
     }
-    AGENT_OHOS_LOG(LOG_INFO, "%s: max fps: %d", __func__, g_AgentConfig.cap_fps);
+    AGENT_OHOS_LOG(LOG_INFO, "%s: max fps: %d, min fps: %d", __func__, g_AgentConfig.cap_fps,
+                   g_AgentConfig.cap_min_fps);
+    if (g_AgentConfig.zero_copy && strcmp(g_AgentConfig.cap_mode, CAP_MODE_DMPUB) == 0) {
+        ScreenCopyBuffer buffer = { .acquire = screenDMPUBAcquire, .release = screenDMPUBRelease };
+        UiTest_SetScreenCopyBuffer(&buffer);
+    }
+    UiTest_SetScreenCopyPipeline(!g_AgentConfig.no_pipeline);
+    UiTest_SetScreenCopyMinFps(g_AgentConfig.cap_min_fps);
     if (UiTest_StartScreenCopy(screenCallback, g_AgentConfig.cap_mode, g_AgentConfig.cap_fps) != RETCODE_SUCCESS) {
         AGENT_OHOS_LOG(LOG_FATAL, "%s: Start Screen Copy Failed", __func__);
         return RETCODE_FAIL;
     }
+    // 没有客户端需要画面时暂停采集
+    g_BufferManager->demandCapture = !g_AgentConfig.cap_always;
+    g_BufferManager->lastDemandNs = stats_now_ns();
+    // 输入注入放到独立线程, 避免阻塞vnc服务器循环
+    if (!g_AgentConfig.input_sync && input_start(g_AgentConfig.input_keep_moves) != 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: Start input thread failed, inject synchronously", __func__);
+    }
+    if (stats_report_init(g_AgentConfig.stats_interval, g_AgentConfig.stats_file) != 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: Stats report unavailable", __func__);
+    }
     run_vnc_server(g_BufferManager);
+    stats_report_close();
+    input_stop();
     if (UiTest_StopScreenCopy() != RETCODE_SUCCESS) {
         AGENT_OHOS_LOG(LOG_FATAL, "%s: Stop Screen Copy Failed", __func__);
     }
     // 等待2秒确保vnc服务器彻底停止
     sleep(2);
+    workers_shutdown();
     cleanup_vnc_server(g_BufferManager);
+    g_BufferManager = NULL;
+    bufpool_shutdown();
     AGENT_OHOS_LOG(LOG_INFO, "%s: Bye~", __func__);
     return RETCODE_SUCCESS;
 }
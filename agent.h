@@ -1,6 +1,7 @@
 #ifndef UITEST_AGENT_VNC_LIBRARY_H
 #define UITEST_AGENT_VNC_LIBRARY_H
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <hilog/log.h>
@@ -8,17 +9,62 @@
 #include <rfb/keysym.h>
 #include <ohos/extension_c_api.h>
 
+#include "dirty.h"
+
+// 三缓冲: 解码线程独占 back, vnc服务器独占 front, 两者通过 pending 原子交换, 互不等待
+#define VNC_BUFFER_COUNT 3
+#define VNC_BUFFER_INDEX 0x3
+// pending 中的缓冲区尚未被vnc服务器取走
+#define VNC_BUFFER_FRESH 0x4
+// 保留最近若干帧的变化区域, 落后更多的缓冲区整帧复制
+#define VNC_DAMAGE_HISTORY 8
+// 屏幕尺寸变化时重建帧缓冲: 解码线程发起(PENDING), vnc服务器线程完成(DONE), 解码线程确认后回到NONE
+#define VNC_RESIZE_NONE 0
+#define VNC_RESIZE_PENDING 1
+#define VNC_RESIZE_DONE 2
+// 设备截图的原始JPEG, 与所在缓冲区的画面一致, 可直接作为 Tight JPEG 矩形发送给客户端
+typedef struct {
+    char *data;
+    int size;
+    int capacity;
+    int width;
+    int height;
+} JpegFrame;
 typedef struct {
     rfbScreenInfoPtr server;
-    char *frontBuffer;
-    char *backBuffer;
+    char *buffers[VNC_BUFFER_COUNT];
+    // 每个缓冲区相对前一次发布的帧的变化区域, 只由持有该缓冲区的解码线程修改
+    DirtyRects damage[VNC_BUFFER_COUNT];
+    // 每个缓冲区相对前一次发布的帧的整块平移(目标区域与偏移, 没有时为空矩形), 由vnc服务器以 CopyRect 发送, 不计入 damage
+    DirtyRect copy[VNC_BUFFER_COUNT];
+    int copyDx[VNC_BUFFER_COUNT];
+    int copyDy[VNC_BUFFER_COUNT];
+    // 每个缓冲区对应的原始JPEG, size为0表示没有; 随缓冲区一起在解码线程与vnc服务器之间交换
+    JpegFrame jpeg[VNC_BUFFER_COUNT];
     int bufferSize;
     int stop_vnc_server_flag;
     int stopped_vnc_server_flag;
     int have_client_flag;
-    pthread_rwlock_t frontBufferLock;
-    pthread_mutex_t backBufferLock;
-    pthread_mutex_t backBufferFuncLock;
+    // 以下下标: back/published 只由解码线程访问, front 只由vnc服务器访问
+    int back;
+    int published;
+    int front;
+    atomic_int pending;
+    // 最近发布的帧序号(从1开始), 各缓冲区内容对应的帧序号(0为未知)
+    uint64_t seq;
+    uint64_t bufferSeq[VNC_BUFFER_COUNT];
+    // history[s % VNC_DAMAGE_HISTORY] 为第 s 帧相对第 s-1 帧的变化区域
+    DirtyRects history[VNC_DAMAGE_HISTORY];
+    // 按需采集: 是否启用, 当前是否已暂停, 最近一次有客户端等待画面的时间; 只由vnc服务器线程访问
+    bool demandCapture;
+    bool capturePaused;
+    uint64_t lastDemandNs;
+    // 帧缓冲重建状态与目标尺寸, PENDING 期间解码线程不访问缓冲区
+    atomic_int resizeState;
+    int resizeWidth;
+    int resizeHeight;
+    // 下一次发布需整帧刷新(首帧, 帧缓冲重建后), 只由解码线程访问
+    bool fullUpdate;
 } BufferManager;
 
 #define CAP_MODE_PNG "png"
@@ -28,7 +74,45 @@ typedef struct {
     bool no_diff;
     char cap_mode[16];
     int cap_fps;
+    // 画面持续不变时逐步降到的最低帧率, 不小于 cap_fps 时固定按 cap_fps 采集
+    int cap_min_fps;
     bool agent_debug;
+    // DMPUB 模式下像素直接读入双缓冲区
+    bool zero_copy;
+    // 使用旧的单矩形包围盒上报变化区域, 便于与tile模式对比
+    bool dirty_bbox;
+    int dirty_tile;
+    // 强制指定差分实现(avx2/sse2/neon/scalar), 为空时自动选择
+    char diff_kernel[16];
+    // 与上一帧保存的行哈希比较, 不读取上一帧; hash_verify 时哈希相同的段再逐字节校验
+    bool hash_diff;
+    bool hash_verify;
+    // 关闭JPEG系数域变化检测, 每帧完整解码
+    bool no_jpeg_coef;
+    // 关闭采集/解码流水线, 在采集线程中同步解码
+    bool no_pipeline;
+    // 始终按 cap_fps 采集, 不因没有客户端需要画面而暂停
+    bool cap_always;
+    // 解码/差分的并行线程数(含采集线程), 默认1即单线程
+    int workers;
+    // 在vnc服务器线程中同步注入输入, 不使用注入线程
+    bool input_sync;
+    // 保留连续移动的中间点(保持滑动速度), 默认合并为最新位置
+    bool input_keep_moves;
+    // 可打印字符合并为 Driver.inputText 输入到最近点击的位置, 默认逐键 Driver.triggerKey
+    bool input_text;
+    // 不把设备JPEG直接转发给 Tight JPEG 客户端, 全部由 libvncserver 重新编码
+    bool no_jpeg_passthrough;
+    // 多个 Tight JPEG 客户端不共享编码结果, 各自由 libvncserver 编码
+    bool no_encode_cache;
+    // 关闭滚动检测, 平移的区域按普通变化重新编码发送
+    bool no_scroll;
+    // 帧缓冲每像素位数: 32(RGBX), 16(RGB565), 8(BGR233), 解码时直接写入该格式
+    int fb_bpp;
+    // 每隔N秒输出一行 JSON 统计, 0 为只在收到 SIGUSR1 时输出
+    int stats_interval;
+    // JSON 统计追加写入的文件, 为空时输出到日志
+    char stats_file[256];
 } AgentConfig;
 
 extern struct UiTestPort g_UiTestPort;
@@ -38,6 +122,9 @@ extern AgentConfig g_AgentConfig;
 
 RetCode UiTestExtension_OnInit(struct UiTestPort port, size_t argc, char **argv);
 RetCode UiTestExtension_OnRun();
+// 截屏数据回调, 按 cap_mode 分发到对应的解码/差分实现
+void screenCallback(char* data, int size);
+void acquire_front_vnc_buf(BufferManager *manager);
 
 void AGENT_OHOS_LOG(LogLevel level, const char* fmt, ...);
 
@@ -0,0 +1,219 @@
+#include "bufpool.h"
+#include "agent.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// 帧级缓冲区池: 页对齐, 映射时即预先触发缺页, 释放后保留映射供下次复用
+// 只在启动/尺寸变化/帧槽增长时分配, 稳定采集时不再映射新内存, 也不经过堆分配器
+typedef struct {
+    void *addr;
+    size_t bytes;
+    bool used;
+} BufPoolMap;
+
+typedef struct {
+    pthread_mutex_t lock;
+    BufPoolMap maps[BUFPOOL_MAX_MAPS];
+    size_t pageSize;
+} BufPool;
+
+static BufPool g_bufPool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t bufpool_round(size_t size) {
+    size_t align = size >= BUFPOOL_HUGE_PAGE ? BUFPOOL_HUGE_PAGE : g_bufPool.pageSize;
+    return (size + align - 1) / align * align;
+}
+
+/**
+ * 映射一块内存并预先触发缺页
+ * 大块映射对齐到大页边界并建议内核使用透明大页, 减少缺页次数与TLB未命中
+ */
+static void *bufpool_map(size_t bytes) {
+    size_t align = bytes >= BUFPOOL_HUGE_PAGE ? BUFPOOL_HUGE_PAGE : g_bufPool.pageSize;
+    size_t span = bytes + align - g_bufPool.pageSize;
+    uint8_t *raw = (uint8_t *) mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: mmap %zu failed (%s)", __func__, span, strerror(errno));
+        return NULL;
+    }
+    // 去掉对齐多出的首尾部分
+    uint8_t *addr = (uint8_t *) (((uintptr_t) raw + align - 1) & ~(uintptr_t) (align - 1));
+    if (addr > raw) {
+        munmap(raw, addr - raw);
+    }
+    if (addr + bytes < raw + span) {
+        munmap(addr + bytes, raw + span - (addr + bytes));
+    }
+#ifdef MADV_HUGEPAGE
+    if (bytes >= BUFPOOL_HUGE_PAGE) {
+        madvise(addr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+    populated = madvise(addr, bytes, MADV_POPULATE_WRITE) == 0;
+#endif
+    if (!populated) {
+        // 内核不支持时逐页写入
+        for (size_t off = 0; off < bytes; off += g_bufPool.pageSize) {
+            ((volatile uint8_t *) addr)[off] = 0;
+        }
+    }
+    atomic_fetch_add_explicit(&g_AgentStats.poolMaps, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_AgentStats.poolBytes, bytes, memory_order_relaxed);
+    return addr;
+}
+
+static void bufpool_unmap(BufPoolMap *map) {
+    munmap(map->addr, map->bytes);
+    atomic_fetch_sub_explicit(&g_AgentStats.poolBytes, map->bytes, memory_order_relaxed);
+    memset(map, 0, sizeof(*map));
+}
+
+/**
+ * 按显示尺寸预先映射整帧缓冲区, 启动后的第一批帧不再触发缺页
+ * 各组同时分配后再一起归还, 之后按大小就近复用
+ *
+ * @param frames 各组缓冲区的大小与个数
+ * @param kinds 组数
+ * @return 0成功, -1映射失败(之后按需映射)
+ */
+int bufpool_init(const BufPoolFrames *frames, int kinds) {
+    g_bufPool.pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    void *buffers[BUFPOOL_MAX_MAPS];
+    int count = 0;
+    int want = 0;
+    for (int k = 0; k < kinds; ++k) {
+        want += frames[k].count;
+        for (int i = 0; i < frames[k].count && count < BUFPOOL_MAX_MAPS; ++i) {
+            buffers[count] = bufpool_alloc(frames[k].bytes);
+            if (buffers[count] == NULL) {
+                break;
+            }
+            count++;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        bufpool_free(buffers[i]);
+    }
+    return count == want ? 0 : -1;
+}
+
+/**
+ * 释放所有空闲映射
+ * 注意: 请在所有缓冲区归还之后调用, 仍在使用的缓冲区保持映射
+ */
+void bufpool_shutdown() {
+    bufpool_trim();
+}
+
+/**
+ * 取得一块页对齐且已触发缺页的缓冲区, 内容不确定
+ * 优先复用空闲映射中能容纳 size 的最小一块
+ *
+ * @param size 字节数
+ * @return 缓冲区地址, 失败返回NULL
+ */
+void *bufpool_alloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (g_bufPool.pageSize == 0) {
+        g_bufPool.pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    }
+    pthread_mutex_lock(&g_bufPool.lock);
+    BufPoolMap *best = NULL;
+    BufPoolMap *slot = NULL;
+    for (int i = 0; i < BUFPOOL_MAX_MAPS; ++i) {
+        BufPoolMap *map = &g_bufPool.maps[i];
+        if (map->addr == NULL) {
+            if (slot == NULL) {
+                slot = map;
+            }
+        } else if (!map->used && map->bytes >= size && (best == NULL || map->bytes < best->bytes)) {
+            best = map;
+        }
+    }
+    void *addr = NULL;
+    if (best != NULL) {
+        best->used = true;
+        addr = best->addr;
+        atomic_fetch_add_explicit(&g_AgentStats.poolReuses, 1, memory_order_relaxed);
+    } else if (slot != NULL) {
+        size_t bytes = bufpool_round(size);
+        addr = bufpool_map(bytes);
+        if (addr != NULL) {
+            slot->addr = addr;
+            slot->bytes = bytes;
+            slot->used = true;
+        }
+    } else {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: too many buffers", __func__);
+    }
+    pthread_mutex_unlock(&g_bufPool.lock);
+    return addr;
+}
+
+/**
+ * 归还缓冲区, 映射保留供下次复用
+ *
+ * @param buffer bufpool_alloc 返回的地址, 可为NULL
+ */
+void bufpool_free(void *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_bufPool.lock);
+    for (int i = 0; i < BUFPOOL_MAX_MAPS; ++i) {
+        if (g_bufPool.maps[i].addr == buffer) {
+            g_bufPool.maps[i].used = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_bufPool.lock);
+}
+
+/**
+ * 确保缓冲区容量不小于 size, 仅在变大时换一块更大的缓冲区, 原内容不保留
+ * 预留余量, 避免压缩帧大小小幅波动时反复更换
+ *
+ * @param buffer 缓冲区, 可能被替换
+ * @param capacity 缓冲区大小
+ * @param size 需要的字节数
+ * @return 是否成功, 失败时原缓冲区不变
+ */
+bool bufpool_reserve(char **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return true;
+    }
+    size_t cap = size + size / 4;
+    char *p = (char *) bufpool_alloc(cap);
+    if (p == NULL) {
+        return false;
+    }
+    bufpool_free(*buffer);
+    *buffer = p;
+    *capacity = cap;
+    return true;
+}
+
+/**
+ * 释放空闲映射, 在尺寸变化换完缓冲区之后调用, 归还旧尺寸的缓冲区占用的内存
+ */
+void bufpool_trim() {
+    pthread_mutex_lock(&g_bufPool.lock);
+    for (int i = 0; i < BUFPOOL_MAX_MAPS; ++i) {
+        BufPoolMap *map = &g_bufPool.maps[i];
+        if (map->addr != NULL && !map->used) {
+            bufpool_unmap(map);
+        }
+    }
+    pthread_mutex_unlock(&g_bufPool.lock);
+}
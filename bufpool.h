@@ -0,0 +1,25 @@
+#ifndef UITEST_AGENT_VNC_BUFPOOL_H
+#define UITEST_AGENT_VNC_BUFPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// 同时存在的映射上限: 帧缓冲 + 采集帧槽 + 私有采集缓冲区, 以及尺寸变化时新旧缓冲区并存
+#define BUFPOOL_MAX_MAPS 32
+// 不小于该大小的映射按透明大页对齐并建议内核使用大页
+#define BUFPOOL_HUGE_PAGE (2 * 1024 * 1024)
+
+// 启动时预先映射的一组同样大小的整帧缓冲区
+typedef struct {
+    size_t bytes;
+    int count;
+} BufPoolFrames;
+
+int bufpool_init(const BufPoolFrames *frames, int kinds);
+void bufpool_shutdown();
+void *bufpool_alloc(size_t size);
+void bufpool_free(void *buffer);
+bool bufpool_reserve(char **buffer, size_t *capacity, size_t size);
+void bufpool_trim();
+
+#endif //UITEST_AGENT_VNC_BUFPOOL_H
@@ -0,0 +1,542 @@
+#include "diff.h"
+#include "workers.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define DIFF_HAVE_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define DIFF_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// 标量参考实现, 其它实现的结果必须与之完全一致
+static size_t diff_first_scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t diff_last_scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+    for (size_t i = n; i > 0; --i) {
+        if (a[i - 1] != b[i - 1]) {
+            return i - 1;
+        }
+    }
+    return n;
+}
+
+#ifdef DIFF_HAVE_X86
+static size_t diff_first_sse2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xFFFFu;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    size_t r = diff_first_scalar(a + i, b + i, n - i);
+    return i + r;
+}
+
+static size_t diff_last_sse2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = n;
+    for (; i >= 16; i -= 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *) (a + i - 16));
+        __m128i vb = _mm_loadu_si128((const __m128i *) (b + i - 16));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xFFFFu;
+        if (mask) {
+            return i - 16 + (31 - __builtin_clz(mask));
+        }
+    }
+    size_t r = diff_last_scalar(a, b, i);
+    return r == i ? n : r;
+}
+
+__attribute__((target("avx2")))
+static size_t diff_first_avx2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                       _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i + 32)),
+                                       _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+        if ((unsigned) _mm256_movemask_epi8(_mm256_and_si256(e0, e1)) != 0xFFFFFFFFu) {
+            unsigned m0 = ~(unsigned) _mm256_movemask_epi8(e0);
+            if (m0) {
+                return i + __builtin_ctz(m0);
+            }
+            return i + 32 + __builtin_ctz(~(unsigned) _mm256_movemask_epi8(e1));
+        }
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i e = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i)));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(e);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + diff_first_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t diff_last_avx2(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = n;
+    for (; i >= 32; i -= 32) {
+        __m256i e = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i - 32)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i - 32)));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(e);
+        if (mask) {
+            return i - 32 + (31 - __builtin_clz(mask));
+        }
+    }
+    size_t r = diff_last_sse2(a, b, i);
+    return r == i ? n : r;
+}
+#endif
+
+#ifdef DIFF_HAVE_NEON
+// 16字节块内是否存在差异, armv7 没有 vmaxvq, 统一按两个64位通道判断
+static inline int diff_block_neon(const uint8_t *a, const uint8_t *b) {
+    uint64x2_t x = vreinterpretq_u64_u8(veorq_u8(vld1q_u8(a), vld1q_u8(b)));
+    return (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) != 0;
+}
+
+static size_t diff_first_neon(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint8x16_t x0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        uint8x16_t x1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+        uint64x2_t x = vreinterpretq_u64_u8(vorrq_u8(x0, x1));
+        if ((vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) != 0) {
+            return i + diff_first_scalar(a + i, b + i, 32);
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        if (diff_block_neon(a + i, b + i)) {
+            return i + diff_first_scalar(a + i, b + i, 16);
+        }
+    }
+    return i + diff_first_scalar(a + i, b + i, n - i);
+}
+
+static size_t diff_last_neon(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = n;
+    for (; i >= 16; i -= 16) {
+        if (diff_block_neon(a + i - 16, b + i - 16)) {
+            return i - 16 + diff_last_scalar(a + i - 16, b + i - 16, 16);
+        }
+    }
+    size_t r = diff_last_scalar(a, b, i);
+    return r == i ? n : r;
+}
+#endif
+
+static const DiffKernel g_diffKernels[] = {
+#ifdef DIFF_HAVE_X86
+    {"avx2", diff_first_avx2, diff_last_avx2},
+    {"sse2", diff_first_sse2, diff_last_sse2},
+#endif
+#ifdef DIFF_HAVE_NEON
+    {"neon", diff_first_neon, diff_last_neon},
+#endif
+    {"scalar", diff_first_scalar, diff_last_scalar},
+};
+
+static const DiffKernel *g_diffKernel = &g_diffKernels[sizeof(g_diffKernels) / sizeof(g_diffKernels[0]) - 1];
+
+static bool diff_kernel_supported(const DiffKernel *kernel) {
+#ifdef DIFF_HAVE_X86
+    if (strcmp(kernel->name, "avx2") == 0) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+/**
+ * 按名称查找差分实现, 当前CPU不支持时返回NULL
+ */
+const DiffKernel *diff_kernel_find(const char *name) {
+    for (size_t i = 0; i < sizeof(g_diffKernels) / sizeof(g_diffKernels[0]); ++i) {
+        if (strcmp(g_diffKernels[i].name, name) == 0) {
+            return diff_kernel_supported(&g_diffKernels[i]) ? &g_diffKernels[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 选择差分实现
+ *
+ * @param name 实现名称(avx2/sse2/neon/scalar), 为NULL或空时自动选择当前CPU支持的最快实现
+ * @return 0成功, -1指定的实现不可用(此时保持自动选择的结果)
+ */
+int diff_init(const char *name) {
+    for (size_t i = 0; i < sizeof(g_diffKernels) / sizeof(g_diffKernels[0]); ++i) {
+        if (diff_kernel_supported(&g_diffKernels[i])) {
+            g_diffKernel = &g_diffKernels[i];
+            break;
+        }
+    }
+    if (name == NULL || name[0] == '\0') {
+        return 0;
+    }
+    const DiffKernel *kernel = diff_kernel_find(name);
+    if (kernel == NULL) {
+        return -1;
+    }
+    g_diffKernel = kernel;
+    return 0;
+}
+
+const char *diff_kernel_name() {
+    return g_diffKernel->name;
+}
+
+/**
+ * 计算内存块的64位哈希, 用于判断数据是否变化(非加密用途)
+ * 4路独立累加以利用乘法流水线, 结果与 seed 相关, 可链式调用
+ *
+ * @param data
+ * @param n 字节数
+ * @param seed 初始值或上一段的哈希
+ * @return 哈希值
+ */
+uint64_t diff_hash(const void *data, size_t n, uint64_t seed) {
+    const uint64_t k1 = 0x9E3779B97F4A7C15ull;
+    const uint64_t k2 = 0xBF58476D1CE4E5B9ull;
+    const uint8_t *p = (const uint8_t *) data;
+    uint64_t h0 = seed ^ (n * k1), h1 = h0 + k1, h2 = h0 + k2, h3 = h0 - k1;
+    uint64_t w[4];
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        memcpy(w, p + i, 32);
+        h0 = (h0 ^ w[0]) * k2;
+        h1 = (h1 ^ w[1]) * k2;
+        h2 = (h2 ^ w[2]) * k2;
+        h3 = (h3 ^ w[3]) * k2;
+        h0 ^= h0 >> 29;
+        h1 ^= h1 >> 29;
+        h2 ^= h2 >> 29;
+        h3 ^= h3 >> 29;
+    }
+    uint64_t h = ((((h0 ^ h1) * k2) ^ h2) * k2 ^ h3) * k2;
+    for (; i + 8 <= n; i += 8) {
+        memcpy(w, p + i, 8);
+        h = (h ^ w[0]) * k2;
+        h ^= h >> 29;
+    }
+    for (; i < n; ++i) {
+        h = (h ^ p[i]) * k1;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * 比较一行像素, 按 segPixels 宽度分段
+ *
+ * @param curr 当前行
+ * @param last 上一帧对应行
+ * @param width 像素数
+ * @param bpp 每像素字节数(3: RGB, 4: BGRA/RGBX)
+ * @param segPixels 分段宽度, 一般为tile宽度
+ * @param skip 可为NULL, skip[k]非0的段已知有变化, 跳过比较
+ * @param segs 输出, 有变化的段置1, 不会清零其它段
+ * @param x1 输出, 比较过的段中第一个变化像素
+ * @param x2 输出, 比较过的段中最后一个变化像素
+ * @return 比较过的段中是否有变化
+ */
+bool diff_row(const uint8_t *curr, const uint8_t *last, int width, int bpp, int segPixels,
+              const uint8_t *skip, uint8_t *segs, int *x1, int *x2) {
+    const DiffKernel *kernel = g_diffKernel;
+    const size_t segBytes = (size_t) segPixels * bpp;
+    const size_t rowBytes = (size_t) width * bpp;
+    size_t lastOff = 0, lastLen = 0;
+    bool changed = false;
+    int k = 0;
+    for (size_t off = 0; off < rowBytes; off += segBytes, ++k) {
+        if (skip && skip[k]) {
+            continue;
+        }
+        size_t n = rowBytes - off < segBytes ? rowBytes - off : segBytes;
+        size_t f = kernel->first(curr + off, last + off, n);
+        if (f == n) {
+            continue;
+        }
+        segs[k] = 1;
+        if (!changed) {
+            *x1 = (int) ((off + f) / bpp);
+            changed = true;
+        }
+        lastOff = off;
+        lastLen = n;
+    }
+    if (changed) {
+        *x2 = (int) ((lastOff + kernel->last(curr + lastOff, last + lastOff, lastLen)) / bpp);
+    }
+    return changed;
+}
+
+/**
+ * 比较两帧中的一段行并记录到脏区域网格
+ *
+ * @param map
+ * @param curr 当前帧
+ * @param currStride 当前帧行字节数
+ * @param last 上一帧
+ * @param lastStride 上一帧行字节数
+ * @param width 比较宽度
+ * @param y1 起始行(含)
+ * @param y2 终止行(不含)
+ * @param bpp 每像素字节数
+ * @param exact 为true时逐行比较所有段, 保证像素级包围盒精确;
+ *              否则已标记为脏的tile在后续行中跳过比较
+ */
+void diff_rows(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+               int width, int y1, int y2, int bpp, bool exact) {
+    for (int y = y1; y < y2; ++y) {
+        const uint8_t *skip = exact ? NULL : &map->tiles[(y / map->tileSize) * map->cols];
+        int x1, x2;
+        memset(map->rowSegs, 0, map->cols);
+        if (diff_row(curr + (size_t) y * currStride, last + (size_t) y * lastStride, width, bpp,
+                     map->tileSize, skip, map->rowSegs, &x1, &x2)) {
+            dirty_map_mark_row(map, y, map->rowSegs, x1, x2);
+        }
+    }
+}
+
+/**
+ * 比较两帧并记录到脏区域网格, 参数同diff_rows
+ */
+void diff_frame(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                int width, int height, int bpp, bool exact) {
+    diff_rows(map, curr, currStride, last, lastStride, width, 0, height, bpp, exact);
+}
+
+/**
+ * 初始化哈希差分状态, 所有行标记为无效
+ *
+ * @param hashes
+ * @param width 帧宽度
+ * @param height 帧高度
+ * @param segPixels 分段宽度, 与脏区域网格的tile宽度一致
+ * @return 0成功, -1内存不足
+ */
+int diff_hashes_init(DiffHashes *hashes, int width, int height, int segPixels) {
+    memset(hashes, 0, sizeof(*hashes));
+    int cols = (width + segPixels - 1) / segPixels;
+    hashes->hashes = (uint64_t *) malloc(sizeof(uint64_t) * cols * height);
+    hashes->rowValid = (uint8_t *) calloc(height, 1);
+    if (!hashes->hashes || !hashes->rowValid) {
+        diff_hashes_free(hashes);
+        return -1;
+    }
+    hashes->width = width;
+    hashes->height = height;
+    hashes->segPixels = segPixels;
+    hashes->cols = cols;
+    return 0;
+}
+
+void diff_hashes_free(DiffHashes *hashes) {
+    free(hashes->hashes);
+    free(hashes->rowValid);
+    memset(hashes, 0, sizeof(*hashes));
+}
+
+/**
+ * 保存的行哈希不再对应最近发布的帧(整帧刷新, 放弃了已比较过的帧), 之后每行先逐字节比较一次
+ */
+void diff_hashes_invalidate(DiffHashes *hashes) {
+    if (hashes->rowValid) {
+        memset(hashes->rowValid, 0, hashes->height);
+    }
+}
+
+/**
+ * 用保存的行哈希代替上一帧做比较, 参数同diff_rows, 变化范围精确到段
+ * 哈希相同的段视为未变化, 只读取当前帧; 行哈希无效的行与 last 逐字节比较
+ *
+ * @param map
+ * @param hashes 与 map 尺寸一致, 比较后更新为当前帧的哈希
+ * @param curr 当前帧
+ * @param currStride
+ * @param last 最近发布的帧, 只在行哈希无效或校验时读取
+ * @param lastStride
+ * @param width 比较宽度
+ * @param y1 起始行(含)
+ * @param y2 终止行(不含)
+ * @param bpp 每像素字节数
+ * @param verify 哈希相同的段再与 last 逐字节比较, 统计并纠正哈希碰撞
+ */
+void diff_rows_hashed(DirtyMap *map, DiffHashes *hashes, const uint8_t *curr, int currStride, const uint8_t *last,
+                      int lastStride, int width, int y1, int y2, int bpp, bool verify) {
+    const DiffKernel *kernel = g_diffKernel;
+    const int segPixels = hashes->segPixels;
+    const size_t segBytes = (size_t) segPixels * bpp;
+    const size_t rowBytes = (size_t) width * bpp;
+    unsigned long long verified = 0, collisions = 0;
+    for (int y = y1; y < y2; ++y) {
+        const uint8_t *row = curr + (size_t) y * currStride;
+        const uint8_t *lastRow = last + (size_t) y * lastStride;
+        uint64_t *rowHashes = &hashes->hashes[(size_t) y * hashes->cols];
+        int first = -1, final = -1;
+        memset(map->rowSegs, 0, map->cols);
+        int k = 0;
+        for (size_t off = 0; off < rowBytes; off += segBytes, ++k) {
+            size_t n = rowBytes - off < segBytes ? rowBytes - off : segBytes;
+            uint64_t h = diff_hash(row + off, n, 0);
+            bool changed;
+            if (!hashes->rowValid[y]) {
+                changed = kernel->first(row + off, lastRow + off, n) != n;
+            } else if (h != rowHashes[k]) {
+                changed = true;
+            } else if (verify) {
+                changed = kernel->first(row + off, lastRow + off, n) != n;
+                verified++;
+                collisions += changed;
+            } else {
+                changed = false;
+            }
+            rowHashes[k] = h;
+            if (changed) {
+                map->rowSegs[k] = 1;
+                if (first < 0) {
+                    first = k;
+                }
+                final = k;
+            }
+        }
+        hashes->rowValid[y] = 1;
+        if (first >= 0) {
+            int x2 = (final + 1) * segPixels < width ? (final + 1) * segPixels : width;
+            dirty_map_mark_row(map, y, map->rowSegs, first * segPixels, x2 - 1);
+        }
+    }
+    if (verified) {
+        atomic_fetch_add_explicit(&hashes->verified, verified, memory_order_relaxed);
+        atomic_fetch_add_explicit(&hashes->collisions, collisions, memory_order_relaxed);
+    }
+}
+
+typedef struct {
+    DirtyMap *map;
+    DirtyMap views[WORKERS_MAX * 2];
+    // 为NULL时逐字节比较
+    DiffHashes *hashes;
+    bool verify;
+    const uint8_t *curr;
+    int currStride;
+    const uint8_t *last;
+    int lastStride;
+    int width;
+    int y1;
+    int y2;
+    int stripeRows;
+    int bpp;
+    bool exact;
+} DiffStripes;
+
+static void diff_stripe_task(void *arg, int index) {
+    DiffStripes *job = (DiffStripes *) arg;
+    // 条带边界对齐到tile行, 保证各条带标记的tile互不重叠
+    int base = (job->y1 / job->map->tileSize) * job->map->tileSize;
+    int y1 = base + index * job->stripeRows;
+    int y2 = y1 + job->stripeRows;
+    if (y1 < job->y1) y1 = job->y1;
+    if (y2 > job->y2) y2 = job->y2;
+    if (y1 < y2 && job->hashes) {
+        diff_rows_hashed(&job->views[index], job->hashes, job->curr, job->currStride, job->last, job->lastStride,
+                         job->width, y1, y2, job->bpp, job->verify);
+    } else if (y1 < y2) {
+        diff_rows(&job->views[index], job->curr, job->currStride, job->last, job->lastStride,
+                  job->width, y1, y2, job->bpp, job->exact);
+    }
+}
+
+static void diff_rows_serial(DirtyMap *map, DiffHashes *hashes, bool verify, const uint8_t *curr, int currStride,
+                             const uint8_t *last, int lastStride, int width, int y1, int y2, int bpp, bool exact) {
+    if (hashes) {
+        diff_rows_hashed(map, hashes, curr, currStride, last, lastStride, width, y1, y2, bpp, verify);
+    } else {
+        diff_rows(map, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+    }
+}
+
+/**
+ * 按tile行对齐切分为条带并行比较, 各条带结果合并到 map; 线程池未启用时在当前线程比较
+ */
+static void diff_rows_striped(DirtyMap *map, DiffHashes *hashes, bool verify, const uint8_t *curr, int currStride,
+                              const uint8_t *last, int lastStride, int width, int y1, int y2, int bpp, bool exact) {
+    static DiffStripes job;
+    static uint8_t *segs = NULL;
+    static size_t segsCap = 0;
+    const int ts = map->tileSize;
+    int tileRows = (y2 - 1) / ts - y1 / ts + 1;
+    int stripes = workers_count() > 1 ? workers_count() * 2 : 1;
+    if (stripes > tileRows) stripes = tileRows;
+    if (stripes <= 1 || y1 >= y2) {
+        diff_rows_serial(map, hashes, verify, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+        return;
+    }
+    size_t need = (size_t) stripes * map->cols;
+    if (need > segsCap) {
+        uint8_t *p = (uint8_t *) realloc(segs, need);
+        if (!p) {
+            diff_rows_serial(map, hashes, verify, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+            return;
+        }
+        segs = p;
+        segsCap = need;
+    }
+    job.map = map;
+    job.hashes = hashes;
+    job.verify = verify;
+    job.curr = curr;
+    job.currStride = currStride;
+    job.last = last;
+    job.lastStride = lastStride;
+    job.width = width;
+    job.y1 = y1;
+    job.y2 = y2;
+    job.stripeRows = (tileRows + stripes - 1) / stripes * ts;
+    job.bpp = bpp;
+    job.exact = exact;
+    for (int i = 0; i < stripes; ++i) {
+        dirty_map_view(map, &job.views[i], &segs[(size_t) i * map->cols]);
+    }
+    workers_run(diff_stripe_task, &job, stripes);
+    for (int i = 0; i < stripes; ++i) {
+        dirty_map_merge(map, &job.views[i]);
+    }
+}
+
+/**
+ * 多线程版本的diff_rows, 按tile行对齐切分为条带, 各条带结果合并到 map
+ * 线程池未启用时等同于diff_rows
+ */
+void diff_rows_parallel(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                        int width, int y1, int y2, int bpp, bool exact) {
+    diff_rows_striped(map, NULL, false, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+}
+
+/**
+ * 多线程版本的diff_rows_hashed, 切分方式同diff_rows_parallel
+ */
+void diff_rows_hashed_parallel(DirtyMap *map, DiffHashes *hashes, const uint8_t *curr, int currStride,
+                               const uint8_t *last, int lastStride, int width, int y1, int y2, int bpp, bool verify) {
+    diff_rows_striped(map, hashes, verify, curr, currStride, last, lastStride, width, y1, y2, bpp, false);
+}
@@ -0,0 +1,56 @@
+#ifndef UITEST_AGENT_VNC_DIFF_H
+#define UITEST_AGENT_VNC_DIFF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dirty.h"
+
+// 在 n 字节内查找第一个/最后一个不同字节的下标, 完全相同时返回 n
+typedef size_t (*DiffScanFunc)(const uint8_t *a, const uint8_t *b, size_t n);
+
+typedef struct {
+    const char *name;
+    DiffScanFunc first;
+    DiffScanFunc last;
+} DiffKernel;
+
+/**
+ * 哈希差分的状态: 上一帧每行每段(段宽同tile)的64位哈希, 比较时只读取当前帧
+ * 大小为 height * cols * 8 字节, 约为一帧 RGBX 的 1/(tileSize/2)
+ */
+typedef struct {
+    int width;
+    int height;
+    int segPixels;
+    int cols;
+    uint64_t *hashes;
+    // 行哈希是否对应最近发布的帧, 为0的行与上一帧逐字节比较后重新记录
+    uint8_t *rowValid;
+    // 校验模式下哈希相同而逐字节比较的段数, 以及其中实际不同(哈希碰撞)的段数
+    atomic_ullong verified;
+    atomic_ullong collisions;
+} DiffHashes;
+
+int diff_init(const char *name);
+const char *diff_kernel_name();
+const DiffKernel *diff_kernel_find(const char *name);
+uint64_t diff_hash(const void *data, size_t n, uint64_t seed);
+bool diff_row(const uint8_t *curr, const uint8_t *last, int width, int bpp, int segPixels,
+              const uint8_t *skip, uint8_t *segs, int *x1, int *x2);
+void diff_rows(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+               int width, int y1, int y2, int bpp, bool exact);
+void diff_rows_parallel(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                        int width, int y1, int y2, int bpp, bool exact);
+int diff_hashes_init(DiffHashes *hashes, int width, int height, int segPixels);
+void diff_hashes_free(DiffHashes *hashes);
+void diff_hashes_invalidate(DiffHashes *hashes);
+void diff_rows_hashed(DirtyMap *map, DiffHashes *hashes, const uint8_t *curr, int currStride, const uint8_t *last,
+                      int lastStride, int width, int y1, int y2, int bpp, bool verify);
+void diff_rows_hashed_parallel(DirtyMap *map, DiffHashes *hashes, const uint8_t *curr, int currStride,
+                               const uint8_t *last, int lastStride, int width, int y1, int y2, int bpp, bool verify);
+void diff_frame(DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                int width, int height, int bpp, bool exact);
+
+#endif //UITEST_AGENT_VNC_DIFF_H
@@ -0,0 +1,348 @@
+#include "dirty.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * 初始化脏区域网格
+ * 注意: 请务必在不需要时调用dirty_map_free释放内存
+ *
+ * @param map
+ * @param width 帧宽度
+ * @param height 帧高度
+ * @param tileSize tile边长(像素)
+ * @return 0成功, -1失败
+ */
+int dirty_map_init(DirtyMap *map, int width, int height, int tileSize) {
+    memset(map, 0, sizeof(*map));
+    if (width <= 0 || height <= 0 || tileSize <= 0) {
+        return -1;
+    }
+    map->width = width;
+    map->height = height;
+    map->tileSize = tileSize;
+    map->cols = (width + tileSize - 1) / tileSize;
+    map->rows = (height + tileSize - 1) / tileSize;
+    map->tiles = (uint8_t *) calloc(1, map->cols * map->rows);
+    map->rects = (DirtyRect *) malloc(sizeof(DirtyRect) * map->cols * map->rows);
+    map->active = (int *) malloc(sizeof(int) * map->cols * 2);
+    map->rowSegs = (uint8_t *) calloc(1, map->cols);
+    if (!map->tiles || !map->rects || !map->active || !map->rowSegs) {
+        dirty_map_free(map);
+        return -1;
+    }
+    dirty_map_reset(map);
+    return 0;
+}
+
+void dirty_map_free(DirtyMap *map) {
+    free(map->tiles);
+    free(map->rects);
+    free(map->active);
+    free(map->rowSegs);
+    memset(map, 0, sizeof(*map));
+}
+
+void dirty_map_reset(DirtyMap *map) {
+    memset(map->tiles, 0, map->cols * map->rows);
+    map->dirtyCount = 0;
+    map->minX = map->width;
+    map->minY = map->height;
+    map->maxX = -1;
+    map->maxY = -1;
+    map->rectCount = 0;
+}
+
+static void dirty_map_mark_tiles(DirtyMap *map, int c1, int r1, int c2, int r2) {
+    for (int r = r1; r <= r2; ++r) {
+        uint8_t *row = &map->tiles[r * map->cols];
+        for (int c = c1; c <= c2; ++c) {
+            if (!row[c]) {
+                row[c] = 1;
+                map->dirtyCount++;
+            }
+        }
+    }
+}
+
+/**
+ * 标记一行中的变化像素
+ *
+ * @param map
+ * @param y 行号
+ * @param x1 起始列(含)
+ * @param x2 终止列(含)
+ */
+void dirty_map_mark_span(DirtyMap *map, int y, int x1, int x2) {
+    if (y < 0 || y >= map->height) {
+        return;
+    }
+    if (x1 < 0) x1 = 0;
+    if (x2 >= map->width) x2 = map->width - 1;
+    if (x1 > x2) {
+        return;
+    }
+    if (x1 < map->minX) map->minX = x1;
+    if (x2 > map->maxX) map->maxX = x2;
+    if (y < map->minY) map->minY = y;
+    if (y > map->maxY) map->maxY = y;
+    int r = y / map->tileSize;
+    dirty_map_mark_tiles(map, x1 / map->tileSize, r, x2 / map->tileSize, r);
+}
+
+/**
+ * 按分段结果标记一行中的变化tile
+ *
+ * @param map
+ * @param y 行号
+ * @param segs 每个tile列是否有变化, 大小为 cols
+ * @param x1 第一个变化像素(含)
+ * @param x2 最后一个变化像素(含)
+ */
+void dirty_map_mark_row(DirtyMap *map, int y, const uint8_t *segs, int x1, int x2) {
+    if (y < 0 || y >= map->height || x1 > x2) {
+        return;
+    }
+    if (x1 < map->minX) map->minX = x1;
+    if (x2 > map->maxX) map->maxX = x2;
+    if (y < map->minY) map->minY = y;
+    if (y > map->maxY) map->maxY = y;
+    uint8_t *row = &map->tiles[(y / map->tileSize) * map->cols];
+    for (int c = 0; c < map->cols; ++c) {
+        if (segs[c] && !row[c]) {
+            row[c] = 1;
+            map->dirtyCount++;
+        }
+    }
+}
+
+/**
+ * 标记矩形区域, 左闭右开
+ */
+void dirty_map_mark_rect(DirtyMap *map, int x1, int y1, int x2, int y2) {
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > map->width) x2 = map->width;
+    if (y2 > map->height) y2 = map->height;
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+    if (x1 < map->minX) map->minX = x1;
+    if (x2 - 1 > map->maxX) map->maxX = x2 - 1;
+    if (y1 < map->minY) map->minY = y1;
+    if (y2 - 1 > map->maxY) map->maxY = y2 - 1;
+    dirty_map_mark_tiles(map, x1 / map->tileSize, y1 / map->tileSize,
+                         (x2 - 1) / map->tileSize, (y2 - 1) / map->tileSize);
+}
+
+/**
+ * 创建共享tile网格的视图, 用于多线程分条带标记
+ * 各视图只能标记互不重叠的tile行, 计数与包围盒独立累计, 完成后用dirty_map_merge合并
+ *
+ * @param map
+ * @param view 输出
+ * @param rowSegs 视图专用的逐行临时数组, 大小为 cols
+ */
+void dirty_map_view(const DirtyMap *map, DirtyMap *view, uint8_t *rowSegs) {
+    *view = *map;
+    view->dirtyCount = 0;
+    view->minX = map->width;
+    view->minY = map->height;
+    view->maxX = -1;
+    view->maxY = -1;
+    view->rects = NULL;
+    view->rectCount = 0;
+    view->active = NULL;
+    view->rowSegs = rowSegs;
+}
+
+void dirty_map_merge(DirtyMap *map, const DirtyMap *view) {
+    map->dirtyCount += view->dirtyCount;
+    if (view->minX < map->minX) map->minX = view->minX;
+    if (view->minY < map->minY) map->minY = view->minY;
+    if (view->maxX > map->maxX) map->maxX = view->maxX;
+    if (view->maxY > map->maxY) map->maxY = view->maxY;
+}
+
+bool dirty_map_empty(const DirtyMap *map) {
+    return map->dirtyCount == 0;
+}
+
+/**
+ * 将脏tile合并为矩形列表, 结果写入 map->rects
+ * 同一tile行内连续的脏tile合并为一段, 上下行列范围完全相同的段再纵向合并
+ *
+ * @param map
+ * @param bbox 为true时只输出一个像素级包围盒(旧行为)
+ * @return 矩形数量
+ */
+int dirty_map_build_rects(DirtyMap *map, bool bbox) {
+    map->rectCount = 0;
+    if (dirty_map_empty(map)) {
+        return 0;
+    }
+    if (bbox) {
+        map->rects[0] = (DirtyRect) {map->minX, map->minY, map->maxX + 1, map->maxY + 1};
+        map->rectCount = 1;
+        return 1;
+    }
+
+    const int ts = map->tileSize;
+    // prev: 上一tile行结束于当前行顶部的矩形下标, cur: 当前行产生/延伸的矩形下标
+    int *prev = map->active;
+    int *cur = map->active + map->cols;
+    int prevCount = 0;
+    for (int r = 0; r < map->rows; ++r) {
+        const uint8_t *row = &map->tiles[r * map->cols];
+        int y1 = r * ts;
+        int y2 = y1 + ts > map->height ? map->height : y1 + ts;
+        int curCount = 0;
+        int p = 0;
+        for (int c = 0; c < map->cols;) {
+            if (!row[c]) {
+                c++;
+                continue;
+            }
+            int c0 = c;
+            while (c < map->cols && row[c]) {
+                c++;
+            }
+            int x1 = c0 * ts;
+            int x2 = c * ts > map->width ? map->width : c * ts;
+            // prev 与当前行的段都按 x 递增, 双指针查找可纵向合并的矩形
+            while (p < prevCount && map->rects[prev[p]].x1 < x1) {
+                p++;
+            }
+            if (p < prevCount && map->rects[prev[p]].x1 == x1 && map->rects[prev[p]].x2 == x2) {
+                map->rects[prev[p]].y2 = y2;
+                cur[curCount++] = prev[p];
+            } else {
+                map->rects[map->rectCount] = (DirtyRect) {x1, y1, x2, y2};
+                cur[curCount++] = map->rectCount++;
+            }
+        }
+        int *tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prevCount = curCount;
+    }
+    return map->rectCount;
+}
+
+bool dirty_rect_empty(const DirtyRect *rect) {
+    return rect->x1 >= rect->x2 || rect->y1 >= rect->y2;
+}
+
+/**
+ * 矩形与另一个矩形求交, 不相交时结果为空矩形
+ */
+void dirty_rect_intersect(DirtyRect *rect, const DirtyRect *other) {
+    if (other->x1 > rect->x1) rect->x1 = other->x1;
+    if (other->y1 > rect->y1) rect->y1 = other->y1;
+    if (other->x2 < rect->x2) rect->x2 = other->x2;
+    if (other->y2 < rect->y2) rect->y2 = other->y2;
+    if (dirty_rect_empty(rect)) {
+        *rect = (DirtyRect) {0, 0, 0, 0};
+    }
+}
+
+void dirty_rects_clear(DirtyRects *list) {
+    list->count = 0;
+}
+
+static void dirty_rects_push(DirtyRects *list, const DirtyRect *rect) {
+    if (list->count < DIRTY_RECTS_MAX) {
+        list->rects[list->count++] = *rect;
+        return;
+    }
+    // 容量已满, 并入最后一个矩形; 按行生成的矩形相邻的通常也靠近
+    DirtyRect *last = &list->rects[list->count - 1];
+    if (rect->x1 < last->x1) last->x1 = rect->x1;
+    if (rect->y1 < last->y1) last->y1 = rect->y1;
+    if (rect->x2 > last->x2) last->x2 = rect->x2;
+    if (rect->y2 > last->y2) last->y2 = rect->y2;
+}
+
+/**
+ * 加入一个矩形, 已被列表中某个矩形包含时忽略
+ */
+void dirty_rects_add(DirtyRects *list, const DirtyRect *rect) {
+    if (dirty_rect_empty(rect)) {
+        return;
+    }
+    for (int i = 0; i < list->count; ++i) {
+        const DirtyRect *r = &list->rects[i];
+        if (r->x1 <= rect->x1 && r->y1 <= rect->y1 && r->x2 >= rect->x2 && r->y2 >= rect->y2) {
+            return;
+        }
+    }
+    dirty_rects_push(list, rect);
+}
+
+void dirty_rects_add_list(DirtyRects *list, const DirtyRects *other) {
+    for (int i = 0; i < other->count; ++i) {
+        dirty_rects_add(list, &other->rects[i]);
+    }
+}
+
+void dirty_rects_copy(DirtyRects *list, const DirtyRects *other) {
+    memcpy(list->rects, other->rects, sizeof(DirtyRect) * other->count);
+    list->count = other->count;
+}
+
+/**
+ * 以 map->rects 替换列表内容, 请先调用dirty_map_build_rects
+ */
+void dirty_rects_from_map(DirtyRects *list, const DirtyMap *map) {
+    list->count = 0;
+    for (int i = 0; i < map->rectCount; ++i) {
+        dirty_rects_push(list, &map->rects[i]);
+    }
+}
+
+/**
+ * 从列表中去掉一个矩形覆盖的部分, 与之相交的矩形拆分为其上下左右至多4块
+ * 容量不足以拆分时保留原矩形, 结果仍覆盖应保留的区域
+ */
+void dirty_rects_subtract(DirtyRects *list, const DirtyRect *cut) {
+    if (dirty_rect_empty(cut)) {
+        return;
+    }
+    int n = list->count;
+    for (int i = 0; i < n; ++i) {
+        DirtyRect r = list->rects[i];
+        if (r.x2 <= cut->x1 || cut->x2 <= r.x1 || r.y2 <= cut->y1 || cut->y2 <= r.y1) {
+            continue;
+        }
+        int y1 = r.y1 > cut->y1 ? r.y1 : cut->y1;
+        int y2 = r.y2 < cut->y2 ? r.y2 : cut->y2;
+        DirtyRect parts[4] = {
+            {r.x1, r.y1, r.x2, y1},
+            {r.x1, y2, r.x2, r.y2},
+            {r.x1, y1, cut->x1 < r.x2 ? cut->x1 : r.x2, y2},
+            {cut->x2 > r.x1 ? cut->x2 : r.x1, y1, r.x2, y2},
+        };
+        int count = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (!dirty_rect_empty(&parts[k])) {
+                parts[count++] = parts[k];
+            }
+        }
+        if (count > 0 && list->count + count - 1 > DIRTY_RECTS_MAX) {
+            continue;
+        }
+        // 第一块原地替换, 其余追加到末尾; 整个被覆盖时用末尾的矩形填补
+        if (count > 0) {
+            list->rects[i] = parts[0];
+            for (int k = 1; k < count; ++k) {
+                list->rects[list->count++] = parts[k];
+            }
+        } else {
+            // 末尾的矩形移到当前位置后重新检查
+            list->rects[i--] = list->rects[--list->count];
+            if (list->count < n) {
+                n = list->count;
+            }
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef UITEST_AGENT_VNC_DIRTY_H
+#define UITEST_AGENT_VNC_DIRTY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+
+#define DIRTY_TILE_SIZE_DEFAULT 64
+#define DIRTY_TILE_SIZE_MIN 8
+#define DIRTY_TILE_SIZE_MAX 512
+
+// 矩形区域, 左闭右开: [x1, x2) x [y1, y2)
+typedef struct {
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+} DirtyRect;
+
+// 矩形列表的容量, 超出时新矩形并入最后一个矩形的包围盒
+#define DIRTY_RECTS_MAX 1024
+
+/**
+ * 固定容量的矩形列表, 矩形之间可以重叠, 增删矩形不分配内存
+ * 容量不足时只会合并为更大的矩形, 结果始终覆盖所有加入的区域
+ */
+typedef struct {
+    DirtyRect rects[DIRTY_RECTS_MAX];
+    int count;
+} DirtyRects;
+
+/**
+ * 基于tile网格的脏区域记录
+ * 每个tile一个标记位, 同时记录像素级包围盒以兼容旧的单矩形模式
+ */
+typedef struct {
+    int width;
+    int height;
+    int tileSize;
+    int cols;
+    int rows;
+    uint8_t *tiles;
+    int dirtyCount;
+    // 像素级包围盒(闭区间), 无变化时 maxX < minX
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+    // dirty_map_build_rects 的输出
+    DirtyRect *rects;
+    int rectCount;
+    // 合并矩形时使用的临时数组, 大小为 cols * 2
+    int *active;
+    // 逐行差分时使用的临时数组, 大小为 cols
+    uint8_t *rowSegs;
+} DirtyMap;
+
+int dirty_map_init(DirtyMap *map, int width, int height, int tileSize);
+void dirty_map_free(DirtyMap *map);
+void dirty_map_reset(DirtyMap *map);
+void dirty_map_mark_span(DirtyMap *map, int y, int x1, int x2);
+void dirty_map_mark_row(DirtyMap *map, int y, const uint8_t *segs, int x1, int x2);
+void dirty_map_mark_rect(DirtyMap *map, int x1, int y1, int x2, int y2);
+void dirty_map_view(const DirtyMap *map, DirtyMap *view, uint8_t *rowSegs);
+void dirty_map_merge(DirtyMap *map, const DirtyMap *view);
+bool dirty_map_empty(const DirtyMap *map);
+int dirty_map_build_rects(DirtyMap *map, bool bbox);
+bool dirty_rect_empty(const DirtyRect *rect);
+void dirty_rect_intersect(DirtyRect *rect, const DirtyRect *other);
+void dirty_rects_clear(DirtyRects *list);
+void dirty_rects_add(DirtyRects *list, const DirtyRect *rect);
+void dirty_rects_add_list(DirtyRects *list, const DirtyRects *other);
+void dirty_rects_copy(DirtyRects *list, const DirtyRects *other);
+void dirty_rects_from_map(DirtyRects *list, const DirtyMap *map);
+void dirty_rects_subtract(DirtyRects *list, const DirtyRect *cut);
+
+#endif //UITEST_AGENT_VNC_DIRTY_H
@@ -0,0 +1,777 @@
+#include "enccache.h"
+#include "agent.h"
+#include "stats.h"
+
+#include <jpeglib.h>
+#include <jerror.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// JPEG 输出缓冲区的初始大小, 不够时加倍
+#define ENC_JPEG_INITIAL_OUT (64 * 1024)
+// 颜色数不超过该值的矩形用调色板编码(无损), 更多颜色用 JPEG
+#define ENC_PALETTE_MAX_COLORS 96
+// 调色板数据不足该长度时不压缩, 与 Tight 协议一致
+#define TIGHT_MIN_TO_COMPRESS 12
+// 面积不小于该值的矩形才寻找纯色区域, 以下取值与 libvncserver 的 Tight 编码一致
+#define ENC_MIN_SPLIT_RECT_SIZE 4096
+// 单独填充的纯色区域的最小面积
+#define ENC_MIN_SOLID_SUBRECT_SIZE 2048
+// 寻找纯色区域时的小块边长
+#define ENC_SPLIT_TILE_SIZE 16
+// 一个子矩形的最大像素数与最大宽度
+#define ENC_MAX_RECT_SIZE 65536
+#define ENC_MAX_RECT_WIDTH 2048
+// 调色板数据使用的 zlib 流: libvncserver 只使用 0-2 号流, 3 号流每个矩形都重置, 编码结果与客户端状态无关
+#define ENC_ZLIB_STREAM 3
+
+// Tight 质量等级(0-9)对应的 JPEG 质量, 与 libvncserver 的取值一致
+static const int g_tightJpegQuality[10] = {15, 29, 41, 42, 62, 77, 79, 86, 92, 100};
+// 水平/垂直色度采样因子: 低等级 4:2:0, 中等级 4:2:2, 高等级 4:4:4
+static const int g_tightJpegSampling[10][2] = {
+    {2, 2}, {2, 2}, {2, 2}, {2, 1}, {2, 1}, {2, 1}, {1, 1}, {1, 1}, {1, 1}, {1, 1},
+};
+
+/**
+ * JPEG 编码上下文, 跨矩形复用
+ * 注意: cinfo 必须是第一个成员, 错误回调据此取得上下文
+ */
+typedef struct {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr err;
+    jmp_buf jmp;
+    struct jpeg_destination_mgr dest;
+    bool inited;
+    JOCTET *out;
+    size_t outCap;
+    size_t outSize;
+    // 帧缓冲不是 RGBX 时转换一行的缓冲区
+    uint8_t *rgb;
+    size_t rgbCap;
+} EncodeJpeg;
+
+static EncodeJpeg g_encodeJpeg;
+
+// 调色板编码上下文, 跨矩形复用
+typedef struct {
+    z_stream zs;
+    bool inited;
+    int level;
+    // 每个像素的调色板下标, ENC_MAX_RECT_SIZE 字节
+    uint8_t *index;
+} EncodeZlib;
+
+static EncodeZlib g_encodeZlib;
+
+static void enccache_jpeg_error_exit(j_common_ptr cinfo) {
+    EncodeJpeg *enc = (EncodeJpeg *) cinfo;
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    AGENT_OHOS_LOG(LOG_ERROR, "%s: %s", __func__, msg);
+    longjmp(enc->jmp, 1);
+}
+
+static void enccache_jpeg_init_destination(j_compress_ptr cinfo) {
+    EncodeJpeg *enc = (EncodeJpeg *) cinfo;
+    enc->dest.next_output_byte = enc->out;
+    enc->dest.free_in_buffer = enc->outCap;
+}
+
+static boolean enccache_jpeg_empty_output(j_compress_ptr cinfo) {
+    EncodeJpeg *enc = (EncodeJpeg *) cinfo;
+    size_t cap = enc->outCap * 2;
+    JOCTET *p = (JOCTET *) realloc(enc->out, cap);
+    if (p == NULL) {
+        ERREXIT(cinfo, JERR_OUT_OF_MEMORY);
+    }
+    // 调用时缓冲区已全部写满
+    enc->dest.next_output_byte = p + enc->outCap;
+    enc->dest.free_in_buffer = cap - enc->outCap;
+    enc->out = p;
+    enc->outCap = cap;
+    return TRUE;
+}
+
+static void enccache_jpeg_term_destination(j_compress_ptr cinfo) {
+    EncodeJpeg *enc = (EncodeJpeg *) cinfo;
+    enc->outSize = enc->outCap - enc->dest.free_in_buffer;
+}
+
+static EncodeJpeg *enccache_jpeg_get() {
+    EncodeJpeg *enc = &g_encodeJpeg;
+    if (!enc->inited) {
+        enc->out = (JOCTET *) malloc(ENC_JPEG_INITIAL_OUT);
+        if (enc->out == NULL) {
+            return NULL;
+        }
+        enc->outCap = ENC_JPEG_INITIAL_OUT;
+        enc->cinfo.err = jpeg_std_error(&enc->err);
+        enc->err.error_exit = enccache_jpeg_error_exit;
+        jpeg_create_compress(&enc->cinfo);
+        enc->dest.init_destination = enccache_jpeg_init_destination;
+        enc->dest.empty_output_buffer = enccache_jpeg_empty_output;
+        enc->dest.term_destination = enccache_jpeg_term_destination;
+        enc->cinfo.dest = &enc->dest;
+        enc->inited = true;
+    }
+    return enc;
+}
+
+// 按帧缓冲像素格式把一行展开为 RGB, 各分量按 libvncserver 转换像素格式的方式放大到 0-255
+static void enccache_expand_row(uint8_t *rgb, const uint8_t *src, int width, const rfbPixelFormat *fmt) {
+    const int bpp = fmt->bitsPerPixel / 8;
+    for (int x = 0; x < width; ++x) {
+        uint32_t v = 0;
+        memcpy(&v, src + x * bpp, bpp);
+        rgb[x * 3] = (uint8_t) ((((v >> fmt->redShift) & fmt->redMax) * 255 + fmt->redMax / 2) / fmt->redMax);
+        rgb[x * 3 + 1] =
+            (uint8_t) ((((v >> fmt->greenShift) & fmt->greenMax) * 255 + fmt->greenMax / 2) / fmt->greenMax);
+        rgb[x * 3 + 2] =
+            (uint8_t) ((((v >> fmt->blueShift) & fmt->blueMax) * 255 + fmt->blueMax / 2) / fmt->blueMax);
+    }
+}
+
+/**
+ * 把帧缓冲中的一个矩形压缩为 JPEG, 结果在 enc->out / enc->outSize
+ *
+ * @return 是否成功
+ */
+static bool enccache_jpeg(EncodeJpeg *enc, rfbScreenInfoPtr server, int x, int y, int w, int h, int quality) {
+    const rfbPixelFormat *fmt = &server->serverFormat;
+    const int bpp = fmt->bitsPerPixel / 8;
+    // RGBX 帧缓冲直接逐行交给 libjpeg
+    const bool direct = bpp == 4 && !fmt->bigEndian && fmt->redShift == 0 && fmt->greenShift == 8 &&
+                        fmt->blueShift == 16;
+    if (!direct && (size_t) w * 3 > enc->rgbCap) {
+        uint8_t *p = (uint8_t *) realloc(enc->rgb, (size_t) w * 3);
+        if (p == NULL) {
+            return false;
+        }
+        enc->rgb = p;
+        enc->rgbCap = (size_t) w * 3;
+    }
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    if (setjmp(enc->jmp)) {
+        jpeg_abort_compress(cinfo);
+        return false;
+    }
+    cinfo->image_width = w;
+    cinfo->image_height = h;
+    cinfo->input_components = direct ? 4 : 3;
+    cinfo->in_color_space = direct ? JCS_EXT_RGBX : JCS_RGB;
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, g_tightJpegQuality[quality], TRUE);
+    cinfo->comp_info[0].h_samp_factor = g_tightJpegSampling[quality][0];
+    cinfo->comp_info[0].v_samp_factor = g_tightJpegSampling[quality][1];
+    jpeg_start_compress(cinfo, TRUE);
+    const uint8_t *fb = (const uint8_t *) server->frameBuffer;
+    while (cinfo->next_scanline < cinfo->image_height) {
+        const uint8_t *src = fb + (size_t) (y + cinfo->next_scanline) * server->paddedWidthInBytes + (size_t) x * bpp;
+        JSAMPROW row = (JSAMPROW) src;
+        if (!direct) {
+            enccache_expand_row(enc->rgb, src, w, fmt);
+            row = enc->rgb;
+        }
+        jpeg_write_scanlines(cinfo, &row, 1);
+    }
+    jpeg_finish_compress(cinfo);
+    return true;
+}
+
+/**
+ * 写入 Tight 紧凑长度: 每字节低7位, 最高位表示后面还有字节, 第3字节用满8位
+ *
+ * @param out 至少3字节
+ * @param len 不超过 TIGHT_MAX_COMPACT_LEN
+ * @return 写入的字节数
+ */
+int tight_compact_len(char *out, int len) {
+    int n = 0;
+    out[n++] = (char) (len & 0x7F);
+    if (len > 0x7F) {
+        out[n - 1] |= (char) 0x80;
+        out[n++] = (char) ((len >> 7) & 0x7F);
+        if (len > 0x3FFF) {
+            out[n - 1] |= (char) 0x80;
+            out[n++] = (char) ((len >> 14) & 0xFF);
+        }
+    }
+    return n;
+}
+
+/**
+ * 统计矩形的颜色, 同时记下每个像素的调色板下标
+ *
+ * @param palette 帧缓冲格式的颜色, 至少 ENC_PALETTE_MAX_COLORS 个
+ * @param index 每像素一个字节的下标, 只在颜色数不超过上限时完整
+ * @return 颜色数, 超过 ENC_PALETTE_MAX_COLORS 时返回 ENC_PALETTE_MAX_COLORS + 1
+ */
+static int enccache_palette(rfbScreenInfoPtr server, int x, int y, int w, int h, uint32_t *palette,
+                            uint8_t *index) {
+    const int bpp = server->serverFormat.bitsPerPixel / 8;
+    const int stride = server->paddedWidthInBytes;
+    const uint8_t *fb = (const uint8_t *) server->frameBuffer + (size_t) y * stride + (size_t) x * bpp;
+    int colors = 0;
+    uint32_t last = 0;
+    int lastIndex = -1;
+    for (int j = 0; j < h; ++j) {
+        const uint8_t *row = fb + (size_t) j * stride;
+        for (int i = 0; i < w; ++i) {
+            uint32_t v = 0;
+            memcpy(&v, row + i * bpp, bpp);
+            // 相邻像素多为同色, 先与上一个像素比较
+            if (lastIndex < 0 || v != last) {
+                lastIndex = -1;
+                for (int k = 0; k < colors; ++k) {
+                    if (palette[k] == v) {
+                        lastIndex = k;
+                        break;
+                    }
+                }
+                if (lastIndex < 0) {
+                    if (colors == ENC_PALETTE_MAX_COLORS) {
+                        return ENC_PALETTE_MAX_COLORS + 1;
+                    }
+                    palette[colors] = v;
+                    lastIndex = colors++;
+                }
+                last = v;
+            }
+            *index++ = (uint8_t) lastIndex;
+        }
+    }
+    return colors;
+}
+
+/**
+ * 把帧缓冲中的一个像素转换为客户端格式的 Tight 像素(TPIXEL)
+ * 客户端为 32 位深度 24 且各分量 8 位时只发送 R/G/B 三个字节
+ *
+ * @return 字节数
+ */
+static int enccache_tight_pixel(rfbClientPtr cl, const uint8_t *src, uint8_t *out) {
+    const rfbPixelFormat *fmt = &cl->format;
+    uint8_t pixel[4];
+    cl->translateFn(cl->translateLookupTable, &cl->screen->serverFormat, &cl->format, (char *) src, (char *) pixel,
+                    cl->screen->paddedWidthInBytes, 1, 1);
+    if (fmt->bitsPerPixel == 32 && fmt->depth == 24 && fmt->redMax == 0xFF && fmt->greenMax == 0xFF &&
+        fmt->blueMax == 0xFF) {
+        uint32_t v = fmt->bigEndian
+                         ? (uint32_t) pixel[0] << 24 | (uint32_t) pixel[1] << 16 | (uint32_t) pixel[2] << 8 | pixel[3]
+                         : (uint32_t) pixel[3] << 24 | (uint32_t) pixel[2] << 16 | (uint32_t) pixel[1] << 8 | pixel[0];
+        out[0] = (uint8_t) (v >> fmt->redShift);
+        out[1] = (uint8_t) (v >> fmt->greenShift);
+        out[2] = (uint8_t) (v >> fmt->blueShift);
+        return 3;
+    }
+    memcpy(out, pixel, fmt->bitsPerPixel / 8);
+    return fmt->bitsPerPixel / 8;
+}
+
+static bool enccache_reserve(EncodeCacheEntry *e, size_t size) {
+    if (size <= e->capacity) {
+        return true;
+    }
+    char *p = (char *) realloc(e->data, size);
+    if (p == NULL) {
+        return false;
+    }
+    e->data = p;
+    e->capacity = size;
+    return true;
+}
+
+/**
+ * 以调色板编码矩形: 两种颜色时每像素1位, 否则每像素一个字节的下标, 数据在 3 号流中压缩
+ *
+ * @param e 已写入控制字节与调色板, size 为其末尾
+ * @param zl 其中 index 为每像素的调色板下标, 两种颜色时就地改写为位图
+ * @param w 矩形宽度
+ * @param h 矩形高度
+ * @param colors 颜色数, 不少于2
+ * @param level zlib 压缩等级
+ * @return 是否成功
+ */
+static bool enccache_indexed(EncodeCacheEntry *e, EncodeZlib *zl, int w, int h, int colors, int level) {
+    uint8_t *data = zl->index;
+    size_t len = (size_t) w * h;
+    if (colors == 2) {
+        // 就地打包为每行按字节对齐的位图, 高位在前
+        const int rowBytes = (w + 7) / 8;
+        for (int j = 0; j < h; ++j) {
+            const uint8_t *src = zl->index + (size_t) j * w;
+            uint8_t *dst = zl->index + (size_t) j * rowBytes;
+            for (int b = 0; b < rowBytes; ++b) {
+                uint8_t bits = 0;
+                for (int i = b * 8; i < b * 8 + 8; ++i) {
+                    bits = (uint8_t) (bits << 1 | (i < w ? src[i] : 0));
+                }
+                dst[b] = bits;
+            }
+        }
+        len = (size_t) rowBytes * h;
+    }
+    if (len < TIGHT_MIN_TO_COMPRESS) {
+        if (!enccache_reserve(e, e->size + len)) {
+            return false;
+        }
+        memcpy(&e->data[e->size], data, len);
+        e->size += len;
+        return true;
+    }
+    if (!zl->inited) {
+        if (deflateInit2(&zl->zs, level, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        zl->inited = true;
+        zl->level = level;
+    }
+    deflateReset(&zl->zs);
+    if (level != zl->level) {
+        deflateParams(&zl->zs, level, Z_DEFAULT_STRATEGY);
+        zl->level = level;
+    }
+    // 同步刷新多出的几个字节
+    size_t bound = deflateBound(&zl->zs, len) + 16;
+    if (!enccache_reserve(e, e->size + 3 + bound)) {
+        return false;
+    }
+    zl->zs.next_in = data;
+    zl->zs.avail_in = (uInt) len;
+    zl->zs.next_out = (Bytef *) &e->data[e->size + 3];
+    zl->zs.avail_out = (uInt) bound;
+    if (deflate(&zl->zs, Z_SYNC_FLUSH) != Z_OK || zl->zs.avail_in != 0) {
+        return false;
+    }
+    size_t packed = bound - zl->zs.avail_out;
+    // 紧凑长度不足3字节时把数据前移
+    int n = tight_compact_len(&e->data[e->size], (int) packed);
+    memmove(&e->data[e->size + n], &e->data[e->size + 3], packed);
+    e->size += n + packed;
+    return true;
+}
+
+// 在编码结果末尾追加一个 Tight 矩形头
+static bool enccache_rect_header(EncodeCacheEntry *e, int x, int y, int w, int h) {
+    if (!enccache_reserve(e, e->size + sz_rfbFramebufferUpdateRectHeader)) {
+        return false;
+    }
+    rfbFramebufferUpdateRectHeader rect;
+    rect.r.x = Swap16IfLE((uint16_t) x);
+    rect.r.y = Swap16IfLE((uint16_t) y);
+    rect.r.w = Swap16IfLE((uint16_t) w);
+    rect.r.h = Swap16IfLE((uint16_t) h);
+    rect.encoding = Swap32IfLE(rfbEncodingTight);
+    memcpy(&e->data[e->size], &rect, sz_rfbFramebufferUpdateRectHeader);
+    e->size += sz_rfbFramebufferUpdateRectHeader;
+    e->rects++;
+    return true;
+}
+
+// 追加一个纯色填充的子矩形
+static bool enccache_fill(EncodeCacheEntry *e, rfbClientPtr cl, int x, int y, int w, int h, uint32_t color) {
+    if (!enccache_rect_header(e, x, y, w, h) || !enccache_reserve(e, e->size + 1 + 4)) {
+        return false;
+    }
+    e->data[e->size] = (char) (rfbTightFill << 4);
+    e->size += 1 + enccache_tight_pixel(cl, (const uint8_t *) &color, (uint8_t *) &e->data[e->size + 1]);
+    return true;
+}
+
+/**
+ * 追加一个子矩形: 纯色用 Tight 填充, 颜色少的用调色板, 其余用 Tight JPEG
+ * 子矩形不超过 ENC_MAX_RECT_SIZE 个像素
+ *
+ * @return 是否成功
+ */
+static bool enccache_subrect(EncodeCacheEntry *e, rfbClientPtr cl, int x, int y, int w, int h) {
+    EncodeZlib *zl = &g_encodeZlib;
+    if (zl->index == NULL) {
+        zl->index = (uint8_t *) malloc(ENC_MAX_RECT_SIZE);
+        if (zl->index == NULL) {
+            return false;
+        }
+    }
+    uint32_t palette[ENC_PALETTE_MAX_COLORS];
+    int colors = enccache_palette(cl->screen, x, y, w, h, palette, zl->index);
+    if (colors == 1) {
+        return enccache_fill(e, cl, x, y, w, h, palette[0]);
+    }
+    if (!enccache_rect_header(e, x, y, w, h)) {
+        return false;
+    }
+    if (colors <= ENC_PALETTE_MAX_COLORS) {
+        if (!enccache_reserve(e, e->size + 3 + 4 * ENC_PALETTE_MAX_COLORS)) {
+            return false;
+        }
+        char *out = &e->data[e->size];
+        out[0] = (char) ((ENC_ZLIB_STREAM | rfbTightExplicitFilter) << 4 | 1 << ENC_ZLIB_STREAM);
+        out[1] = rfbTightFilterPalette;
+        out[2] = (char) (colors - 1);
+        e->size += 3;
+        for (int i = 0; i < colors; ++i) {
+            e->size += enccache_tight_pixel(cl, (const uint8_t *) &palette[i], (uint8_t *) &e->data[e->size]);
+        }
+        int level = e->compress < 0 ? Z_DEFAULT_COMPRESSION : e->compress > 9 ? 9 : e->compress;
+        return enccache_indexed(e, zl, w, h, colors, level);
+    }
+    EncodeJpeg *enc = enccache_jpeg_get();
+    if (enc == NULL || !enccache_jpeg(enc, cl->screen, x, y, w, h, e->quality)) {
+        return false;
+    }
+    if (enc->outSize > TIGHT_MAX_COMPACT_LEN || !enccache_reserve(e, e->size + 1 + 3 + enc->outSize)) {
+        return false;
+    }
+    e->data[e->size] = (char) (rfbTightJpeg << 4);
+    e->size += 1 + tight_compact_len(&e->data[e->size + 1], (int) enc->outSize);
+    memcpy(&e->data[e->size], enc->out, enc->outSize);
+    e->size += enc->outSize;
+    return true;
+}
+
+// 按 Tight 的子矩形大小上限切块后逐块编码
+static bool enccache_simple(EncodeCacheEntry *e, rfbClientPtr cl, int x, int y, int w, int h) {
+    const int maxWidth = w > ENC_MAX_RECT_WIDTH ? ENC_MAX_RECT_WIDTH : w;
+    const int maxHeight = ENC_MAX_RECT_SIZE / maxWidth;
+    for (int dy = 0; dy < h; dy += maxHeight) {
+        for (int dx = 0; dx < w; dx += maxWidth) {
+            int rw = dx + maxWidth < w ? maxWidth : w - dx;
+            int rh = dy + maxHeight < h ? maxHeight : h - dy;
+            if (!enccache_subrect(e, cl, x + dx, y + dy, rw, rh)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * 判断帧缓冲中的矩形是否为纯色
+ *
+ * @param color needSame 为真时要求等于该颜色, 否则返回矩形的颜色
+ */
+static bool enccache_solid_tile(rfbScreenInfoPtr server, int x, int y, int w, int h, uint32_t *color,
+                                bool needSame) {
+    const int bpp = server->serverFormat.bitsPerPixel / 8;
+    const int stride = server->paddedWidthInBytes;
+    const uint8_t *fb = (const uint8_t *) server->frameBuffer + (size_t) y * stride + (size_t) x * bpp;
+    uint32_t first = 0;
+    memcpy(&first, fb, bpp);
+    if (needSame && first != *color) {
+        return false;
+    }
+    for (int j = 0; j < h; ++j) {
+        const uint8_t *row = fb + (size_t) j * stride;
+        for (int i = 0; i < w; ++i) {
+            uint32_t v = 0;
+            memcpy(&v, row + i * bpp, bpp);
+            if (v != first) {
+                return false;
+            }
+        }
+    }
+    *color = first;
+    return true;
+}
+
+// 从 (x, y) 的纯色小块起, 按小块向右下寻找面积最大的同色矩形
+static void enccache_best_solid(rfbScreenInfoPtr server, int x, int y, int w, int h, uint32_t color, int *bestW,
+                                int *bestH) {
+    int prevW = w;
+    *bestW = 0;
+    *bestH = 0;
+    for (int dy = y; dy < y + h; dy += ENC_SPLIT_TILE_SIZE) {
+        int dh = dy + ENC_SPLIT_TILE_SIZE <= y + h ? ENC_SPLIT_TILE_SIZE : y + h - dy;
+        int dw = prevW > ENC_SPLIT_TILE_SIZE ? ENC_SPLIT_TILE_SIZE : prevW;
+        if (!enccache_solid_tile(server, x, dy, dw, dh, &color, true)) {
+            break;
+        }
+        int dx = x + dw;
+        while (dx < x + prevW) {
+            dw = dx + ENC_SPLIT_TILE_SIZE <= x + prevW ? ENC_SPLIT_TILE_SIZE : x + prevW - dx;
+            if (!enccache_solid_tile(server, dx, dy, dw, dh, &color, true)) {
+                break;
+            }
+            dx += dw;
+        }
+        prevW = dx - x;
+        if (prevW * (dy + dh - y) > *bestW * *bestH) {
+            *bestW = prevW;
+            *bestH = dy + dh - y;
+        }
+    }
+}
+
+// 在 (x, y, w, h) 范围内把同色矩形逐行/逐列向四周扩展到最大
+static void enccache_extend_solid(rfbScreenInfoPtr server, int x, int y, int w, int h, uint32_t color,
+                                  sraRect *solid) {
+    int cy = solid->y1 - 1;
+    while (cy >= y && enccache_solid_tile(server, solid->x1, cy, solid->x2 - solid->x1, 1, &color, true)) {
+        cy--;
+    }
+    solid->y1 = cy + 1;
+    cy = solid->y2;
+    while (cy < y + h && enccache_solid_tile(server, solid->x1, cy, solid->x2 - solid->x1, 1, &color, true)) {
+        cy++;
+    }
+    solid->y2 = cy;
+    int cx = solid->x1 - 1;
+    while (cx >= x && enccache_solid_tile(server, cx, solid->y1, 1, solid->y2 - solid->y1, &color, true)) {
+        cx--;
+    }
+    solid->x1 = cx + 1;
+    cx = solid->x2;
+    while (cx < x + w && enccache_solid_tile(server, cx, solid->y1, 1, solid->y2 - solid->y1, &color, true)) {
+        cx++;
+    }
+    solid->x2 = cx;
+}
+
+/**
+ * 编码一个矩形, 与 libvncserver 的 Tight 编码一样先找出大块纯色区域单独填充,
+ * 其余部分递归处理, 避免 JPEG 在纯色与渐变交界处产生振铃
+ *
+ * @return 是否成功
+ */
+static bool enccache_split(EncodeCacheEntry *e, rfbClientPtr cl, int x, int y, int w, int h) {
+    if (w * h < ENC_MIN_SPLIT_RECT_SIZE) {
+        return enccache_simple(e, cl, x, y, w, h);
+    }
+    rfbScreenInfoPtr server = cl->screen;
+    const int maxRows = ENC_MAX_RECT_SIZE / (w > ENC_MAX_RECT_WIDTH ? ENC_MAX_RECT_WIDTH : w);
+    for (int dy = y; dy < y + h; dy += ENC_SPLIT_TILE_SIZE) {
+        // 矩形过高时先发送上半部分
+        if (dy - y >= maxRows) {
+            if (!enccache_simple(e, cl, x, y, w, maxRows)) {
+                return false;
+            }
+            y += maxRows;
+            h -= maxRows;
+        }
+        int dh = dy + ENC_SPLIT_TILE_SIZE <= y + h ? ENC_SPLIT_TILE_SIZE : y + h - dy;
+        for (int dx = x; dx < x + w; dx += ENC_SPLIT_TILE_SIZE) {
+            int dw = dx + ENC_SPLIT_TILE_SIZE <= x + w ? ENC_SPLIT_TILE_SIZE : x + w - dx;
+            uint32_t color = 0;
+            if (!enccache_solid_tile(server, dx, dy, dw, dh, &color, false)) {
+                continue;
+            }
+            int bestW;
+            int bestH;
+            enccache_best_solid(server, dx, dy, w - (dx - x), h - (dy - y), color, &bestW, &bestH);
+            if (bestW * bestH != w * h && bestW * bestH < ENC_MIN_SOLID_SUBRECT_SIZE) {
+                continue;
+            }
+            sraRect solid = {dx, dy, dx + bestW, dy + bestH};
+            enccache_extend_solid(server, x, y, w, h, color, &solid);
+            // 依次编码纯色区域上方, 左侧, 纯色区域本身, 右侧, 下方
+            if (solid.y1 != y && !enccache_simple(e, cl, x, y, w, solid.y1 - y)) {
+                return false;
+            }
+            if (solid.x1 != x && !enccache_split(e, cl, x, solid.y1, solid.x1 - x, solid.y2 - solid.y1)) {
+                return false;
+            }
+            if (!enccache_fill(e, cl, solid.x1, solid.y1, solid.x2 - solid.x1, solid.y2 - solid.y1, color)) {
+                return false;
+            }
+            if (solid.x2 != x + w &&
+                !enccache_split(e, cl, solid.x2, solid.y1, x + w - solid.x2, solid.y2 - solid.y1)) {
+                return false;
+            }
+            if (solid.y2 != y + h && !enccache_split(e, cl, x, solid.y2, w, y + h - solid.y2)) {
+                return false;
+            }
+            return true;
+        }
+    }
+    return enccache_simple(e, cl, x, y, w, h);
+}
+
+/**
+ * 从帧缓冲编码一个矩形, 结果为若干带矩形头的 Tight 子矩形
+ *
+ * @return 是否成功, 失败时该次更新交给 libvncserver
+ */
+static bool enccache_encode(EncodeCacheEntry *e, rfbClientPtr cl) {
+    e->size = 0;
+    e->rects = 0;
+    return enccache_split(e, cl, e->x, e->y, e->w, e->h);
+}
+
+static bool enccache_same_format(const rfbPixelFormat *a, const rfbPixelFormat *b) {
+    return a->bitsPerPixel == b->bitsPerPixel && a->depth == b->depth && a->bigEndian == b->bigEndian &&
+           a->trueColour == b->trueColour && a->redMax == b->redMax && a->greenMax == b->greenMax &&
+           a->blueMax == b->blueMax && a->redShift == b->redShift && a->greenShift == b->greenShift &&
+           a->blueShift == b->blueShift;
+}
+
+static void enccache_evict(EncodeCache *cache, EncodeCacheEntry *e) {
+    e->valid = false;
+    cache->count--;
+    atomic_fetch_add_explicit(&g_AgentStats.encodeCacheEvictions, 1, memory_order_relaxed);
+}
+
+/**
+ * 取得矩形的编码结果, 没有时编码并放入缓存
+ * 缓存已满时淘汰最久未使用的一项, 本次更新已取得的项(lastUse 为当前时刻)不会被淘汰
+ *
+ * @return 编码结果, 失败返回NULL
+ */
+static EncodeCacheEntry *enccache_get(EncodeCache *cache, rfbClientPtr cl, const sraRect *rect) {
+    const int w = rect->x2 - rect->x1;
+    const int h = rect->y2 - rect->y1;
+    EncodeCacheEntry *slot = NULL;
+    EncodeCacheEntry *oldest = NULL;
+    for (int i = 0; i < ENC_CACHE_MAX_ENTRIES; ++i) {
+        EncodeCacheEntry *e = &cache->entries[i];
+        if (!e->valid) {
+            if (slot == NULL) {
+                slot = e;
+            }
+            continue;
+        }
+        if (e->x == rect->x1 && e->y == rect->y1 && e->w == w && e->h == h && e->quality == cl->tightQualityLevel &&
+            e->compress == cl->tightCompressLevel && enccache_same_format(&e->format, &cl->format)) {
+            e->lastUse = cache->clock;
+            atomic_fetch_add_explicit(&g_AgentStats.encodeCacheHits, 1, memory_order_relaxed);
+            return e;
+        }
+        if (e->lastUse != cache->clock && (oldest == NULL || e->lastUse < oldest->lastUse)) {
+            oldest = e;
+        }
+    }
+    if (slot == NULL) {
+        if (oldest == NULL) {
+            return NULL;
+        }
+        enccache_evict(cache, oldest);
+        slot = oldest;
+    }
+    slot->x = rect->x1;
+    slot->y = rect->y1;
+    slot->w = w;
+    slot->h = h;
+    slot->quality = cl->tightQualityLevel;
+    slot->compress = cl->tightCompressLevel;
+    slot->format = cl->format;
+    slot->version = cache->version;
+    slot->lastUse = cache->clock;
+    atomic_fetch_add_explicit(&g_AgentStats.encodeCacheMisses, 1, memory_order_relaxed);
+    if (!enccache_encode(slot, cl)) {
+        return NULL;
+    }
+    slot->valid = true;
+    cache->count++;
+    return slot;
+}
+
+/**
+ * 帧缓冲换为新的一帧: 版本加1, 淘汰与变化区域相交的矩形
+ * 客户端之后只会收到新版本的内容, 这些矩形的旧编码不会再被任何客户端使用
+ *
+ * @param cache
+ * @param damage 新帧相对上一帧的变化区域
+ * @param copy 新帧中整块平移的目标区域, 可为空矩形
+ */
+void enccache_advance(EncodeCache *cache, const DirtyRects *damage, const DirtyRect *copy) {
+    cache->version++;
+    for (int k = 0; k <= damage->count && cache->count > 0; ++k) {
+        const DirtyRect *r = k < damage->count ? &damage->rects[k] : copy;
+        if (dirty_rect_empty(r)) {
+            continue;
+        }
+        for (int i = 0; i < ENC_CACHE_MAX_ENTRIES; ++i) {
+            EncodeCacheEntry *e = &cache->entries[i];
+            if (e->valid && e->x < r->x2 && r->x1 < e->x + e->w && e->y < r->y2 && r->y1 < e->y + e->h) {
+                enccache_evict(cache, e);
+            }
+        }
+    }
+}
+
+/**
+ * 清空缓存, 帧缓冲重建时调用; 各项的内存保留供之后复用
+ */
+void enccache_reset(EncodeCache *cache) {
+    for (int i = 0; i < ENC_CACHE_MAX_ENTRIES; ++i) {
+        cache->entries[i].valid = false;
+    }
+    cache->count = 0;
+    cache->version++;
+}
+
+void enccache_free(EncodeCache *cache) {
+    for (int i = 0; i < ENC_CACHE_MAX_ENTRIES; ++i) {
+        free(cache->entries[i].data);
+    }
+    free(cache->message);
+    memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * 以缓存的 Tight 编码结果向客户端发送一次帧缓冲更新, 缺少的矩形先编码并放入缓存
+ * 调用者负责确认客户端协商了带质量等级的 Tight, 并在发送后更新客户端的待更新区域
+ * 注意: 仅限vnc服务器线程在 rfbProcessEvents 之外调用
+ *
+ * @param cache
+ * @param cl
+ * @param region 要发送的区域, 在帧缓冲范围内
+ * @return 1已发送, 0未发送(矩形过多或编码失败, 应交给 libvncserver), -1写入失败并已关闭客户端
+ */
+int enccache_send_update(EncodeCache *cache, rfbClientPtr cl, sraRegionPtr region) {
+    unsigned long nRects = sraRgnCountRects(region);
+    if (nRects == 0 || nRects > ENC_CACHE_MAX_RECTS) {
+        return 0;
+    }
+    cache->clock++;
+    EncodeCacheEntry *entries[ENC_CACHE_MAX_RECTS];
+    int n = 0;
+    int subrects = 0;
+    size_t total = sz_rfbFramebufferUpdateMsg;
+    sraRectangleIterator *iter = sraRgnGetIterator(region);
+    sraRect r;
+    while (sraRgnIteratorNext(iter, &r)) {
+        EncodeCacheEntry *e = enccache_get(cache, cl, &r);
+        if (e == NULL) {
+            break;
+        }
+        entries[n++] = e;
+        subrects += e->rects;
+        total += e->size;
+    }
+    sraRgnReleaseIterator(iter);
+    if (n != (int) nRects || subrects > UINT16_MAX) {
+        return 0;
+    }
+    if (total > cache->messageCap) {
+        char *p = (char *) realloc(cache->message, total);
+        if (p == NULL) {
+            return 0;
+        }
+        cache->message = p;
+        cache->messageCap = total;
+    }
+
+    char *out = cache->message;
+    rfbFramebufferUpdateMsg msg = {};
+    msg.type = rfbFramebufferUpdate;
+    msg.nRects = Swap16IfLE((uint16_t) subrects);
+    memcpy(out, &msg, sz_rfbFramebufferUpdateMsg);
+    size_t len = sz_rfbFramebufferUpdateMsg;
+    for (int i = 0; i < n; ++i) {
+        memcpy(out + len, entries[i]->data, entries[i]->size);
+        len += entries[i]->size;
+    }
+    if (rfbWriteExact(cl, out, (int) len) < 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: write to %s failed", __func__, cl->host);
+        rfbCloseClient(cl);
+        return -1;
+    }
+    for (int i = 0; i < n; ++i) {
+        rfbStatRecordEncodingSent(cl, rfbEncodingTight, (int) entries[i]->size,
+                                  entries[i]->w * entries[i]->h * (cl->format.bitsPerPixel / 8));
+    }
+    rfbStatRecordMessageSent(cl, rfbFramebufferUpdate, sz_rfbFramebufferUpdateMsg, sz_rfbFramebufferUpdateMsg);
+    return 1;
+}
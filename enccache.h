@@ -0,0 +1,64 @@
+#ifndef UITEST_AGENT_VNC_ENCCACHE_H
+#define UITEST_AGENT_VNC_ENCCACHE_H
+
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dirty.h"
+
+// Tight 压缩数据长度最多用3字节表示
+#define TIGHT_MAX_COMPACT_LEN 0x3FFFFF
+// 缓存的矩形个数上限, 超出时淘汰最久未使用的
+#define ENC_CACHE_MAX_ENTRIES 256
+// 一次更新最多的矩形数, 更碎的区域交给 libvncserver
+#define ENC_CACHE_MAX_RECTS 128
+
+/**
+ * 一个矩形的 Tight 编码结果: 切分后的若干子矩形, 各自带矩形头
+ * 以矩形/质量等级/压缩等级/客户端像素格式为键, 自编码时的帧版本起一直有效, 直到之后的帧改变了矩形内的像素
+ */
+typedef struct {
+    bool valid;
+    int x;
+    int y;
+    int w;
+    int h;
+    int quality;
+    int compress;
+    rfbPixelFormat format;
+    // 编码时的帧版本, 最近一次使用的时刻(淘汰用)
+    uint64_t version;
+    uint64_t lastUse;
+    char *data;
+    size_t size;
+    // data 中的子矩形个数
+    int rects;
+    size_t capacity;
+} EncodeCacheEntry;
+
+/**
+ * 同一帧缓冲的多个客户端共享的编码缓存, 只由vnc服务器线程访问
+ * 只使用与客户端状态无关的 Tight 子编码: 纯色填充, 每个矩形重置压缩流的调色板, JPEG;
+ * 其他 zlib 类编码的压缩流属于各客户端, 编码结果无法共享
+ */
+typedef struct {
+    EncodeCacheEntry entries[ENC_CACHE_MAX_ENTRIES];
+    int count;
+    // 帧缓冲每换一帧加1
+    uint64_t version;
+    uint64_t clock;
+    // 组装一次更新消息的缓冲区
+    char *message;
+    size_t messageCap;
+} EncodeCache;
+
+int tight_compact_len(char *out, int len);
+void enccache_advance(EncodeCache *cache, const DirtyRects *damage, const DirtyRect *copy);
+void enccache_reset(EncodeCache *cache);
+void enccache_free(EncodeCache *cache);
+int enccache_send_update(EncodeCache *cache, rfbClientPtr cl, sraRegionPtr region);
+
+#endif //UITEST_AGENT_VNC_ENCCACHE_H
@@ -0,0 +1,290 @@
+// 采集热路径内存分配校验: 各采集模式稳定运行后统计agent的堆分配次数/大块分配/缺页/RSS
+// 用法: bench_alloc [-seconds S] [-warmup S] [-scene clock] [-port P] [agent参数...]
+//   替换 malloc 系列函数计数, 替身(模拟系统截屏/编码)与客户端线程的分配不计入
+//   下列 libvncserver 调用内部的分配单独计数(链接时以 --wrap 包装): 其客户端区域(sraRegion)与
+//   迭代器都由 malloc 维护, 无法由agent复用; 其中回调到agent的函数(客户端消息处理)也算在内
+//     rfbCheckFds / rfbProcessEvents: 处理客户端消息, 编码并发送更新
+//     rfbMarkRectAsModified: 把帧的变化矩形并入各客户端的待更新区域
+//   稳定阶段agent有任何其他分配, 或帧缓冲池有新映射时返回1
+//   每种模式在独立子进程中运行, 连接一个 raw 编码的客户端持续请求画面
+#include "../agent.h"
+#include "../bufpool.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// 帧级别的大块分配, 常见分配器超过该大小即改用 mmap
+#define BENCH_LARGE_ALLOC (64 * 1024)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *p);
+
+static atomic_bool g_benchCounting;
+static atomic_ullong g_benchAllocs;
+static atomic_ullong g_benchLibAllocs;
+// 当前线程正在执行的允许分配的 libvncserver 调用层数
+static __thread int g_benchLibDepth;
+static atomic_ullong g_benchLargeAllocs;
+static atomic_ullong g_benchLargeBytes;
+
+static void bench_count(size_t size) {
+    if (!atomic_load_explicit(&g_benchCounting, memory_order_relaxed) || g_hostStubDepth > 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(g_benchLibDepth > 0 ? &g_benchLibAllocs : &g_benchAllocs, 1, memory_order_relaxed);
+    if (size >= BENCH_LARGE_ALLOC) {
+        atomic_fetch_add_explicit(&g_benchLargeAllocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_benchLargeBytes, size, memory_order_relaxed);
+    }
+}
+
+void *malloc(size_t size) {
+    bench_count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    bench_count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    bench_count(size);
+    return __libc_realloc(p, size);
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    bench_count(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    void *p = memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+
+extern int __real_rfbCheckFds(rfbScreenInfoPtr screen, long usec);
+extern rfbBool __real_rfbProcessEvents(rfbScreenInfoPtr screen, long usec);
+extern void __real_rfbMarkRectAsModified(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2);
+
+int __wrap_rfbCheckFds(rfbScreenInfoPtr screen, long usec) {
+    g_benchLibDepth++;
+    int ret = __real_rfbCheckFds(screen, usec);
+    g_benchLibDepth--;
+    return ret;
+}
+
+rfbBool __wrap_rfbProcessEvents(rfbScreenInfoPtr screen, long usec) {
+    g_benchLibDepth++;
+    rfbBool ret = __real_rfbProcessEvents(screen, usec);
+    g_benchLibDepth--;
+    return ret;
+}
+
+void __wrap_rfbMarkRectAsModified(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2) {
+    g_benchLibDepth++;
+    __real_rfbMarkRectAsModified(screen, x1, y1, x2, y2);
+    g_benchLibDepth--;
+}
+
+typedef struct {
+    const char *mode;
+    bool zeroCopy;
+    const char *scene;
+    int port;
+    int seconds;
+    int warmup;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    double fps;
+    double allocsPerFrame;
+    double libAllocsPerFrame;
+    unsigned long long largeAllocs;
+    unsigned long long largeBytes;
+    unsigned long long poolMaps;
+    double faultsPerFrame;
+    unsigned long long startFaults;
+    double rssMb;
+    int ok;
+} BenchResult;
+
+typedef struct {
+    int port;
+    volatile int stop;
+    volatile int connected;
+} BenchClient;
+
+static void *bench_client_main(void *arg) {
+    // 客户端代表远端, 其分配不计入
+    g_hostStubDepth = 1;
+    BenchClient *client = (BenchClient *) arg;
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = client->port;
+    cl->appData.encodingsString = "raw";
+    int argc = 0;
+    if (!rfbInitClient(cl, &argc, NULL)) {
+        fprintf(stderr, "bench_alloc: client connect failed\n");
+        return NULL;
+    }
+    client->connected = 1;
+    while (!client->stop) {
+        int n = WaitForMessage(cl, 10000);
+        if (n < 0 || (n > 0 && !HandleRFBServerMessage(cl))) {
+            break;
+        }
+    }
+    rfbClientCleanup(cl);
+    return NULL;
+}
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+static unsigned long long bench_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (unsigned long long) usage.ru_minflt + usage.ru_majflt;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    setenv("AGENT_HOST_SCENE", job->scene, 1);
+
+    char portArg[16];
+    snprintf(portArg, sizeof(portArg), "%d", job->port);
+    char *argv[80] = {"bench_alloc", "-cap_mode", (char *) job->mode, "-cap_fps", "30", "-rfbport", portArg};
+    int argc = 7;
+    if (job->zeroCopy) {
+        argv[argc++] = "-zero_copy";
+    }
+    for (int i = 0; i < job->agentArgc && argc < 78; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    unsigned long long faults = bench_faults();
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(300 * 1000);
+    BenchClient client = {.port = job->port};
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_client_main, &client);
+
+    // 预热阶段各缓冲区增长到稳定大小
+    sleep(job->warmup);
+    if (!client.connected) {
+        return;
+    }
+    out->startFaults = bench_faults() - faults;
+    AgentStats *s = &g_AgentStats;
+    unsigned long long frames = atomic_load(&s->framesPublished);
+    unsigned long long maps = atomic_load(&s->poolMaps);
+    faults = bench_faults();
+    double wall = bench_now(CLOCK_MONOTONIC);
+    atomic_store(&g_benchCounting, true);
+    sleep(job->seconds);
+    atomic_store(&g_benchCounting, false);
+    wall = bench_now(CLOCK_MONOTONIC) - wall;
+    frames = atomic_load(&s->framesPublished) - frames;
+    faults = bench_faults() - faults;
+
+    out->fps = (double) frames * 1000.0 / wall;
+    out->allocsPerFrame = frames ? (double) atomic_load(&g_benchAllocs) / frames : 0;
+    out->libAllocsPerFrame = frames ? (double) atomic_load(&g_benchLibAllocs) / frames : 0;
+    out->largeAllocs = atomic_load(&g_benchLargeAllocs);
+    out->largeBytes = atomic_load(&g_benchLargeBytes);
+    out->poolMaps = atomic_load(&s->poolMaps) - maps;
+    out->faultsPerFrame = frames ? (double) faults / frames : 0;
+    out->rssMb = (double) stats_rss_kb() / 1024.0;
+    out->ok = frames > 0;
+    // 子进程随后直接退出, 不等待agent停止
+    client.stop = 1;
+    pthread_join(thread, NULL);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 3, warmup = 2, port = 5968;
+    const char *scene = "clock";
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc) {
+            scene = argv[++i];
+        } else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 64) {
+            // 其余参数交给agent, 后出现的同名参数覆盖默认值
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    if (seconds <= 0 || warmup < 0) {
+        return 1;
+    }
+
+    static const struct {
+        const char *mode;
+        bool zeroCopy;
+        const char *name;
+    } modes[] = {
+        {CAP_MODE_DEFAULT, false, "jpeg"},
+        {CAP_MODE_PNG, false, "png"},
+        {CAP_MODE_DMPUB, false, "dmpub"},
+        {CAP_MODE_DMPUB, true, "zero_copy"},
+    };
+    int failed = 0;
+    printf("scene %s, %d s per run after %d s warmup, large alloc >= %d KiB\n", scene, seconds, warmup,
+           BENCH_LARGE_ALLOC / 1024);
+    printf("%-10s %8s %12s %12s %8s %10s %8s %12s %12s %8s\n", "mode", "fps", "allocs/frm", "vnc al/frm", "large",
+           "large KiB", "pool map", "faults/frm", "start flt", "rss MB");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        BenchJob job = {modes[m].mode, modes[m].zeroCopy, scene, port++, seconds, warmup, agentArgc, agentArgv};
+        BenchResult res;
+        if (bench_fork(bench_run, &job, &res, sizeof(res)) != 0 || !res.ok) {
+            fprintf(stderr, "bench_alloc: run failed (%s)\n", modes[m].name);
+            return 1;
+        }
+        printf("%-10s %8.1f %12.2f %12.1f %8llu %10llu %8llu %12.1f %12llu %8.1f\n", modes[m].name, res.fps,
+               res.allocsPerFrame, res.libAllocsPerFrame, res.largeAllocs, res.largeBytes / 1024, res.poolMaps, res.faultsPerFrame,
+               res.startFaults, res.rssMb);
+        failed |= res.allocsPerFrame != 0 || res.largeAllocs != 0 || res.poolMaps != 0;
+    }
+    printf("%s\n", failed ? "FAIL: allocations in steady state" : "no agent allocations in steady state");
+    return failed;
+}
@@ -0,0 +1,510 @@
+// 多客户端负载基准: 同时打开 N 个 RFB 会话, 统计每个客户端的更新频率/等待时间与vnc服务器循环线程的CPU占用
+// 用法: bench_clients [-clients 1,2,4,8] [-seconds S] [-encodings raw,tight,zrle] [-quality Q] [-compress C]
+//                     [-rate_kbps K] [-request_ms M] [-full_ms M] [-client_bpp 32|16|8] [-connect HOST:PORT]
+//                     [-port P] [-verbose] [agent参数...]
+//   -clients 为逗号分隔的客户端数, 每个数量在独立子进程中运行一轮, 便于找到事件循环跟不上的客户端数
+//   -encodings 按客户端轮流分配; -quality 为 Tight 的 JPEG 质量(0-9), 默认不使用 JPEG
+//   -rate_kbps: 每个客户端经本地转发限速(服务器到客户端方向), 0 为不限速
+//   -request_ms: 客户端每处理完一次更新后停顿 M 毫秒(模拟显示较慢的查看端)
+//   -full_ms: 每隔 M 毫秒额外请求一次非增量全屏更新
+//   -client_bpp: 客户端请求的像素格式, 16 为 RGB565, 8 为 BGR233; 与agent的 -fb_bpp 相同时服务器无需转换
+//   默认在进程内运行agent(-cap_mode dmpub -cap_fps 30, 画面来自 AGENT_HOST_SCENE/AGENT_HOST_REPLAY, 默认 clock);
+//   -connect 改为连接已运行的agent(如经 hdc fport 转发的设备), 此时不统计服务器CPU与编码缓存命中率
+//   更新等待: 客户端准备好接收下一帧(上一帧处理完并停顿之后)到下一次更新接收完成的时间
+#include "../agent.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define BENCH_RUN_MAX 16
+#define BENCH_CLIENT_MAX 64
+#define BENCH_SAMPLE_MAX 8192
+
+typedef struct {
+    const char *encodings;
+    int quality;
+    int compress;
+    int rateKbps;
+    int requestMs;
+    int fullMs;
+    int clientBpp;
+    int seconds;
+    const char *host;
+    int port;
+    bool external;
+    int clients;
+    int agentArgc;
+    char **agentArgv;
+} BenchConfig;
+
+// 本地转发: 客户端连到 listenFd, 转发到服务器, 服务器到客户端方向按令牌桶限速
+typedef struct {
+    int listenFd;
+    int port;
+    const char *host;
+    int upstreamPort;
+    int rateKbps;
+    volatile int *stop;
+    atomic_ullong bytes;
+    pthread_t thread;
+} BenchRelay;
+
+typedef struct {
+    int index;
+    char encoding[16];
+    const BenchConfig *config;
+    BenchRelay relay;
+    volatile int stop;
+    int ok;
+    atomic_ullong updates;
+    // 以下只由客户端线程访问
+    double readyMs;
+    double fullSentMs;
+    double waitSumMs;
+    double fullSumMs;
+    int fullCount;
+    int sampleCount;
+    float samples[BENCH_SAMPLE_MAX];
+    pthread_t thread;
+} BenchClient;
+
+typedef struct {
+    char encoding[16];
+    double ups;
+    double waitAvgMs;
+    double kbps;
+} BenchClientResult;
+
+typedef struct {
+    int ok;
+    int clients;
+    double seconds;
+    double upsTotal;
+    double upsMin;
+    double upsMax;
+    double waitAvgMs;
+    double waitP99Ms;
+    double fullAvgMs;
+    double mbps;
+    double loopCpuPct;
+    double procCpuPct;
+    // 编码缓存命中的矩形占比, 没有经过缓存时为-1
+    double cacheHitPct;
+    BenchClientResult perClient[BENCH_CLIENT_MAX];
+} BenchResult;
+
+static int bench_connect_upstream(const char *host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static bool bench_forward(int from, int to, size_t max, atomic_ullong *bytes) {
+    char buffer[16384];
+    ssize_t n = read(from, buffer, max < sizeof(buffer) ? max : sizeof(buffer));
+    if (n <= 0) {
+        return false;
+    }
+    for (ssize_t off = 0; off < n;) {
+        ssize_t w = write(to, buffer + off, n - off);
+        if (w <= 0) {
+            return false;
+        }
+        off += w;
+    }
+    if (bytes != NULL) {
+        atomic_fetch_add(bytes, (unsigned long long) n);
+    }
+    return true;
+}
+
+static void *bench_relay_main(void *arg) {
+    BenchRelay *relay = (BenchRelay *) arg;
+    int down = accept(relay->listenFd, NULL, NULL);
+    int up = down >= 0 ? bench_connect_upstream(relay->host, relay->upstreamPort) : -1;
+    // 令牌桶: 每毫秒补充 rate/8 字节, 最多攒 50 毫秒
+    const double bytesPerMs = relay->rateKbps * 1000.0 / 8 / 1000;
+    const double burst = bytesPerMs * 50 > 16384 ? bytesPerMs * 50 : 16384;
+    double tokens = burst;
+    double last = bench_now(CLOCK_MONOTONIC);
+    while (up >= 0 && !*relay->stop) {
+        bool limited = relay->rateKbps > 0;
+        if (limited) {
+            double now = bench_now(CLOCK_MONOTONIC);
+            tokens += (now - last) * bytesPerMs;
+            tokens = tokens > burst ? burst : tokens;
+            last = now;
+        }
+        bool canRead = !limited || tokens >= 1024;
+        struct pollfd fds[2] = {{down, POLLIN, 0}, {up, canRead ? POLLIN : 0, 0}};
+        if (poll(fds, 2, canRead ? 100 : 1) < 0) {
+            break;
+        }
+        if ((fds[0].revents & (POLLIN | POLLHUP)) && !bench_forward(down, up, SIZE_MAX, NULL)) {
+            break;
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            unsigned long long before = atomic_load(&relay->bytes);
+            if (!bench_forward(up, down, limited ? (size_t) tokens : SIZE_MAX, &relay->bytes)) {
+                break;
+            }
+            tokens -= (double) (atomic_load(&relay->bytes) - before);
+        }
+    }
+    if (up >= 0) {
+        close(up);
+    }
+    if (down >= 0) {
+        close(down);
+    }
+    return NULL;
+}
+
+static int bench_relay_start(BenchRelay *relay) {
+    relay->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    if (relay->listenFd < 0 || bind(relay->listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(relay->listenFd, 1) != 0 || getsockname(relay->listenFd, (struct sockaddr *) &addr, &len) != 0) {
+        return -1;
+    }
+    relay->port = ntohs(addr.sin_port);
+    return pthread_create(&relay->thread, NULL, bench_relay_main, relay);
+}
+
+static void bench_update_done(rfbClient *cl) {
+    BenchClient *client = (BenchClient *) rfbClientGetClientData(cl, bench_update_done);
+    double now = bench_now(CLOCK_MONOTONIC);
+    double wait = now - client->readyMs;
+    atomic_fetch_add(&client->updates, 1);
+    client->waitSumMs += wait;
+    if (client->sampleCount < BENCH_SAMPLE_MAX) {
+        client->samples[client->sampleCount++] = (float) wait;
+    }
+    if (client->fullSentMs > 0) {
+        client->fullSumMs += now - client->fullSentMs;
+        client->fullCount++;
+        client->fullSentMs = 0;
+    }
+}
+
+// 按 -client_bpp 设置客户端请求的像素格式, 与agent的16/8位帧缓冲格式相同
+static void bench_client_format(rfbClient *cl, int bpp) {
+    rfbPixelFormat *format = &cl->format;
+    if (bpp == 16) {
+        format->bitsPerPixel = 16;
+        format->depth = 16;
+        format->redMax = 31;
+        format->greenMax = 63;
+        format->blueMax = 31;
+        format->redShift = 11;
+        format->greenShift = 5;
+        format->blueShift = 0;
+    } else if (bpp == 8) {
+        format->bitsPerPixel = 8;
+        format->depth = 8;
+        format->redMax = 7;
+        format->greenMax = 7;
+        format->blueMax = 3;
+        format->redShift = 0;
+        format->greenShift = 3;
+        format->blueShift = 6;
+    }
+}
+
+static void *bench_client_main(void *arg) {
+    BenchClient *client = (BenchClient *) arg;
+    const BenchConfig *config = client->config;
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    bench_client_format(cl, config->clientBpp);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = client->relay.port;
+    cl->appData.encodingsString = client->encoding;
+    cl->appData.compressLevel = config->compress;
+    cl->appData.enableJPEG = config->quality >= 0;
+    cl->appData.qualityLevel = config->quality >= 0 ? config->quality : 5;
+    cl->appData.useRemoteCursor = TRUE;
+    cl->FinishedFrameBufferUpdate = bench_update_done;
+    rfbClientSetClientData(cl, bench_update_done, client);
+    int argc = 0;
+    if (!rfbInitClient(cl, &argc, NULL)) {
+        fprintf(stderr, "bench_clients: client %d connect failed\n", client->index);
+        return NULL;
+    }
+    client->ok = 1;
+    client->readyMs = bench_now(CLOCK_MONOTONIC);
+    double lastFull = client->readyMs;
+    while (!client->stop) {
+        unsigned long long updates = atomic_load(&client->updates);
+        int n = WaitForMessage(cl, 10000);
+        if (n < 0 || (n > 0 && !HandleRFBServerMessage(cl))) {
+            client->ok = 0;
+            break;
+        }
+        if (atomic_load(&client->updates) != updates) {
+            if (config->requestMs > 0) {
+                usleep(config->requestMs * 1000);
+            }
+            client->readyMs = bench_now(CLOCK_MONOTONIC);
+        }
+        if (config->fullMs > 0 && client->readyMs - lastFull >= config->fullMs && client->fullSentMs == 0) {
+            lastFull = bench_now(CLOCK_MONOTONIC);
+            client->fullSentMs = lastFull;
+            SendFramebufferUpdateRequest(cl, 0, 0, cl->width, cl->height, FALSE);
+        }
+    }
+    rfbClientCleanup(cl);
+    return NULL;
+}
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+static int bench_float_cmp(const void *a, const void *b) {
+    float x = *(const float *) a, y = *(const float *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double bench_thread_cpu(clockid_t clock, bool valid) {
+    return valid ? bench_now(clock) : 0;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchConfig *config = (const BenchConfig *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    out->clients = config->clients;
+    clockid_t loopClock = CLOCK_PROCESS_CPUTIME_ID;
+    bool haveLoop = false;
+    if (!config->external) {
+        setenv("AGENT_HOST_SCENE", getenv("AGENT_HOST_SCENE") ? getenv("AGENT_HOST_SCENE") : "clock", 1);
+        char portArg[16];
+        snprintf(portArg, sizeof(portArg), "%d", config->port);
+        char *argv[80] = {"bench_clients", "-cap_mode", CAP_MODE_DMPUB, "-cap_fps", "30", "-rfbport", portArg};
+        int argc = 7;
+        for (int i = 0; i < config->agentArgc && argc < 80; ++i) {
+            argv[argc++] = config->agentArgv[i];
+        }
+        if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+            return;
+        }
+        pthread_t agent;
+        pthread_create(&agent, NULL, bench_agent_main, NULL);
+        // agent 线程即vnc服务器的事件循环线程
+        haveLoop = pthread_getcpuclockid(agent, &loopClock) == 0;
+        usleep(300 * 1000);
+    }
+
+    BenchClient *clients = calloc(config->clients, sizeof(BenchClient));
+    volatile int relayStop = 0;
+    for (int i = 0; i < config->clients; ++i) {
+        BenchClient *client = &clients[i];
+        client->index = i;
+        client->config = config;
+        // 按客户端轮流分配编码
+        const char *p = config->encodings;
+        for (int k = 0; k < i; ++k) {
+            const char *comma = strchr(p, ',');
+            p = comma ? comma + 1 : config->encodings;
+        }
+        size_t len = strcspn(p, ",");
+        snprintf(client->encoding, sizeof(client->encoding), "%.*s", (int) len, p);
+        client->relay.host = config->host;
+        client->relay.upstreamPort = config->port;
+        client->relay.rateKbps = config->rateKbps;
+        client->relay.stop = &relayStop;
+        if (bench_relay_start(&client->relay) != 0) {
+            fprintf(stderr, "bench_clients: relay failed\n");
+            return;
+        }
+        pthread_create(&client->thread, NULL, bench_client_main, client);
+    }
+    // 等待所有客户端完成握手并收到第一帧
+    usleep(500 * 1000);
+    unsigned long long updates[BENCH_CLIENT_MAX], bytes[BENCH_CLIENT_MAX];
+    for (int i = 0; i < config->clients; ++i) {
+        updates[i] = atomic_load(&clients[i].updates);
+        bytes[i] = atomic_load(&clients[i].relay.bytes);
+        clients[i].waitSumMs = 0;
+        clients[i].sampleCount = 0;
+        clients[i].fullSumMs = 0;
+        clients[i].fullCount = 0;
+    }
+    double wall = bench_now(CLOCK_MONOTONIC);
+    double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    double loopCpu = bench_thread_cpu(loopClock, haveLoop);
+    unsigned long long hits = atomic_load(&g_AgentStats.encodeCacheHits);
+    unsigned long long misses = atomic_load(&g_AgentStats.encodeCacheMisses);
+    sleep(config->seconds);
+    wall = bench_now(CLOCK_MONOTONIC) - wall;
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    loopCpu = bench_thread_cpu(loopClock, haveLoop) - loopCpu;
+    hits = atomic_load(&g_AgentStats.encodeCacheHits) - hits;
+    misses = atomic_load(&g_AgentStats.encodeCacheMisses) - misses;
+    // 计数在窗口结束时取值, 客户端退出前可能还在接收一次较大的更新
+    for (int i = 0; i < config->clients; ++i) {
+        clients[i].stop = 1;
+        updates[i] = atomic_load(&clients[i].updates) - updates[i];
+        bytes[i] = atomic_load(&clients[i].relay.bytes) - bytes[i];
+    }
+    for (int i = 0; i < config->clients; ++i) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    relayStop = 1;
+
+    float *samples = malloc(sizeof(float) * BENCH_SAMPLE_MAX * config->clients);
+    int sampleCount = 0, fullCount = 0, ok = 1;
+    double waitSum = 0, fullSum = 0, bytesTotal = 0;
+    unsigned long long updatesTotal = 0;
+    out->upsMin = -1;
+    for (int i = 0; i < config->clients; ++i) {
+        BenchClient *client = &clients[i];
+        ok &= client->ok;
+        unsigned long long n = updates[i];
+        double b = (double) bytes[i];
+        double ups = n * 1000.0 / wall;
+        out->upsMin = out->upsMin < 0 || ups < out->upsMin ? ups : out->upsMin;
+        out->upsMax = ups > out->upsMax ? ups : out->upsMax;
+        updatesTotal += n;
+        bytesTotal += b;
+        waitSum += client->waitSumMs;
+        fullSum += client->fullSumMs;
+        fullCount += client->fullCount;
+        memcpy(samples + sampleCount, client->samples, sizeof(float) * client->sampleCount);
+        sampleCount += client->sampleCount;
+        if (i < BENCH_CLIENT_MAX) {
+            BenchClientResult *r = &out->perClient[i];
+            snprintf(r->encoding, sizeof(r->encoding), "%s", client->encoding);
+            r->ups = ups;
+            r->waitAvgMs = n ? client->waitSumMs / n : 0;
+            r->kbps = b * 8 / wall;
+        }
+    }
+    qsort(samples, sampleCount, sizeof(float), bench_float_cmp);
+    out->seconds = wall / 1000;
+    out->upsTotal = updatesTotal * 1000.0 / wall;
+    out->waitAvgMs = updatesTotal ? waitSum / updatesTotal : 0;
+    out->waitP99Ms = sampleCount ? samples[(sampleCount - 1) * 99 / 100] : 0;
+    out->fullAvgMs = fullCount ? fullSum / fullCount : 0;
+    out->mbps = bytesTotal * 8 / 1e6 / (wall / 1000);
+    out->loopCpuPct = haveLoop ? 100.0 * loopCpu / wall : -1;
+    out->procCpuPct = config->external ? -1 : 100.0 * cpu / wall;
+    out->cacheHitPct = hits + misses ? 100.0 * (double) hits / (double) (hits + misses) : -1;
+    out->ok = ok;
+    // 子进程随后直接退出, 不等待agent停止
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config = {.encodings = "raw", .quality = -1, .compress = 1, .clientBpp = 32, .seconds = 5,
+                          .host = "127.0.0.1", .port = 5949};
+    const char *counts = "1,2,4,8";
+    bool verbose = false;
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc) {
+            counts = argv[++i];
+        } else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            config.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-encodings") == 0 && i + 1 < argc) {
+            config.encodings = argv[++i];
+        } else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc) {
+            config.quality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-compress") == 0 && i + 1 < argc) {
+            config.compress = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-rate_kbps") == 0 && i + 1 < argc) {
+            config.rateKbps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-request_ms") == 0 && i + 1 < argc) {
+            config.requestMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-full_ms") == 0 && i + 1 < argc) {
+            config.fullMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-client_bpp") == 0 && i + 1 < argc) {
+            config.clientBpp = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-connect") == 0 && i + 1 < argc) {
+            static char host[64];
+            if (sscanf(argv[++i], "%63[^:]:%d", host, &config.port) != 2) {
+                return 1;
+            }
+            config.host = host;
+            config.external = true;
+        } else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            config.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-verbose") == 0) {
+            verbose = true;
+        } else if (agentArgc < 64) {
+            // 其余参数交给agent, 后出现的同名参数覆盖默认值
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    config.agentArgc = agentArgc;
+    config.agentArgv = agentArgv;
+    if (config.seconds <= 0) {
+        return 1;
+    }
+
+    printf("%d s per run, encodings %s, quality %d, client %d bpp, rate %d kbps/client, pause %d ms, "
+           "full every %d ms\n", config.seconds, config.encodings, config.quality, config.clientBpp, config.rateKbps,
+           config.requestMs, config.fullMs);
+    printf("%-8s %9s %9s %9s %10s %10s %9s %9s %9s %9s %9s\n", "clients", "upd/s", "min/cli", "max/cli", "wait ms",
+           "p99 ms", "full ms", "Mbit/s", "loop cpu", "proc cpu", "cache hit");
+    int status = 0;
+    const char *p = counts;
+    for (int run = 0; run < BENCH_RUN_MAX && *p; ++run) {
+        config.clients = atoi(p);
+        p += strcspn(p, ",");
+        p += *p == ',';
+        if (config.clients <= 0 || config.clients > BENCH_CLIENT_MAX) {
+            continue;
+        }
+        BenchResult res;
+        if (bench_fork(bench_run, &config, &res, sizeof(res)) != 0) {
+            fprintf(stderr, "bench_clients: run failed (%d clients)\n", config.clients);
+            return 1;
+        }
+        printf("%-8d %9.1f %9.1f %9.1f %10.2f %10.2f %9.2f %9.2f", res.clients, res.upsTotal, res.upsMin,
+               res.upsMax, res.waitAvgMs, res.waitP99Ms, res.fullAvgMs, res.mbps);
+        if (res.loopCpuPct >= 0) {
+            printf(" %8.1f%% %8.1f%%", res.loopCpuPct, res.procCpuPct);
+        } else {
+            printf(" %9s %9s", "n/a", "n/a");
+        }
+        if (res.cacheHitPct >= 0) {
+            printf(" %8.1f%%\n", res.cacheHitPct);
+        } else {
+            printf(" %9s\n", "n/a");
+        }
+        if (!res.ok) {
+            printf("  some clients disconnected\n");
+            status = 1;
+        }
+        if (verbose) {
+            for (int i = 0; i < res.clients; ++i) {
+                const BenchClientResult *r = &res.perClient[i];
+                printf("  #%-3d %-8s %9.1f upd/s %9.2f ms %11.0f kbit/s\n", i, r->encoding, r->ups, r->waitAvgMs,
+                       r->kbps);
+            }
+        }
+        if (!config.external) {
+            config.port++;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,100 @@
+// 缓冲区补齐校验: DMPUB 模式下随机修改源画面的若干矩形, 随机决定vnc服务器是否取帧,
+// 逐帧校验发布的缓冲区(以及服务器刚取走的帧)与源画面逐字节一致, 并统计补齐复制的字节数
+// 用法: bench_damage [-frames N] [-seed S] [-rects N] [agent参数...]
+//   屏幕尺寸来自 AGENT_HOST_SCREEN, 可追加 -dirty_bbox / -workers N 等参数覆盖更多路径
+//   -fb_bpp 16|8 时与转换为帧缓冲格式的源画面比较
+#include "../agent.h"
+#include "../pixfmt.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void bench_mutate(uint8_t *frame, int w, int h, int rects) {
+    int n = 1 + rand() % rects;
+    for (int i = 0; i < n; ++i) {
+        // 大多是小矩形, 偶尔出现大块变化
+        int maxW = rand() % 8 == 0 ? w : w / 8;
+        int maxH = rand() % 8 == 0 ? h : h / 16;
+        int rw = 1 + rand() % maxW, rh = 1 + rand() % maxH;
+        int x = rand() % (w - rw + 1), y = rand() % (h - rh + 1);
+        uint32_t px = (uint32_t) rand() | 0xFF000000u;
+        for (int yy = y; yy < y + rh; ++yy) {
+            uint32_t *row = (uint32_t *) &frame[((size_t) yy * w + x) * 4];
+            for (int xx = 0; xx < rw; ++xx) {
+                row[xx] = px;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int frames = 500, rects = 4;
+    unsigned seed = 1;
+    char *agentArgv[64] = {"bench_damage", "-rfbport", "0", "-cap_mode", CAP_MODE_DMPUB};
+    int agentArgc = 5;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-rects") == 0 && i + 1 < argc) {
+            rects = atoi(argv[++i]);
+        } else if (agentArgc < 63) {
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    if (frames <= 0 || rects <= 0) {
+        return 1;
+    }
+    if (UiTestExtension_OnInit(host_uitest_port(), agentArgc, agentArgv) != RETCODE_SUCCESS) {
+        fprintf(stderr, "bench_damage: init failed\n");
+        return 1;
+    }
+    srand(seed);
+    const int w = g_BufferManager->server->width;
+    const int h = g_BufferManager->server->height;
+    const int bpp = g_BufferManager->server->bitsPerPixel / 8;
+    const size_t size = (size_t) w * h * 4;
+    const size_t fbSize = (size_t) w * h * bpp;
+    uint8_t *frame = calloc(1, size);
+    uint8_t *expected = bpp == 4 ? frame : calloc(1, fbSize);
+
+    long bad = 0, checkedFront = 0;
+    double ms = 0;
+    for (int i = 0; i < frames && bad == 0; ++i) {
+        // 偶尔送入不变的帧, 覆盖无变化直接返回的路径
+        if (rand() % 10 != 0) {
+            bench_mutate(frame, w, h, rects);
+        }
+        double t = bench_now(CLOCK_MONOTONIC);
+        screenCallback((char *) frame, (int) size);
+        ms += bench_now(CLOCK_MONOTONIC) - t;
+        if (bpp != 4) {
+            pixfmt_convert_rows(expected, w * bpp, frame, w * 4, w, 0, h, bpp);
+        }
+        if (memcmp(g_BufferManager->buffers[g_BufferManager->published], expected, fbSize) != 0) {
+            fprintf(stderr, "bench_damage: published frame %d differs from source\n", i);
+            bad++;
+        }
+        // 模拟vnc服务器取帧节奏不定, 让三个缓冲区以不同的落后帧数轮转
+        if (rand() % 3 == 0) {
+            acquire_front_vnc_buf(g_BufferManager);
+            checkedFront++;
+            if (memcmp(g_BufferManager->server->frameBuffer, expected, fbSize) != 0) {
+                fprintf(stderr, "bench_damage: server frame %d differs from source\n", i);
+                bad++;
+            }
+        }
+    }
+
+    AgentStats *s = &g_AgentStats;
+    printf("frames: %d (%dx%d, %d bpp, seed %u), server pickups checked: %ld\n", frames, w, h, bpp * 8, seed,
+           checkedFront);
+    printf("callback: %.2f ms/frame, sync copied %.1f KiB/frame, full copies %llu\n", ms / frames,
+           (double) atomic_load(&s->syncBytes) / 1024 / frames, atomic_load(&s->syncFullCopies));
+    printf("%s\n", bad == 0 ? "all frames match" : "MISMATCH");
+    return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+// 输入注入基准: 客户端快速拖动时, 对比同步注入与注入线程(合并/保留移动事件)对画面更新的影响
+// 用法: bench_input [-moves N] [-move_us U] [-touch_us T] [-port P] [agent参数...]
+//   客户端以 U 微秒间隔发送 N 个移动事件组成一次拖动, 替身 atomicTouch 每次阻塞 T 微秒
+//   统计拖动期间客户端收到画面更新的最大间隔, 注入次数/合并数/延迟, 抬起事件从发送到注入完成的时间
+//   并校验: 保留移动时注入序列与同步注入完全一致, 合并时去掉连续移动的中间点后一致
+#include "../agent.h"
+#include "../stats.h"
+#include "../uitest.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *option;
+    int port;
+    int moves;
+    int moveUs;
+    int touchUs;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    int ok;
+    int updates;
+    double maxGapMs;
+    double dragMs;
+    double upLatencyMs;
+    unsigned long long touches;
+    unsigned long long coalesced;
+    unsigned long long dropped;
+    double latencyAvgMs;
+    double latencyMaxMs;
+    uint64_t fullDigest;
+    uint64_t mergedDigest;
+} BenchResult;
+
+// 客户端收到的画面更新时间, 只在客户端线程中访问
+static double g_lastUpdateMs;
+static double g_maxGapMs;
+static int g_updates;
+static bool g_dragging;
+
+static void bench_update_done(rfbClient *cl) {
+    double now = bench_now(CLOCK_MONOTONIC);
+    if (g_dragging) {
+        if (now - g_lastUpdateMs > g_maxGapMs) {
+            g_maxGapMs = now - g_lastUpdateMs;
+        }
+        g_updates++;
+    }
+    g_lastUpdateMs = now;
+}
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+static bool bench_pump(rfbClient *cl, int usec) {
+    int n = WaitForMessage(cl, usec);
+    return n >= 0 && (n == 0 || HandleRFBServerMessage(cl));
+}
+
+static uint64_t bench_digest(uint64_t h, const HostTouch *t) {
+    int32_t v[3] = {t->stage, t->x, t->y};
+    const uint8_t *p = (const uint8_t *) v;
+    for (size_t i = 0; i < sizeof(v); ++i) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    char touchUs[16], portArg[16];
+    snprintf(touchUs, sizeof(touchUs), "%d", job->touchUs);
+    snprintf(portArg, sizeof(portArg), "%d", job->port);
+    setenv("AGENT_HOST_TOUCH_DELAY_US", touchUs, 1);
+
+    char *argv[80] = {"bench_input", "-cap_mode", CAP_MODE_DMPUB, "-cap_fps", "30", "-rfbport", portArg};
+    int argc = 7;
+    if (job->option[0]) {
+        argv[argc++] = (char *) job->option;
+    }
+    for (int i = 0; i < job->agentArgc && argc < 80; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(300 * 1000);
+
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = job->port;
+    cl->appData.encodingsString = "raw";
+    cl->FinishedFrameBufferUpdate = bench_update_done;
+    int clientArgc = 0;
+    if (!rfbInitClient(cl, &clientArgc, NULL)) {
+        fprintf(stderr, "bench_input: client connect failed\n");
+        return;
+    }
+    // 先接收几帧, 让画面更新进入稳定节奏
+    double warmup = bench_now(CLOCK_MONOTONIC);
+    while (bench_now(CLOCK_MONOTONIC) - warmup < 500) {
+        if (!bench_pump(cl, 10000)) {
+            return;
+        }
+    }
+
+    // 一次从左到右的拖动
+    const int y = cl->height / 2;
+    g_dragging = true;
+    g_lastUpdateMs = bench_now(CLOCK_MONOTONIC);
+    double dragStart = g_lastUpdateMs;
+    SendPointerEvent(cl, 0, y, rfbButton1Mask);
+    for (int i = 1; i <= job->moves; ++i) {
+        double next = dragStart + (double) i * job->moveUs / 1000.0;
+        while (bench_now(CLOCK_MONOTONIC) < next) {
+            bench_pump(cl, 0);
+        }
+        SendPointerEvent(cl, i % cl->width, y, rfbButton1Mask);
+    }
+    double upSent = bench_now(CLOCK_MONOTONIC);
+    SendPointerEvent(cl, job->moves % cl->width, y, 0);
+    out->dragMs = upSent - dragStart;
+
+    // 等待注入全部完成: 触摸记录连续一段时间不再增加
+    const HostTouch *touches;
+    size_t count = host_port_touches(&touches);
+    double stable = bench_now(CLOCK_MONOTONIC);
+    while (bench_now(CLOCK_MONOTONIC) - stable < 300 && bench_now(CLOCK_MONOTONIC) - upSent < 30000) {
+        bench_pump(cl, 10000);
+        size_t now = host_port_touches(&touches);
+        if (now != count) {
+            count = now;
+            stable = bench_now(CLOCK_MONOTONIC);
+        }
+    }
+    g_dragging = false;
+    if (count == 0 || count > 65536) {
+        return;
+    }
+
+    uint64_t full = 1469598103934665603ull, merged = full;
+    for (size_t i = 0; i < count; ++i) {
+        full = bench_digest(full, &touches[i]);
+        if (touches[i].stage != ActionStage_MOVE || i + 1 == count || touches[i + 1].stage != ActionStage_MOVE) {
+            merged = bench_digest(merged, &touches[i]);
+        }
+    }
+    AgentStats *s = &g_AgentStats;
+    unsigned long long injections = atomic_load(&s->inputInjections);
+    out->fullDigest = full;
+    out->mergedDigest = merged;
+    out->touches = count;
+    out->coalesced = atomic_load(&s->inputCoalesced);
+    out->dropped = atomic_load(&s->inputDropped);
+    out->latencyAvgMs = injections ? (double) atomic_load(&s->inputLatencyNs) / injections / 1e6 : 0;
+    out->latencyMaxMs = (double) atomic_load(&s->inputLatencyMaxNs) / 1e6;
+    out->upLatencyMs = (double) touches[count - 1].ns / 1e6 - upSent;
+    out->maxGapMs = g_maxGapMs;
+    out->updates = g_updates;
+    out->ok = 1;
+    // 子进程随后直接退出, 不等待agent停止
+    rfbClientCleanup(cl);
+}
+
+int main(int argc, char **argv) {
+    int moves = 500, moveUs = 1000, touchUs = 2000, port = 5979;
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-moves") == 0 && i + 1 < argc) {
+            moves = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-move_us") == 0 && i + 1 < argc) {
+            moveUs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-touch_us") == 0 && i + 1 < argc) {
+            touchUs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 64) {
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    if (moves <= 0 || moveUs < 0 || touchUs < 0) {
+        return 1;
+    }
+
+    static const char *options[] = {"-input_sync", "", "-input_keep_moves"};
+    static const char *names[] = {"sync", "queue", "queue+keep"};
+    BenchResult res[3];
+    printf("drag of %d moves every %d us, touch takes %d us\n", moves, moveUs, touchUs);
+    printf("%-11s %8s %8s %8s %8s %9s %8s %8s %8s %8s\n", "injection", "drag ms", "updates", "max gap", "touches",
+           "coalesce", "dropped", "avg lat", "max lat", "up lat");
+    for (int i = 0; i < 3; ++i) {
+        BenchJob job = {options[i], port + i, moves, moveUs, touchUs, agentArgc, agentArgv};
+        if (bench_fork(bench_run, &job, &res[i], sizeof(res[i])) != 0 || !res[i].ok) {
+            fprintf(stderr, "bench_input: run failed (%s)\n", names[i]);
+            return 1;
+        }
+        printf("%-11s %8.1f %8d %8.1f %8llu %9llu %8llu %8.2f %8.2f %8.2f\n", names[i], res[i].dragMs,
+               res[i].updates, res[i].maxGapMs, res[i].touches, res[i].coalesced, res[i].dropped,
+               res[i].latencyAvgMs, res[i].latencyMaxMs, res[i].upLatencyMs);
+    }
+    // 同步注入即原始序列
+    bool keepSame = res[2].fullDigest == res[0].fullDigest;
+    bool mergedSame = res[1].mergedDigest == res[0].mergedDigest && res[2].mergedDigest == res[0].mergedDigest;
+    printf("sequence with kept moves %s, coalesced sequence %s\n", keepSame ? "matches" : "DIFFERS",
+           mergedSame ? "matches" : "DIFFERS");
+    return keepSame && mergedSame ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+// JPEG 采集路径基准: 在同一段 JPEG 序列上对比完整解码+像素差分与系数域变化检测
+// 用法: bench_jpeg [-reps N] [-frames N] [-quality Q] [frame.jpg ...]
+//   不指定文件时用主机替身画面(AGENT_HOST_SCENE/AGENT_HOST_SCREEN)现场编码一段序列
+//   每种模式在独立子进程中运行, 互不影响解码器与双缓冲区状态
+#include "../agent.h"
+#include "../diff.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <jpeglib.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double wallMs;
+    double cpuMs;
+    uint64_t digest;
+} BenchResult;
+
+typedef struct {
+    const char *flag;
+    const BenchFrame *frames;
+    int count;
+    int reps;
+} BenchJob;
+
+// 从主机替身截屏并编码为 JPEG, 模拟 uitest 的 JPEG 截屏数据
+static int bench_record_frame(BenchFrame *frame, int quality) {
+    int32_t w, h;
+    unsigned char *pixels = host_port_capture(&w, &h);
+    if (pixels == NULL) {
+        return -1;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    frame->data = NULL;
+    frame->size = 0;
+    jpeg_mem_dest(&cinfo, &frame->data, &frame->size);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_RGBX;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &pixels[(size_t) cinfo.next_scanline * w * 4];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(pixels);
+    return 0;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    char *argv[] = {"bench_jpeg", "-rfbport", "0", "-cap_mode", CAP_MODE_DEFAULT, (char *) job->flag};
+    int argc = job->flag ? 6 : 5;
+    memset(out, 0, sizeof(*out));
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    const size_t fbSize = (size_t) g_BufferManager->bufferSize;
+    for (int r = 0; r < job->reps; ++r) {
+        for (int i = 0; i < job->count; ++i) {
+            double wall = bench_now(CLOCK_MONOTONIC);
+            double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+            screenCallback((char *) job->frames[i].data, (int) job->frames[i].size);
+            out->cpuMs += bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+            out->wallMs += bench_now(CLOCK_MONOTONIC) - wall;
+            // 每帧发布结果都计入摘要, 两种模式必须完全一致
+            out->digest = diff_hash(g_BufferManager->buffers[g_BufferManager->published], fbSize, out->digest);
+        }
+    }
+    out->wallMs /= (double) job->reps * job->count;
+    out->cpuMs /= (double) job->reps * job->count;
+}
+
+int main(int argc, char **argv) {
+    int reps = 3, count = 60, quality = 85;
+    BenchFrame *frames = calloc(argc + count, sizeof(BenchFrame));
+    int loaded = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (bench_load_file(argv[i], &frames[loaded]) == 0) {
+            loaded++;
+        } else {
+            fprintf(stderr, "bench_jpeg: cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (loaded > 0) {
+        count = loaded;
+    } else {
+        frames = realloc(frames, sizeof(BenchFrame) * (count > 0 ? count : 1));
+        for (int i = 0; i < count; ++i) {
+            if (bench_record_frame(&frames[i], quality) != 0) {
+                fprintf(stderr, "bench_jpeg: capture failed\n");
+                return 1;
+            }
+        }
+    }
+    if (count <= 0 || reps <= 0) {
+        return 1;
+    }
+
+    BenchResult full, coef;
+    BenchJob fullJob = {"-no_jpeg_coef", frames, count, reps};
+    BenchJob coefJob = {NULL, frames, count, reps};
+    if (bench_fork(bench_run, &fullJob, &full, sizeof(full)) != 0 ||
+        bench_fork(bench_run, &coefJob, &coef, sizeof(coef)) != 0) {
+        fprintf(stderr, "bench_jpeg: run failed\n");
+        return 1;
+    }
+    printf("frames: %d x %d reps (%s)\n", count, reps, loaded > 0 ? "recorded" : "host scene");
+    printf("%-22s %10s %10s\n", "mode", "wall ms", "cpu ms");
+    printf("%-22s %10.2f %10.2f\n", "full decode + diff", full.wallMs, full.cpuMs);
+    printf("%-22s %10.2f %10.2f\n", "coefficient skip", coef.wallMs, coef.cpuMs);
+    printf("speedup: %.2fx, output %s\n", coef.cpuMs > 0 ? full.cpuMs / coef.cpuMs : 0.0,
+           full.digest == coef.digest ? "identical" : "DIFFERS");
+    return full.digest == coef.digest ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+// 键盘注入校验: 两个客户端按脚本发送按键, 校验替身 callThroughMessage 收到的 Driver 调用序列与预期完全一致
+// 用法: bench_keys [-port P] [agent参数...]
+//   分别以默认(逐键 triggerKey), -input_text(连续字符合并为一次 inputText)和
+//   -input_text -input_sync(每个字符一次调用)运行同一脚本, 并统计合并省去的调用次数;
+//   点击后拖动, 或回车/Tab 移走焦点后的字符逐键注入;
+//   修饰键按客户端分别记录, 一个客户端按住 Ctrl 不影响另一个客户端的输入
+#include "../agent.h"
+#include "../keymap.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_CALL_MAX 64
+
+typedef struct {
+    const char *options[2];
+    int port;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    int ok;
+    int calls;
+    // 第一个不一致的调用下标, -1 表示完全一致
+    int mismatch;
+    char got[512];
+    char want[512];
+    unsigned long long keyCalls;
+    unsigned long long textCalls;
+    unsigned long long textChars;
+    double latencyMaxMs;
+} BenchResult;
+
+typedef struct {
+    const char *calls[BENCH_CALL_MAX];
+    int count;
+} BenchExpect;
+
+static void bench_expect(BenchExpect *e, const char *api, const char *args) {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "{\"api\":\"%s\",\"this\":\"Driver#0\",\"args\":[%s]}", api, args);
+    e->calls[e->count++] = strdup(buffer);
+}
+
+// 预期的文本输入, split 时每个 UTF-8 字符一次调用
+static void bench_expect_text(BenchExpect *e, const char *text, bool split) {
+    const unsigned char *p = (const unsigned char *) text;
+    while (*p) {
+        char args[256];
+        int n = snprintf(args, sizeof(args), "{\"x\":100,\"y\":200},\"");
+        do {
+            int len = *p < 0x80 ? 1 : *p < 0xE0 ? 2 : *p < 0xF0 ? 3 : 4;
+            if (*p == '"' || *p == '\\') {
+                args[n++] = '\\';
+            }
+            memcpy(args + n, p, len);
+            n += len;
+            p += len;
+        } while (*p && !split);
+        snprintf(args + n, sizeof(args) - n, "\",{\"paste\":false,\"addition\":true}");
+        bench_expect(e, "Driver.inputText", args);
+    }
+}
+
+// 预期的逐键输入, 大写字母带 Shift, 不支持的字符丢弃
+static void bench_expect_keys(BenchExpect *e, const rfbKeySym *keys, int count) {
+    for (int i = 0; i < count; ++i) {
+        bool shift = false;
+        int code = keymap_keycode(keys[i], &shift);
+        if (code < 0) {
+            continue;
+        }
+        char args[32];
+        if (shift) {
+            snprintf(args, sizeof(args), "%d,%d", KEYCODE_SHIFT_LEFT, code);
+            bench_expect(e, "Driver.triggerCombineKeys", args);
+        } else {
+            snprintf(args, sizeof(args), "%d", code);
+            bench_expect(e, "Driver.triggerKey", args);
+        }
+    }
+}
+
+// 预期的有焦点时的输入: 开启文本输入时为 inputText, 否则逐键
+static void bench_expect_typed(BenchExpect *e, bool text, bool split, const rfbKeySym *keys, int count,
+                               const char *utf8) {
+    if (text) {
+        bench_expect_text(e, utf8, split);
+    } else {
+        bench_expect_keys(e, keys, count);
+    }
+}
+
+static void bench_pump(rfbClient **clients, int count, int ms) {
+    double end = bench_now(CLOCK_MONOTONIC) + ms;
+    do {
+        for (int i = 0; i < count; ++i) {
+            if (clients[i] != NULL && WaitForMessage(clients[i], 1000) > 0) {
+                HandleRFBServerMessage(clients[i]);
+            }
+        }
+    } while (bench_now(CLOCK_MONOTONIC) < end);
+}
+
+static void bench_tap(rfbClient *cl, rfbKeySym key) {
+    SendKeyEvent(cl, key, TRUE);
+    SendKeyEvent(cl, key, FALSE);
+}
+
+// 按真实客户端的方式发送字符: 大写字母与上档符号前后按下/抬起 Shift
+static void bench_type(rfbClient *cl, const rfbKeySym *keys, int count) {
+    for (int i = 0; i < count; ++i) {
+        bool shift = (keys[i] >= 'A' && keys[i] <= 'Z') || keys[i] == '"';
+        if (shift) {
+            SendKeyEvent(cl, XK_Shift_L, TRUE);
+        }
+        bench_tap(cl, keys[i]);
+        if (shift) {
+            SendKeyEvent(cl, XK_Shift_L, FALSE);
+        }
+    }
+}
+
+static rfbClient *bench_connect(int port) {
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = port;
+    cl->appData.encodingsString = "raw";
+    int argc = 0;
+    if (!rfbInitClient(cl, &argc, NULL)) {
+        fprintf(stderr, "bench_keys: client connect failed\n");
+        return NULL;
+    }
+    return cl;
+}
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    bool text = false, sync = false;
+    for (int i = 0; i < 2 && job->options[i] != NULL; ++i) {
+        text |= strcmp(job->options[i], "-input_text") == 0;
+        sync |= strcmp(job->options[i], "-input_sync") == 0;
+    }
+    setenv("AGENT_HOST_SCREEN", "360x640", 1);
+    setenv("AGENT_HOST_SCENE", "static", 1);
+    char portArg[16];
+    snprintf(portArg, sizeof(portArg), "%d", job->port);
+    char *argv[80] = {"bench_keys", "-cap_mode", CAP_MODE_DMPUB, "-rfbport", portArg};
+    int argc = 5;
+    for (int i = 0; i < 2 && job->options[i] != NULL; ++i) {
+        argv[argc++] = (char *) job->options[i];
+    }
+    for (int i = 0; i < job->agentArgc && argc < 80; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(300 * 1000);
+    rfbClient *clients[2] = {bench_connect(job->port), NULL};
+    rfbClient *a = clients[0];
+    if (a == NULL) {
+        return;
+    }
+    bench_pump(clients, 1, 200);
+
+    BenchExpect expect = {};
+    expect.calls[expect.count++] = "{\"api\":\"Driver.create\",\"this\":null,\"args\":[]}";
+    // 点击输入框, 之后的文本输入到该位置
+    SendPointerEvent(a, 100, 200, rfbButton1Mask);
+    SendPointerEvent(a, 100, 200, 0);
+    // 一串快速输入的字符
+    static const rfbKeySym hello[] = {'H', 'e', 'l', 'l', 'o', ',', ' ', '"', 'w', 'o', 'r', 'l', 'd', '"', ' ',
+                                      'c', 'a', 'f', XK_eacute};
+    bench_type(a, hello, sizeof(hello) / sizeof(hello[0]));
+    bench_expect_typed(&expect, text, sync, hello, sizeof(hello) / sizeof(hello[0]), "Hello, \"world\" caf\xc3\xa9");
+    bench_pump(clients, 1, 100);
+    // Ctrl+A, 回车(焦点移走), 退格
+    SendKeyEvent(a, XK_Control_L, TRUE);
+    bench_tap(a, XK_a);
+    SendKeyEvent(a, XK_Control_L, FALSE);
+    bench_expect(&expect, "Driver.triggerCombineKeys", "2072,2017");
+    bench_tap(a, XK_Return);
+    bench_expect(&expect, "Driver.triggerKey", "2054");
+    bench_tap(a, XK_BackSpace);
+    bench_expect(&expect, "Driver.triggerKey", "2055");
+    // 回车后没有焦点, 逐键注入
+    static const rfbKeySym ok[] = {'o', 'k'};
+    bench_tap(a, XK_o);
+    bench_pump(clients, 1, 100);
+    bench_tap(a, XK_k);
+    bench_expect_keys(&expect, ok, 2);
+    bench_pump(clients, 1, 100);
+    // 重新点击输入框, 间隔较长的两个字符不合并
+    SendPointerEvent(a, 100, 200, rfbButton1Mask);
+    SendPointerEvent(a, 100, 200, 0);
+    bench_tap(a, XK_o);
+    bench_pump(clients, 1, 100);
+    bench_tap(a, XK_k);
+    bench_expect_typed(&expect, text, sync, ok, 1, "o");
+    bench_expect_typed(&expect, text, sync, ok + 1, 1, "k");
+    bench_pump(clients, 1, 100);
+
+    // 第二个客户端按住 Ctrl, 不影响第一个客户端
+    clients[1] = bench_connect(job->port);
+    rfbClient *b = clients[1];
+    if (b == NULL) {
+        return;
+    }
+    bench_pump(clients, 2, 200);
+    SendKeyEvent(b, XK_Control_L, TRUE);
+    bench_pump(clients, 2, 50);
+    static const rfbKeySym xyz[] = {'x', 'y', 'z', 'q'};
+    bench_tap(a, XK_x);
+    bench_expect_typed(&expect, text, sync, xyz, 1, "x");
+    bench_pump(clients, 2, 50);
+    bench_tap(b, XK_c);
+    bench_expect(&expect, "Driver.triggerCombineKeys", "2072,2019");
+    bench_pump(clients, 2, 50);
+    SendKeyEvent(b, XK_Control_L, FALSE);
+    bench_pump(clients, 2, 50);
+    // 按下后拖动不是点击输入框, 之后的字符逐键注入
+    SendPointerEvent(a, 100, 200, rfbButton1Mask);
+    SendPointerEvent(a, 150, 300, rfbButton1Mask);
+    SendPointerEvent(a, 150, 300, 0);
+    bench_tap(a, XK_y);
+    bench_expect_keys(&expect, xyz + 1, 1);
+    bench_pump(clients, 2, 50);
+    // 重新点击后输入; Shift+Tab 移走焦点, 之后的字符逐键注入
+    SendPointerEvent(a, 100, 200, rfbButton1Mask);
+    SendPointerEvent(a, 100, 200, 0);
+    bench_tap(a, XK_z);
+    bench_expect_typed(&expect, text, sync, xyz + 2, 1, "z");
+    SendKeyEvent(a, XK_Shift_L, TRUE);
+    bench_tap(a, XK_Tab);
+    SendKeyEvent(a, XK_Shift_L, FALSE);
+    bench_expect(&expect, "Driver.triggerCombineKeys", "2047,2049");
+    bench_tap(a, XK_q);
+    bench_expect_keys(&expect, xyz + 3, 1);
+    // 功能键
+    bench_tap(a, XK_F5);
+    bench_expect(&expect, "Driver.triggerKey", "2094");
+    // Ctrl+Alt+T 可以注入; Ctrl+Alt+Shift+T 超出3个键, 丢弃而不是注入为 Ctrl+Alt+T
+    SendKeyEvent(a, XK_Control_L, TRUE);
+    SendKeyEvent(a, XK_Alt_L, TRUE);
+    bench_tap(a, XK_t);
+    bench_expect(&expect, "Driver.triggerCombineKeys", "2072,2045,2036");
+    SendKeyEvent(a, XK_Shift_L, TRUE);
+    bench_tap(a, XK_T);
+    SendKeyEvent(a, XK_Shift_L, FALSE);
+    SendKeyEvent(a, XK_Alt_L, FALSE);
+    SendKeyEvent(a, XK_Control_L, FALSE);
+    bench_tap(a, XK_F5);
+    bench_expect(&expect, "Driver.triggerKey", "2094");
+
+    // 等待注入全部完成
+    char *const *calls;
+    size_t count = host_port_calls(&calls);
+    double stable = bench_now(CLOCK_MONOTONIC);
+    while (bench_now(CLOCK_MONOTONIC) - stable < 300) {
+        bench_pump(clients, 2, 10);
+        size_t now = host_port_calls(&calls);
+        if (now != count) {
+            count = now;
+            stable = bench_now(CLOCK_MONOTONIC);
+        }
+    }
+
+    out->calls = (int) count;
+    out->mismatch = -1;
+    for (int i = 0; i < expect.count || i < (int) count; ++i) {
+        const char *got = i < (int) count ? calls[i] : "(none)";
+        const char *want = i < expect.count ? expect.calls[i] : "(none)";
+        if (strcmp(got, want) != 0) {
+            out->mismatch = i;
+            snprintf(out->got, sizeof(out->got), "%s", got);
+            snprintf(out->want, sizeof(out->want), "%s", want);
+            break;
+        }
+    }
+    AgentStats *s = &g_AgentStats;
+    out->keyCalls = atomic_load(&s->inputKeyCalls);
+    out->textCalls = atomic_load(&s->inputTextCalls);
+    out->textChars = atomic_load(&s->inputTextChars);
+    out->latencyMaxMs = (double) atomic_load(&s->inputLatencyMaxNs) / 1e6;
+    out->ok = 1;
+    // 子进程随后直接退出, 不等待agent停止
+}
+
+int main(int argc, char **argv) {
+    int port = 5989;
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 64) {
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+
+    static const char *options[][2] = {{NULL, NULL}, {"-input_text", NULL}, {"-input_text", "-input_sync"}};
+    static const char *names[] = {"key", "text", "sync"};
+    BenchResult res[3];
+    int status = 0;
+    printf("%-6s %8s %8s %8s %8s %9s  %s\n", "input", "calls", "keys", "text", "chars", "max lat", "sequence");
+    for (int i = 0; i < 3; ++i) {
+        BenchJob job = {{options[i][0], options[i][1]}, port + i, agentArgc, agentArgv};
+        if (bench_fork(bench_run, &job, &res[i], sizeof(res[i])) != 0 || !res[i].ok) {
+            fprintf(stderr, "bench_keys: run failed (%s)\n", names[i]);
+            return 1;
+        }
+        printf("%-6s %8d %8llu %8llu %8llu %9.2f  %s\n", names[i], res[i].calls, res[i].keyCalls, res[i].textCalls,
+               res[i].textChars, res[i].latencyMaxMs, res[i].mismatch < 0 ? "matches" : "DIFFERS");
+        if (res[i].mismatch >= 0) {
+            printf("  call %d\n    got:  %s\n    want: %s\n", res[i].mismatch, res[i].got, res[i].want);
+            status = 1;
+        }
+    }
+    printf("text round trips saved: %lld\n", (long long) res[2].calls - res[1].calls);
+    return status;
+}
@@ -0,0 +1,186 @@
+// 自适应采集帧率基准: 分别在静止画面与动画画面下, 以固定帧率和自适应帧率运行agent, 统计进程平均CPU占用
+// 用法: bench_pacing [-seconds S] [-warmup S] [-min_fps N] [-input_ms N] [-cap_mode M] [-port P] [agent参数...]
+//   默认 -cap_fps 30, 三种画面使用 dmpub 采集, 静止画面另外以 jpeg 与 png 采集, 检查各采集方式都能降低帧率;
+//   指定 -cap_mode 时所有画面只用该采集方式. 连接一个 raw 编码的客户端持续请求画面, 避免按需采集暂停
+//   -input_ms: 客户端每隔N毫秒移动一次指针, 观察输入后恢复满帧率的开销
+//   每组配置在独立子进程中运行, CPU 时间包含客户端线程
+#include "../agent.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *scene;
+    const char *capMode;
+    const char *minFps;
+    int port;
+    int seconds;
+    int warmup;
+    int inputMs;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    double cpuPct;
+    double fps;
+    double intervalMs;
+    unsigned long long inputResets;
+    unsigned long long changeResets;
+    int ok;
+} BenchResult;
+
+typedef struct {
+    int port;
+    int inputMs;
+    volatile int stop;
+    volatile int connected;
+} BenchClient;
+
+static void *bench_client_main(void *arg) {
+    BenchClient *client = (BenchClient *) arg;
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = client->port;
+    cl->appData.encodingsString = "raw";
+    int argc = 0;
+    if (!rfbInitClient(cl, &argc, NULL)) {
+        fprintf(stderr, "bench_pacing: client connect failed\n");
+        return NULL;
+    }
+    client->connected = 1;
+    double lastInput = bench_now(CLOCK_MONOTONIC);
+    int x = 0;
+    while (!client->stop) {
+        int n = WaitForMessage(cl, 10000);
+        if (n < 0 || (n > 0 && !HandleRFBServerMessage(cl))) {
+            break;
+        }
+        if (client->inputMs > 0 && bench_now(CLOCK_MONOTONIC) - lastInput >= client->inputMs) {
+            lastInput = bench_now(CLOCK_MONOTONIC);
+            x = (x + 16) % cl->width;
+            SendPointerEvent(cl, x, cl->height / 2, 0);
+        }
+    }
+    rfbClientCleanup(cl);
+    return NULL;
+}
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    setenv("AGENT_HOST_SCENE", job->scene, 1);
+
+    char portArg[16];
+    snprintf(portArg, sizeof(portArg), "%d", job->port);
+    char *argv[80] = {"bench_pacing", "-cap_mode", (char *) job->capMode, "-cap_fps", "30", "-rfbport", portArg};
+    int argc = 7;
+    for (int i = 0; i < job->agentArgc && argc < 77; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    argv[argc++] = "-cap_min_fps";
+    argv[argc++] = (char *) job->minFps;
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(300 * 1000);
+    BenchClient client = {.port = job->port, .inputMs = job->inputMs};
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_client_main, &client);
+
+    // 预热阶段让自适应帧率降到稳定状态
+    sleep(job->warmup);
+    if (!client.connected) {
+        return;
+    }
+    AgentStats *s = &g_AgentStats;
+    unsigned long long frames = atomic_load(&s->framesCaptured);
+    unsigned long long inputResets = atomic_load(&s->paceInputResets);
+    unsigned long long changeResets = atomic_load(&s->paceChangeResets);
+    double wall = bench_now(CLOCK_MONOTONIC);
+    double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    sleep(job->seconds);
+    cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    wall = bench_now(CLOCK_MONOTONIC) - wall;
+
+    out->cpuPct = 100.0 * cpu / wall;
+    out->fps = (double) (atomic_load(&s->framesCaptured) - frames) * 1000.0 / wall;
+    out->intervalMs = (double) atomic_load(&s->captureIntervalUs) / 1000.0;
+    out->inputResets = atomic_load(&s->paceInputResets) - inputResets;
+    out->changeResets = atomic_load(&s->paceChangeResets) - changeResets;
+    out->ok = 1;
+    // 子进程随后直接退出, 不等待agent停止
+    client.stop = 1;
+    pthread_join(thread, NULL);
+}
+
+int main(int argc, char **argv) {
+    int seconds = 5, warmup = 3, inputMs = 0, port = 5969;
+    const char *minFps = "5";
+    const char *capMode = NULL;
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-min_fps") == 0 && i + 1 < argc) {
+            minFps = argv[++i];
+        } else if (strcmp(argv[i], "-input_ms") == 0 && i + 1 < argc) {
+            inputMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-cap_mode") == 0 && i + 1 < argc) {
+            capMode = argv[++i];
+        } else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 64) {
+            // 其余参数交给agent, 后出现的同名参数覆盖默认值
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    if (seconds <= 0 || warmup < 0) {
+        return 1;
+    }
+
+    // 画面与采集方式
+    static const char *runs[][2] = {
+        {"static", CAP_MODE_DMPUB}, {"clock", CAP_MODE_DMPUB}, {"full", CAP_MODE_DMPUB},
+        {"static", CAP_MODE_DEFAULT}, {"static", CAP_MODE_PNG},
+    };
+    int runCount = capMode == NULL ? 5 : 3;
+    // 最低帧率等于采集帧率即固定帧率
+    const char *pacings[] = {"1000", minFps};
+    printf("%d s per run after %d s warmup, input every %d ms\n", seconds, warmup, inputMs);
+    printf("%-8s %-6s %-10s %8s %8s %12s %8s %8s\n", "scene", "mode", "pacing", "cpu %", "fps", "interval ms",
+           "input", "change");
+    for (int r = 0; r < runCount; ++r) {
+        const char *scene = runs[r][0];
+        const char *mode = capMode == NULL ? runs[r][1] : capMode;
+        for (int p = 0; p < 2; ++p) {
+            BenchJob job = {scene, mode, pacings[p], port++, seconds, warmup, inputMs, agentArgc, agentArgv};
+            BenchResult res;
+            if (bench_fork(bench_run, &job, &res, sizeof(res)) != 0 || !res.ok) {
+                fprintf(stderr, "bench_pacing: run failed (%s, %s)\n", scene, mode);
+                return 1;
+            }
+            char pacing[24];
+            snprintf(pacing, sizeof(pacing), p == 0 ? "fixed" : "min %s", minFps);
+            printf("%-8s %-6s %-10s %8.1f %8.1f %12.1f %8llu %8llu\n", scene, mode, pacing, res.cpuPct, res.fps,
+                   res.intervalMs, res.inputResets, res.changeResets);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,405 @@
+// 采集流水线重放基准: 把录制的 JPEG/PNG/BGRA 帧不限速地依次送入 screenCallback, 每帧后模拟vnc服务器取帧
+// 用法: bench_pipeline [-reps N] [-frames N] [-quality Q] [-size WxH] [-record FILE] [-modes jpeg,png,dmpub]
+//                      [-fb_bpp 32,16,8] [帧文件|目录|容器文件 ...] [agent参数...]
+//   第一个无法识别的 - 参数及其后的参数都交给agent, 帧路径需写在它们之前
+//   帧格式按文件头识别: JPEG 送入 jpeg 模式, PNG 送入 png 模式, 其余视为 BGRA 原始像素(需 -size 或来自容器)送入 dmpub
+//   目录按文件名排序读取; 容器文件为 "AGFRAMES" 后接若干条 {宽, 高, 字节数(均为 uint32 小端), 帧数据}
+//   不指定帧时用主机替身画面(AGENT_HOST_SCENE/AGENT_HOST_SCREEN)现场编码三种格式, -record 把它们保存为容器文件
+//   每种模式在独立子进程中运行, 输出帧率, 每帧CPU时间, 各阶段平均耗时, 平均变化面积, 峰值RSS与帧缓冲池大小
+//   -fb_bpp 为逗号分隔的帧缓冲位数, 每种模式按各位数分别运行
+#include "../agent.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <dirent.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define BENCH_CONTAINER_MAGIC "AGFRAMES"
+#define BENCH_MODE_COUNT 3
+
+typedef enum {
+    BENCH_FORMAT_JPEG,
+    BENCH_FORMAT_PNG,
+    BENCH_FORMAT_BGRA,
+} BenchFormat;
+
+typedef struct {
+    BenchFrame frame;
+    int width;
+    int height;
+} BenchInput;
+
+// 每种格式一段序列, 下标即 BenchFormat
+typedef struct {
+    BenchInput *items;
+    int count;
+    int capacity;
+} BenchSequence;
+
+typedef struct {
+    const char *mode;
+    const char *fbBpp;
+    const BenchSequence *frames;
+    int reps;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    int ok;
+    int frames;
+    int width;
+    int height;
+    double wallMs;
+    double cpuMs;
+    double stageUs[STATS_STAGE_COUNT];
+    unsigned long long published;
+    unsigned long long dirtyPixels;
+    unsigned long long dropped;
+    long peakRssKb;
+    unsigned long long poolBytes;
+} BenchResult;
+
+static const char *g_modes[BENCH_MODE_COUNT] = {CAP_MODE_DEFAULT, CAP_MODE_PNG, CAP_MODE_DMPUB};
+
+static void bench_push(BenchSequence *seq, const BenchFrame *frame, int width, int height) {
+    if (seq->count == seq->capacity) {
+        seq->capacity = seq->capacity ? seq->capacity * 2 : 16;
+        seq->items = realloc(seq->items, sizeof(BenchInput) * seq->capacity);
+    }
+    BenchInput *in = &seq->items[seq->count++];
+    in->frame = *frame;
+    in->width = width;
+    in->height = height;
+}
+
+static uint32_t bench_u32le(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void bench_put_u32le(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) (v >> 16);
+    p[3] = (unsigned char) (v >> 24);
+}
+
+static int bench_jpeg_size(const BenchFrame *frame, int *width, int *height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, frame->data, frame->size);
+    int ok = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+    *width = (int) cinfo.image_width;
+    *height = (int) cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    return ok ? 0 : -1;
+}
+
+/**
+ * 按文件头把一帧加入对应格式的序列
+ *
+ * @param rawW 原始像素帧的宽度, 0 表示未知
+ * @return 0 成功, -1 无法识别
+ */
+static int bench_add_frame(BenchSequence *seqs, const BenchFrame *frame, int rawW, int rawH) {
+    int w = 0, h = 0;
+    if (frame->size > 3 && frame->data[0] == 0xFF && frame->data[1] == 0xD8) {
+        if (bench_jpeg_size(frame, &w, &h) != 0) {
+            return -1;
+        }
+        bench_push(&seqs[BENCH_FORMAT_JPEG], frame, w, h);
+    } else if (frame->size > 24 && png_sig_cmp(frame->data, 0, 8) == 0) {
+        // IHDR 紧跟签名, 宽高为大端
+        const unsigned char *p = frame->data + 16;
+        w = p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        h = p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+        bench_push(&seqs[BENCH_FORMAT_PNG], frame, w, h);
+    } else if (rawW > 0 && rawH > 0 && frame->size >= (unsigned long) rawW * rawH * 4) {
+        bench_push(&seqs[BENCH_FORMAT_BGRA], frame, rawW, rawH);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_load_container(const BenchFrame *file, BenchSequence *seqs) {
+    size_t off = strlen(BENCH_CONTAINER_MAGIC);
+    while (off + 12 <= file->size) {
+        const unsigned char *p = file->data + off;
+        uint32_t w = bench_u32le(p), h = bench_u32le(p + 4), size = bench_u32le(p + 8);
+        off += 12;
+        if (size == 0 || size > file->size - off) {
+            return -1;
+        }
+        BenchFrame frame = {malloc(size), size};
+        memcpy(frame.data, file->data + off, size);
+        off += size;
+        if (bench_add_frame(seqs, &frame, (int) w, (int) h) != 0) {
+            free(frame.data);
+            return -1;
+        }
+    }
+    return off == file->size ? 0 : -1;
+}
+
+static int bench_name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// 读取文件, 目录(按文件名排序)或容器文件
+static int bench_load_path(const char *path, BenchSequence *seqs, int rawW, int rawH) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        BenchFrame file;
+        if (bench_load_file(path, &file) != 0) {
+            return -1;
+        }
+        size_t magic = strlen(BENCH_CONTAINER_MAGIC);
+        if (file.size >= magic && memcmp(file.data, BENCH_CONTAINER_MAGIC, magic) == 0) {
+            int ret = bench_load_container(&file, seqs);
+            free(file.data);
+            return ret;
+        }
+        return bench_add_frame(seqs, &file, rawW, rawH);
+    }
+    char **names = NULL;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        names = realloc(names, sizeof(char *) * (count + 1));
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char *), bench_name_cmp);
+    for (int i = 0; i < count; ++i) {
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", path, names[i]);
+        if (bench_load_path(file, seqs, rawW, rawH) != 0) {
+            fprintf(stderr, "bench_pipeline: skip %s\n", file);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return 0;
+}
+
+// 从主机替身截取一帧, 分别编码为 JPEG/PNG, 并转换为 DMPUB 的 BGRA
+static int bench_record_frame(BenchSequence *seqs, int quality) {
+    int32_t w, h;
+    uint8_t *pixels = host_port_capture(&w, &h);
+    if (pixels == NULL) {
+        return -1;
+    }
+    BenchFrame jpeg = {};
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &jpeg.data, &jpeg.size);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_RGBX;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &pixels[(size_t) cinfo.next_scanline * w * 4];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    bench_push(&seqs[BENCH_FORMAT_JPEG], &jpeg, w, h);
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+    png_alloc_size_t size = 0;
+    png_image_write_get_memory_size(image, size, 0, pixels, 0, NULL);
+    BenchFrame png = {malloc(size), size};
+    if (!png_image_write_to_memory(&image, png.data, &size, 0, pixels, 0, NULL)) {
+        free(pixels);
+        return -1;
+    }
+    png.size = size;
+    bench_push(&seqs[BENCH_FORMAT_PNG], &png, w, h);
+
+    for (size_t i = 0; i < (size_t) w * h; ++i) {
+        uint8_t r = pixels[i * 4];
+        pixels[i * 4] = pixels[i * 4 + 2];
+        pixels[i * 4 + 2] = r;
+    }
+    BenchFrame bgra = {pixels, (unsigned long) w * h * 4};
+    bench_push(&seqs[BENCH_FORMAT_BGRA], &bgra, w, h);
+    return 0;
+}
+
+static int bench_save_container(const char *path, const BenchSequence *seqs) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return -1;
+    }
+    fwrite(BENCH_CONTAINER_MAGIC, 1, strlen(BENCH_CONTAINER_MAGIC), fp);
+    for (int f = 0; f < BENCH_MODE_COUNT; ++f) {
+        for (int i = 0; i < seqs[f].count; ++i) {
+            const BenchInput *in = &seqs[f].items[i];
+            unsigned char header[12];
+            bench_put_u32le(header, (uint32_t) in->width);
+            bench_put_u32le(header + 4, (uint32_t) in->height);
+            bench_put_u32le(header + 8, (uint32_t) in->frame.size);
+            fwrite(header, 1, sizeof(header), fp);
+            fwrite(in->frame.data, 1, in->frame.size, fp);
+        }
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+static long bench_peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    const BenchSequence *seq = job->frames;
+    // 替身屏幕与第一帧同尺寸, 之后尺寸变化时由模拟的服务器取帧重建帧缓冲
+    host_screen_resize(seq->items[0].width, seq->items[0].height);
+    char *argv[80] = {"bench_pipeline", "-rfbport", "0", "-cap_mode", (char *) job->mode, "-fb_bpp",
+                      (char *) job->fbBpp};
+    int argc = 7;
+    for (int i = 0; i < job->agentArgc && argc < 80; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    double wall = bench_now(CLOCK_MONOTONIC);
+    double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    for (int r = 0; r < job->reps; ++r) {
+        for (int i = 0; i < seq->count; ++i) {
+            screenCallback((char *) seq->items[i].frame.data, (int) seq->items[i].frame.size);
+            acquire_front_vnc_buf(g_BufferManager);
+        }
+    }
+    out->cpuMs = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    out->wallMs = bench_now(CLOCK_MONOTONIC) - wall;
+    out->frames = job->reps * seq->count;
+    out->width = g_BufferManager->server->width;
+    out->height = g_BufferManager->server->height;
+    AgentStats *s = &g_AgentStats;
+    for (int i = 0; i < STATS_STAGE_COUNT; ++i) {
+        unsigned long long count = atomic_load(&s->stages[i].count);
+        out->stageUs[i] = count ? (double) atomic_load(&s->stages[i].sumNs) / count / 1000 : 0;
+    }
+    out->published = atomic_load(&s->framesPublished);
+    out->dirtyPixels = atomic_load(&s->dirtyPixels);
+    out->dropped = atomic_load(&s->framesDropped);
+    out->peakRssKb = bench_peak_rss_kb();
+    out->poolBytes = atomic_load(&s->poolBytes);
+    out->ok = 1;
+}
+
+int main(int argc, char **argv) {
+    int reps = 3, count = 60, quality = 85, rawW = 0, rawH = 0;
+    const char *record = NULL, *modes = "jpeg,png,dmpub", *fbBpps = "32";
+    BenchSequence seqs[BENCH_MODE_COUNT] = {};
+    char *agentArgv[64];
+    int agentArgc = 0, loaded = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &rawW, &rawH) != 2) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+            record = argv[++i];
+        } else if (strcmp(argv[i], "-modes") == 0 && i + 1 < argc) {
+            modes = argv[++i];
+        } else if (strcmp(argv[i], "-fb_bpp") == 0 && i + 1 < argc) {
+            fbBpps = argv[++i];
+        } else if (argv[i][0] == '-') {
+            while (i < argc && agentArgc < 64) {
+                agentArgv[agentArgc++] = argv[i++];
+            }
+        } else if (bench_load_path(argv[i], seqs, rawW, rawH) == 0) {
+            loaded++;
+        } else {
+            fprintf(stderr, "bench_pipeline: cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (loaded == 0) {
+        for (int i = 0; i < count; ++i) {
+            if (bench_record_frame(seqs, quality) != 0) {
+                fprintf(stderr, "bench_pipeline: capture failed\n");
+                return 1;
+            }
+        }
+        if (record != NULL && bench_save_container(record, seqs) != 0) {
+            fprintf(stderr, "bench_pipeline: cannot write %s\n", record);
+            return 1;
+        }
+    }
+    if (reps <= 0) {
+        return 1;
+    }
+
+    static const char *stageNames[] = {"decode", "diff", "write"};
+    static const StatsStage stages[] = {STATS_STAGE_DECODE, STATS_STAGE_DIFF, STATS_STAGE_WRITE};
+    printf("%d rep(s) of %s frames, unlimited rate\n", reps, loaded > 0 ? "recorded" : "host scene");
+    printf("%-6s %4s %7s %11s %8s %8s %8s %8s %8s %8s %9s %9s %9s\n", "mode", "bpp", "frames", "size", "fps",
+           "cpu ms", stageNames[0], stageNames[1], stageNames[2], "dirty %", "dropped", "peak MB", "pool MB");
+    int status = 0;
+    for (int f = 0; f < BENCH_MODE_COUNT; ++f) {
+        if (seqs[f].count == 0 || strstr(modes, g_modes[f]) == NULL) {
+            continue;
+        }
+        for (const char *p = fbBpps; *p != '\0';) {
+            size_t len = strcspn(p, ",");
+            char bpp[8];
+            snprintf(bpp, sizeof(bpp), "%.*s", (int) len, p);
+            p += p[len] == ',' ? len + 1 : len;
+            BenchJob job = {g_modes[f], bpp, &seqs[f], reps, agentArgc, agentArgv};
+            BenchResult res;
+            if (bench_fork(bench_run, &job, &res, sizeof(res)) != 0 || !res.ok) {
+                fprintf(stderr, "bench_pipeline: run failed (%s, %s bpp)\n", g_modes[f], bpp);
+                status = 1;
+                continue;
+            }
+            char size[24];
+            snprintf(size, sizeof(size), "%dx%d", res.width, res.height);
+            double area = (double) res.width * res.height;
+            printf("%-6s %4s %7d %11s %8.1f %8.2f", g_modes[f], bpp, res.frames, size,
+                   res.wallMs > 0 ? res.frames * 1000.0 / res.wallMs : 0.0, res.cpuMs / res.frames);
+            for (int i = 0; i < 3; ++i) {
+                printf(" %8.0f", res.stageUs[stages[i]]);
+            }
+            printf(" %8.1f %9llu %9.1f %9.1f\n",
+                   res.published && area > 0 ? 100.0 * res.dirtyPixels / res.published / area : 0.0, res.dropped,
+                   (double) res.peakRssKb / 1024, (double) res.poolBytes / (1024 * 1024));
+        }
+    }
+    printf("stage columns are average us per frame, dirty %% is per published frame\n");
+    return status;
+}
@@ -0,0 +1,182 @@
+// PNG 采集路径基准: 逐行解码写入帧缓冲, 并逐帧校验发布结果与 png_image 整帧解码(旧实现)逐字节一致
+// 用法: bench_png [-reps N] [-frames N] [-mixed] [frame.png ...]
+//   不指定文件时用主机替身画面(AGENT_HOST_SCENE/AGENT_HOST_SCREEN)现场编码一段序列
+//   -mixed: 替身画面依次编码为 RGBA/RGB/GRAY/GRAY+ALPHA, 覆盖各类像素格式转换
+#include "../agent.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double cpuMs;
+    double refMs;
+    long mismatched;
+} BenchResult;
+
+typedef struct {
+    const BenchFrame *frames;
+    int count;
+    int reps;
+} BenchJob;
+
+static int bench_record_frame(BenchFrame *frame, png_uint_32 format) {
+    int32_t w, h;
+    uint8_t *rgba = host_port_capture(&w, &h);
+    if (rgba == NULL) {
+        return -1;
+    }
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+    // 先转换为目标格式的像素, 再编码
+    png_alloc_size_t size = 0;
+    uint8_t *pixels = rgba;
+    if (format != PNG_FORMAT_RGBA) {
+        int channels = PNG_IMAGE_PIXEL_CHANNELS(format);
+        pixels = malloc((size_t) w * h * channels);
+        for (size_t i = 0; i < (size_t) w * h; ++i) {
+            const uint8_t *p = &rgba[i * 4];
+            uint8_t *q = &pixels[i * channels];
+            if (format & PNG_FORMAT_FLAG_COLOR) {
+                memcpy(q, p, 3);
+            } else {
+                q[0] = (uint8_t) ((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+            }
+            if (format & PNG_FORMAT_FLAG_ALPHA) {
+                q[channels - 1] = 0xFF;
+            }
+        }
+        image.format = format;
+    }
+    png_image_write_get_memory_size(image, size, 0, pixels, 0, NULL);
+    frame->data = malloc(size);
+    frame->size = size;
+    int ok = png_image_write_to_memory(&image, frame->data, &size, 0, pixels, 0, NULL);
+    frame->size = size;
+    if (pixels != rgba) {
+        free(pixels);
+    }
+    free(rgba);
+    return ok ? 0 : -1;
+}
+
+// 按旧实现的方式解码参考帧: png_image 整帧解码为 RGB, 与帧缓冲比较
+static long bench_verify(const BenchFrame *frame, uint8_t **ref, size_t *refCap, double *decodeMs) {
+    double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, frame->data, frame->size)) {
+        return -1;
+    }
+    image.format = PNG_FORMAT_RGB;
+    if (PNG_IMAGE_SIZE(image) > *refCap) {
+        *refCap = PNG_IMAGE_SIZE(image);
+        *ref = realloc(*ref, *refCap);
+    }
+    if (!png_image_finish_read(&image, NULL, *ref, 0, NULL)) {
+        png_image_free(&image);
+        return -1;
+    }
+    *decodeMs += bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    const int screenW = g_BufferManager->server->width;
+    const int screenH = g_BufferManager->server->height;
+    const uint8_t *fb = (const uint8_t *) g_BufferManager->buffers[g_BufferManager->published];
+    long bad = 0;
+    for (int y = 0; y < screenH; ++y) {
+        for (int x = 0; x < screenW; ++x) {
+            const uint8_t *p = &fb[((size_t) y * screenW + x) * 4];
+            // 未被图像覆盖的区域为白色
+            uint8_t expect[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+            if (x < (int) image.width && y < (int) image.height) {
+                memcpy(expect, &(*ref)[((size_t) y * image.width + x) * 3], 3);
+            }
+            bad += memcmp(p, expect, 4) != 0;
+        }
+    }
+    return bad;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    char *argv[] = {"bench_png", "-rfbport", "0", "-cap_mode", CAP_MODE_PNG};
+    memset(out, 0, sizeof(*out));
+    if (UiTestExtension_OnInit(host_uitest_port(), 5, argv) != RETCODE_SUCCESS) {
+        out->mismatched = -1;
+        return;
+    }
+    for (int r = 0; r < job->reps; ++r) {
+        for (int i = 0; i < job->count; ++i) {
+            double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+            screenCallback((char *) job->frames[i].data, (int) job->frames[i].size);
+            out->cpuMs += bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        }
+    }
+    out->cpuMs /= (double) job->reps * job->count;
+
+    // 校验放在计时与内存统计之后, 逐帧重放并与参考解码比较
+    uint8_t *ref = NULL;
+    size_t refCap = 0;
+    for (int i = 0; i < job->count; ++i) {
+        screenCallback((char *) job->frames[i].data, (int) job->frames[i].size);
+        long bad = bench_verify(&job->frames[i], &ref, &refCap, &out->refMs);
+        out->mismatched += bad < 0 ? 1 : bad;
+    }
+    out->refMs /= job->count;
+    free(ref);
+}
+
+int main(int argc, char **argv) {
+    int reps = 3, count = 30;
+    bool mixed = false;
+    BenchFrame *frames = calloc(argc + count, sizeof(BenchFrame));
+    int loaded = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-mixed") == 0) {
+            mixed = true;
+        } else if (bench_load_file(argv[i], &frames[loaded]) == 0) {
+            loaded++;
+        } else {
+            fprintf(stderr, "bench_png: cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (loaded > 0) {
+        count = loaded;
+    } else {
+        static const png_uint_32 formats[] = {PNG_FORMAT_RGBA, PNG_FORMAT_RGB, PNG_FORMAT_GRAY, PNG_FORMAT_GA};
+        frames = realloc(frames, sizeof(BenchFrame) * (count > 0 ? count : 1));
+        for (int i = 0; i < count; ++i) {
+            if (bench_record_frame(&frames[i], mixed ? formats[i % 4] : PNG_FORMAT_RGBA) != 0) {
+                fprintf(stderr, "bench_png: capture failed\n");
+                return 1;
+            }
+        }
+    }
+    if (count <= 0 || reps <= 0) {
+        return 1;
+    }
+
+    BenchResult result;
+    BenchJob job = {frames, count, reps};
+    if (bench_fork(bench_run, &job, &result, sizeof(result)) != 0 || result.mismatched < 0) {
+        fprintf(stderr, "bench_png: run failed\n");
+        return 1;
+    }
+    printf("frames: %d x %d reps (%s)\n", count, reps, loaded > 0 ? "recorded" : "host scene");
+    printf("streamed decode + diff: %.2f ms/frame cpu\n", result.cpuMs);
+    printf("png_image decode only:  %.2f ms/frame cpu (reference)\n", result.refMs);
+    printf("mismatched pixels vs reference: %ld\n", result.mismatched);
+    return result.mismatched == 0 ? 0 : 1;
+}
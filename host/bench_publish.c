@@ -0,0 +1,165 @@
+// 帧缓冲发布基准: 固定帧率采集, 同时连接若干读取缓慢的客户端, 统计解码线程与vnc服务器循环交接帧缓冲的耗时
+// 以及从截屏到发送各阶段的耗时分布
+// 用法: bench_publish [-clients N] [-seconds S] [-client_delay_ms D] [-port P] [agent参数...]
+//   默认 -cap_mode dmpub -cap_fps 60, 客户端使用 raw 编码且接收缓冲很小, 使服务器发送时阻塞
+//   结束时由第一个客户端发送 Ctrl+Q 停止agent
+#include "../agent.h"
+#include "../stats.h"
+#include "host_port.h"
+
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+typedef struct {
+    int port;
+    int delayMs;
+    volatile int stop;
+    atomic_ullong updates;
+    pthread_t thread;
+} BenchClient;
+
+static void *bench_client_main(void *arg) {
+    BenchClient *client = (BenchClient *) arg;
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = client->port;
+    cl->appData.encodingsString = "raw";
+    int argc = 0;
+    if (!rfbInitClient(cl, &argc, NULL)) {
+        fprintf(stderr, "bench_publish: client connect failed\n");
+        return NULL;
+    }
+    int rcvbuf = 16 * 1024;
+    setsockopt(cl->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    while (!client->stop) {
+        int n = WaitForMessage(cl, 100000);
+        if (n < 0) {
+            break;
+        }
+        if (n > 0) {
+            if (!HandleRFBServerMessage(cl)) {
+                break;
+            }
+            atomic_fetch_add(&client->updates, 1);
+        }
+        // 模拟慢速网络: 每处理一条消息停顿一下
+        usleep(client->delayMs * 1000);
+    }
+    if (client->stop == 2) {
+        SendKeyEvent(cl, XK_Control_L, TRUE);
+        SendKeyEvent(cl, XK_q, TRUE);
+        SendKeyEvent(cl, XK_q, FALSE);
+        SendKeyEvent(cl, XK_Control_L, FALSE);
+    }
+    rfbClientCleanup(cl);
+    return NULL;
+}
+
+static volatile int g_agentExited;
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    g_agentExited = 1;
+    return NULL;
+}
+
+static double bench_ms(atomic_ullong *ns) {
+    return (double) atomic_load(ns) / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int clients = 4, seconds = 5, delayMs = 50, port = 5959;
+    char portArg[16];
+    char *agentArgv[64] = {"bench_publish", "-cap_mode", CAP_MODE_DMPUB, "-cap_fps", "60", "-rfbport", portArg};
+    int agentArgc = 7;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc) {
+            clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-client_delay_ms") == 0 && i + 1 < argc) {
+            delayMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 63) {
+            // 其余参数交给agent, 后出现的同名参数覆盖默认值
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+    snprintf(portArg, sizeof(portArg), "%d", port);
+    if (clients < 1) {
+        clients = 1;
+    }
+
+    if (UiTestExtension_OnInit(host_uitest_port(), agentArgc, agentArgv) != RETCODE_SUCCESS) {
+        fprintf(stderr, "bench_publish: init failed\n");
+        return 1;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(500 * 1000);
+    if (g_agentExited) {
+        // 例如主机替身不支持的采集模式
+        fprintf(stderr, "bench_publish: agent exited early\n");
+        return 1;
+    }
+
+    BenchClient *pool = calloc(clients, sizeof(BenchClient));
+    for (int i = 0; i < clients; ++i) {
+        pool[i].port = port;
+        pool[i].delayMs = delayMs;
+        pthread_create(&pool[i].thread, NULL, bench_client_main, &pool[i]);
+    }
+    sleep(seconds);
+    for (int i = 0; i < clients; ++i) {
+        pool[i].stop = i == 0 ? 2 : 1;
+    }
+    unsigned long long updates = 0;
+    for (int i = 0; i < clients; ++i) {
+        pthread_join(pool[i].thread, NULL);
+        updates += atomic_load(&pool[i].updates);
+    }
+    pthread_join(agent, NULL);
+
+    AgentStats *s = &g_AgentStats;
+    unsigned long long pw = atomic_load(&s->producerWaits), sw = atomic_load(&s->serverWaits);
+    printf("%d clients x %d s, client delay %d ms\n", clients, seconds, delayMs);
+    printf("frames captured=%llu decoded=%llu dropped=%llu skipped=%llu, client messages=%llu\n",
+           atomic_load(&s->framesCaptured), atomic_load(&s->framesDecoded), atomic_load(&s->framesDropped),
+           atomic_load(&s->framesSkipped), updates);
+    printf("capture pauses=%llu resumes=%llu, paused %.2f s\n", atomic_load(&s->capturePauses),
+           atomic_load(&s->captureResumes), bench_ms(&s->pausedNs) / 1000);
+    printf("%-10s %10s %12s %12s %12s\n", "side", "handoffs", "total ms", "avg us", "max ms");
+    printf("%-10s %10llu %12.2f %12.2f %12.2f\n", "producer", pw, bench_ms(&s->producerWaitNs),
+           pw ? bench_ms(&s->producerWaitNs) * 1000 / pw : 0.0, bench_ms(&s->producerWaitMaxNs));
+    printf("%-10s %10llu %12.2f %12.2f %12.2f\n", "server", sw, bench_ms(&s->serverWaitNs),
+           sw ? bench_ms(&s->serverWaitNs) * 1000 / sw : 0.0, bench_ms(&s->serverWaitMaxNs));
+
+    // 各阶段的分位数取自 JSON 统计, 与 -stats_file 输出一致
+    static char json[8192];
+    if (stats_json(json, sizeof(json), NULL) < 0) {
+        return 1;
+    }
+    static const char *stages[STATS_STAGE_COUNT] = {"capture", "decode", "diff", "write", "publish", "acquire",
+                                                    "send"};
+    printf("%-10s %10s %12s %12s %12s %12s\n", "stage", "count", "avg us", "p50 us", "p99 us", "max ms");
+    for (int i = 0; i < STATS_STAGE_COUNT; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "\"%s\":{", stages[i]);
+        const char *p = strstr(json, key);
+        unsigned long long count, avg, max, p50, p90, p99;
+        if (p == NULL || sscanf(p + strlen(key), "\"count\":%llu,\"avg_us\":%llu,\"max_us\":%llu,\"p50_us\":%llu,"
+                                "\"p90_us\":%llu,\"p99_us\":%llu", &count, &avg, &max, &p50, &p90, &p99) != 6) {
+            fprintf(stderr, "bench_publish: stage %s missing\n", stages[i]);
+            return 1;
+        }
+        printf("%-10s %10llu %12llu %12llu %12llu %12.2f\n", stages[i], count, avg, p50, p99, (double) max / 1000);
+    }
+    printf("frames published=%llu, dirty pixels/frame=%.0f\n", atomic_load(&s->framesPublished),
+           atomic_load(&s->framesPublished) ?
+           (double) atomic_load(&s->dirtyPixels) / atomic_load(&s->framesPublished) : 0.0);
+    return 0;
+}
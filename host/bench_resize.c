@@ -0,0 +1,218 @@
+// 屏幕尺寸变化校验: 运行中旋转/切换替身屏幕分辨率, 客户端(支持 NewFBSize)应跟随到新尺寸且画面与替身屏幕一致
+// 用法: bench_resize [-port P] [agent参数...]
+//   依次以 dmpub / dmpub -zero_copy / png 采集, 以及替身不发送显示变化通知(只靠定期检查)的 dmpub 运行
+//   统计每次尺寸变化到客户端画面一致的耗时, 以及每帧查询屏幕参数的次数与准备截屏请求的耗时
+//   -fb_bpp 16|8 时与转换为帧缓冲格式再还原为 RGB 的替身画面比较
+#include "../agent.h"
+#include "../pixfmt.h"
+#include "../stats.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <pthread.h>
+#include <rfb/rfbclient.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_STEP_COUNT 3
+// 等待客户端跟随新尺寸的上限, 大于定期检查的间隔
+#define BENCH_FOLLOW_TIMEOUT_MS 6000
+
+typedef struct {
+    const char *mode;
+    const char *option;
+    bool notify;
+    int port;
+    int agentArgc;
+    char **agentArgv;
+} BenchJob;
+
+typedef struct {
+    int ok;
+    int followed;
+    double followMs[BENCH_STEP_COUNT];
+    unsigned long long frames;
+    unsigned long long queries;
+    unsigned long long resizes;
+    double requestAvgNs;
+} BenchResult;
+
+static void *bench_agent_main(void *arg) {
+    UiTestExtension_OnRun();
+    return NULL;
+}
+
+// 按服务器像素格式量化替身画面, 与服务器转换给32位客户端的结果一致
+static void bench_quantize(uint8_t *pixels, int32_t w, int32_t h) {
+    const rfbPixelFormat *fmt = &g_BufferManager->server->serverFormat;
+    const int bpp = fmt->bitsPerPixel / 8;
+    const int max[3] = {fmt->redMax, fmt->greenMax, fmt->blueMax};
+    const int shift[3] = {fmt->redShift, fmt->greenShift, fmt->blueShift};
+    uint8_t row[4];
+    for (size_t i = 0; i < (size_t) w * h; ++i) {
+        pixfmt_convert_row(row, &pixels[i * 4], 1, bpp);
+        uint32_t v = bpp == 2 ? (uint32_t) (row[0] | row[1] << 8) : row[0];
+        for (int c = 0; c < 3; ++c) {
+            int s = (int) (v >> shift[c]) & max[c];
+            pixels[i * 4 + c] = (uint8_t) ((s * 255 + max[c] / 2) / max[c]);
+        }
+    }
+}
+
+// 客户端画面与替身屏幕一致(忽略 alpha/填充字节)
+static bool bench_matches(rfbClient *cl) {
+    int32_t w, h;
+    uint8_t *pixels = host_port_capture(&w, &h);
+    bool same = pixels != NULL && cl->width == w && cl->height == h;
+    if (same && g_BufferManager->server->serverFormat.bitsPerPixel != 32) {
+        bench_quantize(pixels, w, h);
+    }
+    for (size_t i = 0; same && i < (size_t) w * h; ++i) {
+        same = memcmp(&cl->frameBuffer[i * 4], &pixels[i * 4], 3) == 0;
+    }
+    free(pixels);
+    return same;
+}
+
+/**
+ * 接收画面直到客户端尺寸与内容都与替身屏幕一致
+ *
+ * @return 耗时(毫秒), 超时返回-1
+ */
+static double bench_follow(rfbClient *cl, int width, int height) {
+    double start = bench_now(CLOCK_MONOTONIC);
+    while (bench_now(CLOCK_MONOTONIC) - start < BENCH_FOLLOW_TIMEOUT_MS) {
+        int n = WaitForMessage(cl, 10000);
+        if (n < 0 || (n > 0 && !HandleRFBServerMessage(cl))) {
+            return -1;
+        }
+        if (cl->width == width && cl->height == height && bench_matches(cl)) {
+            return bench_now(CLOCK_MONOTONIC) - start;
+        }
+    }
+    return -1;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    memset(out, 0, sizeof(*out));
+    setenv("AGENT_HOST_SCREEN", "360x640", 1);
+    setenv("AGENT_HOST_SCENE", "static", 1);
+    if (!job->notify) {
+        setenv("AGENT_HOST_NO_DISPLAY_LISTENER", "1", 1);
+    }
+    char portArg[16];
+    snprintf(portArg, sizeof(portArg), "%d", job->port);
+    char *argv[80] = {"bench_resize", "-cap_mode", (char *) job->mode, "-cap_fps", "30", "-rfbport", portArg};
+    int argc = 7;
+    if (job->option[0]) {
+        argv[argc++] = (char *) job->option;
+    }
+    for (int i = 0; i < job->agentArgc && argc < 80; ++i) {
+        argv[argc++] = job->agentArgv[i];
+    }
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    pthread_t agent;
+    pthread_create(&agent, NULL, bench_agent_main, NULL);
+    usleep(300 * 1000);
+
+    rfbClient *cl = rfbGetClient(8, 3, 4);
+    cl->serverHost = strdup("127.0.0.1");
+    cl->serverPort = job->port;
+    cl->appData.encodingsString = "raw";
+    // 光标形状单独发送, 否则服务器会把光标画进发送的画面
+    cl->appData.useRemoteCursor = TRUE;
+    int clientArgc = 0;
+    if (!rfbInitClient(cl, &clientArgc, NULL)) {
+        fprintf(stderr, "bench_resize: client connect failed\n");
+        return;
+    }
+    if (bench_follow(cl, 360, 640) < 0) {
+        fprintf(stderr, "bench_resize: initial frame mismatch\n");
+        return;
+    }
+    AgentStats *s = &g_AgentStats;
+    unsigned long long queries = atomic_load(&s->displayQueries);
+    unsigned long long requests = atomic_load(&s->captureRequests);
+    unsigned long long requestNs = atomic_load(&s->captureRequestNs);
+
+    // 旋转, 转回, 切换分辨率
+    static const int steps[BENCH_STEP_COUNT][2] = {{640, 360}, {360, 640}, {720, 1280}};
+    for (int i = 0; i < BENCH_STEP_COUNT; ++i) {
+        host_screen_resize(steps[i][0], steps[i][1]);
+        out->followMs[i] = bench_follow(cl, steps[i][0], steps[i][1]);
+        out->followed += out->followMs[i] >= 0;
+    }
+    // 尺寸稳定后再采集一段, 使每帧的查询次数有代表性
+    double settle = bench_now(CLOCK_MONOTONIC);
+    while (bench_now(CLOCK_MONOTONIC) - settle < 1000) {
+        if (WaitForMessage(cl, 10000) > 0 && !HandleRFBServerMessage(cl)) {
+            break;
+        }
+    }
+
+    // 每次截屏准备一次请求, 零拷贝模式不经过流水线时也计数
+    out->frames = atomic_load(&s->captureRequests) - requests;
+    out->queries = atomic_load(&s->displayQueries) - queries;
+    out->resizes = atomic_load(&s->screenResizes);
+    out->requestAvgNs = out->frames ? (double) (atomic_load(&s->captureRequestNs) - requestNs) / out->frames : 0;
+    out->ok = 1;
+    // 子进程随后直接退出, 不等待agent停止
+    rfbClientCleanup(cl);
+}
+
+int main(int argc, char **argv) {
+    int port = 5999;
+    char *agentArgv[64];
+    int agentArgc = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (agentArgc < 64) {
+            agentArgv[agentArgc++] = argv[i];
+        }
+    }
+
+    static const BenchJob jobs[] = {
+        {CAP_MODE_DMPUB, "", true},
+        {CAP_MODE_DMPUB, "-zero_copy", true},
+        {CAP_MODE_PNG, "", true},
+        {CAP_MODE_DMPUB, "", false},
+    };
+    static const char *names[] = {"dmpub", "zero copy", "png", "no notify"};
+    int status = 0;
+    printf("360x640 -> 640x360 -> 360x640 -> 720x1280\n");
+    printf("%-10s %9s %9s %9s %8s %8s %10s %12s\n", "capture", "rotate", "back", "resize", "frames", "queries",
+           "query/frm", "request ns");
+    for (int i = 0; i < 4; ++i) {
+        BenchJob job = jobs[i];
+        job.port = port + i;
+        job.agentArgc = agentArgc;
+        job.agentArgv = agentArgv;
+        BenchResult res;
+        if (bench_fork(bench_run, &job, &res, sizeof(res)) != 0 || !res.ok) {
+            fprintf(stderr, "bench_resize: run failed (%s)\n", names[i]);
+            return 1;
+        }
+        printf("%-10s", names[i]);
+        for (int k = 0; k < BENCH_STEP_COUNT; ++k) {
+            if (res.followMs[k] >= 0) {
+                printf(" %9.1f", res.followMs[k]);
+            } else {
+                printf(" %9s", "TIMEOUT");
+            }
+        }
+        printf(" %8llu %8llu %10.3f %12.1f\n", res.frames, res.queries,
+               res.frames ? (double) res.queries / res.frames : 0.0, res.requestAvgNs);
+        if (res.followed != BENCH_STEP_COUNT || res.resizes != BENCH_STEP_COUNT) {
+            printf("  followed %d/%d, framebuffer resized %llu time(s)\n", res.followed, BENCH_STEP_COUNT,
+                   res.resizes);
+            status = 1;
+        }
+    }
+    printf("%s\n", status == 0 ? "client followed every change" : "MISMATCH");
+    return status;
+}
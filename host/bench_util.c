@@ -0,0 +1,51 @@
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+double bench_now(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int bench_load_file(const char *path, BenchFrame *frame) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    frame->data = malloc(size > 0 ? size : 1);
+    frame->size = fread(frame->data, 1, size > 0 ? size : 0, fp);
+    fclose(fp);
+    return frame->size > 0 ? 0 : -1;
+}
+
+int bench_fork(void (*fn)(void *arg, void *result), void *arg, void *result, size_t resultSize) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        fn(arg, result);
+        ssize_t n = write(fds[1], result, resultSize);
+        _exit(n == (ssize_t) resultSize ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], result, resultSize);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return n == (ssize_t) resultSize && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
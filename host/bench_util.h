@@ -0,0 +1,18 @@
+#ifndef UITEST_AGENT_VNC_BENCH_UTIL_H
+#define UITEST_AGENT_VNC_BENCH_UTIL_H
+
+#include <stddef.h>
+#include <time.h>
+
+// 主机构建基准工具的公共部分
+typedef struct {
+    unsigned char *data;
+    unsigned long size;
+} BenchFrame;
+
+double bench_now(clockid_t clock);
+int bench_load_file(const char *path, BenchFrame *frame);
+// 在子进程中运行 fn, 结果通过管道带回, 每次运行的 agent 状态互不影响
+int bench_fork(void (*fn)(void *arg, void *result), void *arg, void *result, size_t resultSize);
+
+#endif //UITEST_AGENT_VNC_BENCH_UTIL_H
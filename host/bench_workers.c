@@ -0,0 +1,168 @@
+// 多线程条带处理基准: 同一段序列分别以 -workers 1..N 重放, 对比耗时并校验各线程数的发布结果完全一致
+// 用法: bench_workers [-reps N] [-frames N] [-max N] [-quality Q]
+//   画面来自主机替身(AGENT_HOST_SCENE/AGENT_HOST_SCREEN), 依次测试:
+//   jpeg-rst: 每个 MCU 行一个重启间隔的 JPEG, 可按条带并行解码
+//   jpeg: 无重启标记的 JPEG, 只有差分并行
+//   png / dmpub: 差分与复制并行
+#include "../agent.h"
+#include "../diff.h"
+#include "../workers.h"
+#include "bench_util.h"
+#include "host_port.h"
+
+#include <jpeglib.h>
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double wallMs;
+    double cpuMs;
+    uint64_t digest;
+    int workers;
+} BenchResult;
+
+typedef struct {
+    const char *mode;
+    const BenchFrame *frames;
+    int count;
+    int reps;
+    int workers;
+} BenchJob;
+
+static int bench_encode_jpeg(BenchFrame *frame, const uint8_t *pixels, int w, int h, int quality, bool restart) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    frame->data = NULL;
+    frame->size = 0;
+    jpeg_mem_dest(&cinfo, &frame->data, &frame->size);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_RGBX;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    if (restart) {
+        cinfo.restart_in_rows = 1;
+    }
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW) &pixels[(size_t) cinfo.next_scanline * w * 4];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return 0;
+}
+
+static int bench_encode_png(BenchFrame *frame, const uint8_t *pixels, int w, int h) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+    png_alloc_size_t size = 0;
+    png_image_write_get_memory_size(image, size, 0, pixels, 0, NULL);
+    frame->data = malloc(size);
+    int ok = png_image_write_to_memory(&image, frame->data, &size, 0, pixels, 0, NULL);
+    frame->size = size;
+    return ok ? 0 : -1;
+}
+
+static void bench_run(void *arg, void *result) {
+    const BenchJob *job = (const BenchJob *) arg;
+    BenchResult *out = (BenchResult *) result;
+    char workers[16];
+    snprintf(workers, sizeof(workers), "%d", job->workers);
+    const char *capMode = strncmp(job->mode, "jpeg", 4) == 0 ? CAP_MODE_DEFAULT : job->mode;
+    char *argv[] = {"bench_workers", "-rfbport", "0", "-cap_mode", (char *) capMode, "-workers", workers};
+    memset(out, 0, sizeof(*out));
+    if (UiTestExtension_OnInit(host_uitest_port(), 7, argv) != RETCODE_SUCCESS) {
+        return;
+    }
+    out->workers = workers_count();
+    const size_t fbSize = (size_t) g_BufferManager->bufferSize;
+    for (int r = 0; r < job->reps; ++r) {
+        for (int i = 0; i < job->count; ++i) {
+            double wall = bench_now(CLOCK_MONOTONIC);
+            double cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+            screenCallback((char *) job->frames[i].data, (int) job->frames[i].size);
+            out->cpuMs += bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+            out->wallMs += bench_now(CLOCK_MONOTONIC) - wall;
+            out->digest = diff_hash(g_BufferManager->buffers[g_BufferManager->published], fbSize, out->digest);
+        }
+    }
+    out->wallMs /= (double) job->reps * job->count;
+    out->cpuMs /= (double) job->reps * job->count;
+    workers_shutdown();
+}
+
+int main(int argc, char **argv) {
+    int reps = 3, count = 30, maxWorkers = 8, quality = 85;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            maxWorkers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc) {
+            quality = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "bench_workers: unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (count <= 0 || reps <= 0 || maxWorkers < 1) {
+        return 1;
+    }
+    if (maxWorkers > WORKERS_MAX) {
+        maxWorkers = WORKERS_MAX;
+    }
+
+    static const char *modes[] = {"jpeg-rst", "jpeg", CAP_MODE_PNG, CAP_MODE_DMPUB};
+    const int modeCount = sizeof(modes) / sizeof(modes[0]);
+    BenchFrame *frames = calloc((size_t) modeCount * count, sizeof(BenchFrame));
+    for (int i = 0; i < count; ++i) {
+        int32_t w, h;
+        uint8_t *pixels = host_port_capture(&w, &h);
+        if (pixels == NULL) {
+            fprintf(stderr, "bench_workers: capture failed\n");
+            return 1;
+        }
+        bench_encode_jpeg(&frames[i], pixels, w, h, quality, true);
+        bench_encode_jpeg(&frames[count + i], pixels, w, h, quality, false);
+        if (bench_encode_png(&frames[2 * count + i], pixels, w, h) != 0) {
+            fprintf(stderr, "bench_workers: png encode failed\n");
+            return 1;
+        }
+        frames[3 * count + i].data = pixels;
+        frames[3 * count + i].size = (unsigned long) w * h * 4;
+    }
+
+    printf("frames: %d x %d reps (host scene)\n", count, reps);
+    printf("%-10s %8s %10s %10s %9s\n", "mode", "workers", "wall ms", "cpu ms", "speedup");
+    int status = 0;
+    for (int m = 0; m < modeCount; ++m) {
+        BenchResult base;
+        for (int n = 1; n <= maxWorkers; n *= 2) {
+            BenchJob job = {modes[m], &frames[m * count], count, reps, n};
+            BenchResult res;
+            if (bench_fork(bench_run, &job, &res, sizeof(res)) != 0 || res.workers == 0) {
+                fprintf(stderr, "bench_workers: run failed\n");
+                return 1;
+            }
+            if (n == 1) {
+                base = res;
+            }
+            bool same = res.digest == base.digest;
+            printf("%-10s %8d %10.2f %10.2f %8.2fx%s\n", modes[m], res.workers, res.wallMs, res.cpuMs,
+                   res.wallMs > 0 ? base.wallMs / res.wallMs : 0.0, same ? "" : "  output DIFFERS");
+            status |= !same;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,11 @@
+// 主机构建入口: 模拟 uitest 加载扩展的流程, 直接调用 UiTestExtension_OnInit/OnRun
+// 用法: agent_host -cap_mode dmpub [-zero_copy] [-agent_debug] [libvncserver参数...]
+#include "../agent.h"
+#include "host_port.h"
+
+int main(int argc, char **argv) {
+    if (UiTestExtension_OnInit(host_uitest_port(), argc, argv) != RETCODE_SUCCESS) {
+        return 1;
+    }
+    return UiTestExtension_OnRun() == RETCODE_SUCCESS ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+// 主机构建替身: 模拟 uitest 提供给扩展的 UiTestPort/LowLevelFunctions
+// Driver 的其余接口(按键/文本输入等): 记录完整消息(host_port_calls), 返回成功
+// LowLevelFunctions.atomicTouch: 记录每次触摸及完成时间(host_port_touches)
+//   环境变量 AGENT_HOST_TOUCH_DELAY_US=N 时每次触摸阻塞N微秒, 模拟较慢的注入
+// Driver.screenCapture: 将替身画面编码为PNG写入传入的fd, 写完关闭fd(与真实驱动一致)
+//   环境变量 AGENT_HOST_REJECT_MEMFD=1 时拒绝内存文件, 用于验证回退到临时文件;
+//   =N(N>1) 时每N次拒绝一次, 模拟偶发失败, 用于验证之后仍继续使用内存文件
+// LowLevelFunctions.startCapture/stopCapture: 独立线程按30fps把替身画面编码为JPEG回调给扩展, 模拟设备的JPEG采集
+#include "host_port.h"
+
+#include <png.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <jpeglib.h>
+#include <window_manager/oh_display_manager.h>
+#include <window_manager/oh_display_capture.h>
+#include <multimedia/image_framework/image/pixelmap_native.h>
+
+uint8_t *host_port_capture(int32_t *width, int32_t *height) {
+    OH_PixelmapNative *pm = NULL;
+    if (OH_NativeDisplayManager_CaptureScreenPixelmap(0, &pm) != DISPLAY_MANAGER_OK) {
+        return NULL;
+    }
+    // 截屏期间替身屏幕尺寸不会改变
+    OH_NativeDisplayManager_GetDefaultDisplayWidth(width);
+    OH_NativeDisplayManager_GetDefaultDisplayHeight(height);
+    size_t size = (size_t) *width * *height * 4;
+    g_hostStubDepth++;
+    uint8_t *pixels = malloc(size);
+    g_hostStubDepth--;
+    if (pixels) {
+        OH_PixelmapNative_ReadPixels(pm, pixels, &size);
+    }
+    OH_PixelmapNative_Destroy(&pm);
+    return pixels;
+}
+
+static const char *host_screen_capture(const char *msg) {
+    const char *args = strstr(msg, "\"args\":[");
+    int fd = args ? atoi(args + 8) : -1;
+    if (fd < 0) {
+        return "{\"exception\":{\"code\":401,\"message\":\"invalid fd\"}}";
+    }
+    const char *reject = getenv("AGENT_HOST_REJECT_MEMFD");
+    int every = reject ? atoi(reject) : 0;
+    if (every > 0) {
+        static int memfdCaptures;
+        char link[64], target[256];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = readlink(link, target, sizeof(target) - 1);
+        if (n > 0 && (target[n] = '\0', strncmp(target, "/memfd:", 7) == 0) && ++memfdCaptures % every == 0) {
+            close(fd);
+            return "{\"exception\":{\"code\":401,\"message\":\"memfd rejected\"}}";
+        }
+    }
+
+    int32_t w, h;
+    uint8_t *pixels = host_port_capture(&w, &h);
+    if (pixels == NULL) {
+        close(fd);
+        return "{\"exception\":{\"code\":401,\"message\":\"capture failed\"}}";
+    }
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+    FILE *fp = fdopen(fd, "wb");
+    int ok = fp && png_image_write_to_stdio(&image, fp, 0, pixels, 0, NULL);
+    if (fp) {
+        fclose(fp);
+    } else {
+        close(fd);
+    }
+    free(pixels);
+    return ok ? "{\"result\":true}" : "{\"exception\":{\"code\":401,\"message\":\"write failed\"}}";
+}
+
+#define HOST_CALL_MAX 4096
+
+static char *g_hostCalls[HOST_CALL_MAX];
+static size_t g_hostCallCount;
+static pthread_mutex_t g_hostCallLock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t host_port_calls(char *const **calls) {
+    pthread_mutex_lock(&g_hostCallLock);
+    *calls = g_hostCalls;
+    size_t count = g_hostCallCount;
+    pthread_mutex_unlock(&g_hostCallLock);
+    return count;
+}
+
+static RetCode host_callThroughMessage(struct Text in, struct ReceiveBuffer out, int32_t *fatalError) {
+    const char *reply = "{\"result\":null}";
+    if (in.data && strstr(in.data, "\"Driver.screenCapture\"")) {
+        g_hostStubDepth++;
+        reply = host_screen_capture(in.data);
+        g_hostStubDepth--;
+    } else if (in.data) {
+        if (strstr(in.data, "\"Driver.create\"")) {
+            reply = "{\"result\":\"Driver#0\"}";
+        }
+        pthread_mutex_lock(&g_hostCallLock);
+        if (g_hostCallCount < HOST_CALL_MAX) {
+            g_hostCalls[g_hostCallCount++] = strndup(in.data, in.size);
+        }
+        pthread_mutex_unlock(&g_hostCallLock);
+    }
+    size_t len = strlen(reply);
+    size_t n = len < out.capacity ? len : out.capacity;
+    memcpy(out.data, reply, n);
+    if (out.size) {
+        *out.size = n;
+    }
+    *fatalError = 0;
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_setCallbackMessageHandler(DataCallback handler) {
+    return RETCODE_SUCCESS;
+}
+
+#define HOST_TOUCH_MAX 65536
+
+static HostTouch g_hostTouches[HOST_TOUCH_MAX];
+static size_t g_hostTouchCount;
+
+size_t host_port_touches(const HostTouch **touches) {
+    *touches = g_hostTouches;
+    return g_hostTouchCount;
+}
+
+static RetCode host_atomicTouch(int32_t stage, int32_t px, int32_t py) {
+    const char *delay = getenv("AGENT_HOST_TOUCH_DELAY_US");
+    if (delay && atoi(delay) > 0) {
+        usleep(atoi(delay));
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (g_hostTouchCount < HOST_TOUCH_MAX) {
+        HostTouch *touch = &g_hostTouches[g_hostTouchCount];
+        touch->stage = stage;
+        touch->x = px;
+        touch->y = py;
+        touch->ns = (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+    }
+    g_hostTouchCount++;
+    fprintf(stderr, "host: atomicTouch stage=%d x=%d y=%d\n", stage, px, py);
+    return RETCODE_SUCCESS;
+}
+
+#define HOST_CAPTURE_INTERVAL_US 33333
+#define HOST_CAPTURE_QUALITY 80
+
+static pthread_t g_hostCaptureThread;
+static atomic_bool g_hostCaptureRun;
+static DataCallback g_hostCaptureCallback;
+
+static void *host_capture_task(void *arg) {
+    // 模拟设备截屏编码, 只有回调属于agent
+    g_hostStubDepth++;
+    while (atomic_load(&g_hostCaptureRun)) {
+        int32_t w, h;
+        uint8_t *pixels = host_port_capture(&w, &h);
+        if (pixels != NULL) {
+            unsigned char *data = NULL;
+            unsigned long size = 0;
+            struct jpeg_compress_struct cinfo;
+            struct jpeg_error_mgr jerr;
+            cinfo.err = jpeg_std_error(&jerr);
+            jpeg_create_compress(&cinfo);
+            jpeg_mem_dest(&cinfo, &data, &size);
+            cinfo.image_width = w;
+            cinfo.image_height = h;
+            cinfo.input_components = 4;
+            cinfo.in_color_space = JCS_EXT_RGBX;
+            jpeg_set_defaults(&cinfo);
+            jpeg_set_quality(&cinfo, HOST_CAPTURE_QUALITY, TRUE);
+            jpeg_start_compress(&cinfo, TRUE);
+            while (cinfo.next_scanline < cinfo.image_height) {
+                JSAMPROW row = &pixels[(size_t) cinfo.next_scanline * w * 4];
+                jpeg_write_scanlines(&cinfo, &row, 1);
+            }
+            jpeg_finish_compress(&cinfo);
+            jpeg_destroy_compress(&cinfo);
+            free(pixels);
+            struct Text bytes = {.data = (const char *) data, .size = size};
+            g_hostStubDepth--;
+            g_hostCaptureCallback(bytes);
+            g_hostStubDepth++;
+            free(data);
+        }
+        usleep(HOST_CAPTURE_INTERVAL_US);
+    }
+    return NULL;
+}
+
+static RetCode host_startCapture(struct Text name, DataCallback callback, struct Text optJson) {
+    if (callback == NULL || atomic_load(&g_hostCaptureRun)) {
+        return RETCODE_FAIL;
+    }
+    g_hostCaptureCallback = callback;
+    atomic_store(&g_hostCaptureRun, true);
+    if (pthread_create(&g_hostCaptureThread, NULL, host_capture_task, NULL) != 0) {
+        atomic_store(&g_hostCaptureRun, false);
+        return RETCODE_FAIL;
+    }
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_stopCapture(struct Text name) {
+    if (!atomic_exchange(&g_hostCaptureRun, false)) {
+        return RETCODE_FAIL;
+    }
+    pthread_join(g_hostCaptureThread, NULL);
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_initLowLevelFunctions(struct LowLevelFunctions *out) {
+    memset(out, 0, sizeof(*out));
+    out->callThroughMessage = host_callThroughMessage;
+    out->setCallbackMessageHandler = host_setCallbackMessageHandler;
+    out->atomicTouch = host_atomicTouch;
+    out->startCapture = host_startCapture;
+    out->stopCapture = host_stopCapture;
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_getUiTestVersion(struct ReceiveBuffer out) {
+    int n = snprintf((char *) out.data, out.capacity, "host");
+    if (out.size) {
+        *out.size = n;
+    }
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_printLog(int32_t level, struct Text tag, struct Text format, va_list ap) {
+    vfprintf(stderr, format.data, ap);
+    fputc('\n', stderr);
+    return RETCODE_SUCCESS;
+}
+
+static RetCode host_getAndClearLastError(int32_t *codeOut, struct ReceiveBuffer msgOut) {
+    *codeOut = 0;
+    return RETCODE_SUCCESS;
+}
+
+struct UiTestPort host_uitest_port(void) {
+    struct UiTestPort port = {
+        .getUiTestVersion = host_getUiTestVersion,
+        .printLog = host_printLog,
+        .getAndClearLastError = host_getAndClearLastError,
+        .initLowLevelFunctions = host_initLowLevelFunctions,
+    };
+    return port;
+}
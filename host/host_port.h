@@ -0,0 +1,33 @@
+#ifndef UITEST_AGENT_VNC_HOST_PORT_H
+#define UITEST_AGENT_VNC_HOST_PORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ohos/extension_c_api.h>
+
+// 主机构建下模拟 uitest 提供给扩展的接口
+struct UiTestPort host_uitest_port(void);
+// 从替身屏幕截取一帧 RGBA 像素, 调用者负责free
+uint8_t *host_port_capture(int32_t *width, int32_t *height);
+
+// 替身屏幕改为 width x height (如旋转时交换宽高), 并通知已注册的显示变化监听
+void host_screen_resize(int width, int height);
+
+// 当前线程正在执行替身(模拟系统)代码的嵌套深度, 统计agent自身的内存分配时据此排除替身的分配
+extern __thread int g_hostStubDepth;
+
+// 替身 callThroughMessage 记录的 Driver 调用(截图除外), 按调用顺序排列
+size_t host_port_calls(char *const **calls);
+
+// 替身 atomicTouch 记录的触摸事件, ns 为注入完成时间(CLOCK_MONOTONIC)
+typedef struct {
+    int32_t stage;
+    int32_t x;
+    int32_t y;
+    uint64_t ns;
+} HostTouch;
+
+// 返回已记录的触摸事件数, 超过容量的部分只计数不记录
+size_t host_port_touches(const HostTouch **touches);
+
+#endif //UITEST_AGENT_VNC_HOST_PORT_H
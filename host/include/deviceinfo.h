@@ -0,0 +1,7 @@
+// 主机构建替身: 仅声明agent用到的 deviceinfo 接口
+#ifndef UITEST_AGENT_VNC_HOST_DEVICEINFO_H
+#define UITEST_AGENT_VNC_HOST_DEVICEINFO_H
+
+const char *OH_GetMarketName(void);
+
+#endif //UITEST_AGENT_VNC_HOST_DEVICEINFO_H
@@ -0,0 +1,22 @@
+// 主机构建替身: 仅声明agent用到的 hilog 接口
+#ifndef UITEST_AGENT_VNC_HOST_HILOG_LOG_H
+#define UITEST_AGENT_VNC_HOST_HILOG_LOG_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+typedef enum {
+    LOG_APP = 0,
+} LogType;
+
+typedef enum {
+    LOG_DEBUG = 3,
+    LOG_INFO = 4,
+    LOG_WARN = 5,
+    LOG_ERROR = 6,
+    LOG_FATAL = 7,
+} LogLevel;
+
+int OH_LOG_Print(LogType type, LogLevel level, unsigned int domain, const char *tag, const char *fmt, ...);
+
+#endif //UITEST_AGENT_VNC_HOST_HILOG_LOG_H
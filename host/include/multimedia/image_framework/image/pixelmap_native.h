@@ -0,0 +1,18 @@
+// 主机构建替身: 仅声明agent用到的 pixelmap 接口
+#ifndef UITEST_AGENT_VNC_HOST_PIXELMAP_NATIVE_H
+#define UITEST_AGENT_VNC_HOST_PIXELMAP_NATIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    IMAGE_SUCCESS = 0,
+    IMAGE_BAD_PARAMETER = 401,
+} Image_ErrorCode;
+
+typedef struct OH_PixelmapNative OH_PixelmapNative;
+
+Image_ErrorCode OH_PixelmapNative_ReadPixels(OH_PixelmapNative *pixelmap, uint8_t *destination, size_t *bufferSize);
+Image_ErrorCode OH_PixelmapNative_Destroy(OH_PixelmapNative **pixelmap);
+
+#endif //UITEST_AGENT_VNC_HOST_PIXELMAP_NATIVE_H
@@ -0,0 +1,11 @@
+// 主机构建替身: 仅声明agent用到的截屏接口
+#ifndef UITEST_AGENT_VNC_HOST_OH_DISPLAY_CAPTURE_H
+#define UITEST_AGENT_VNC_HOST_OH_DISPLAY_CAPTURE_H
+
+#include <window_manager/oh_display_manager.h>
+#include <multimedia/image_framework/image/pixelmap_native.h>
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_CaptureScreenPixelmap(uint32_t displayId,
+                                                                             OH_PixelmapNative **pixelMap);
+
+#endif //UITEST_AGENT_VNC_HOST_OH_DISPLAY_CAPTURE_H
@@ -0,0 +1,22 @@
+// 主机构建替身: 仅声明agent用到的 display manager 接口
+#ifndef UITEST_AGENT_VNC_HOST_OH_DISPLAY_MANAGER_H
+#define UITEST_AGENT_VNC_HOST_OH_DISPLAY_MANAGER_H
+
+#include <stdint.h>
+
+typedef enum {
+    DISPLAY_MANAGER_OK = 0,
+    DISPLAY_MANAGER_ERROR_INVALID_PARAM = 401,
+    DISPLAY_MANAGER_ERROR_SYSTEM_ABNORMAL = 1400003,
+} NativeDisplayManager_ErrorCode;
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayId(uint64_t *displayId);
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayWidth(int32_t *displayWidth);
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayHeight(int32_t *displayHeight);
+
+typedef void (*OH_NativeDisplayManager_DisplayChangeCallback)(uint64_t displayId);
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_RegisterDisplayChangeListener(
+    OH_NativeDisplayManager_DisplayChangeCallback displayChangeCallback, uint32_t *listenerIndex);
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_UnregisterDisplayChangeListener(uint32_t listenerIndex);
+
+#endif //UITEST_AGENT_VNC_HOST_OH_DISPLAY_MANAGER_H
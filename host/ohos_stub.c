@@ -0,0 +1,400 @@
+// 主机构建替身: 在Linux上模拟agent用到的OHOS接口, 便于离线测试与性能测量
+// 屏幕尺寸: 环境变量 AGENT_HOST_SCREEN=WxH, 默认 1080x2400
+// 画面内容: 环境变量 AGENT_HOST_SCENE=static|clock|full|scroll|pager, 默认 clock
+//   static: 画面始终不变
+//   clock: 顶部时钟每秒变化一次, 底部一个方块每帧移动(模拟状态栏+加载动画)
+//   full: 每帧全屏变化
+//   scroll: 状态栏与导航栏之间的列表每帧向上滚动若干行
+//   pager: 状态栏与导航栏之间的页面每帧向左滑动若干列
+// 环境变量 AGENT_HOST_REPLAY=frames.bin 时循环重放 bench_pipeline -record 保存的 BGRA 帧, 屏幕尺寸取第一帧
+// host_screen_resize 改变屏幕尺寸(模拟旋转/分辨率切换), 并通知已注册的显示变化监听
+//   环境变量 AGENT_HOST_NO_DISPLAY_LISTENER=1 时拒绝注册监听, 用于验证定期检查
+#include <hilog/log.h>
+#include <deviceinfo.h>
+#include <window_manager/oh_display_manager.h>
+#include <window_manager/oh_display_capture.h>
+#include <multimedia/image_framework/image/pixelmap_native.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+
+struct OH_PixelmapNative {
+    int width;
+    int height;
+    const uint8_t *pixels;
+};
+
+// 当前线程正在执行替身(模拟系统)代码的嵌套深度, 见 host_port.h
+__thread int g_hostStubDepth;
+
+static const char *g_hostLogLevel[] = {"D", "I", "W", "E", "F"};
+
+int OH_LOG_Print(LogType type, LogLevel level, unsigned int domain, const char *tag, const char *fmt, ...) {
+    // 去掉 hilog 的 {public}/{private} 修饰
+    char format[256];
+    size_t n = 0;
+    for (const char *p = fmt; *p && n + 1 < sizeof(format); ++p) {
+        if (*p == '{') {
+            const char *end = strchr(p, '}');
+            if (end && (strncmp(p, "{public}", 8) == 0 || strncmp(p, "{private}", 9) == 0)) {
+                p = end;
+                continue;
+            }
+        }
+        format[n++] = *p;
+    }
+    format[n] = '\0';
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int idx = level >= LOG_DEBUG && level <= LOG_FATAL ? level - LOG_DEBUG : 1;
+    fprintf(stderr, "%ld.%06ld %s %s: ", (long) now.tv_sec, now.tv_nsec / 1000, g_hostLogLevel[idx], tag);
+    va_list args;
+    va_start(args, fmt);
+    int ret = vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    return ret;
+}
+
+const char *OH_GetMarketName(void) {
+    return "UiTest Agent Host";
+}
+
+// OHOS libc 的 fortify 检查, 预编译的 libvncserver.a 依赖该符号
+int __fd_chk(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        abort();
+    }
+    return fd;
+}
+
+static pthread_once_t g_hostScreenOnce = PTHREAD_ONCE_INIT;
+static int g_hostWidth = 1080;
+static int g_hostHeight = 2400;
+static const char *g_hostScene = "clock";
+static uint8_t *g_hostCanvas;
+static pthread_mutex_t g_hostCanvasLock = PTHREAD_MUTEX_INITIALIZER;
+// 重放的帧(已转换为画布的 RGBA), 尺寸均与第一帧相同
+static uint8_t **g_hostReplay;
+static int g_hostReplayCount;
+static int g_hostReplayWidth;
+static int g_hostReplayHeight;
+
+static void host_fill_rect(int x1, int y1, int x2, int y2, uint32_t rgba) {
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > g_hostWidth) x2 = g_hostWidth;
+    if (y2 > g_hostHeight) y2 = g_hostHeight;
+    for (int y = y1; y < y2; ++y) {
+        uint32_t *row = (uint32_t *) (g_hostCanvas + (size_t) y * g_hostWidth * 4);
+        for (int x = x1; x < x2; ++x) {
+            row[x] = rgba;
+        }
+    }
+}
+
+static uint32_t host_background(int x, int y) {
+    uint8_t px[4] = {(uint8_t) (x * 255 / g_hostWidth), (uint8_t) (y * 255 / g_hostHeight), 0x80, 0xFF};
+    uint32_t v;
+    memcpy(&v, px, 4);
+    return v;
+}
+
+// 按当前尺寸重新分配画布并绘制背景, 调用者持有画布锁或尚未开始截屏
+static void host_screen_alloc() {
+    free(g_hostCanvas);
+    g_hostCanvas = malloc((size_t) g_hostWidth * g_hostHeight * 4);
+    for (int y = 0; y < g_hostHeight; ++y) {
+        uint32_t *row = (uint32_t *) (g_hostCanvas + (size_t) y * g_hostWidth * 4);
+        for (int x = 0; x < g_hostWidth; ++x) {
+            row[x] = host_background(x, y);
+        }
+    }
+}
+
+static uint32_t host_u32le(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * 读取 bench_pipeline 的容器文件中与第一帧同尺寸的 BGRA 帧, JPEG/PNG 帧跳过
+ * 容器格式: "AGFRAMES" 后接若干条 {宽, 高, 字节数(均为 uint32 小端), 帧数据}
+ */
+static void host_replay_load(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "host: cannot open %s\n", path);
+        return;
+    }
+    uint8_t header[12];
+    if (fread(header, 1, 8, fp) != 8 || memcmp(header, "AGFRAMES", 8) != 0) {
+        fprintf(stderr, "host: %s is not a frame container\n", path);
+        fclose(fp);
+        return;
+    }
+    while (fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+        int w = (int) host_u32le(header), h = (int) host_u32le(header + 4);
+        uint32_t size = host_u32le(header + 8);
+        uint8_t *data = malloc(size ? size : 1);
+        if (fread(data, 1, size, fp) != size) {
+            free(data);
+            break;
+        }
+        bool raw = w > 0 && h > 0 && size == (uint32_t) w * h * 4;
+        if (raw && g_hostReplayCount == 0) {
+            g_hostReplayWidth = w;
+            g_hostReplayHeight = h;
+        }
+        if (!raw || w != g_hostReplayWidth || h != g_hostReplayHeight) {
+            free(data);
+            continue;
+        }
+        for (size_t i = 0; i < (size_t) w * h; ++i) {
+            uint8_t b = data[i * 4];
+            data[i * 4] = data[i * 4 + 2];
+            data[i * 4 + 2] = b;
+        }
+        g_hostReplay = realloc(g_hostReplay, sizeof(uint8_t *) * (g_hostReplayCount + 1));
+        g_hostReplay[g_hostReplayCount++] = data;
+    }
+    fclose(fp);
+    if (g_hostReplayCount > 0) {
+        g_hostWidth = g_hostReplayWidth;
+        g_hostHeight = g_hostReplayHeight;
+    }
+    fprintf(stderr, "host: replay %d frame(s) of %dx%d\n", g_hostReplayCount, g_hostReplayWidth,
+            g_hostReplayHeight);
+}
+
+static void host_screen_init() {
+    const char *size = getenv("AGENT_HOST_SCREEN");
+    int w, h;
+    if (size && sscanf(size, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+        g_hostWidth = w;
+        g_hostHeight = h;
+    }
+    const char *scene = getenv("AGENT_HOST_SCENE");
+    if (scene && scene[0]) {
+        g_hostScene = scene;
+    }
+    const char *replay = getenv("AGENT_HOST_REPLAY");
+    if (replay && replay[0]) {
+        host_replay_load(replay);
+    }
+    host_screen_alloc();
+}
+
+#define HOST_BAR_TOP 64
+#define HOST_BAR_BOTTOM 96
+#define HOST_SCROLL_STEP 12
+#define HOST_PAGER_STEP 24
+
+// 列表内容坐标 (x, y) 处的像素: 每项160行, 底色交替, 中间若干行伪随机的"文字", 使各行内容互不相同
+static uint32_t host_list_pixel(int x, int y) {
+    int item = y / 160;
+    int line = y % 160;
+    int col = x % 720;
+    uint8_t base = (item & 1) ? 0xF0 : 0xE0;
+    uint8_t px[4] = {base, base, base, 0xFF};
+    if (line >= 40 && line < 120 && col >= 48 && col < 672) {
+        uint32_t v = (uint32_t) x * 2654435761u ^ (uint32_t) y * 40503u;
+        v ^= v >> 15;
+        v *= 0x2C1B3C6Du;
+        v ^= v >> 12;
+        if ((v & 7) == 0) {
+            px[0] = (uint8_t) (v >> 8);
+            px[1] = (uint8_t) (v >> 16);
+            px[2] = (uint8_t) (v >> 24);
+        }
+    }
+    uint32_t rgba;
+    memcpy(&rgba, px, 4);
+    return rgba;
+}
+
+// 用列表内容绘制画布的 [x1, x2) x [y1, y2), 内容坐标相对画布偏移 (offX, offY)
+static void host_list_draw(int x1, int y1, int x2, int y2, int offX, int offY) {
+    for (int y = y1; y < y2; ++y) {
+        uint32_t *row = (uint32_t *) (g_hostCanvas + (size_t) y * g_hostWidth * 4);
+        for (int x = x1; x < x2; ++x) {
+            row[x] = host_list_pixel(x + offX, y + offY);
+        }
+    }
+}
+
+// 按场景推进一帧画面, 只重绘变化部分
+static void host_screen_advance() {
+    static unsigned frame = 0;
+    static time_t lastSecond = 0;
+    frame++;
+    if (g_hostReplayCount > 0) {
+        // 尺寸被 host_screen_resize 改变后不再重放
+        if (g_hostWidth == g_hostReplayWidth && g_hostHeight == g_hostReplayHeight) {
+            memcpy(g_hostCanvas, g_hostReplay[(frame - 1) % g_hostReplayCount],
+                   (size_t) g_hostWidth * g_hostHeight * 4);
+        }
+    } else if (strcmp(g_hostScene, "scroll") == 0 || strcmp(g_hostScene, "pager") == 0) {
+        const int y1 = HOST_BAR_TOP;
+        const int y2 = g_hostHeight - HOST_BAR_BOTTOM;
+        const size_t stride = (size_t) g_hostWidth * 4;
+        if (y2 - y1 <= HOST_SCROLL_STEP || g_hostWidth <= HOST_PAGER_STEP) {
+            return;
+        }
+        if (frame == 1) {
+            host_list_draw(0, y1, g_hostWidth, y2, 0, 0);
+        } else if (g_hostScene[0] == 's') {
+            // 内容上移, 只绘制底部新露出的行
+            memmove(g_hostCanvas + y1 * stride, g_hostCanvas + (y1 + HOST_SCROLL_STEP) * stride,
+                    (y2 - y1 - HOST_SCROLL_STEP) * stride);
+            host_list_draw(0, y2 - HOST_SCROLL_STEP, g_hostWidth, y2, 0, (int) (frame - 1) * HOST_SCROLL_STEP);
+        } else {
+            // 内容左移, 只绘制右侧新露出的列
+            for (int y = y1; y < y2; ++y) {
+                uint8_t *row = g_hostCanvas + y * stride;
+                memmove(row, row + HOST_PAGER_STEP * 4, (g_hostWidth - HOST_PAGER_STEP) * 4);
+            }
+            host_list_draw(g_hostWidth - HOST_PAGER_STEP, y1, g_hostWidth, y2, (int) (frame - 1) * HOST_PAGER_STEP, 0);
+        }
+    } else if (strcmp(g_hostScene, "full") == 0) {
+        uint32_t rgba = 0xFF000000u | (frame * 0x010305u);
+        host_fill_rect(0, 0, g_hostWidth, g_hostHeight, rgba);
+    } else if (strcmp(g_hostScene, "clock") == 0) {
+        time_t now = time(NULL);
+        if (now != lastSecond) {
+            lastSecond = now;
+            uint32_t rgba = 0xFF000000u | ((uint32_t) (now % 60) * 0x040404u);
+            host_fill_rect(16, 8, 176, 48, rgba);
+        }
+        const int box = 64;
+        int span = g_hostWidth - box;
+        int pos = span > 0 ? (int) ((frame * 8) % span) : 0;
+        int prev = span > 0 ? (int) (((frame - 1) * 8) % span) : 0;
+        int y = g_hostHeight - 2 * box;
+        for (int yy = y; yy < y + box && yy < g_hostHeight; ++yy) {
+            uint32_t *row = (uint32_t *) (g_hostCanvas + (size_t) yy * g_hostWidth * 4);
+            for (int x = prev; x < prev + box && x < g_hostWidth; ++x) {
+                row[x] = host_background(x, yy);
+            }
+        }
+        host_fill_rect(pos, y, pos + box, y + box, 0xFF2020E0u);
+    }
+}
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayId(uint64_t *displayId) {
+    *displayId = 0;
+    return DISPLAY_MANAGER_OK;
+}
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayWidth(int32_t *displayWidth) {
+    pthread_once(&g_hostScreenOnce, host_screen_init);
+    *displayWidth = g_hostWidth;
+    return DISPLAY_MANAGER_OK;
+}
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_GetDefaultDisplayHeight(int32_t *displayHeight) {
+    pthread_once(&g_hostScreenOnce, host_screen_init);
+    *displayHeight = g_hostHeight;
+    return DISPLAY_MANAGER_OK;
+}
+
+#define HOST_LISTENER_MAX 4
+
+static OH_NativeDisplayManager_DisplayChangeCallback g_hostListeners[HOST_LISTENER_MAX];
+static pthread_mutex_t g_hostListenerLock = PTHREAD_MUTEX_INITIALIZER;
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_RegisterDisplayChangeListener(
+    OH_NativeDisplayManager_DisplayChangeCallback displayChangeCallback, uint32_t *listenerIndex) {
+    if (displayChangeCallback == NULL || listenerIndex == NULL) {
+        return DISPLAY_MANAGER_ERROR_INVALID_PARAM;
+    }
+    const char *disabled = getenv("AGENT_HOST_NO_DISPLAY_LISTENER");
+    if (disabled && disabled[0] == '1') {
+        return DISPLAY_MANAGER_ERROR_SYSTEM_ABNORMAL;
+    }
+    pthread_mutex_lock(&g_hostListenerLock);
+    for (uint32_t i = 0; i < HOST_LISTENER_MAX; ++i) {
+        if (g_hostListeners[i] == NULL) {
+            g_hostListeners[i] = displayChangeCallback;
+            *listenerIndex = i;
+            pthread_mutex_unlock(&g_hostListenerLock);
+            return DISPLAY_MANAGER_OK;
+        }
+    }
+    pthread_mutex_unlock(&g_hostListenerLock);
+    return DISPLAY_MANAGER_ERROR_SYSTEM_ABNORMAL;
+}
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_UnregisterDisplayChangeListener(uint32_t listenerIndex) {
+    if (listenerIndex >= HOST_LISTENER_MAX) {
+        return DISPLAY_MANAGER_ERROR_INVALID_PARAM;
+    }
+    pthread_mutex_lock(&g_hostListenerLock);
+    g_hostListeners[listenerIndex] = NULL;
+    pthread_mutex_unlock(&g_hostListenerLock);
+    return DISPLAY_MANAGER_OK;
+}
+
+void host_screen_resize(int width, int height) {
+    pthread_once(&g_hostScreenOnce, host_screen_init);
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    // 等正在进行的截屏结束后再替换画布
+    pthread_mutex_lock(&g_hostCanvasLock);
+    g_hostWidth = width;
+    g_hostHeight = height;
+    host_screen_alloc();
+    pthread_mutex_unlock(&g_hostCanvasLock);
+    pthread_mutex_lock(&g_hostListenerLock);
+    for (int i = 0; i < HOST_LISTENER_MAX; ++i) {
+        if (g_hostListeners[i] != NULL) {
+            g_hostListeners[i](0);
+        }
+    }
+    pthread_mutex_unlock(&g_hostListenerLock);
+}
+
+NativeDisplayManager_ErrorCode OH_NativeDisplayManager_CaptureScreenPixelmap(uint32_t displayId,
+                                                                             OH_PixelmapNative **pixelMap) {
+    pthread_once(&g_hostScreenOnce, host_screen_init);
+    if (pixelMap == NULL || g_hostCanvas == NULL) {
+        return DISPLAY_MANAGER_ERROR_INVALID_PARAM;
+    }
+    g_hostStubDepth++;
+    OH_PixelmapNative *pm = malloc(sizeof(OH_PixelmapNative));
+    g_hostStubDepth--;
+    pthread_mutex_lock(&g_hostCanvasLock);
+    host_screen_advance();
+    pm->width = g_hostWidth;
+    pm->height = g_hostHeight;
+    pm->pixels = g_hostCanvas;
+    *pixelMap = pm;
+    return DISPLAY_MANAGER_OK;
+}
+
+Image_ErrorCode OH_PixelmapNative_ReadPixels(OH_PixelmapNative *pixelmap, uint8_t *destination, size_t *bufferSize) {
+    size_t need = (size_t) pixelmap->width * pixelmap->height * 4;
+    if (destination == NULL || bufferSize == NULL || *bufferSize < need) {
+        return IMAGE_BAD_PARAMETER;
+    }
+    memcpy(destination, pixelmap->pixels, need);
+    *bufferSize = need;
+    return IMAGE_SUCCESS;
+}
+
+Image_ErrorCode OH_PixelmapNative_Destroy(OH_PixelmapNative **pixelmap) {
+    if (pixelmap == NULL || *pixelmap == NULL) {
+        return IMAGE_BAD_PARAMETER;
+    }
+    free(*pixelmap);
+    *pixelmap = NULL;
+    // 画布在截屏到销毁之间保持不变, 与真实pixelmap的快照语义一致
+    pthread_mutex_unlock(&g_hostCanvasLock);
+    return IMAGE_SUCCESS;
+}
@@ -0,0 +1,282 @@
+// 差分实现一致性校验: 当前CPU支持的每种实现(avx2/sse2/neon/scalar)与逐字节参考结果完全一致
+// 覆盖随机数据, 每个偏移处单字节不同, 非16/32/64整数倍的长度, 非对齐的起始地址, 每像素3/4字节
+// 用法: test_diff [-seed S] [-rounds N], 有不一致时返回1
+#include "../diff.h"
+#include "../dirty.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 缓冲区前后的余量, 用于非对齐起始地址
+#define TEST_PAD 64
+#define TEST_MAX_LEN 4200
+// 每项最多打印的不一致数
+#define TEST_MAX_REPORT 8
+
+static const char *g_kernelNames[] = {"avx2", "sse2", "neon", "scalar"};
+static int g_failures;
+
+static void test_fail(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void test_fail(const char *fmt, ...) {
+    if (g_failures++ < TEST_MAX_REPORT) {
+        va_list ap;
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        fputc('\n', stderr);
+    }
+}
+
+static size_t ref_first(const uint8_t *a, const uint8_t *b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t ref_last(const uint8_t *a, const uint8_t *b, size_t n) {
+    for (size_t i = n; i > 0; --i) {
+        if (a[i - 1] != b[i - 1]) {
+            return i - 1;
+        }
+    }
+    return n;
+}
+
+static void fill_random(uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        p[i] = (uint8_t) rand();
+    }
+}
+
+// 改变一个字节, 偶尔只改最高位或最低位, 检查按有符号比较/按位比较的实现
+static void flip_byte(uint8_t *p) {
+    switch (rand() % 4) {
+        case 0:
+            *p ^= 0x80;
+            break;
+        case 1:
+            *p ^= 0x01;
+            break;
+        default:
+            *p ^= (uint8_t) (1 + rand() % 255);
+            break;
+    }
+}
+
+static void check_scan(const DiffKernel *kernel, const uint8_t *a, const uint8_t *b, size_t n, const char *what) {
+    size_t first = kernel->first(a, b, n);
+    size_t last = kernel->last(a, b, n);
+    size_t wantFirst = ref_first(a, b, n);
+    size_t wantLast = ref_last(a, b, n);
+    if (first != wantFirst || last != wantLast) {
+        test_fail("%s %s: n=%zu align=%u/%u first %zu (want %zu) last %zu (want %zu)", kernel->name, what, n,
+                  (unsigned) ((uintptr_t) a % TEST_PAD), (unsigned) ((uintptr_t) b % TEST_PAD), first, wantFirst,
+                  last, wantLast);
+    }
+}
+
+/**
+ * 校验 first/last: 相同数据, 每个偏移处单字节不同, 首尾同时不同, 随机多处不同
+ */
+static void test_scan(const DiffKernel *kernel, uint8_t *bufA, uint8_t *bufB, int rounds) {
+    static const size_t lengths[] = {
+        0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 95, 127, 128, 129, 191, 255, 256, 257, 1000, 4095,
+    };
+    for (size_t li = 0; li < sizeof(lengths) / sizeof(lengths[0]); ++li) {
+        size_t n = lengths[li];
+        for (int align = 0; align < 8; ++align) {
+            uint8_t *a = bufA + TEST_PAD + align;
+            uint8_t *b = bufB + TEST_PAD + (align * 5) % 8;
+            fill_random(a, n);
+            memcpy(b, a, n);
+            check_scan(kernel, a, b, n, "same");
+            for (size_t pos = 0; pos < n; ++pos) {
+                uint8_t saved = b[pos];
+                flip_byte(&b[pos]);
+                check_scan(kernel, a, b, n, "single");
+                b[pos] = saved;
+            }
+            if (n >= 2) {
+                b[0] ^= 0x80;
+                b[n - 1] ^= 0x01;
+                check_scan(kernel, a, b, n, "ends");
+                b[0] ^= 0x80;
+                b[n - 1] ^= 0x01;
+            }
+        }
+    }
+    for (int r = 0; r < rounds; ++r) {
+        size_t n = (size_t) (rand() % TEST_MAX_LEN);
+        uint8_t *a = bufA + TEST_PAD + rand() % TEST_PAD;
+        uint8_t *b = bufB + TEST_PAD + rand() % TEST_PAD;
+        fill_random(a, n);
+        memcpy(b, a, n);
+        int changes = n == 0 ? 0 : rand() % 4;
+        for (int i = 0; i < changes; ++i) {
+            flip_byte(&b[rand() % n]);
+        }
+        check_scan(kernel, a, b, n, "random");
+    }
+}
+
+typedef struct {
+    bool changed;
+    int x1;
+    int x2;
+    uint8_t segs[TEST_MAX_LEN];
+} RowResult;
+
+static void run_row(const char *name, const uint8_t *curr, const uint8_t *last, int width, int bpp, int segPixels,
+                    const uint8_t *skip, RowResult *out) {
+    diff_init(name);
+    memset(out, 0, sizeof(*out));
+    out->changed = diff_row(curr, last, width, bpp, segPixels, skip, out->segs, &out->x1, &out->x2);
+}
+
+/**
+ * 校验 diff_row: 与 scalar 实现的返回值/分段标记/首末变化像素完全一致
+ */
+static void test_row(const DiffKernel *kernel, uint8_t *bufA, uint8_t *bufB, int rounds) {
+    static const int segSizes[] = {8, 16, 64, 100};
+    static RowResult want;
+    static RowResult got;
+    uint8_t skip[TEST_MAX_LEN];
+    for (int r = 0; r < rounds; ++r) {
+        int bpp = rand() % 2 == 0 ? 3 : 4;
+        int width = 1 + rand() % ((TEST_MAX_LEN - TEST_PAD) / 4 - 1);
+        int segPixels = segSizes[rand() % 4];
+        size_t bytes = (size_t) width * bpp;
+        uint8_t *curr = bufA + TEST_PAD + rand() % TEST_PAD;
+        uint8_t *last = bufB + TEST_PAD + rand() % TEST_PAD;
+        fill_random(curr, bytes);
+        memcpy(last, curr, bytes);
+        int changes = rand() % 4;
+        for (int i = 0; i < changes; ++i) {
+            flip_byte(&last[rand() % bytes]);
+        }
+        const uint8_t *skipPtr = NULL;
+        if (rand() % 2 == 0) {
+            for (int k = 0; k < (width + segPixels - 1) / segPixels; ++k) {
+                skip[k] = rand() % 4 == 0;
+            }
+            skipPtr = skip;
+        }
+        run_row("scalar", curr, last, width, bpp, segPixels, skipPtr, &want);
+        run_row(kernel->name, curr, last, width, bpp, segPixels, skipPtr, &got);
+        int segCount = (width + segPixels - 1) / segPixels;
+        if (got.changed != want.changed || memcmp(got.segs, want.segs, segCount) != 0 ||
+            (want.changed && (got.x1 != want.x1 || got.x2 != want.x2))) {
+            test_fail("%s diff_row: width=%d bpp=%d seg=%d skip=%d changed %d/%d x1 %d/%d x2 %d/%d", kernel->name,
+                      width, bpp, segPixels, skipPtr != NULL, got.changed, want.changed, got.x1, want.x1, got.x2,
+                      want.x2);
+        }
+        // 不跳过时首末变化像素与逐字节参考一致
+        if (skipPtr == NULL) {
+            size_t f = ref_first(curr, last, bytes);
+            bool changed = f != bytes;
+            if (got.changed != changed ||
+                (changed && (got.x1 != (int) (f / bpp) || got.x2 != (int) (ref_last(curr, last, bytes) / bpp)))) {
+                test_fail("%s diff_row: width=%d bpp=%d x1 %d x2 %d differ from reference", kernel->name, width,
+                          bpp, got.x1, got.x2);
+            }
+        }
+    }
+}
+
+static void run_rows(const char *name, DirtyMap *map, const uint8_t *curr, int currStride, const uint8_t *last,
+                     int lastStride, int width, int y1, int y2, int bpp, bool exact) {
+    diff_init(name);
+    dirty_map_reset(map);
+    diff_rows(map, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+}
+
+/**
+ * 校验 diff_rows: 行距大于行宽且起始地址非对齐的两帧中任意一段行, 脏tile与包围盒与 scalar 实现完全一致
+ */
+static void test_rows(const DiffKernel *kernel, uint8_t *bufA, uint8_t *bufB, int rounds) {
+    for (int r = 0; r < rounds; ++r) {
+        int bpp = rand() % 2 == 0 ? 3 : 4;
+        int width = 1 + rand() % 200;
+        int height = 1 + rand() % 40;
+        int tileSize = DIRTY_TILE_SIZE_MIN << rand() % 3;
+        int currStride = width * bpp + rand() % 16;
+        int lastStride = width * bpp + rand() % 16;
+        uint8_t *curr = bufA + rand() % TEST_PAD;
+        uint8_t *last = bufB + rand() % TEST_PAD;
+        for (int y = 0; y < height; ++y) {
+            uint8_t *row = curr + (size_t) y * currStride;
+            fill_random(row, (size_t) width * bpp);
+            memcpy(last + (size_t) y * lastStride, row, (size_t) width * bpp);
+        }
+        int changes = rand() % 6;
+        for (int i = 0; i < changes; ++i) {
+            int y = rand() % height;
+            flip_byte(&last[(size_t) y * lastStride + rand() % (width * bpp)]);
+        }
+        bool exact = rand() % 2 == 0;
+        int y1 = rand() % height;
+        int y2 = y1 + 1 + rand() % (height - y1);
+        DirtyMap want;
+        DirtyMap got;
+        if (dirty_map_init(&want, width, height, tileSize) != 0 || dirty_map_init(&got, width, height, tileSize) != 0) {
+            test_fail("dirty_map_init failed");
+            return;
+        }
+        run_rows("scalar", &want, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+        run_rows(kernel->name, &got, curr, currStride, last, lastStride, width, y1, y2, bpp, exact);
+        if (memcmp(got.tiles, want.tiles, (size_t) want.cols * want.rows) != 0 || got.dirtyCount != want.dirtyCount ||
+            got.minX != want.minX || got.minY != want.minY || got.maxX != want.maxX || got.maxY != want.maxY) {
+            test_fail("%s diff_rows: %dx%d rows %d-%d bpp=%d tile=%d exact=%d dirty %d/%d bbox (%d,%d)-(%d,%d) "
+                      "want (%d,%d)-(%d,%d)",
+                      kernel->name, width, height, y1, y2, bpp, tileSize, exact, got.dirtyCount, want.dirtyCount,
+                      got.minX, got.minY, got.maxX, got.maxY, want.minX, want.minY, want.maxX, want.maxY);
+        }
+        dirty_map_free(&want);
+        dirty_map_free(&got);
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = 1;
+    int rounds = 2000;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = (unsigned) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        }
+    }
+    srand(seed);
+    // diff_rows 的两帧最多 40 行 x (200 像素 x 4 字节 + 16)
+    size_t bufSize = 40 * (200 * 4 + 16) + TEST_MAX_LEN + 2 * TEST_PAD;
+    uint8_t *bufA = (uint8_t *) malloc(bufSize);
+    uint8_t *bufB = (uint8_t *) malloc(bufSize);
+    if (bufA == NULL || bufB == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(g_kernelNames) / sizeof(g_kernelNames[0]); ++i) {
+        const DiffKernel *kernel = diff_kernel_find(g_kernelNames[i]);
+        if (kernel == NULL) {
+            printf("%-8s not available\n", g_kernelNames[i]);
+            continue;
+        }
+        int before = g_failures;
+        test_scan(kernel, bufA, bufB, rounds);
+        test_row(kernel, bufA, bufB, rounds);
+        test_rows(kernel, bufA, bufB, rounds / 10);
+        printf("%-8s %s\n", kernel->name, g_failures == before ? "ok" : "MISMATCH");
+    }
+    free(bufA);
+    free(bufB);
+    if (g_failures > 0) {
+        fprintf(stderr, "test_diff: %d mismatch(es), seed %u\n", g_failures, seed);
+        return 1;
+    }
+    return 0;
+}
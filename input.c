@@ -0,0 +1,331 @@
+#include "input.h"
+#include "keymap.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// 单生产者单消费者环形队列: vnc服务器线程写入, 注入线程读出, 容量须为2的幂
+#define INPUT_QUEUE_SIZE 1024
+#define INPUT_QUEUE_MASK (INPUT_QUEUE_SIZE - 1)
+// 一次文本输入最多合并的字符数
+#define INPUT_TEXT_MAX 256
+// 合并文本时等待后续字符的时间, 粘贴与快速输入的字符间隔远小于该值
+#define INPUT_TEXT_GATHER_MS 10
+
+typedef enum {
+    INPUT_PTR,
+    INPUT_KEY,
+    INPUT_TEXT,
+} InputType;
+
+typedef struct {
+    InputType type;
+    // INPUT_PTR
+    enum ActionStage stage;
+    int x;
+    int y;
+    // INPUT_KEY: OHOS 键码, 修饰键在前
+    int keys[3];
+    int keyCount;
+    // INPUT_TEXT: 一个字符
+    uint32_t codepoint;
+    // 入队时间, 用于统计注入延迟
+    uint64_t queuedNs;
+} InputEvent;
+
+typedef struct {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    // head 只由注入线程推进, tail 只由vnc服务器线程推进
+    atomic_uint head;
+    atomic_uint tail;
+    sem_t ready;
+    pthread_t thread;
+    atomic_bool running;
+    // 保留连续移动的中间点, 不合并
+    bool keepMoves;
+    // 最近一次点击的位置, 文本输入到该位置的输入框; 只由注入事件的线程访问
+    // 按下后移动(拖动/滑动)或按下移走焦点的按键后失效
+    bool hasFocus;
+    bool pressed;
+    int focusX;
+    int focusY;
+} InputQueue;
+
+static InputQueue g_input;
+
+static void input_latency(uint64_t queuedNs) {
+    stats_wait(&g_AgentStats.inputInjections, &g_AgentStats.inputLatencyNs, &g_AgentStats.inputLatencyMaxNs,
+               stats_now_ns() - queuedNs);
+}
+
+static void input_inject_keys(const int *keys, int count) {
+    UiTest_InjectionKey(keys, count);
+    atomic_fetch_add_explicit(&g_AgentStats.inputKeyCalls, 1, memory_order_relaxed);
+}
+
+/**
+ * 注入一段文本
+ * 没有按下过的位置时无法确定输入框, 逐个字符转换为按键注入, 不支持的字符丢弃
+ */
+static void input_inject_text(InputQueue *q, const uint32_t *text, int count) {
+    if (!q->hasFocus) {
+        for (int i = 0; i < count; ++i) {
+            bool shift = false;
+            int code = text[i] < 0x80 ? keymap_keycode(text[i], &shift) : -1;
+            if (code < 0) {
+                AGENT_OHOS_LOG(LOG_DEBUG, "%s: no focus, drop U+%04X", __func__, text[i]);
+                continue;
+            }
+            int keys[2] = {KEYCODE_SHIFT_LEFT, code};
+            input_inject_keys(shift ? keys : keys + 1, shift ? 2 : 1);
+        }
+        return;
+    }
+    char utf8[INPUT_TEXT_MAX * 4 + 1];
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        n += keymap_utf8(text[i], utf8 + n);
+    }
+    utf8[n] = '\0';
+    UiTest_InjectionText(q->focusX, q->focusY, utf8);
+    atomic_fetch_add_explicit(&g_AgentStats.inputTextCalls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_AgentStats.inputTextChars, count, memory_order_relaxed);
+}
+
+/**
+ * 跟踪文本输入的焦点位置
+ */
+static void input_track_focus(InputQueue *q, const InputEvent *ev) {
+    if (ev->type == INPUT_PTR) {
+        if (ev->stage == ActionStage_DOWN) {
+            q->hasFocus = true;
+            q->pressed = true;
+            q->focusX = ev->x;
+            q->focusY = ev->y;
+        } else if (ev->stage == ActionStage_UP) {
+            q->pressed = false;
+        } else if (ev->stage == ActionStage_MOVE && q->pressed && (ev->x != q->focusX || ev->y != q->focusY)) {
+            q->hasFocus = false;
+        }
+    } else if (ev->type == INPUT_KEY) {
+        switch (ev->keys[ev->keyCount - 1]) {
+            case KEYCODE_BACK:
+            case KEYCODE_TAB:
+            case KEYCODE_ENTER:
+            case KEYCODE_ESCAPE:
+                q->hasFocus = false;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void input_inject(InputQueue *q, const InputEvent *ev) {
+    input_track_focus(q, ev);
+    if (ev->type == INPUT_PTR) {
+        UiTest_InjectionPtr(ev->stage, ev->x, ev->y);
+    } else if (ev->type == INPUT_KEY) {
+        input_inject_keys(ev->keys, ev->keyCount);
+    } else {
+        input_inject_text(q, &ev->codepoint, 1);
+    }
+    input_latency(ev->queuedNs);
+}
+
+/**
+ * 查看下一个未处理的事件
+ *
+ * @param head 下一个事件的位置
+ * @param tail 已知的队尾, 队列为空时重新读取
+ * @param waitMs 队列为空时最多等待的毫秒数
+ * @return 下一个事件, 没有时返回NULL
+ */
+static const InputEvent *input_peek(InputQueue *q, unsigned head, unsigned *tail, int waitMs) {
+    for (int i = 0;; ++i) {
+        if (head == *tail) {
+            *tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        }
+        if (head != *tail) {
+            return &q->events[head & INPUT_QUEUE_MASK];
+        }
+        if (i >= waitMs || !atomic_load(&q->running)) {
+            return NULL;
+        }
+        usleep(1000);
+    }
+}
+
+/**
+ * 注入队列中已有的全部事件, 其余事件保持原有顺序逐个注入:
+ * 连续的移动事件只注入最后一个位置;
+ * 连续的文本字符合并为一次文本输入, 并短暂等待仍在到达的后续字符
+ */
+static void input_drain(InputQueue *q) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    while (head != tail) {
+        InputEvent ev = q->events[head & INPUT_QUEUE_MASK];
+        head++;
+        const InputEvent *next;
+        if (ev.type == INPUT_PTR && ev.stage == ActionStage_MOVE && !q->keepMoves) {
+            while ((next = input_peek(q, head, &tail, 0)) != NULL &&
+                   next->type == INPUT_PTR && next->stage == ActionStage_MOVE) {
+                // 延迟按被合并事件中最早的入队时间计算
+                ev.x = next->x;
+                ev.y = next->y;
+                head++;
+                atomic_fetch_add_explicit(&g_AgentStats.inputCoalesced, 1, memory_order_relaxed);
+            }
+        } else if (ev.type == INPUT_TEXT) {
+            uint32_t text[INPUT_TEXT_MAX];
+            int count = 0;
+            text[count++] = ev.codepoint;
+            while (count < INPUT_TEXT_MAX && (next = input_peek(q, head, &tail, INPUT_TEXT_GATHER_MS)) != NULL &&
+                   next->type == INPUT_TEXT) {
+                text[count++] = next->codepoint;
+                head++;
+            }
+            atomic_store_explicit(&q->head, head, memory_order_release);
+            input_inject_text(q, text, count);
+            input_latency(ev.queuedNs);
+            tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+            continue;
+        }
+        // 事件已复制出来, 槽位可以交还给生产者
+        atomic_store_explicit(&q->head, head, memory_order_release);
+        input_inject(q, &ev);
+        tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    }
+}
+
+static void *input_worker(void *arg) {
+    InputQueue *q = (InputQueue *) arg;
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Start, keep moves: %d", __func__, q->keepMoves);
+    while (true) {
+        if (sem_wait(&q->ready) != 0 && errno == EINTR) {
+            continue;
+        }
+        bool running = atomic_load(&q->running);
+        // 一次取完队列, 信号量可能多于剩余事件, 空转一次即可
+        input_drain(q);
+        if (!running) {
+            break;
+        }
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Stop", __func__);
+    return NULL;
+}
+
+/**
+ * 启动注入线程, 之后 input_push_* 只入队不等待注入完成
+ * 未启动时 input_push_* 在调用线程中同步注入, 不做任何合并
+ *
+ * @param keepMoves 保留连续移动的中间点(保持滑动速度), 为false时合并为最新位置
+ * @return 0成功, -1失败
+ */
+int input_start(bool keepMoves) {
+    InputQueue *q = &g_input;
+    if (atomic_load(&q->running)) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: already running", __func__);
+        return -1;
+    }
+    atomic_store(&q->head, 0);
+    atomic_store(&q->tail, 0);
+    q->keepMoves = keepMoves;
+    q->hasFocus = false;
+    q->pressed = false;
+    if (sem_init(&q->ready, 0, 0) != 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: sem_init failed", __func__);
+        return -1;
+    }
+    atomic_store(&q->running, true);
+    if (pthread_create(&q->thread, NULL, input_worker, q) != 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: create worker failed", __func__);
+        atomic_store(&q->running, false);
+        sem_destroy(&q->ready);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 停止注入线程, 队列中剩余的事件注入完成后返回
+ * 注意: 请在vnc服务器线程停止产生事件后调用
+ */
+void input_stop() {
+    InputQueue *q = &g_input;
+    if (!atomic_exchange(&q->running, false)) {
+        return;
+    }
+    sem_post(&q->ready);
+    pthread_join(q->thread, NULL);
+    sem_destroy(&q->ready);
+}
+
+bool input_running() {
+    return atomic_load(&g_input.running);
+}
+
+/**
+ * 提交一个事件, 由vnc服务器线程调用; 注入线程未启动时在调用线程中同步注入
+ * 队列满时丢弃移动事件; 其余事件不能丢弃, 等待注入线程腾出空间
+ */
+static void input_push(InputEvent *ev) {
+    InputQueue *q = &g_input;
+    ev->queuedNs = stats_now_ns();
+    if (!atomic_load(&q->running)) {
+        input_inject(q, ev);
+        return;
+    }
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    while (tail - head >= INPUT_QUEUE_SIZE) {
+        if (ev->type == INPUT_PTR && ev->stage == ActionStage_MOVE) {
+            atomic_fetch_add_explicit(&g_AgentStats.inputDropped, 1, memory_order_relaxed);
+            return;
+        }
+        usleep(1000);
+        head = atomic_load_explicit(&q->head, memory_order_acquire);
+    }
+    q->events[tail & INPUT_QUEUE_MASK] = *ev;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    atomic_fetch_add_explicit(&g_AgentStats.inputQueued, 1, memory_order_relaxed);
+    stats_input_depth((int) (tail + 1 - head));
+    sem_post(&q->ready);
+}
+
+/**
+ * 提交一个触摸事件
+ */
+void input_push_ptr(enum ActionStage stage, int x, int y) {
+    InputEvent ev = {.type = INPUT_PTR, .stage = stage, .x = x, .y = y};
+    input_push(&ev);
+}
+
+/**
+ * 提交一次按键(按下并抬起)
+ *
+ * @param keys OHOS 键码, 修饰键在前, 1~3个
+ * @param count
+ */
+void input_push_key(const int *keys, int count) {
+    if (count < 1 || count > 3) {
+        return;
+    }
+    InputEvent ev = {.type = INPUT_KEY, .keyCount = count};
+    memcpy(ev.keys, keys, count * sizeof(int));
+    input_push(&ev);
+}
+
+/**
+ * 提交一个文本字符, 连续的字符由注入线程合并为一次文本输入
+ * 没有点击过输入框, 或焦点已移走时逐键注入
+ */
+void input_push_text(uint32_t codepoint) {
+    InputEvent ev = {.type = INPUT_TEXT, .codepoint = codepoint};
+    input_push(&ev);
+}
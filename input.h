@@ -0,0 +1,16 @@
+#ifndef UITEST_AGENT_VNC_INPUT_H
+#define UITEST_AGENT_VNC_INPUT_H
+
+#include "uitest.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+int input_start(bool keepMoves);
+void input_stop();
+bool input_running();
+void input_push_ptr(enum ActionStage stage, int x, int y);
+void input_push_key(const int *keys, int count);
+void input_push_text(uint32_t codepoint);
+
+#endif //UITEST_AGENT_VNC_INPUT_H
@@ -0,0 +1,182 @@
+#include "jpeg_stripes.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int read_u16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static bool jpeg_stripes_push(JpegStripePlan *plan, int index, size_t start) {
+    if (index >= plan->segCap) {
+        int cap = plan->segCap ? plan->segCap * 2 : 64;
+        size_t *s = (size_t *) realloc(plan->segStart, sizeof(size_t) * cap);
+        if (s) plan->segStart = s;
+        size_t *e = (size_t *) realloc(plan->segEnd, sizeof(size_t) * cap);
+        if (e) plan->segEnd = e;
+        if (!s || !e) {
+            return false;
+        }
+        plan->segCap = cap;
+    }
+    plan->segStart[index] = start;
+    return true;
+}
+
+/**
+ * 解析 JPEG 头部并定位所有重启间隔
+ * 只支持单次扫描包含全部分量的顺序 Huffman 编码(基线/扩展), 其它情况返回false
+ *
+ * @param plan 输出, 段数组跨帧复用
+ * @param data
+ * @param size
+ * @return 是否可以按条带并行解码
+ */
+bool jpeg_stripes_parse(JpegStripePlan *plan, const uint8_t *data, size_t size) {
+    plan->data = data;
+    plan->segments = 0;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    int components = 0, hmax = 1, vmax = 1, interval = 0;
+    bool sof = false;
+    size_t pos = 2;
+    while (true) {
+        if (pos + 4 > size || data[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t len = read_u16(&data[pos + 2]);
+        if (len < 2 || pos + 2 + len > size) {
+            return false;
+        }
+        const uint8_t *seg = &data[pos + 4];
+        if (marker == 0xC0 || marker == 0xC1) {
+            if (len < 8) return false;
+            plan->heightOffset = pos + 5;
+            plan->height = read_u16(&seg[1]);
+            plan->width = read_u16(&seg[3]);
+            components = seg[5];
+            if (components <= 0 || len < 8 + 3 * (size_t) components || plan->width <= 0 || plan->height <= 0) {
+                return false;
+            }
+            for (int i = 0; i < components; ++i) {
+                int h = seg[6 + i * 3 + 1] >> 4, v = seg[6 + i * 3 + 1] & 0x0F;
+                if (h > hmax) hmax = h;
+                if (v > vmax) vmax = v;
+            }
+            if (components == 1 && (hmax != 1 || vmax != 1)) {
+                return false;
+            }
+            sof = true;
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // 渐进/无损/算术编码
+            return false;
+        } else if (marker == 0xDD) {
+            if (len < 4) return false;
+            interval = read_u16(seg);
+        } else if (marker == 0xDA) {
+            if (!sof || seg[0] != components) {
+                return false;
+            }
+            plan->headerLen = pos + 2 + len;
+            break;
+        }
+        pos += 2 + len;
+    }
+
+    int mcuW = 8 * hmax, mcuH = 8 * vmax;
+    int mcusPerRow = (plan->width + mcuW - 1) / mcuW;
+    int mcuRows = (plan->height + mcuH - 1) / mcuH;
+    if (interval <= 0 || interval % mcusPerRow != 0) {
+        return false;
+    }
+    int rowsPerSegment = interval / mcusPerRow;
+    plan->mcuHeight = mcuH;
+    plan->segmentRows = rowsPerSegment * mcuH;
+    int expected = (mcuRows + rowsPerSegment - 1) / rowsPerSegment;
+
+    // 扫描熵编码数据, 0xFF00 为填充字节, RSTn 为段分隔
+    int count = 0;
+    if (!jpeg_stripes_push(plan, count, plan->headerLen)) {
+        return false;
+    }
+    pos = plan->headerLen;
+    while (true) {
+        const uint8_t *ff = (const uint8_t *) memchr(&data[pos], 0xFF, size - pos);
+        if (ff == NULL || (size_t) (ff - data) + 1 >= size) {
+            return false;
+        }
+        pos = (size_t) (ff - data);
+        uint8_t marker = data[pos + 1];
+        if (marker == 0x00 || marker == 0xFF) {
+            pos += marker == 0x00 ? 2 : 1;
+        } else if (marker >= 0xD0 && marker <= 0xD7) {
+            plan->segEnd[count++] = pos;
+            if (count >= expected || !jpeg_stripes_push(plan, count, pos + 2)) {
+                return false;
+            }
+            pos += 2;
+        } else if (marker == 0xD9) {
+            plan->segEnd[count++] = pos;
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (count != expected) {
+        return false;
+    }
+    plan->segments = count;
+    return true;
+}
+
+/**
+ * 生成只包含 [seg0, seg1) 段的独立 JPEG: 头部高度改为条带高度, RST 从0重新编号
+ *
+ * @param plan
+ * @param seg0 起始段(含)
+ * @param seg1 终止段(不含)
+ * @param out 输出缓冲区, 不足时重新分配
+ * @param cap 输出缓冲区大小
+ * @return 码流长度, 失败返回0
+ */
+size_t jpeg_stripes_build(const JpegStripePlan *plan, int seg0, int seg1, uint8_t **out, size_t *cap) {
+    size_t need = plan->headerLen + 2;
+    for (int k = seg0; k < seg1; ++k) {
+        need += plan->segEnd[k] - plan->segStart[k] + 2;
+    }
+    if (need > *cap) {
+        uint8_t *p = (uint8_t *) realloc(*out, need);
+        if (!p) {
+            return 0;
+        }
+        *out = p;
+        *cap = need;
+    }
+    uint8_t *dst = *out;
+    memcpy(dst, plan->data, plan->headerLen);
+    int y1 = seg1 * plan->segmentRows;
+    int rows = (y1 < plan->height ? y1 : plan->height) - seg0 * plan->segmentRows;
+    dst[plan->heightOffset] = (uint8_t) (rows >> 8);
+    dst[plan->heightOffset + 1] = (uint8_t) rows;
+    size_t n = plan->headerLen;
+    for (int k = seg0; k < seg1; ++k) {
+        size_t len = plan->segEnd[k] - plan->segStart[k];
+        memcpy(&dst[n], &plan->data[plan->segStart[k]], len);
+        n += len;
+        dst[n++] = 0xFF;
+        dst[n++] = k + 1 < seg1 ? (uint8_t) (0xD0 + ((k - seg0) & 7)) : 0xD9;
+    }
+    return n;
+}
+
+void jpeg_stripes_free(JpegStripePlan *plan) {
+    free(plan->segStart);
+    free(plan->segEnd);
+    memset(plan, 0, sizeof(*plan));
+}
@@ -0,0 +1,33 @@
+#ifndef UITEST_AGENT_VNC_JPEG_STRIPES_H
+#define UITEST_AGENT_VNC_JPEG_STRIPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 按重启标记(RST)切分的 JPEG 码流
+ * 每个重启间隔必须恰好是整数个 MCU 行, 这样每段都能独立解码为一条水平条带
+ */
+typedef struct {
+    const uint8_t *data;
+    int width;
+    int height;
+    // MCU 高度, 以及每段覆盖的像素行数(最后一段可能更少)
+    int mcuHeight;
+    int segmentRows;
+    int segments;
+    // SOS 之前(含SOS)的头部长度, 以及SOF中高度字段的偏移
+    size_t headerLen;
+    size_t heightOffset;
+    // 每段熵编码数据的起止偏移, 不含RST标记
+    size_t *segStart;
+    size_t *segEnd;
+    int segCap;
+} JpegStripePlan;
+
+bool jpeg_stripes_parse(JpegStripePlan *plan, const uint8_t *data, size_t size);
+size_t jpeg_stripes_build(const JpegStripePlan *plan, int seg0, int seg1, uint8_t **out, size_t *cap);
+void jpeg_stripes_free(JpegStripePlan *plan);
+
+#endif //UITEST_AGENT_VNC_JPEG_STRIPES_H
@@ -0,0 +1,131 @@
+#include "keymap.h"
+
+#include <rfb/keysym.h>
+
+// X11 keysym 到 OHOS 键码, 只列出非字符键; 字符键见 keymap_char
+typedef struct {
+    rfbKeySym keysym;
+    int keycode;
+} KeymapEntry;
+
+static const KeymapEntry g_keymap[] = {
+    {XK_Return, 2054},    {XK_KP_Enter, 2054},  {XK_BackSpace, 2055}, {XK_Tab, 2049},
+    {XK_ISO_Left_Tab, 2049}, {XK_Escape, 2070}, {XK_Delete, 2071},    {XK_KP_Delete, 2071},
+    {XK_Home, 2081},      {XK_KP_Home, 2081},   {XK_End, 2082},       {XK_KP_End, 2082},
+    {XK_Page_Up, 2068},   {XK_KP_Page_Up, 2068}, {XK_Page_Down, 2069}, {XK_KP_Page_Down, 2069},
+    {XK_Insert, 2083},    {XK_KP_Insert, 2083}, {XK_Up, 2012},        {XK_KP_Up, 2012},
+    {XK_Down, 2013},      {XK_KP_Down, 2013},   {XK_Left, 2014},      {XK_KP_Left, 2014},
+    {XK_Right, 2015},     {XK_KP_Right, 2015},  {XK_Menu, 2067},      {XK_Caps_Lock, 2074},
+    {XK_Scroll_Lock, 2075}, {XK_Print, 2079},   {XK_Break, 2080},
+    {XK_F1, 2090},  {XK_F2, 2091},  {XK_F3, 2092},  {XK_F4, 2093},  {XK_F5, 2094},  {XK_F6, 2095},
+    {XK_F7, 2096},  {XK_F8, 2097},  {XK_F9, 2098},  {XK_F10, 2099}, {XK_F11, 2100}, {XK_F12, 2101},
+    // XF86 多媒体键映射为设备按键: 返回/主页/音量/电源
+    {0x1008FF26, 2},  {0x1008FF18, 1},  {0x1008FF13, 16}, {0x1008FF11, 17}, {0x1008FF2A, 18},
+};
+
+/**
+ * 可直接作为文本输入的按键
+ *
+ * @param key
+ * @param codepoint 对应的 Unicode 码点
+ * @return 是否为可打印字符
+ */
+bool keymap_text(rfbKeySym key, uint32_t *codepoint) {
+    if ((key >= 0x20 && key <= 0x7E) || (key >= 0xA0 && key <= 0xFF)) {
+        // ASCII 与 Latin-1 的 keysym 即码点
+        *codepoint = key;
+        return true;
+    }
+    if (key >= 0x01000100 && key <= 0x0110FFFF) {
+        // Unicode keysym
+        *codepoint = key & 0x00FFFFFF;
+        return true;
+    }
+    return false;
+}
+
+static int keymap_char(rfbKeySym key, bool *shift) {
+    if (key >= 'a' && key <= 'z') {
+        return 2017 + (int)(key - 'a');
+    }
+    if (key >= 'A' && key <= 'Z') {
+        *shift = true;
+        return 2017 + (int)(key - 'A');
+    }
+    if (key >= '0' && key <= '9') {
+        return 2000 + (int)(key - '0');
+    }
+    switch (key) {
+        case ' ': return 2050;
+        case ',': return 2043;
+        case '.': return 2044;
+        case '`': return 2056;
+        case '-': return 2057;
+        case '=': return 2058;
+        case '[': return 2059;
+        case ']': return 2060;
+        case '\\': return 2061;
+        case ';': return 2062;
+        case '\'': return 2063;
+        case '/': return 2064;
+        case '@': return 2065;
+        case '+': return 2066;
+        case '*': return 2010;
+        case '#': return 2011;
+        default: return -1;
+    }
+}
+
+/**
+ * X11 keysym 转换为 OHOS 键码
+ *
+ * @param key
+ * @param shift 大写字母需要同时按下 Shift 时置为true, 其余情况不修改
+ * @return 键码, 不支持的按键返回-1
+ */
+int keymap_keycode(rfbKeySym key, bool *shift) {
+    int code = keymap_char(key, shift);
+    if (code >= 0) {
+        return code;
+    }
+    for (size_t i = 0; i < sizeof(g_keymap) / sizeof(g_keymap[0]); ++i) {
+        if (g_keymap[i].keysym == key) {
+            return g_keymap[i].keycode;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Unicode 码点编码为 UTF-8
+ *
+ * @return 字节数, 无效码点返回0
+ */
+int keymap_utf8(uint32_t codepoint, char out[4]) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
+        return 0;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    if (codepoint < 0x110000) {
+        out[0] = (char)(0xF0 | (codepoint >> 18));
+        out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (codepoint & 0x3F));
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef UITEST_AGENT_VNC_KEYMAP_H
+#define UITEST_AGENT_VNC_KEYMAP_H
+
+#include <rfb/rfb.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// OHOS 修饰键键码(@ohos.multimodalInput.keyCode)
+#define KEYCODE_ALT_LEFT 2045
+#define KEYCODE_SHIFT_LEFT 2047
+#define KEYCODE_CTRL_LEFT 2072
+#define KEYCODE_META_LEFT 2076
+// 会移走输入焦点的按键
+#define KEYCODE_BACK 2
+#define KEYCODE_TAB 2049
+#define KEYCODE_ENTER 2054
+#define KEYCODE_ESCAPE 2070
+
+bool keymap_text(rfbKeySym key, uint32_t *codepoint);
+int keymap_keycode(rfbKeySym key, bool *shift);
+int keymap_utf8(uint32_t codepoint, char out[4]);
+
+#endif //UITEST_AGENT_VNC_KEYMAP_H
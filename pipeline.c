@@ -0,0 +1,151 @@
+#include "pipeline.h"
+#include "agent.h"
+#include "bufpool.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PIPELINE_FRESH 0x4u
+#define PIPELINE_INDEX 0x3u
+
+typedef struct {
+    PipelineSlot slots[PIPELINE_SLOTS];
+    // 中间槽下标, PIPELINE_FRESH 表示其中是尚未处理的新帧
+    atomic_uint mailbox;
+    unsigned producer;
+    unsigned consumer;
+    sem_t ready;
+    pthread_t thread;
+    atomic_bool running;
+    PipelineConsumer callback;
+} FramePipeline;
+
+static FramePipeline g_pipeline;
+
+static void *pipeline_worker(void *arg) {
+    FramePipeline *p = (FramePipeline *) arg;
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Start", __func__);
+    while (true) {
+        if (sem_wait(&p->ready) != 0 && errno == EINTR) {
+            continue;
+        }
+        if (!atomic_load(&p->running)) {
+            break;
+        }
+        // 丢帧时信号量会多于帧数, 取到的不是新帧就继续等待
+        if (!(atomic_load(&p->mailbox) & PIPELINE_FRESH)) {
+            continue;
+        }
+        unsigned prev = atomic_exchange(&p->mailbox, p->consumer);
+        p->consumer = prev & PIPELINE_INDEX;
+        stats_queue_depth(0);
+        PipelineSlot *slot = &p->slots[p->consumer];
+        p->callback(slot->data, slot->size);
+        atomic_fetch_add_explicit(&g_AgentStats.framesDecoded, 1, memory_order_relaxed);
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Stop", __func__);
+    return NULL;
+}
+
+/**
+ * 启动解码线程, 之后采集线程通过 pipeline_acquire/pipeline_submit 或 pipeline_push 提交帧
+ * 注意: 只支持单个生产者线程
+ *
+ * @param consumer 解码回调, 在解码线程中调用
+ * @return 0成功, -1失败
+ */
+int pipeline_start(PipelineConsumer consumer) {
+    FramePipeline *p = &g_pipeline;
+    if (atomic_load(&p->running)) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: already running", __func__);
+        return -1;
+    }
+    p->producer = 0;
+    atomic_store(&p->mailbox, 1);
+    p->consumer = 2;
+    p->callback = consumer;
+    if (sem_init(&p->ready, 0, 0) != 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: sem_init failed", __func__);
+        return -1;
+    }
+    atomic_store(&p->running, true);
+    if (pthread_create(&p->thread, NULL, pipeline_worker, p) != 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: create worker failed", __func__);
+        atomic_store(&p->running, false);
+        sem_destroy(&p->ready);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 停止解码线程并释放帧槽
+ * 注意: 请先停止采集线程, 未处理的帧会被丢弃
+ */
+void pipeline_stop() {
+    FramePipeline *p = &g_pipeline;
+    if (!atomic_exchange(&p->running, false)) {
+        return;
+    }
+    sem_post(&p->ready);
+    pthread_join(p->thread, NULL);
+    sem_destroy(&p->ready);
+    for (int i = 0; i < PIPELINE_SLOTS; ++i) {
+        bufpool_free(p->slots[i].data);
+        memset(&p->slots[i], 0, sizeof(PipelineSlot));
+    }
+}
+
+bool pipeline_running() {
+    return atomic_load(&g_pipeline.running);
+}
+
+/**
+ * 获取生产者的帧槽, 填充后调用 pipeline_submit 提交
+ */
+PipelineSlot *pipeline_acquire() {
+    return &g_pipeline.slots[g_pipeline.producer];
+}
+
+/**
+ * 确保帧槽容量不小于 size, 仅在变大时从帧缓冲池换一块更大的缓冲区, 原内容不保留
+ */
+bool pipeline_reserve(PipelineSlot *slot, size_t size) {
+    if (!bufpool_reserve(&slot->data, &slot->capacity, size)) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: reserve %zu failed", __func__, size);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 提交生产者帧槽中的帧, 若上一帧尚未被取走则将其丢弃
+ */
+void pipeline_submit() {
+    FramePipeline *p = &g_pipeline;
+    unsigned prev = atomic_exchange(&p->mailbox, p->producer | PIPELINE_FRESH);
+    p->producer = prev & PIPELINE_INDEX;
+    atomic_fetch_add_explicit(&g_AgentStats.framesCaptured, 1, memory_order_relaxed);
+    if (prev & PIPELINE_FRESH) {
+        atomic_fetch_add_explicit(&g_AgentStats.framesDropped, 1, memory_order_relaxed);
+    }
+    stats_queue_depth(1);
+    sem_post(&p->ready);
+}
+
+/**
+ * 复制一帧并提交, 用于数据只在回调期间有效的生产者
+ */
+void pipeline_push(const char *data, int size) {
+    PipelineSlot *slot = pipeline_acquire();
+    if (!pipeline_reserve(slot, (size_t) size)) {
+        return;
+    }
+    memcpy(slot->data, data, size);
+    slot->size = size;
+    pipeline_submit();
+}
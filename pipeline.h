@@ -0,0 +1,27 @@
+#ifndef UITEST_AGENT_VNC_PIPELINE_H
+#define UITEST_AGENT_VNC_PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// 三槽邮箱: 生产者与消费者各持有一个槽, 中间槽用于交换, 新帧总是覆盖未被取走的旧帧
+#define PIPELINE_SLOTS 3
+
+typedef void (*PipelineConsumer)(char *data, int size);
+
+// 帧槽, 缓冲区归槽所有(取自帧缓冲池), 生产者可按需扩容
+typedef struct {
+    char *data;
+    size_t capacity;
+    int size;
+} PipelineSlot;
+
+int pipeline_start(PipelineConsumer consumer);
+void pipeline_stop();
+bool pipeline_running();
+PipelineSlot *pipeline_acquire();
+bool pipeline_reserve(PipelineSlot *slot, size_t size);
+void pipeline_submit();
+void pipeline_push(const char *data, int size);
+
+#endif //UITEST_AGENT_VNC_PIPELINE_H
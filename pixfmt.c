@@ -0,0 +1,181 @@
+#include "pixfmt.h"
+#include "workers.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define PIXFMT_HAVE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define PIXFMT_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// 颜色分量按截断取高位, 各实现的结果必须与标量实现完全一致
+static inline uint16_t pixfmt_rgb565(const uint8_t *p) {
+    return (uint16_t) (((p[0] & 0xF8) << 8) | ((p[1] & 0xFC) << 3) | (p[2] >> 3));
+}
+
+static inline uint8_t pixfmt_bgr233(const uint8_t *p) {
+    return (uint8_t) ((p[0] >> 5) | ((p[1] >> 5) << 3) | (p[2] & 0xC0));
+}
+
+static void pixfmt_rgb565_scalar(uint16_t *dst, const uint8_t *src, int width) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = pixfmt_rgb565(src + x * 4);
+    }
+}
+
+static void pixfmt_bgr233_scalar(uint8_t *dst, const uint8_t *src, int width) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = pixfmt_bgr233(src + x * 4);
+    }
+}
+
+#ifdef PIXFMT_HAVE_SSE2
+static inline __m128i pixfmt_rgb565_sse2(__m128i p) {
+    __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x7E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 19), _mm_set1_epi32(0x1F));
+    // packs 为有符号饱和, 先平移到有符号范围, 打包后再平移回来
+    return _mm_sub_epi32(_mm_or_si128(_mm_or_si128(r, g), b), _mm_set1_epi32(0x8000));
+}
+
+static inline __m128i pixfmt_bgr233_sse2(__m128i p) {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 10), _mm_set1_epi32(0x38));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xC0));
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static void pixfmt_rgb565_row(uint16_t *dst, const uint8_t *src, int width) {
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i lo = pixfmt_rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + x * 4)));
+        __m128i hi = pixfmt_rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + x * 4 + 16)));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_xor_si128(_mm_packs_epi32(lo, hi), bias));
+    }
+    pixfmt_rgb565_scalar(dst + x, src + x * 4, width - x);
+}
+
+static void pixfmt_bgr233_row(uint8_t *dst, const uint8_t *src, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *s = (const __m128i *) (src + x * 4);
+        __m128i p0 = pixfmt_bgr233_sse2(_mm_loadu_si128(s));
+        __m128i p1 = pixfmt_bgr233_sse2(_mm_loadu_si128(s + 1));
+        __m128i p2 = pixfmt_bgr233_sse2(_mm_loadu_si128(s + 2));
+        __m128i p3 = pixfmt_bgr233_sse2(_mm_loadu_si128(s + 3));
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3)));
+    }
+    pixfmt_bgr233_scalar(dst + x, src + x * 4, width - x);
+}
+#elif defined(PIXFMT_HAVE_NEON)
+static inline uint16x8_t pixfmt_rgb565_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    // 保留 R 的高5位, 依次在其后插入 G 的高6位与 B 的高5位
+    uint16x8_t v = vshll_n_u8(r, 8);
+    v = vsriq_n_u16(v, vshll_n_u8(g, 8), 5);
+    return vsriq_n_u16(v, vshll_n_u8(b, 8), 11);
+}
+
+static void pixfmt_rgb565_row(uint16_t *dst, const uint8_t *src, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t p = vld4q_u8(src + x * 4);
+        vst1q_u16(dst + x, pixfmt_rgb565_neon(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2])));
+        vst1q_u16(dst + x + 8,
+                  pixfmt_rgb565_neon(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2])));
+    }
+    pixfmt_rgb565_scalar(dst + x, src + x * 4, width - x);
+}
+
+static void pixfmt_bgr233_row(uint8_t *dst, const uint8_t *src, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t p = vld4q_u8(src + x * 4);
+        uint8x16_t v = vorrq_u8(vshrq_n_u8(p.val[0], 5), vshlq_n_u8(vshrq_n_u8(p.val[1], 5), 3));
+        vst1q_u8(dst + x, vorrq_u8(v, vandq_u8(p.val[2], vdupq_n_u8(0xC0))));
+    }
+    pixfmt_bgr233_scalar(dst + x, src + x * 4, width - x);
+}
+#else
+static void pixfmt_rgb565_row(uint16_t *dst, const uint8_t *src, int width) {
+    pixfmt_rgb565_scalar(dst, src, width);
+}
+
+static void pixfmt_bgr233_row(uint8_t *dst, const uint8_t *src, int width) {
+    pixfmt_bgr233_scalar(dst, src, width);
+}
+#endif
+
+const char *pixfmt_kernel_name() {
+#if defined(PIXFMT_HAVE_SSE2)
+    return "sse2";
+#elif defined(PIXFMT_HAVE_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/**
+ * 把一行 RGBX 像素转换为帧缓冲格式
+ *
+ * @param dst 目标行, 16位格式时须2字节对齐
+ * @param src RGBX 源行
+ * @param width 像素数
+ * @param bpp 目标每像素字节数(4: RGBX 直接复制, 2: RGB565, 1: BGR233)
+ */
+void pixfmt_convert_row(uint8_t *dst, const uint8_t *src, int width, int bpp) {
+    if (bpp == 4) {
+        memcpy(dst, src, (size_t) width * 4);
+    } else if (bpp == 2) {
+        pixfmt_rgb565_row((uint16_t *) dst, src, width);
+    } else {
+        pixfmt_bgr233_row(dst, src, width);
+    }
+}
+
+/**
+ * 转换 [y1, y2) 行
+ */
+void pixfmt_convert_rows(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride, int width, int y1, int y2,
+                         int bpp) {
+    for (int y = y1; y < y2; ++y) {
+        pixfmt_convert_row(dst + (size_t) y * dstStride, src + (size_t) y * srcStride, width, bpp);
+    }
+}
+
+typedef struct {
+    uint8_t *dst;
+    int dstStride;
+    const uint8_t *src;
+    int srcStride;
+    int width;
+    int y1;
+    int y2;
+    int stripeRows;
+    int bpp;
+} PixfmtStripes;
+
+static void pixfmt_stripe_task(void *arg, int index) {
+    const PixfmtStripes *job = (const PixfmtStripes *) arg;
+    int y1 = job->y1 + index * job->stripeRows;
+    int y2 = y1 + job->stripeRows < job->y2 ? y1 + job->stripeRows : job->y2;
+    pixfmt_convert_rows(job->dst, job->dstStride, job->src, job->srcStride, job->width, y1, y2, job->bpp);
+}
+
+/**
+ * 多线程版本的pixfmt_convert_rows, 按水平条带切分; 线程池未启用时在当前线程转换
+ */
+void pixfmt_convert_rows_parallel(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride, int width,
+                                  int y1, int y2, int bpp) {
+    int stripes = workers_count();
+    if (stripes <= 1 || y2 - y1 < stripes) {
+        pixfmt_convert_rows(dst, dstStride, src, srcStride, width, y1, y2, bpp);
+        return;
+    }
+    PixfmtStripes job = {dst, dstStride, src, srcStride, width, y1, y2, (y2 - y1 + stripes - 1) / stripes, bpp};
+    workers_run(pixfmt_stripe_task, &job, stripes);
+}
@@ -0,0 +1,18 @@
+#ifndef UITEST_AGENT_VNC_PIXFMT_H
+#define UITEST_AGENT_VNC_PIXFMT_H
+
+#include <stdint.h>
+
+// 帧缓冲支持的每像素位数: 32 为 RGBX, 16 为 RGB565, 8 为 BGR233(固定调色板, R 占低3位, B 占高2位)
+#define PIXFMT_BPP_DEFAULT 32
+
+// 以下函数把解码得到的 RGBX 转换为帧缓冲格式, bpp 为每像素字节数, 与差分一致
+
+const char *pixfmt_kernel_name();
+void pixfmt_convert_row(uint8_t *dst, const uint8_t *src, int width, int bpp);
+void pixfmt_convert_rows(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride, int width, int y1, int y2,
+                         int bpp);
+void pixfmt_convert_rows_parallel(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride, int width,
+                                  int y1, int y2, int bpp);
+
+#endif //UITEST_AGENT_VNC_PIXFMT_H
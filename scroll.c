@@ -0,0 +1,254 @@
+#include "scroll.h"
+#include "diff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// 水平平移的采样行数与每行用于定位的像素段长度
+#define SCROLL_SAMPLE_ROWS 32
+#define SCROLL_SAMPLE_PIXELS 64
+
+#define SCROLL_ROW_EMPTY (-1)
+#define SCROLL_ROW_DUPLICATE (-2)
+
+void scroll_detector_free(ScrollDetector *det) {
+    free(det->currHashes);
+    free(det->lastHashes);
+    free(det->tableKeys);
+    free(det->tableRows);
+    free(det->votes);
+    memset(det, 0, sizeof(*det));
+}
+
+static bool scroll_reserve(ScrollDetector *det, int width, int height) {
+    int size = width > height ? width : height;
+    if (size <= det->capacity) {
+        return true;
+    }
+    scroll_detector_free(det);
+    det->tableSize = 1;
+    while (det->tableSize < size * 2) {
+        det->tableSize <<= 1;
+    }
+    det->currHashes = (uint64_t *) malloc(sizeof(uint64_t) * size);
+    det->lastHashes = (uint64_t *) malloc(sizeof(uint64_t) * size);
+    det->tableKeys = (uint64_t *) malloc(sizeof(uint64_t) * det->tableSize);
+    det->tableRows = (int *) malloc(sizeof(int) * det->tableSize);
+    det->votes = (int *) malloc(sizeof(int) * (size * 2 + 1));
+    if (!det->currHashes || !det->lastHashes || !det->tableKeys || !det->tableRows || !det->votes) {
+        scroll_detector_free(det);
+        return false;
+    }
+    det->capacity = size;
+    return true;
+}
+
+static void scroll_hash_rows(uint64_t *hashes, const uint8_t *data, int stride, int rowBytes, int height) {
+    for (int y = 0; y < height; ++y) {
+        hashes[y] = diff_hash(data + (size_t) y * stride, rowBytes, 0);
+    }
+}
+
+static void scroll_table_build(ScrollDetector *det, int height) {
+    const int mask = det->tableSize - 1;
+    for (int i = 0; i < det->tableSize; ++i) {
+        det->tableRows[i] = SCROLL_ROW_EMPTY;
+    }
+    for (int y = 0; y < height; ++y) {
+        uint64_t key = det->lastHashes[y];
+        int i = (int) (key & mask);
+        while (det->tableRows[i] != SCROLL_ROW_EMPTY && det->tableKeys[i] != key) {
+            i = (i + 1) & mask;
+        }
+        if (det->tableRows[i] == SCROLL_ROW_EMPTY) {
+            det->tableKeys[i] = key;
+            det->tableRows[i] = y;
+        } else {
+            det->tableRows[i] = SCROLL_ROW_DUPLICATE;
+        }
+    }
+}
+
+static int scroll_table_find(const ScrollDetector *det, uint64_t key) {
+    const int mask = det->tableSize - 1;
+    int i = (int) (key & mask);
+    while (det->tableRows[i] != SCROLL_ROW_EMPTY) {
+        if (det->tableKeys[i] == key) {
+            return det->tableRows[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return SCROLL_ROW_EMPTY;
+}
+
+// 得票最多的偏移量, 票数不足时返回 false
+static bool scroll_best_vote(const int *votes, int range, int *offset) {
+    int best = 0;
+    for (int i = 1; i < range * 2 + 1; ++i) {
+        if (votes[i] > votes[best]) {
+            best = i;
+        }
+    }
+    if (votes[best] < SCROLL_MIN_VOTES) {
+        return false;
+    }
+    *offset = best - range;
+    return true;
+}
+
+/**
+ * 找出 [y1, y2) 内逐行校验通过的最长连续行
+ */
+static bool scroll_longest_run(const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                               const uint64_t *currHashes, const uint64_t *lastHashes, int y1, int y2,
+                               int x1, int x2, int bpp, int dx, int dy, int *runY1, int *runY2) {
+    int start = -1;
+    int bestLen = 0;
+    size_t bytes = (size_t) (x2 - x1) * bpp;
+    for (int y = y1; y <= y2; ++y) {
+        bool match = false;
+        if (y < y2 && (dx != 0 || currHashes[y] == lastHashes[y - dy])) {
+            match = memcmp(curr + (size_t) y * currStride + (size_t) x1 * bpp,
+                           last + (size_t) (y - dy) * lastStride + (size_t) (x1 - dx) * bpp, bytes) == 0;
+        }
+        if (match) {
+            if (start < 0) {
+                start = y;
+            }
+        } else if (start >= 0) {
+            if (y - start > bestLen) {
+                bestLen = y - start;
+                *runY1 = start;
+                *runY2 = y;
+            }
+            start = -1;
+        }
+    }
+    return bestLen >= SCROLL_MIN_ROWS;
+}
+
+/**
+ * 垂直平移: 有变化的行在上一帧中按哈希查找唯一对应的行, 对行偏移计票
+ */
+static bool scroll_detect_vertical(ScrollDetector *det, const uint8_t *curr, int currStride, const uint8_t *last,
+                                   int lastStride, int width, int height, int bpp, ScrollMove *move) {
+    scroll_table_build(det, height);
+    memset(det->votes, 0, sizeof(int) * (height * 2 + 1));
+    for (int y = 0; y < height; ++y) {
+        if (det->currHashes[y] == det->lastHashes[y]) {
+            continue;
+        }
+        int from = scroll_table_find(det, det->currHashes[y]);
+        if (from >= 0) {
+            det->votes[y - from + height]++;
+        }
+    }
+    int dy;
+    if (!scroll_best_vote(det->votes, height, &dy) || dy == 0) {
+        return false;
+    }
+    int y1 = dy > 0 ? dy : 0;
+    int y2 = dy > 0 ? height : height + dy;
+    if (!scroll_longest_run(curr, currStride, last, lastStride, det->currHashes, det->lastHashes, y1, y2,
+                            0, width, bpp, 0, dy, &move->y1, &move->y2)) {
+        return false;
+    }
+    move->x1 = 0;
+    move->x2 = width;
+    move->dx = 0;
+    move->dy = dy;
+    return true;
+}
+
+/**
+ * 水平平移: 在有变化的行中采样, 用行中间的一段像素在上一帧同一行中查找位置, 对列偏移计票
+ */
+static bool scroll_detect_horizontal(ScrollDetector *det, const uint8_t *curr, int currStride, const uint8_t *last,
+                                     int lastStride, int width, int height, int bpp, ScrollMove *move) {
+    if (width < SCROLL_SAMPLE_PIXELS * 2) {
+        return false;
+    }
+    int changed = 0;
+    for (int y = 0; y < height; ++y) {
+        changed += det->currHashes[y] != det->lastHashes[y];
+    }
+    if (changed < SCROLL_MIN_ROWS) {
+        return false;
+    }
+    memset(det->votes, 0, sizeof(int) * (width * 2 + 1));
+    const int step = changed > SCROLL_SAMPLE_ROWS ? changed / SCROLL_SAMPLE_ROWS : 1;
+    const int x = (width - SCROLL_SAMPLE_PIXELS) / 2;
+    const size_t segBytes = (size_t) SCROLL_SAMPLE_PIXELS * bpp;
+    int seen = 0;
+    for (int y = 0; y < height; ++y) {
+        if (det->currHashes[y] == det->lastHashes[y] || seen++ % step != 0) {
+            continue;
+        }
+        const uint8_t *seg = curr + (size_t) y * currStride + (size_t) x * bpp;
+        // 纯色段在任何位置都能匹配, 无法定位
+        if (memcmp(seg, seg + bpp, segBytes - bpp) == 0) {
+            continue;
+        }
+        const uint8_t *row = last + (size_t) y * lastStride;
+        for (int d = 1; d <= x; ++d) {
+            if (memcmp(seg, row + (size_t) (x - d) * bpp, segBytes) == 0) {
+                det->votes[d + width]++;
+                break;
+            }
+            if (memcmp(seg, row + (size_t) (x + d) * bpp, segBytes) == 0) {
+                det->votes[-d + width]++;
+                break;
+            }
+        }
+    }
+    int dx;
+    if (!scroll_best_vote(det->votes, width, &dx)) {
+        return false;
+    }
+    int x1 = dx > 0 ? dx : 0;
+    int x2 = dx > 0 ? width : width + dx;
+    if (!scroll_longest_run(curr, currStride, last, lastStride, det->currHashes, det->lastHashes, 0, height,
+                            x1, x2, bpp, dx, 0, &move->y1, &move->y2)) {
+        return false;
+    }
+    move->x1 = x1;
+    move->x2 = x2;
+    move->dx = dx;
+    move->dy = 0;
+    return true;
+}
+
+/**
+ * 检测当前帧相对上一帧的整块平移(列表滚动/左右翻页)
+ * 先按行哈希找垂直平移, 找不到再找水平平移; 结果区域逐行校验与上一帧偏移后的内容完全一致
+ *
+ * @param det
+ * @param curr 当前帧
+ * @param currStride
+ * @param last 上一帧
+ * @param lastStride
+ * @param width
+ * @param height
+ * @param bpp 每像素字节数
+ * @param lastHashed 上一帧就是上一次调用时的当前帧, 可复用其行哈希
+ * @param move 检测到的平移
+ * @return 是否检测到平移
+ */
+bool scroll_detect(ScrollDetector *det, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                   int width, int height, int bpp, bool lastHashed, ScrollMove *move) {
+    if (!scroll_reserve(det, width, height)) {
+        return false;
+    }
+    if (lastHashed && det->width == width && det->height == height) {
+        uint64_t *hashes = det->lastHashes;
+        det->lastHashes = det->currHashes;
+        det->currHashes = hashes;
+    } else {
+        scroll_hash_rows(det->lastHashes, last, lastStride, width * bpp, height);
+    }
+    scroll_hash_rows(det->currHashes, curr, currStride, width * bpp, height);
+    det->width = width;
+    det->height = height;
+    return scroll_detect_vertical(det, curr, currStride, last, lastStride, width, height, bpp, move) ||
+           scroll_detect_horizontal(det, curr, currStride, last, lastStride, width, height, bpp, move);
+}
@@ -0,0 +1,44 @@
+#ifndef UITEST_AGENT_VNC_SCROLL_H
+#define UITEST_AGENT_VNC_SCROLL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 平移区域至少的行数, 更小的移动按普通变化发送
+#define SCROLL_MIN_ROWS 64
+// 至少这么多行在上一帧中找到唯一对应的行, 才认为是一次平移
+#define SCROLL_MIN_VOTES 8
+
+// 检测到的平移: 目标矩形 [x1, x2) x [y1, y2) 的内容等于上一帧中偏移 (-dx, -dy) 处的内容
+typedef struct {
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+    int dx;
+    int dy;
+} ScrollMove;
+
+/**
+ * 平移检测上下文, 跨帧复用
+ * 保存最近一帧的行哈希, 下一帧与之比较时无需重新计算上一帧
+ */
+typedef struct {
+    int width;
+    int height;
+    int capacity;
+    uint64_t *currHashes;
+    uint64_t *lastHashes;
+    // 上一帧行哈希 -> 行号的开放寻址表, 行号-1为空, -2为哈希重复(纯色行等)无法定位
+    uint64_t *tableKeys;
+    int *tableRows;
+    int tableSize;
+    // 按偏移量计票, 下标为偏移 + 尺寸
+    int *votes;
+} ScrollDetector;
+
+void scroll_detector_free(ScrollDetector *det);
+bool scroll_detect(ScrollDetector *det, const uint8_t *curr, int currStride, const uint8_t *last, int lastStride,
+                   int width, int height, int bpp, bool lastHashed, ScrollMove *move);
+
+#endif //UITEST_AGENT_VNC_SCROLL_H
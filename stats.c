@@ -0,0 +1,376 @@
+#include "stats.h"
+#include "agent.h"
+
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define STATS_LOG_INTERVAL_SEC 5
+
+AgentStats g_AgentStats;
+
+/**
+ * 记录当前队列深度, 同时维护历史最大值
+ */
+void stats_queue_depth(int depth) {
+    atomic_store_explicit(&g_AgentStats.queueDepth, depth, memory_order_relaxed);
+    int max = atomic_load_explicit(&g_AgentStats.queueDepthMax, memory_order_relaxed);
+    while (depth > max &&
+           !atomic_compare_exchange_weak_explicit(&g_AgentStats.queueDepthMax, &max, depth,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * 记录输入队列深度的历史最大值
+ */
+void stats_input_depth(int depth) {
+    int max = atomic_load_explicit(&g_AgentStats.inputDepthMax, memory_order_relaxed);
+    while (depth > max &&
+           !atomic_compare_exchange_weak_explicit(&g_AgentStats.inputDepthMax, &max, depth,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+uint64_t stats_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * 记录一次等待
+ *
+ * @param count 等待次数
+ * @param total 累计等待时间
+ * @param max 最大等待时间
+ * @param ns 本次等待时间(纳秒)
+ */
+void stats_wait(atomic_ullong *count, atomic_ullong *total, atomic_ullong *max, uint64_t ns) {
+    atomic_fetch_add_explicit(count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(total, ns, memory_order_relaxed);
+    unsigned long long old = atomic_load_explicit(max, memory_order_relaxed);
+    while (ns > old &&
+           !atomic_compare_exchange_weak_explicit(max, &old, ns, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static uint64_t stats_cpu_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+// 当前暂停开始的时间点, 0表示未暂停; 只由vnc服务器线程访问
+static uint64_t g_pauseStartNs;
+static uint64_t g_pauseStartCpuNs;
+
+/**
+ * 记录采集暂停/恢复, 暂停期间的墙钟与CPU时间在恢复时累计
+ */
+void stats_capture_paused(bool paused) {
+    if (paused && g_pauseStartNs == 0) {
+        atomic_fetch_add_explicit(&g_AgentStats.capturePauses, 1, memory_order_relaxed);
+        g_pauseStartNs = stats_now_ns();
+        g_pauseStartCpuNs = stats_cpu_ns();
+    } else if (!paused && g_pauseStartNs != 0) {
+        atomic_fetch_add_explicit(&g_AgentStats.captureResumes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.pausedNs, stats_now_ns() - g_pauseStartNs, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_AgentStats.pausedCpuNs, stats_cpu_ns() - g_pauseStartCpuNs,
+                                  memory_order_relaxed);
+        g_pauseStartNs = 0;
+    }
+}
+
+/**
+ * 进程当前常驻内存(KiB), 读取失败返回0
+ */
+unsigned long long stats_rss_kb() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    unsigned long long pages = 0, resident = 0;
+    int n = fscanf(fp, "%llu %llu", &pages, &resident);
+    fclose(fp);
+    return n == 2 ? resident * (unsigned long long) sysconf(_SC_PAGESIZE) / 1024 : 0;
+}
+
+/**
+ * 记录一次阶段耗时, 按微秒的 2 的幂分桶
+ *
+ * @param stage
+ * @param ns 耗时(纳秒)
+ */
+void stats_stage(StatsStage stage, uint64_t ns) {
+    StatsHistogram *hist = &g_AgentStats.stages[stage];
+    uint64_t us = ns / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= STATS_HIST_BUCKETS) {
+        bucket = STATS_HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&hist->buckets[bucket], 1, memory_order_relaxed);
+    stats_wait(&hist->count, &hist->sumNs, &hist->maxNs, ns);
+}
+
+/**
+ * 周期性输出计数器, 由vnc服务器循环调用, 未到间隔时直接返回
+ */
+void stats_tick() {
+    static time_t last = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - last < STATS_LOG_INTERVAL_SEC) {
+        return;
+    }
+    last = now.tv_sec;
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: frames captured=%llu decoded=%llu dropped=%llu skipped=%llu, queue depth=%d max=%d",
+                   __func__, atomic_load(&g_AgentStats.framesCaptured), atomic_load(&g_AgentStats.framesDecoded),
+                   atomic_load(&g_AgentStats.framesDropped), atomic_load(&g_AgentStats.framesSkipped),
+                   atomic_load(&g_AgentStats.queueDepth), atomic_load(&g_AgentStats.queueDepthMax));
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: buffer handoff producer=%lluus (max %lluus), server=%lluus (max %lluus)", __func__,
+                   atomic_load(&g_AgentStats.producerWaitNs) / 1000,
+                   atomic_load(&g_AgentStats.producerWaitMaxNs) / 1000,
+                   atomic_load(&g_AgentStats.serverWaitNs) / 1000,
+                   atomic_load(&g_AgentStats.serverWaitMaxNs) / 1000);
+    // 正在暂停时把本次暂停的部分也计入
+    uint64_t pausedNs = atomic_load(&g_AgentStats.pausedNs);
+    uint64_t pausedCpuNs = atomic_load(&g_AgentStats.pausedCpuNs);
+    if (g_pauseStartNs != 0) {
+        pausedNs += stats_now_ns() - g_pauseStartNs;
+        pausedCpuNs += stats_cpu_ns() - g_pauseStartCpuNs;
+    }
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: capture pauses=%llu resumes=%llu, paused %.1fs, idle cpu %.2f%%%s", __func__,
+                   atomic_load(&g_AgentStats.capturePauses), atomic_load(&g_AgentStats.captureResumes),
+                   (double) pausedNs / 1e9, pausedNs ? 100.0 * (double) pausedCpuNs / (double) pausedNs : 0.0,
+                   g_pauseStartNs != 0 ? " (paused)" : "");
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: capture interval=%.1fms, full rate restored on input=%llu change=%llu", __func__,
+                   (double) atomic_load(&g_AgentStats.captureIntervalUs) / 1000,
+                   atomic_load(&g_AgentStats.paceInputResets), atomic_load(&g_AgentStats.paceChangeResets));
+    unsigned long long injections = atomic_load(&g_AgentStats.inputInjections);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: input queued=%llu injected=%llu coalesced=%llu dropped=%llu depth max=%d, "
+                   "latency avg=%lluus max=%lluus", __func__,
+                   atomic_load(&g_AgentStats.inputQueued), injections, atomic_load(&g_AgentStats.inputCoalesced),
+                   atomic_load(&g_AgentStats.inputDropped), atomic_load(&g_AgentStats.inputDepthMax),
+                   injections ? atomic_load(&g_AgentStats.inputLatencyNs) / injections / 1000 : 0,
+                   atomic_load(&g_AgentStats.inputLatencyMaxNs) / 1000);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: keys injected=%llu, text calls=%llu chars=%llu", __func__,
+                   atomic_load(&g_AgentStats.inputKeyCalls), atomic_load(&g_AgentStats.inputTextCalls),
+                   atomic_load(&g_AgentStats.inputTextChars));
+    unsigned long long requests = atomic_load(&g_AgentStats.captureRequests);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: capture request avg=%lluns max=%lluns, display queries=%llu, resizes=%llu",
+                   __func__, requests ? atomic_load(&g_AgentStats.captureRequestNs) / requests : 0,
+                   atomic_load(&g_AgentStats.captureRequestMaxNs), atomic_load(&g_AgentStats.displayQueries),
+                   atomic_load(&g_AgentStats.screenResizes));
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: jpeg passthrough rects=%llu bytes=%llu", __func__,
+                   atomic_load(&g_AgentStats.jpegPassthroughRects), atomic_load(&g_AgentStats.jpegPassthroughBytes));
+    unsigned long long hits = atomic_load(&g_AgentStats.encodeCacheHits);
+    unsigned long long misses = atomic_load(&g_AgentStats.encodeCacheMisses);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: encode cache hits=%llu misses=%llu (hit %.1f%%) evictions=%llu", __func__, hits,
+                   misses, hits + misses ? 100.0 * (double) hits / (double) (hits + misses) : 0.0,
+                   atomic_load(&g_AgentStats.encodeCacheEvictions));
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: scroll frames=%llu pixels=%llu, detect %lluus", __func__,
+                   atomic_load(&g_AgentStats.scrollFrames), atomic_load(&g_AgentStats.scrollPixels),
+                   atomic_load(&g_AgentStats.scrollDetectNs) / 1000);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: hash verified segments=%llu collisions=%llu", __func__,
+                   atomic_load(&g_AgentStats.hashVerifiedSegs), atomic_load(&g_AgentStats.hashCollisions));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    AGENT_OHOS_LOG(LOG_DEBUG, "%s: buffer pool maps=%llu reuses=%llu mapped=%lluKiB, faults minor=%ld major=%ld, "
+                   "rss=%lluKiB", __func__, atomic_load(&g_AgentStats.poolMaps),
+                   atomic_load(&g_AgentStats.poolReuses), atomic_load(&g_AgentStats.poolBytes) / 1024,
+                   usage.ru_minflt, usage.ru_majflt, stats_rss_kb());
+}
+
+static const char *g_stageNames[STATS_STAGE_COUNT] = {
+    "capture", "decode", "diff", "write", "publish", "acquire", "send",
+};
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t len;
+} StatsWriter;
+
+static void stats_put(StatsWriter *w, const char *fmt, ...) {
+    if (w->len >= w->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w->buffer + w->len, w->size - w->len, fmt, args);
+    va_end(args);
+    w->len += n > 0 ? (size_t) n : 0;
+}
+
+/**
+ * 由分桶估算分位数, 返回所在桶的上界(微秒)
+ */
+static unsigned long long stats_percentile(const unsigned long long *buckets, unsigned long long count, int pct) {
+    unsigned long long rank = (count * pct + 99) / 100;
+    unsigned long long seen = 0;
+    for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (STATS_HIST_BUCKETS - 1);
+}
+
+static void stats_put_stage(StatsWriter *w, StatsStage stage) {
+    StatsHistogram *hist = &g_AgentStats.stages[stage];
+    unsigned long long buckets[STATS_HIST_BUCKETS];
+    unsigned long long count = 0;
+    for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+        buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        count += buckets[i];
+    }
+    unsigned long long sum = atomic_load_explicit(&hist->sumNs, memory_order_relaxed);
+    stats_put(w, "\"%s\":{\"count\":%llu,\"avg_us\":%llu,\"max_us\":%llu,\"p50_us\":%llu,\"p90_us\":%llu,"
+              "\"p99_us\":%llu,\"buckets\":[", g_stageNames[stage], count, count ? sum / count / 1000 : 0,
+              atomic_load_explicit(&hist->maxNs, memory_order_relaxed) / 1000,
+              count ? stats_percentile(buckets, count, 50) : 0, count ? stats_percentile(buckets, count, 90) : 0,
+              count ? stats_percentile(buckets, count, 99) : 0);
+    for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+        stats_put(w, i ? ",%llu" : "%llu", buckets[i]);
+    }
+    stats_put(w, "]}");
+}
+
+/**
+ * 把计数器与各阶段直方图格式化为一行 JSON
+ * 直方图第 k 个桶为 [2^(k-1), 2^k) 微秒, 分位数取所在桶的上界; 各项均为启动以来的累计值
+ *
+ * @param buffer
+ * @param size
+ * @param server 为NULL时不输出客户端
+ * @return JSON 长度, 缓冲区不足时返回-1
+ */
+int stats_json(char *buffer, size_t size, rfbScreenInfoPtr server) {
+    StatsWriter w = {buffer, size, 0};
+    AgentStats *s = &g_AgentStats;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    stats_put(&w, "{\"time_ms\":%llu,", (unsigned long long) now.tv_sec * 1000 + now.tv_nsec / 1000000);
+    stats_put(&w, "\"frames\":{\"captured\":%llu,\"decoded\":%llu,\"dropped\":%llu,\"skipped\":%llu,"
+              "\"published\":%llu},\"dirty_pixels\":%llu,\"queue_depth_max\":%d,\"capture_interval_us\":%llu,"
+              "\"jpeg_passthrough\":{\"rects\":%llu,\"bytes\":%llu},"
+              "\"encode_cache\":{\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu},"
+              "\"scroll\":{\"frames\":%llu,\"pixels\":%llu,\"detect_us\":%llu},"
+              "\"hash_verify\":{\"segments\":%llu,\"collisions\":%llu},"
+              "\"memory\":{\"pool_maps\":%llu,\"pool_reuses\":%llu,\"pool_kb\":%llu,\"minor_faults\":%ld,"
+              "\"major_faults\":%ld,\"rss_kb\":%llu},",
+              atomic_load(&s->framesCaptured), atomic_load(&s->framesDecoded), atomic_load(&s->framesDropped),
+              atomic_load(&s->framesSkipped), atomic_load(&s->framesPublished), atomic_load(&s->dirtyPixels),
+              atomic_load(&s->queueDepthMax), atomic_load(&s->captureIntervalUs),
+              atomic_load(&s->jpegPassthroughRects), atomic_load(&s->jpegPassthroughBytes),
+              atomic_load(&s->encodeCacheHits), atomic_load(&s->encodeCacheMisses),
+              atomic_load(&s->encodeCacheEvictions),
+              atomic_load(&s->scrollFrames), atomic_load(&s->scrollPixels), atomic_load(&s->scrollDetectNs) / 1000,
+              atomic_load(&s->hashVerifiedSegs), atomic_load(&s->hashCollisions),
+              atomic_load(&s->poolMaps), atomic_load(&s->poolReuses), atomic_load(&s->poolBytes) / 1024,
+              usage.ru_minflt, usage.ru_majflt, stats_rss_kb());
+    stats_put(&w, "\"stages\":{");
+    for (int i = 0; i < STATS_STAGE_COUNT; ++i) {
+        if (i) {
+            stats_put(&w, ",");
+        }
+        stats_put_stage(&w, (StatsStage) i);
+    }
+    stats_put(&w, "},\"clients\":[");
+    if (server != NULL) {
+        rfbClientIteratorPtr iter = rfbGetClientIterator(server);
+        rfbClientPtr cl;
+        bool first = true;
+        while ((cl = rfbClientIteratorNext(iter)) != NULL) {
+            stats_put(&w, "%s{\"host\":\"%s\",\"bytes_sent\":%d,\"updates\":%d}", first ? "" : ",",
+                      cl->host ? cl->host : "", rfbStatGetSentBytes(cl),
+                      rfbStatGetMessageCountSent(cl, rfbFramebufferUpdate));
+            first = false;
+        }
+        rfbReleaseClientIterator(iter);
+    }
+    stats_put(&w, "]}");
+    return w.len < w.size ? (int) w.len : -1;
+}
+
+// 周期性/按需输出 JSON: 只由vnc服务器线程访问, 按需请求来自 SIGUSR1
+static FILE *g_reportFile;
+static int g_reportIntervalSec;
+static uint64_t g_reportLastNs;
+static bool g_reportSignal;
+static struct sigaction g_reportOldAction;
+static volatile sig_atomic_t g_reportRequested;
+
+static void stats_report_signal(int sig) {
+    g_reportRequested = 1;
+}
+
+/**
+ * 开启 JSON 统计输出
+ * 每 intervalSec 秒输出一行, 0 为不定期输出; 开启后收到 SIGUSR1 时立即输出一行
+ *
+ * @param intervalSec
+ * @param path 追加写入的文件, 为空时输出到日志
+ * @return
+ */
+int stats_report_init(int intervalSec, const char *path) {
+    g_reportIntervalSec = intervalSec;
+    g_reportLastNs = stats_now_ns();
+    if (path != NULL && path[0]) {
+        g_reportFile = fopen(path, "a");
+        if (g_reportFile == NULL) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: open %s failed", __func__, path);
+            return -1;
+        }
+        setvbuf(g_reportFile, NULL, _IOLBF, 0);
+    }
+    if (intervalSec <= 0 && g_reportFile == NULL) {
+        return 0;
+    }
+    struct sigaction action = {};
+    action.sa_handler = stats_report_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    g_reportSignal = sigaction(SIGUSR1, &action, &g_reportOldAction) == 0;
+    return 0;
+}
+
+/**
+ * 到达输出间隔或收到按需请求时输出一行 JSON, 由vnc服务器循环调用
+ */
+void stats_report(rfbScreenInfoPtr server) {
+    uint64_t now = stats_now_ns();
+    bool due = g_reportIntervalSec > 0 && now - g_reportLastNs >= (uint64_t) g_reportIntervalSec * 1000000000ull;
+    if (!due && !g_reportRequested) {
+        return;
+    }
+    g_reportRequested = 0;
+    g_reportLastNs = now;
+    static char buffer[8192];
+    if (stats_json(buffer, sizeof(buffer), server) < 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: stats truncated", __func__);
+        return;
+    }
+    if (g_reportFile != NULL) {
+        fputs(buffer, g_reportFile);
+        fputc('\n', g_reportFile);
+    } else {
+        AGENT_OHOS_LOG(LOG_INFO, "stats: %s", buffer);
+    }
+}
+
+void stats_report_close() {
+    if (g_reportSignal) {
+        sigaction(SIGUSR1, &g_reportOldAction, NULL);
+        g_reportSignal = false;
+    }
+    if (g_reportFile != NULL) {
+        fclose(g_reportFile);
+        g_reportFile = NULL;
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef UITEST_AGENT_VNC_STATS_H
+#define UITEST_AGENT_VNC_STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 耗时直方图按 2 的幂分桶(微秒): 桶0为 <1us, 桶k为 [2^(k-1), 2^k) us, 最后一个桶包含更大的值
+#define STATS_HIST_BUCKETS 24
+
+typedef struct {
+    atomic_ullong count;
+    atomic_ullong sumNs;
+    atomic_ullong maxNs;
+    atomic_ullong buckets[STATS_HIST_BUCKETS];
+} StatsHistogram;
+
+// 从截屏到发送给客户端的各阶段, 每帧(发送为每次有数据发出的循环)记录一次
+typedef enum {
+    // 取得一帧原始截图(PNG/DMPUB, JPEG 的截屏在 uitest 内部无法计时)
+    STATS_STAGE_CAPTURE,
+    // JPEG/PNG 解码整帧, 包含与解码交错进行的差分与写入
+    STATS_STAGE_DECODE,
+    // 与最近发布的帧比较
+    STATS_STAGE_DIFF,
+    // 写入帧缓冲: 补齐复用的缓冲区, DMPUB 复制变化区域
+    STATS_STAGE_WRITE,
+    // 解码线程发布帧缓冲(release_vnc_buf)
+    STATS_STAGE_PUBLISH,
+    // vnc服务器取用帧缓冲
+    STATS_STAGE_ACQUIRE,
+    // vnc服务器编码并发送更新
+    STATS_STAGE_SEND,
+    STATS_STAGE_COUNT
+} StatsStage;
+
+// 运行时计数器, 多线程无锁更新
+typedef struct {
+    // 采集线程提交的帧
+    atomic_ullong framesCaptured;
+    // 解码线程处理的帧
+    atomic_ullong framesDecoded;
+    // 解码来不及, 被更新的帧覆盖而丢弃的帧
+    atomic_ullong framesDropped;
+    // 已发布但vnc服务器还未取用就被新帧替换的帧
+    atomic_ullong framesSkipped;
+    // 等待解码的帧数与历史最大值
+    atomic_int queueDepth;
+    atomic_int queueDepthMax;
+    // 复用缓冲区前从最新帧补齐的字节数, 以及落后过多时的整帧复制次数
+    atomic_ullong syncBytes;
+    atomic_ullong syncFullCopies;
+    // 解码线程获取/发布帧缓冲的次数, 累计与最大耗时(纳秒)
+    atomic_ullong producerWaits;
+    atomic_ullong producerWaitNs;
+    atomic_ullong producerWaitMaxNs;
+    // vnc服务器循环取用帧缓冲的次数与耗时
+    atomic_ullong serverWaits;
+    atomic_ullong serverWaitNs;
+    atomic_ullong serverWaitMaxNs;
+    // 按客户端需求暂停/恢复采集的次数, 累计暂停时长及暂停期间进程消耗的CPU时间(纳秒)
+    atomic_ullong capturePauses;
+    atomic_ullong captureResumes;
+    atomic_ullong pausedNs;
+    atomic_ullong pausedCpuNs;
+    // 当前采集间隔(微秒), 以及从降速状态恢复满帧率的次数: 注入输入 / 检测到画面变化
+    atomic_ullong captureIntervalUs;
+    atomic_ullong paceInputResets;
+    atomic_ullong paceChangeResets;
+    // 输入事件: 入队数, 合并掉的移动事件, 队列满时丢弃的移动事件, 队列深度历史最大值
+    atomic_ullong inputQueued;
+    atomic_ullong inputCoalesced;
+    atomic_ullong inputDropped;
+    atomic_int inputDepthMax;
+    // 实际注入次数, 从入队到注入完成的累计与最大延迟(纳秒)
+    atomic_ullong inputInjections;
+    atomic_ullong inputLatencyNs;
+    atomic_ullong inputLatencyMaxNs;
+    // 按键注入次数, 文本输入次数及其包含的字符数(两者之差即合并省去的调用)
+    atomic_ullong inputKeyCalls;
+    atomic_ullong inputTextCalls;
+    atomic_ullong inputTextChars;
+    // 采集线程每帧准备截屏请求(屏幕参数/请求模板)的次数, 累计与最大耗时(纳秒)
+    atomic_ullong captureRequests;
+    atomic_ullong captureRequestNs;
+    atomic_ullong captureRequestMaxNs;
+    // 查询屏幕参数的次数(每次包含 displayId/宽/高), 以及帧缓冲随屏幕尺寸重建的次数
+    atomic_ullong displayQueries;
+    atomic_ullong screenResizes;
+    // 发布的帧数与变化区域的累计像素数
+    atomic_ullong framesPublished;
+    atomic_ullong dirtyPixels;
+    // 设备JPEG直接转发给 Tight JPEG 客户端的矩形数与字节数
+    atomic_ullong jpegPassthroughRects;
+    atomic_ullong jpegPassthroughBytes;
+    // 多客户端共享的编码缓存: 命中/编码的矩形数, 以及因内容变化或容量不足淘汰的矩形数
+    atomic_ullong encodeCacheHits;
+    atomic_ullong encodeCacheMisses;
+    atomic_ullong encodeCacheEvictions;
+    // 检测到整块平移(以 CopyRect 发送)的帧数与平移区域的累计像素数, 以及检测的累计耗时(纳秒)
+    atomic_ullong scrollFrames;
+    atomic_ullong scrollPixels;
+    atomic_ullong scrollDetectNs;
+    // 哈希差分校验: 哈希相同而逐字节比较的段数, 以及其中实际有变化(哈希碰撞)的段数
+    atomic_ullong hashVerifiedSegs;
+    atomic_ullong hashCollisions;
+    // 帧缓冲池: 映射次数, 当前映射的字节数, 复用空闲映射的次数
+    atomic_ullong poolMaps;
+    atomic_ullong poolBytes;
+    atomic_ullong poolReuses;
+    StatsHistogram stages[STATS_STAGE_COUNT];
+} AgentStats;
+
+extern AgentStats g_AgentStats;
+
+void stats_queue_depth(int depth);
+void stats_input_depth(int depth);
+uint64_t stats_now_ns();
+void stats_wait(atomic_ullong *count, atomic_ullong *total, atomic_ullong *max, uint64_t ns);
+void stats_capture_paused(bool paused);
+unsigned long long stats_rss_kb();
+void stats_stage(StatsStage stage, uint64_t ns);
+void stats_tick();
+
+struct _rfbScreenInfo;
+int stats_report_init(int intervalSec, const char *path);
+void stats_report(struct _rfbScreenInfo *server);
+void stats_report_close();
+int stats_json(char *buffer, size_t size, struct _rfbScreenInfo *server);
+
+#endif //UITEST_AGENT_VNC_STATS_H
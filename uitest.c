@@ -1,33 +1,194 @@
 #include "uitest.h"
+#include "bufpool.h"
+#include "pipeline.h"
+#include "stats.h"
 
 #include <errno.h>
 #include <window_manager/oh_display_manager.h>
 #include <window_manager/oh_display_capture.h>
 #include <multimedia/image_framework/image/pixelmap_native.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdatomic.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 ScreenCopyCallback g_screenCopyCallback;
+ScreenCopyBuffer g_screenCopyBuffer;
+bool g_screenCopyPipeline;
 bool g_screenCopyDMPUBThreadRun;
 bool g_screenCopyPNGThreadRun;
 char g_screenCopyMode[16] = {};
 int g_fps;
+// 画面持续不变时允许降到的最低帧率, 不小于 g_fps 时不降速
+int g_minFps;
+// 暂停采集: PNG/DMPUB 线程阻塞等待, JPEG 模式停止 uitest 的截屏流
+static bool g_screenCopyPaused;
+static pthread_mutex_t g_screenCopyPauseLock = PTHREAD_MUTEX_INITIALIZER;
+// 唤醒采集线程: 暂停恢复/停止, 以及降速等待中的采集间隔被缩短; 使用单调时钟计时
+static pthread_cond_t g_screenCopyWakeCond;
+static pthread_once_t g_screenCopyWakeOnce = PTHREAD_ONCE_INIT;
+// 连续无变化开始的时间(单调时钟纳秒, 0表示最近一帧有变化)与其后超过保持时间的无变化帧数
+// 解码线程累加, 有输入注入或画面变化时清零
+static atomic_ullong g_screenCopyIdleSinceNs;
+static atomic_int g_screenCopyIdleFrames;
 
-int UiTest_getScreenWidth() {
-    int32_t width;
-    if (OH_NativeDisplayManager_GetDefaultDisplayWidth(&width) != DISPLAY_MANAGER_OK) {
-        return RETCODE_FAIL;
+// 屏幕参数缓存: 只在收到显示变化通知或定期检查时重新查询, 采集/解码线程每帧直接读取缓存
+static pthread_mutex_t g_screenGeometryLock = PTHREAD_MUTEX_INITIALIZER;
+static ScreenGeometry g_screenGeometry;
+// 与 g_screenGeometry.gen 相同, 采集线程先比较它, 变化时才加锁读取
+static atomic_uint g_screenGeometryGen;
+// 收到显示变化通知或帧尺寸改变, 下一次检查时立即重新查询
+static atomic_bool g_screenGeometryStale;
+static uint32_t g_displayListenerIndex;
+static bool g_displayListening;
+
+// 没有显示变化通知时定期检查屏幕参数的间隔
+#define SCREEN_GEOMETRY_CHECK_MS 2000
+// 读取像素连续失败的帧数上限: 屏幕尺寸刚变化时读取可能失败, 重新查询屏幕参数后重试
+#define DMPUB_READ_RETRY_MAX 30
+
+// 画面连续无变化超过该时长后开始降速; 按时间而不是帧数计, 单帧采集很慢(png)时同样半秒后开始
+#define PACE_HOLD_NS (500 * 1000 * 1000ULL)
+// 每次降速把采集间隔放大 1/4
+#define PACE_GROWTH_NUM 5
+#define PACE_GROWTH_DEN 4
+
+static void UiTest_InitWakeCond() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_screenCopyWakeCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * 当前采集间隔: 画面连续无变化超过半秒后, 每多一帧无变化间隔放大 1/4, 最长为 1/g_minFps 秒
+ *
+ * @return 采集间隔(微秒)
+ */
+static long UiTest_FrameIntervalUs() {
+    long interval_us = 1000000 / g_fps;
+    if (g_minFps > 0 && g_minFps < g_fps) {
+        long max_us = 1000000 / g_minFps;
+        int steps = atomic_load_explicit(&g_screenCopyIdleFrames, memory_order_relaxed);
+        while (steps-- > 0 && interval_us < max_us) {
+            interval_us = interval_us * PACE_GROWTH_NUM / PACE_GROWTH_DEN + 1;
+        }
+        if (interval_us > max_us) {
+            interval_us = max_us;
+        }
     }
-    return width;
+    atomic_store_explicit(&g_AgentStats.captureIntervalUs, interval_us, memory_order_relaxed);
+    return interval_us;
 }
 
-int UiTest_getScreenHeight() {
-    int32_t height;
-    if (OH_NativeDisplayManager_GetDefaultDisplayHeight(&height) != DISPLAY_MANAGER_OK) {
-        return RETCODE_FAIL;
+/**
+ * 恢复满帧率采集, 已经降速时唤醒正在等待下一帧的采集线程
+ *
+ * @param counter 恢复原因的计数器
+ */
+static void UiTest_ResetScreenCopyPace(atomic_ullong *counter) {
+    atomic_store_explicit(&g_screenCopyIdleSinceNs, 0, memory_order_relaxed);
+    int idle = atomic_exchange_explicit(&g_screenCopyIdleFrames, 0, memory_order_relaxed);
+    if (g_minFps <= 0 || g_minFps >= g_fps || idle == 0) {
+        // 未降速
+        return;
     }
-    return height;
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+    pthread_mutex_lock(&g_screenCopyPauseLock);
+    pthread_cond_broadcast(&g_screenCopyWakeCond);
+    pthread_mutex_unlock(&g_screenCopyPauseLock);
+}
+
+/**
+ * 查询屏幕参数并更新缓存
+ *
+ * @return 参数是否变化, 查询失败时保留缓存并返回false
+ */
+static bool UiTest_QueryScreenGeometry() {
+    uint64_t displayId = 0;
+    int32_t width = 0;
+    int32_t height = 0;
+    atomic_fetch_add_explicit(&g_AgentStats.displayQueries, 1, memory_order_relaxed);
+    if (OH_NativeDisplayManager_GetDefaultDisplayId(&displayId) != DISPLAY_MANAGER_OK ||
+        OH_NativeDisplayManager_GetDefaultDisplayWidth(&width) != DISPLAY_MANAGER_OK ||
+        OH_NativeDisplayManager_GetDefaultDisplayHeight(&height) != DISPLAY_MANAGER_OK || width <= 0 || height <= 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: query display failed", __func__);
+        return false;
+    }
+    pthread_mutex_lock(&g_screenGeometryLock);
+    bool changed = g_screenGeometry.gen == 0 || displayId != g_screenGeometry.displayId ||
+                   width != g_screenGeometry.width || height != g_screenGeometry.height;
+    if (changed) {
+        g_screenGeometry.displayId = displayId;
+        g_screenGeometry.width = width;
+        g_screenGeometry.height = height;
+        g_screenGeometry.gen++;
+        atomic_store_explicit(&g_screenGeometryGen, g_screenGeometry.gen, memory_order_release);
+    }
+    pthread_mutex_unlock(&g_screenGeometryLock);
+    if (changed) {
+        AGENT_OHOS_LOG(LOG_INFO, "%s: display %llu, %dx%d", __func__, (unsigned long long)displayId, width, height);
+    }
+    return changed;
+}
+
+/**
+ * 读取缓存的屏幕参数, 首次调用时查询
+ *
+ * @param geometry
+ * @return
+ */
+int UiTest_GetScreenGeometry(ScreenGeometry *geometry) {
+    if (atomic_load_explicit(&g_screenGeometryGen, memory_order_acquire) == 0) {
+        UiTest_QueryScreenGeometry();
+    }
+    pthread_mutex_lock(&g_screenGeometryLock);
+    *geometry = g_screenGeometry;
+    pthread_mutex_unlock(&g_screenGeometryLock);
+    return geometry->gen != 0 ? RETCODE_SUCCESS : RETCODE_FAIL;
+}
+
+/**
+ * 缓存的屏幕参数是否已更新, 是则读取到 geometry; 收到变化通知时先在本线程查询, 下一帧即按新尺寸采集
+ * 注意: 仅限采集线程使用, 参数未变化时不加锁
+ */
+static bool UiTest_UpdateScreenGeometry(ScreenGeometry *geometry) {
+    if (atomic_exchange(&g_screenGeometryStale, false)) {
+        UiTest_QueryScreenGeometry();
+    }
+    if (atomic_load_explicit(&g_screenGeometryGen, memory_order_acquire) == geometry->gen) {
+        return false;
+    }
+    return UiTest_GetScreenGeometry(geometry) == RETCODE_SUCCESS;
+}
+
+/**
+ * 检查屏幕参数是否变化, 由vnc服务器循环调用
+ * 收到变化通知后立即查询, 否则每 SCREEN_GEOMETRY_CHECK_MS 查询一次, 兼容不发送通知的设备
+ */
+void UiTest_CheckScreenGeometry() {
+    static int64_t last_ms = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if (!atomic_exchange(&g_screenGeometryStale, false) && now_ms - last_ms < SCREEN_GEOMETRY_CHECK_MS) {
+        return;
+    }
+    last_ms = now_ms;
+    UiTest_QueryScreenGeometry();
+}
+
+/**
+ * 屏幕参数可能已变化(如截图尺寸改变), 下一次检查时立即查询
+ */
+void UiTest_InvalidateScreenGeometry() {
+    atomic_store(&g_screenGeometryStale, true);
+}
+
+static void UiTest_onDisplayChange(uint64_t displayId) {
+    UiTest_InvalidateScreenGeometry();
 }
 
 void UiTest_onScreenCopy(struct Text bytes) {
@@ -41,9 +202,7 @@ void UiTest_onScreenCopy(struct Text bytes) {
         return;
     }
     int64_t elapsed_us = now_us - last_us;
-    int64_t frame_interval_us = 1000000 / g_fps;
-    int64_t sleep_us = frame_interval_us - elapsed_us;
-    AGENT_OHOS_LOG(LOG_DEBUG, "%s: frame time %.3f ms, sleep %.3f ms", __func__, (double)elapsed_us / 1000.0, (double)sleep_us / 1000.0);
+    int64_t frame_interval_us = UiTest_FrameIntervalUs();
     if (elapsed_us < frame_interval_us) {
         AGENT_OHOS_LOG(LOG_DEBUG, "%s: elapsed_us < frame_interval_us, skip frame", __func__);
         return;
@@ -51,7 +210,12 @@ void UiTest_onScreenCopy(struct Text bytes) {
     last_us = now_us;
 
     if (g_screenCopyCallback != NULL && bytes.data != NULL && bytes.size > 0) {
-        g_screenCopyCallback((char*)bytes.data, (int)bytes.size);
+        if (pipeline_running()) {
+            // 数据只在回调期间有效, 复制到帧槽后交给解码线程
+            pipeline_push((const char*)bytes.data, (int)bytes.size);
+        } else {
+            g_screenCopyCallback((char*)bytes.data, (int)bytes.size);
+        }
     }
 }
 
@@ -66,148 +230,524 @@ static void UiTest_CreateDriver() {
     AGENT_OHOS_LOG(LOG_INFO, "%s: %s", __func__, output.data);
 }
 
-void UiTest_ScreenCopyPNGTask() {
-    // 20MB大缓冲区
-    char *png_buffer = malloc(1024 * 1024 * 20);
-    if (!png_buffer) {
-        AGENT_OHOS_LOG(LOG_ERROR, "%s: png_buffer malloc failed", __func__);
-        g_screenCopyPNGThreadRun = false;
-        return;
+// Driver 对象由截图与按键注入共用, 只创建一次
+static pthread_once_t g_driverOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * 调用 Driver#0 的接口
+ *
+ * @param api 接口名, 如 Driver.triggerKey
+ * @param args JSON 参数列表, 不含外层方括号
+ * @return
+ */
+static int UiTest_CallDriver(const char *api, const char *args) {
+    if (g_LowLevelFunctions.callThroughMessage == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
+        return RETCODE_FAIL;
+    }
+    pthread_once(&g_driverOnce, UiTest_CreateDriver);
+    char buffer[2048];
+    int n = snprintf(buffer, sizeof(buffer), "{\"api\":\"%s\",\"this\":\"Driver#0\",\"args\":[%s]}", api, args);
+    if (n < 0 || n >= (int)sizeof(buffer)) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: %s args too long", __func__, api);
+        return RETCODE_FAIL;
     }
+    struct Text input = {.data = buffer, .size = (size_t)n};
+    uint8_t outputData[512] = {};
+    size_t outputSize = 0;
+    struct ReceiveBuffer output = { outputData, sizeof(outputData) - 1, &outputSize };
+    int32_t fatalError = 0;
+    g_LowLevelFunctions.callThroughMessage(input, output, &fatalError);
+    if (fatalError != 0 || strstr((const char *)outputData, "\"exception\"") != NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: %s failed (%d)(%s)", __func__, api, fatalError, outputData);
+        return RETCODE_FAIL;
+    }
+    return RETCODE_SUCCESS;
+}
 
-    UiTest_CreateDriver();
-    AGENT_OHOS_LOG(LOG_INFO, "%s: Start", __func__);
+#define PNG_CAPTURE_FILE "/data/local/tmp/uitest_agent_vnc_cap.png"
+// 内存文件连续失败该次数后不再使用, 改用临时文件
+#define PNG_MEMFD_RETRY_MAX 3
+#define PNG_CAPTURE_PREFIX "{\"api\":\"Driver.screenCapture\",\"this\":\"Driver#0\",\"args\":["
 
-    const long frame_interval_us = 1000000 / g_fps;
+/**
+ * Driver.screenCapture 请求模板: fd 之后的部分只在屏幕参数变化时重建, 每帧只填入 fd
+ */
+typedef struct {
+    ScreenGeometry geometry;
+    char suffix[128];
+    size_t suffixLen;
+} PNGCaptureRequest;
 
-    while (g_screenCopyPNGThreadRun) {
-        struct timespec start, end;
-        clock_gettime(CLOCK_MONOTONIC, &start);
+static void UiTest_PNGBuildRequest(PNGCaptureRequest *request) {
+    int n = snprintf(request->suffix, sizeof(request->suffix),
+                     ",{\"left\":%d,\"right\":%d,\"top\":%d,\"bottom\":%d}]}",
+                     0, request->geometry.width, 0, request->geometry.height);
+    request->suffixLen = (size_t)n;
+}
 
-        int fd = open("/data/local/tmp/uitest_agent_vnc_cap.png", O_RDWR | O_CREAT, 0666);
-        if (fd < 0) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: open file failed", __func__);
-            break;
+/**
+ * 调用 Driver.screenCapture 将PNG截图写入 fd
+ * 注意: Driver.screenCapture 写入后会关闭 fd, 仍指向 owner 同一文件时才由这里关闭,
+ * 防止误关其它线程复用的同号 fd
+ *
+ * @param request 请求模板
+ * @param fd 交给驱动的 fd
+ * @param owner 调用者持有的同一文件的 fd
+ * @return 驱动是否返回成功
+ */
+static bool UiTest_PNGCapture(const PNGCaptureRequest *request, int fd, int owner) {
+    char buffer[256];
+    int n = snprintf(buffer, sizeof(buffer), PNG_CAPTURE_PREFIX "%d", fd);
+    memcpy(buffer + n, request->suffix, request->suffixLen + 1);
+
+    struct Text input = {.data = buffer, .size = (size_t)n + request->suffixLen};
+    uint8_t outputData[2048] = {};
+    size_t outputSize = 0;
+    struct ReceiveBuffer output = { outputData, sizeof(outputData) - 1, &outputSize };
+    int32_t fatalError = 0;
+    g_LowLevelFunctions.callThroughMessage(input, output, &fatalError);
+
+    struct stat fdSt, ownerSt;
+    if (fstat(fd, &fdSt) == 0 && fstat(owner, &ownerSt) == 0 &&
+        fdSt.st_dev == ownerSt.st_dev && fdSt.st_ino == ownerSt.st_ino) {
+        close(fd);
+    }
+    if (fatalError != 0 || strstr((const char *)outputData, "\"exception\"") != NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: screenCapture failed (%d)(%s)", __func__, fatalError, outputData);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 读取截图文件的全部内容, 缓冲区取自帧缓冲池, 按实际大小增长并复用
+ *
+ * @param fd
+ * @param buffer 缓冲区, 可能被重新分配
+ * @param capacity 缓冲区大小
+ * @return 读取的字节数, 失败返回-1
+ */
+static ssize_t UiTest_PNGRead(int fd, char **buffer, size_t *capacity) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: fstat failed (%s)", __func__, strerror(errno));
+        return -1;
+    }
+    if (st.st_size <= 2) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: st_size <= 2", __func__);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (!bufpool_reserve(buffer, capacity, size)) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: reserve %zu failed", __func__, size);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, *buffer + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: read failed (%s)", __func__, n < 0 ? strerror(errno) : "eof");
+            return -1;
         }
-        char buffer[512] = {};
-        snprintf(buffer, sizeof(buffer),
-                 "{\"api\":\"Driver.screenCapture\",\"this\":\"Driver#0\",\"args\":[%d,{\"left\":%d,\"right\":%d,\"top\":%d,\"bottom\":%d}]}",
-                 fd, 0, UiTest_getScreenWidth(), 0, UiTest_getScreenHeight());
-
-        struct Text input = {.data = buffer, .size = strlen(buffer)};
-        uint8_t outputData[2048] = {};
-        size_t outputSize;
-        struct ReceiveBuffer output = { outputData, sizeof(outputData), &outputSize };
-        int32_t fatalError = 0;
-        g_LowLevelFunctions.callThroughMessage(input, output, &fatalError);
-        // Driver.screenCapture 写入后会关闭 fd
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * 截取一帧到内存文件: 每帧交给驱动一个 dup 出来的 fd, memfd 本身保留复用
+ *
+ * @return 读取的字节数, -1表示内存文件不可用
+ */
+static ssize_t UiTest_PNGCaptureMemfd(const PNGCaptureRequest *request, int memfd, char **buffer, size_t *capacity) {
+    if (ftruncate(memfd, 0) != 0 || lseek(memfd, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    int fd = dup(memfd);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!UiTest_PNGCapture(request, fd, memfd)) {
+        return -1;
+    }
+    return UiTest_PNGRead(memfd, buffer, capacity);
+}
+
+/**
+ * 截取一帧到临时文件, 内存文件不可用时的兼容方案
+ *
+ * @return 读取的字节数, 失败返回-1
+ */
+static ssize_t UiTest_PNGCaptureFile(const PNGCaptureRequest *request, char **buffer, size_t *capacity) {
+    int fd = open(PNG_CAPTURE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: open file failed (%s)", __func__, strerror(errno));
+        return -1;
+    }
+    int owner = dup(fd);
+    if (owner < 0) {
         close(fd);
-        fd = open("/data/local/tmp/uitest_agent_vnc_cap.png", O_RDONLY);
-        if (fd < 0) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: reopen failed (%s)(%s)", __func__, strerror(errno), output.data);
-            break;
+        return -1;
+    }
+    ssize_t n = -1;
+    if (UiTest_PNGCapture(request, fd, owner)) {
+        n = UiTest_PNGRead(owner, buffer, capacity);
+    }
+    close(owner);
+    return n;
+}
+
+/**
+ * 采集线程在每帧开始前调用, 暂停期间阻塞, 恢复或停止时返回
+ *
+ * @param run 线程运行标志
+ */
+static void UiTest_WaitScreenCopyResume(const bool *run) {
+    pthread_mutex_lock(&g_screenCopyPauseLock);
+    while (g_screenCopyPaused && *run) {
+        pthread_cond_wait(&g_screenCopyWakeCond, &g_screenCopyPauseLock);
+    }
+    pthread_mutex_unlock(&g_screenCopyPauseLock);
+}
+
+/**
+ * 采集线程在每帧结束后调用, 等到距本帧开始一个采集间隔后返回
+ * 等待期间采集间隔被缩短(输入注入/画面变化)时按新间隔提前返回, 停止时立即返回
+ *
+ * @param run 线程运行标志
+ * @param start 本帧开始时间(CLOCK_MONOTONIC)
+ */
+static void UiTest_WaitNextFrame(const bool *run, const struct timespec *start) {
+    pthread_mutex_lock(&g_screenCopyPauseLock);
+    while (*run) {
+        long interval_us = UiTest_FrameIntervalUs();
+        struct timespec deadline = *start;
+        deadline.tv_sec += interval_us / 1000000;
+        deadline.tv_nsec += (interval_us % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
-        struct stat st;
-        if (fstat(fd, &st) != 0) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: fstat failed (%s)(%s)", __func__, strerror(errno), output.data);
-            close(fd);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
             break;
         }
-        if (st.st_size <= 2) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: st_size <= 2 (%s)", __func__, output.data);
-            close(fd);
-            break;
+        pthread_cond_timedwait(&g_screenCopyWakeCond, &g_screenCopyPauseLock, &deadline);
+    }
+    pthread_mutex_unlock(&g_screenCopyPauseLock);
+}
+
+void UiTest_ScreenCopyPNGTask() {
+    // 缓冲区按实际截图大小分配并复用
+    char *png_buffer = NULL;
+    size_t png_capacity = 0;
+
+    // 截图写入匿名内存文件, 不经过文件系统
+    int memfd = (int)syscall(SYS_memfd_create, "uitest_agent_vnc_cap", 0);
+    if (memfd < 0) {
+        AGENT_OHOS_LOG(LOG_WARN, "%s: memfd_create failed (%s), use %s", __func__, strerror(errno), PNG_CAPTURE_FILE);
+    }
+
+    pthread_once(&g_driverOnce, UiTest_CreateDriver);
+    PNGCaptureRequest request = {};
+    if (UiTest_GetScreenGeometry(&request.geometry) != RETCODE_SUCCESS) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: get screen geometry failed", __func__);
+        if (memfd >= 0) {
+            close(memfd);
         }
-        lseek(fd, 0, SEEK_SET);
-        ssize_t n = read(fd, png_buffer, st.st_size);
-        close(fd);
-        if (n != st.st_size) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: read n != st.st_size", __func__);
+        g_screenCopyPNGThreadRun = false;
+        return;
+    }
+    UiTest_PNGBuildRequest(&request);
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Start, memfd: %d", __func__, memfd >= 0);
+    // 内存文件是否成功截取过一帧, 以及连续失败次数
+    bool memfd_ok = false;
+    int memfd_failures = 0;
+
+    while (g_screenCopyPNGThreadRun) {
+        UiTest_WaitScreenCopyResume(&g_screenCopyPNGThreadRun);
+        if (!g_screenCopyPNGThreadRun) {
             break;
         }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t t0 = stats_now_ns();
+        if (UiTest_UpdateScreenGeometry(&request.geometry)) {
+            UiTest_PNGBuildRequest(&request);
+        }
+        stats_wait(&g_AgentStats.captureRequests, &g_AgentStats.captureRequestNs, &g_AgentStats.captureRequestMaxNs,
+                   stats_now_ns() - t0);
+
+        // 流水线模式下直接读入帧槽, 省去一次复制
+        PipelineSlot *slot = pipeline_running() ? pipeline_acquire() : NULL;
+        char **buffer = slot ? &slot->data : &png_buffer;
+        size_t *capacity = slot ? &slot->capacity : &png_capacity;
+        ssize_t n = -1;
+        uint64_t t1 = stats_now_ns();
+        if (memfd >= 0) {
+            n = UiTest_PNGCaptureMemfd(&request, memfd, buffer, capacity);
+            if (n >= 0) {
+                memfd_ok = true;
+                memfd_failures = 0;
+            } else if (!memfd_ok || ++memfd_failures >= PNG_MEMFD_RETRY_MAX) {
+                // 首次使用即失败说明驱动不接受内存文件, 连续多次失败也不再重试, 之后改用临时文件
+                AGENT_OHOS_LOG(LOG_WARN, "%s: memfd %s, fall back to %s", __func__,
+                               memfd_ok ? "failed repeatedly" : "rejected", PNG_CAPTURE_FILE);
+                close(memfd);
+                memfd = -1;
+            } else {
+                // 偶发失败时跳过本帧, 下一帧仍用内存文件
+                AGENT_OHOS_LOG(LOG_WARN, "%s: memfd capture failed (%d), retry next frame", __func__, memfd_failures);
+                UiTest_WaitNextFrame(&g_screenCopyPNGThreadRun, &start);
+                continue;
+            }
+        }
+        if (memfd < 0) {
+            n = UiTest_PNGCaptureFile(&request, buffer, capacity);
+            if (n < 0) {
+                break;
+            }
+        }
+        stats_stage(STATS_STAGE_CAPTURE, stats_now_ns() - t1);
         AGENT_OHOS_LOG(LOG_DEBUG, "%s: Read screenshot: %zd bytes", __func__, n);
-        if (g_screenCopyCallback != NULL) {
+        if (slot) {
+            slot->size = (int)n;
+            pipeline_submit();
+        } else if (g_screenCopyCallback != NULL) {
             g_screenCopyCallback(png_buffer, (int)n);
         }
 
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
-        long sleep_us = frame_interval_us - elapsed_us;
-        AGENT_OHOS_LOG(LOG_DEBUG, "%s: frame time %.3f ms, sleep %.3f ms", __func__, (double)elapsed_us / 1000.0, (double)sleep_us / 1000.0);
-        if (sleep_us > 0) {
-            usleep(sleep_us);
-        }
+        UiTest_WaitNextFrame(&g_screenCopyPNGThreadRun, &start);
     }
 
     AGENT_OHOS_LOG(LOG_INFO, "%s: Stop", __func__);
-    free(png_buffer);
+    if (memfd >= 0) {
+        close(memfd);
+    }
+    bufpool_free(png_buffer);
     g_screenCopyPNGThreadRun = false;
 }
 
 void UiTest_ScreenCopyDMPUBTask() {
-    // 复用缓冲区
-    size_t rgb_buffer_size = UiTest_getScreenHeight() * UiTest_getScreenWidth() * 4;
-    char *rgb_buffer = malloc(rgb_buffer_size);
-    if (!rgb_buffer) {
-        AGENT_OHOS_LOG(LOG_ERROR, "%s: rgb_buffer malloc failed", __func__);
+    // 零拷贝模式下像素直接读入agent提供的缓冲区, 不再需要私有缓冲区
+    bool zeroCopy = g_screenCopyBuffer.acquire != NULL && g_screenCopyBuffer.release != NULL;
+    ScreenGeometry geometry = {};
+    if (UiTest_GetScreenGeometry(&geometry) != RETCODE_SUCCESS) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: get screen geometry failed", __func__);
         g_screenCopyDMPUBThreadRun = false;
         return;
     }
-    AGENT_OHOS_LOG(LOG_INFO, "%s: Start", __func__);
-    const long frame_interval_us = 1000000 / g_fps;
+    // 复用帧缓冲池中的缓冲区, 屏幕尺寸变化时更换
+    size_t rgb_buffer_size = (size_t)geometry.width * geometry.height * 4;
+    char *rgb_buffer = NULL;
+    bool own_buffer = !zeroCopy && !pipeline_running();
+    if (own_buffer) {
+        rgb_buffer = bufpool_alloc(rgb_buffer_size);
+        if (!rgb_buffer) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: rgb_buffer alloc failed", __func__);
+            g_screenCopyDMPUBThreadRun = false;
+            return;
+        }
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: Start, zero copy: %d", __func__, zeroCopy);
 
+    int read_failures = 0;
     while (g_screenCopyDMPUBThreadRun) {
-        struct timespec start, end;
+        UiTest_WaitScreenCopyResume(&g_screenCopyDMPUBThreadRun);
+        if (!g_screenCopyDMPUBThreadRun) {
+            break;
+        }
+        struct timespec start;
         clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t t0 = stats_now_ns();
+        if (UiTest_UpdateScreenGeometry(&geometry)) {
+            rgb_buffer_size = (size_t)geometry.width * geometry.height * 4;
+            if (own_buffer) {
+                bufpool_free(rgb_buffer);
+                rgb_buffer = bufpool_alloc(rgb_buffer_size);
+                if (!rgb_buffer) {
+                    AGENT_OHOS_LOG(LOG_ERROR, "%s: rgb_buffer alloc failed", __func__);
+                    break;
+                }
+            }
+        }
+        stats_wait(&g_AgentStats.captureRequests, &g_AgentStats.captureRequestNs, &g_AgentStats.captureRequestMaxNs,
+                   stats_now_ns() - t0);
         NativeDisplayManager_ErrorCode dmRet;
 
-        uint64_t displayId = 0;
-        dmRet = OH_NativeDisplayManager_GetDefaultDisplayId(&displayId);
-        if (dmRet != DISPLAY_MANAGER_OK) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: GetDefaultDisplayId failed %d", __func__, dmRet);
-            break;
-        }
         OH_PixelmapNative *pixelMap = NULL;
-        uint32_t displayId32 = (uint32_t)displayId;
+        uint32_t displayId32 = (uint32_t)geometry.displayId;
+        uint64_t t1 = stats_now_ns();
         dmRet = OH_NativeDisplayManager_CaptureScreenPixelmap(displayId32, &pixelMap);
         if (dmRet != DISPLAY_MANAGER_OK) {
             AGENT_OHOS_LOG(LOG_ERROR, "%s: CaptureScreenPixelmap failed %d", __func__, dmRet);
             break;
         }
-        Image_ErrorCode pmRet = OH_PixelmapNative_ReadPixels(pixelMap, (uint8_t*)rgb_buffer, &rgb_buffer_size);
-        if (pmRet != IMAGE_SUCCESS) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: ReadPixels failed %d", __func__, dmRet);
-            break;
-        }
-        AGENT_OHOS_LOG(LOG_DEBUG, "%s: Read screenshot: %zd bytes", __func__, rgb_buffer_size);
-        if (g_screenCopyCallback != NULL) {
-            g_screenCopyCallback(rgb_buffer, (int)rgb_buffer_size);
+        Image_ErrorCode pmRet = IMAGE_SUCCESS;
+        if (zeroCopy) {
+            size_t buffer_size = 0;
+            char *buffer = g_screenCopyBuffer.acquire(&buffer_size);
+            if (buffer != NULL) {
+                pmRet = OH_PixelmapNative_ReadPixels(pixelMap, (uint8_t*)buffer, &buffer_size);
+                if (pmRet == IMAGE_SUCCESS) {
+                    stats_stage(STATS_STAGE_CAPTURE, stats_now_ns() - t1);
+                }
+                AGENT_OHOS_LOG(LOG_DEBUG, "%s: Read screenshot: %zd bytes", __func__, buffer_size);
+                g_screenCopyBuffer.release(buffer, (int)buffer_size, pmRet == IMAGE_SUCCESS);
+            }
+        } else if (!own_buffer) {
+            // 流水线模式下直接读入帧槽
+            PipelineSlot *slot = pipeline_acquire();
+            size_t buffer_size = rgb_buffer_size;
+            if (pipeline_reserve(slot, rgb_buffer_size)) {
+                pmRet = OH_PixelmapNative_ReadPixels(pixelMap, (uint8_t*)slot->data, &buffer_size);
+                if (pmRet == IMAGE_SUCCESS) {
+                    stats_stage(STATS_STAGE_CAPTURE, stats_now_ns() - t1);
+                    AGENT_OHOS_LOG(LOG_DEBUG, "%s: Read screenshot: %zd bytes", __func__, buffer_size);
+                    slot->size = (int)buffer_size;
+                    pipeline_submit();
+                }
+            }
+        } else {
+            size_t buffer_size = rgb_buffer_size;
+            pmRet = OH_PixelmapNative_ReadPixels(pixelMap, (uint8_t*)rgb_buffer, &buffer_size);
+            if (pmRet == IMAGE_SUCCESS) {
+                stats_stage(STATS_STAGE_CAPTURE, stats_now_ns() - t1);
+                AGENT_OHOS_LOG(LOG_DEBUG, "%s: Read screenshot: %zd bytes", __func__, buffer_size);
+                if (g_screenCopyCallback != NULL) {
+                    g_screenCopyCallback(rgb_buffer, (int)buffer_size);
+                }
+            }
         }
         OH_PixelmapNative_Destroy(&pixelMap);
-
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
-        long sleep_us = frame_interval_us - elapsed_us;
-        AGENT_OHOS_LOG(LOG_DEBUG, "%s: frame time %.3f ms, sleep %.3f ms", __func__, (double)elapsed_us / 1000.0, (double)sleep_us / 1000.0);
-        if (sleep_us > 0) {
-            usleep(sleep_us);
+        if (pmRet != IMAGE_SUCCESS) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: ReadPixels failed %d", __func__, pmRet);
+            if (++read_failures > DMPUB_READ_RETRY_MAX) {
+                break;
+            }
+            UiTest_InvalidateScreenGeometry();
+        } else {
+            read_failures = 0;
         }
+
+        UiTest_WaitNextFrame(&g_screenCopyDMPUBThreadRun, &start);
     }
 
     AGENT_OHOS_LOG(LOG_INFO, "%s: Stop", __func__);
-    free(rgb_buffer);
+    bufpool_free(rgb_buffer);
     g_screenCopyDMPUBThreadRun = false;
 }
 
-int UiTest_StartScreenCopy(ScreenCopyCallback callback, char mode[16], int fps) {
-    if (callback == NULL) {
-        AGENT_OHOS_LOG(LOG_ERROR, "%s: callback is nullptr", __func__);
-        return -1;
+/**
+ * 设置零拷贝采集缓冲区, 目前仅 DMPUB 模式使用
+ * 注意: 请在 UiTest_StartScreenCopy 之前调用, 传NULL取消
+ *
+ * @param buffer
+ * @return
+ */
+int UiTest_SetScreenCopyBuffer(const ScreenCopyBuffer *buffer) {
+    if (buffer == NULL) {
+        memset(&g_screenCopyBuffer, 0, sizeof(g_screenCopyBuffer));
+        return RETCODE_SUCCESS;
     }
-    g_screenCopyCallback = callback;
-    g_fps = fps;
-    snprintf(g_screenCopyMode, sizeof(g_screenCopyMode), "%s", mode);
+    if (buffer->acquire == NULL || buffer->release == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: acquire/release is nullptr", __func__);
+        return RETCODE_FAIL;
+    }
+    g_screenCopyBuffer = *buffer;
+    return RETCODE_SUCCESS;
+}
+
+/**
+ * 设置是否通过流水线解码: 采集线程只负责取帧, 解码/差分在独立线程中进行,
+ * 解码跟不上时丢弃旧帧只保留最新帧
+ * 注意: 请在 UiTest_StartScreenCopy 之前调用, 零拷贝采集不经过流水线
+ *
+ * @param enable
+ * @return
+ */
+int UiTest_SetScreenCopyPipeline(bool enable) {
+    g_screenCopyPipeline = enable;
+    return RETCODE_SUCCESS;
+}
+
+/**
+ * 设置画面持续不变时的最低采集帧率
+ * 连续无变化时采集间隔逐步放大到 1/fps 秒, 注入输入或检测到变化时立即恢复满帧率
+ * 注意: 请在 UiTest_StartScreenCopy 之前调用, fps 不小于采集帧率时不降速
+ *
+ * @param fps
+ * @return
+ */
+int UiTest_SetScreenCopyMinFps(int fps) {
+    g_minFps = fps;
+    return RETCODE_SUCCESS;
+}
+
+/**
+ * 报告最近一帧相对上一帧是否有变化, 由解码线程在每帧处理完成后调用
+ *
+ * @param changed
+ */
+void UiTest_ReportScreenChange(bool changed) {
+    if (changed) {
+        UiTest_ResetScreenCopyPace(&g_AgentStats.paceChangeResets);
+        return;
+    }
+    uint64_t now = stats_now_ns();
+    uint64_t since = atomic_load_explicit(&g_screenCopyIdleSinceNs, memory_order_relaxed);
+    if (since == 0) {
+        atomic_store_explicit(&g_screenCopyIdleSinceNs, now, memory_order_relaxed);
+    } else if (now - since >= PACE_HOLD_NS &&
+               atomic_load_explicit(&g_screenCopyIdleFrames, memory_order_relaxed) < INT_MAX / 2) {
+        atomic_fetch_add_explicit(&g_screenCopyIdleFrames, 1, memory_order_relaxed);
+    }
+}
 
+/**
+ * 即将注入输入, 画面可能马上变化, 立即恢复满帧率采集
+ */
+void UiTest_BoostScreenCopy() {
+    UiTest_ResetScreenCopyPace(&g_AgentStats.paceInputResets);
+}
+
+static int UiTest_StartJPEGCapture() {
+    if (g_LowLevelFunctions.startCapture == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
+        return RETCODE_FAIL;
+    }
+
+    struct Text name = { .data = "copyScreen" };
+    name.size = strlen(name.data);
+    struct Text optJson = {};
+    if (g_LowLevelFunctions.startCapture(name, UiTest_onScreenCopy, optJson) != RETCODE_SUCCESS) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions.startCapture failed", __func__);
+        return RETCODE_FAIL;
+    }
+    return RETCODE_SUCCESS;
+}
+
+static int UiTest_StopJPEGCapture() {
+    if (g_LowLevelFunctions.stopCapture == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
+        return RETCODE_FAIL;
+    }
+
+    struct Text name = { .data = "copyScreen" };
+    name.size = strlen(name.data);
+    if (g_LowLevelFunctions.stopCapture(name) != RETCODE_SUCCESS) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions.stopCapture failed", __func__);
+        return RETCODE_FAIL;
+    }
+    return RETCODE_SUCCESS;
+}
+
+static int UiTest_StartScreenCopyTask(const char *mode) {
     if (strcmp(mode, CAP_MODE_PNG) == 0) {
         if (g_screenCopyPNGThreadRun) {
             AGENT_OHOS_LOG(LOG_ERROR, "%s: PNG Thread already running", __func__);
@@ -238,48 +778,123 @@ int UiTest_StartScreenCopy(ScreenCopyCallback callback, char mode[16], int fps)
         pthread_detach(thread);
     } else {
         AGENT_OHOS_LOG(LOG_INFO, "%s: Start JPEG Screen Copy Task", __func__);
-        if (g_LowLevelFunctions.startCapture == NULL) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
-            return RETCODE_FAIL;
+        return UiTest_StartJPEGCapture();
+    }
+    return RETCODE_SUCCESS;
+}
+
+int UiTest_StartScreenCopy(ScreenCopyCallback callback, char mode[16], int fps) {
+    if (callback == NULL) {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: callback is nullptr", __func__);
+        return -1;
+    }
+    g_screenCopyCallback = callback;
+    g_fps = fps;
+    g_screenCopyPaused = false;
+    atomic_store(&g_screenCopyIdleSinceNs, 0);
+    atomic_store(&g_screenCopyIdleFrames, 0);
+    pthread_once(&g_screenCopyWakeOnce, UiTest_InitWakeCond);
+    snprintf(g_screenCopyMode, sizeof(g_screenCopyMode), "%s", mode);
+    // 旋转/分辨率变化时由通知触发重新查询屏幕参数, 注册失败时只依赖定期检查
+    if (!g_displayListening) {
+        NativeDisplayManager_ErrorCode dmRet =
+            OH_NativeDisplayManager_RegisterDisplayChangeListener(UiTest_onDisplayChange, &g_displayListenerIndex);
+        g_displayListening = dmRet == DISPLAY_MANAGER_OK;
+        if (!g_displayListening) {
+            AGENT_OHOS_LOG(LOG_WARN, "%s: RegisterDisplayChangeListener failed %d", __func__, dmRet);
         }
+    }
 
-        struct Text name = { .data = "copyScreen" };
-        name.size = strlen(name.data);
-        struct Text optJson = {};
-        if (g_LowLevelFunctions.startCapture(name, UiTest_onScreenCopy, optJson) != RETCODE_SUCCESS) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions.startCapture failed", __func__);
+    bool zeroCopy = strcmp(mode, CAP_MODE_DMPUB) == 0 &&
+                    g_screenCopyBuffer.acquire != NULL && g_screenCopyBuffer.release != NULL;
+    if (g_screenCopyPipeline && !zeroCopy) {
+        if (pipeline_start(callback) != 0) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: Start pipeline failed", __func__);
             return RETCODE_FAIL;
         }
+        AGENT_OHOS_LOG(LOG_INFO, "%s: Pipeline started", __func__);
     }
-    return RETCODE_SUCCESS;
+    int ret = UiTest_StartScreenCopyTask(mode);
+    if (ret != RETCODE_SUCCESS) {
+        pipeline_stop();
+    }
+    return ret;
 }
 
-int UiTest_StopScreenCopy() {
+static int UiTest_StopScreenCopyTask() {
     if (strcmp(g_screenCopyMode, CAP_MODE_PNG) == 0) {
         AGENT_OHOS_LOG(LOG_INFO, "%s: Stop PNG Screen Copy Task", __func__);
+        pthread_mutex_lock(&g_screenCopyPauseLock);
         g_screenCopyPNGThreadRun = false;
+        pthread_cond_broadcast(&g_screenCopyWakeCond);
+        pthread_mutex_unlock(&g_screenCopyPauseLock);
         sleep(2);
     }else if (strcmp(g_screenCopyMode, CAP_MODE_DMPUB) == 0) {
+        pthread_mutex_lock(&g_screenCopyPauseLock);
         g_screenCopyDMPUBThreadRun = false;
+        pthread_cond_broadcast(&g_screenCopyWakeCond);
+        pthread_mutex_unlock(&g_screenCopyPauseLock);
         sleep(2);
     } else {
         AGENT_OHOS_LOG(LOG_INFO, "%s: Stop JPEG Screen Copy Task", __func__);
-        if (g_LowLevelFunctions.startCapture == NULL) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
-            return RETCODE_FAIL;
-        }
-
         g_screenCopyCallback = NULL;
-        struct Text name = { .data = "copyScreen" };
-        name.size = strlen(name.data);
-        if (g_LowLevelFunctions.stopCapture(name) != RETCODE_SUCCESS) {
-            AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions.stopCapture failed", __func__);
-            return RETCODE_FAIL;
+        // 暂停时截屏流已经停止
+        if (!g_screenCopyPaused) {
+            return UiTest_StopJPEGCapture();
         }
     }
     return RETCODE_SUCCESS;
 }
 
+int UiTest_StopScreenCopy() {
+    int ret = UiTest_StopScreenCopyTask();
+    // 采集线程停止后再停止解码线程
+    pipeline_stop();
+    if (g_displayListening) {
+        OH_NativeDisplayManager_UnregisterDisplayChangeListener(g_displayListenerIndex);
+        g_displayListening = false;
+    }
+    return ret;
+}
+
+/**
+ * 暂停或恢复采集, 用于没有客户端需要画面时节省CPU
+ * PNG/DMPUB 线程保持存在, 暂停期间阻塞在条件变量上, 恢复时立即继续; JPEG 模式停止/重新开始截屏流
+ * 注意: 请在 UiTest_StartScreenCopy 之后, UiTest_StopScreenCopy 之前调用
+ *
+ * @param paused
+ * @return
+ */
+int UiTest_PauseScreenCopy(bool paused) {
+    pthread_mutex_lock(&g_screenCopyPauseLock);
+    if (g_screenCopyPaused == paused) {
+        pthread_mutex_unlock(&g_screenCopyPauseLock);
+        return RETCODE_SUCCESS;
+    }
+    g_screenCopyPaused = paused;
+    if (!paused) {
+        // 恢复后从满帧率开始
+        atomic_store(&g_screenCopyIdleSinceNs, 0);
+        atomic_store(&g_screenCopyIdleFrames, 0);
+        pthread_cond_broadcast(&g_screenCopyWakeCond);
+    }
+    pthread_mutex_unlock(&g_screenCopyPauseLock);
+
+    int ret = RETCODE_SUCCESS;
+    if (strcmp(g_screenCopyMode, CAP_MODE_PNG) != 0 && strcmp(g_screenCopyMode, CAP_MODE_DMPUB) != 0) {
+        ret = paused ? UiTest_StopJPEGCapture() : UiTest_StartJPEGCapture();
+        if (ret != RETCODE_SUCCESS) {
+            // 截屏流状态未改变, 保持原状态以便下次重试
+            pthread_mutex_lock(&g_screenCopyPauseLock);
+            g_screenCopyPaused = !paused;
+            pthread_mutex_unlock(&g_screenCopyPauseLock);
+        }
+    }
+    AGENT_OHOS_LOG(LOG_INFO, "%s: %s %s", __func__, paused ? "pause" : "resume",
+                   ret == RETCODE_SUCCESS ? "ok" : "failed");
+    return ret;
+}
+
 int UiTest_InjectionPtr(enum ActionStage stage, int x, int y) {
     if (g_LowLevelFunctions.atomicTouch == NULL) {
         AGENT_OHOS_LOG(LOG_ERROR, "%s: g_LowLevelFunctions is nullptr", __func__);
@@ -291,3 +906,52 @@ int UiTest_InjectionPtr(enum ActionStage stage, int x, int y) {
     }
     return RETCODE_SUCCESS;
 }
+
+/**
+ * 注入按键, 单个按键调用 Driver.triggerKey, 组合键调用 Driver.triggerCombineKeys
+ *
+ * @param keys OHOS 键码, 修饰键在前, 最多3个
+ * @param count
+ * @return
+ */
+int UiTest_InjectionKey(const int *keys, int count) {
+    char args[64];
+    if (count == 1) {
+        snprintf(args, sizeof(args), "%d", keys[0]);
+        return UiTest_CallDriver("Driver.triggerKey", args);
+    }
+    if (count == 2) {
+        snprintf(args, sizeof(args), "%d,%d", keys[0], keys[1]);
+    } else if (count == 3) {
+        snprintf(args, sizeof(args), "%d,%d,%d", keys[0], keys[1], keys[2]);
+    } else {
+        AGENT_OHOS_LOG(LOG_ERROR, "%s: invalid key count %d", __func__, count);
+        return RETCODE_FAIL;
+    }
+    return UiTest_CallDriver("Driver.triggerCombineKeys", args);
+}
+
+/**
+ * 在指定位置输入文本(追加到已有内容之后), 调用 Driver.inputText
+ *
+ * @param x
+ * @param y
+ * @param text UTF-8 文本
+ * @return
+ */
+int UiTest_InjectionText(int x, int y, const char *text) {
+    char args[1536];
+    int n = snprintf(args, sizeof(args), "{\"x\":%d,\"y\":%d},\"", x, y);
+    for (const unsigned char *p = (const unsigned char *)text; *p && n < (int)sizeof(args) - 32; ++p) {
+        if (*p == '"' || *p == '\\') {
+            args[n++] = '\\';
+            args[n++] = (char)*p;
+        } else if (*p < 0x20) {
+            n += snprintf(args + n, sizeof(args) - n, "\\u%04x", *p);
+        } else {
+            args[n++] = (char)*p;
+        }
+    }
+    snprintf(args + n, sizeof(args) - n, "\",{\"paste\":false,\"addition\":true}");
+    return UiTest_CallDriver("Driver.inputText", args);
+}
@@ -5,7 +5,28 @@
 
 typedef void (*ScreenCopyCallback)(char* data, int size);
 extern ScreenCopyCallback g_screenCopyCallback;
-enum ActionStage : uint8_t {
+
+/**
+ * 零拷贝采集: 采集线程向agent申请可写缓冲区, 将像素直接读入后再提交
+ * acquire 返回NULL表示暂时无法提供缓冲区, 本帧跳过
+ * release 必须与成功的 acquire 一一对应, valid 为false表示读取失败, 放弃本帧
+ */
+typedef struct {
+    char *(*acquire)(size_t *size);
+    void (*release)(char *data, int size, bool valid);
+} ScreenCopyBuffer;
+
+/**
+ * 缓存的屏幕参数, gen 每次参数变化加1
+ */
+typedef struct {
+    uint64_t displayId;
+    int width;
+    int height;
+    unsigned gen;
+} ScreenGeometry;
+
+enum ActionStage {
     ActionStage_NONE = 0,
     ActionStage_DOWN = 1,
     ActionStage_MOVE = 2,
@@ -15,10 +36,19 @@ enum ActionStage : uint8_t {
     ActionStage_AXIS_STOP = 6
 };
 
-int UiTest_getScreenWidth();
-int UiTest_getScreenHeight();
+int UiTest_GetScreenGeometry(ScreenGeometry *geometry);
+void UiTest_CheckScreenGeometry();
+void UiTest_InvalidateScreenGeometry();
+int UiTest_SetScreenCopyBuffer(const ScreenCopyBuffer *buffer);
+int UiTest_SetScreenCopyPipeline(bool enable);
+int UiTest_SetScreenCopyMinFps(int fps);
 int UiTest_StartScreenCopy(ScreenCopyCallback cb, char mode[16], int fps);
 int UiTest_StopScreenCopy();
+int UiTest_PauseScreenCopy(bool paused);
+void UiTest_ReportScreenChange(bool changed);
+void UiTest_BoostScreenCopy();
 int UiTest_InjectionPtr(enum ActionStage stage, int x, int y);
+int UiTest_InjectionKey(const int *keys, int count);
+int UiTest_InjectionText(int x, int y, const char *text);
 
 #endif //UITEST_AGENT_VNC_UITEST_H
\ No newline at end of file
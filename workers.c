@@ -0,0 +1,134 @@
+#include "workers.h"
+#include "agent.h"
+
+#include <stdatomic.h>
+
+// 固定大小的线程池, 只提供 parallel-for: 调用线程也参与执行, 全部任务完成后返回
+typedef struct {
+    pthread_t threads[WORKERS_MAX];
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    // 同一时刻只允许一个调用者
+    pthread_mutex_t runLock;
+    unsigned generation;
+    bool stop;
+    WorkerTask task;
+    void *arg;
+    int tasks;
+    atomic_int next;
+    int active;
+} WorkerPool;
+
+static WorkerPool g_workers = {
+    .count = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .runLock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void workers_drain(WorkerPool *pool) {
+    int i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->tasks) {
+        pool->task(pool->arg, i);
+    }
+}
+
+static void *workers_main(void *arg) {
+    WorkerPool *pool = (WorkerPool *) arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        workers_drain(pool);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * 创建线程池
+ * 注意: 请务必在不需要时调用workers_shutdown
+ *
+ * @param count 参与计算的线程总数(含调用线程), 1表示不创建线程
+ * @return 实际线程总数
+ */
+int workers_init(int count) {
+    WorkerPool *pool = &g_workers;
+    if (count < 1) count = 1;
+    if (count > WORKERS_MAX) count = WORKERS_MAX;
+    // 新线程从第0代开始等待, 此时没有运行中的任务
+    pool->stop = false;
+    pool->generation = 0;
+    pool->count = 1;
+    for (int i = 1; i < count; ++i) {
+        if (pthread_create(&pool->threads[i], NULL, workers_main, pool) != 0) {
+            AGENT_OHOS_LOG(LOG_ERROR, "%s: create worker %d failed", __func__, i);
+            break;
+        }
+        pool->count++;
+    }
+    return pool->count;
+}
+
+void workers_shutdown() {
+    WorkerPool *pool = &g_workers;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pool->count = 1;
+}
+
+int workers_count() {
+    return g_workers.count;
+}
+
+/**
+ * 并行执行 task(arg, 0..tasks-1), 全部完成后返回
+ * 线程池为空或只有一个任务时在调用线程中顺序执行
+ */
+void workers_run(WorkerTask task, void *arg, int tasks) {
+    WorkerPool *pool = &g_workers;
+    if (pool->count <= 1 || tasks <= 1) {
+        for (int i = 0; i < tasks; ++i) {
+            task(arg, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool->runLock);
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->tasks = tasks;
+    atomic_store(&pool->next, 0);
+    pool->active = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    workers_drain(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->runLock);
+}
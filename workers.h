@@ -0,0 +1,14 @@
+#ifndef UITEST_AGENT_VNC_WORKERS_H
+#define UITEST_AGENT_VNC_WORKERS_H
+
+#define WORKERS_MAX 16
+
+// 并行任务, index 为任务下标
+typedef void (*WorkerTask)(void *arg, int index);
+
+int workers_init(int count);
+void workers_shutdown();
+int workers_count();
+void workers_run(WorkerTask task, void *arg, int tasks);
+
+#endif //UITEST_AGENT_VNC_WORKERS_H